@@ -110,6 +110,10 @@ int tagsistant_querytree_find_duplicates(tagsistant_querytree *qtree, gchar *hex
 		"delete from tagging where inode = %d",
 		qtree->dbi,	NULL, NULL,	qtree->inode);
 
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_move_object(qtree->inode, main_inode);
+#endif
+
 	/*
 	 * unlink the removable inode
 	 */
@@ -310,8 +314,8 @@ int tagsistant_fix_checksums_callback(void *null_pointer, dbi_result result)
 	(void) null_pointer;
 
 	/* fetch the inode and the objectname from the query */
-	const gchar *inode = dbi_result_get_string_idx(result, 1);
-	const gchar *objectname = dbi_result_get_string_idx(result, 2);
+	const gchar *inode = tagsistant_result_get_string_idx(result, 1);
+	const gchar *objectname = tagsistant_result_get_string_idx(result, 2);
 
 	/* build the path using the ALL/ tag */
 	gchar *path = g_strdup_printf("/store/ALL/@@/%s%s%s", inode, TAGSISTANT_INODE_DELIMITER, objectname);
@@ -341,7 +345,7 @@ void tagsistant_fix_checksums()
 		"select cast(inode as char(12)), objectname from objects where checksum = '' and (symlink = '' or symlink is null)",
 		dbi, tagsistant_fix_checksums_callback, NULL);
 
-	tagsistant_db_connection_release(dbi, 1);
+	tagsistant_db_connection_release(dbi, 0);
 }
 
 /**
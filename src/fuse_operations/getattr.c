@@ -90,13 +90,13 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 	
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && is_error_path(path)) {
 		lstat_path = tagsistant.tags;
 	}
 
 	// -- archive --
 	else if (QTREE_IS_ARCHIVE(qtree)) {
-		if (!g_regex_match_simple(TAGSISTANT_INODE_DELIMITER, qtree->object_path, 0, 0)) {
+		if (!strstr(qtree->object_path, TAGSISTANT_INODE_DELIMITER)) {
 			lstat_path = tagsistant.archive;
 		} else if (qtree->full_archive_path) {
 			lstat_path = qtree->full_archive_path;
@@ -182,9 +182,9 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
-		if (g_regex_match_simple("^/stats/(connections|cached_queries|configuration|objects|relations|tags)$", path, 0, 0))
+		if (tagsistant_regex_match(TAGSISTANT_RX_STATS_FILE, path))
 			lstat_path = tagsistant.tags;
-		else if (g_regex_match_simple("^/stats$", path, 0, 0))
+		else if ((g_strcmp0(path, "/stats") == 0))
 			lstat_path = tagsistant.archive;
 		else
 			TAGSISTANT_ABORT_OPERATION(ENOENT);
@@ -201,7 +201,7 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 	tagsistant_errno = errno;
 
 	// post-processing output
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && is_error_path(path)) {
 		stbuf->st_size = strlen(qtree->error_message);
 		stbuf->st_mode = S_IFREG|S_IRUSR|S_IRGRP|S_IROTH;
 		stbuf->st_nlink = 1;
@@ -242,7 +242,7 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 			stbuf->st_mode = S_IFDIR|_PERMISSIONS;
 			stbuf->st_nlink = 3;
 
-		} else if (g_regex_match_simple("^" TAGSISTANT_ALIAS_IDENTIFIER, qtree->last_tag, 0, 0)) {
+		} else if (qtree->last_tag && g_str_has_prefix(qtree->last_tag, TAGSISTANT_ALIAS_IDENTIFIER)) {
 			gchar *alias_name = qtree->last_tag + 1;
 			int exists = tagsistant_sql_alias_exists(qtree->dbi, alias_name);
 			if (!exists) {
@@ -294,7 +294,11 @@ int tagsistant_getattr(const char *path, struct stat *stbuf)
 	} else if (QTREE_IS_STATS(qtree)) {
 
 		stbuf->st_size = TAGSISTANT_STATS_BUFFER;
-		if (g_regex_match_simple("^/stats/(connections|cached_queries|configuration|objects|relations|tags)$", path, 0, 0)) {
+		if ((g_strcmp0(path, "/stats/sql") == 0)) {
+			// writing to /stats/sql resets the statistics
+			stbuf->st_size = TAGSISTANT_SQL_STATS_BUFFER;
+			stbuf->st_mode = tagsistant.open_permission ? S_IFREG|S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH : S_IFREG|S_IRUSR|S_IWUSR;
+		} else if (tagsistant_regex_match(TAGSISTANT_RX_STATS_FILE, path)) {
 			stbuf->st_mode = tagsistant.open_permission ? S_IFREG|S_IRUSR|S_IRGRP|S_IROTH : S_IFREG|S_IRUSR;
 		} else {
 			stbuf->st_mode = S_IFDIR|_PERMISSIONS;
@@ -40,13 +40,13 @@ int tagsistant_getxattr(const char *path, const char *name, char *value, size_t
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 	
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && is_error_path(path)) {
 		TAGSISTANT_ABORT_OPERATION(EFAULT);
 	}
 
 	// -- archive --
 	else if (QTREE_IS_ARCHIVE(qtree)) {
-		if (!g_regex_match_simple(TAGSISTANT_INODE_DELIMITER, qtree->object_path, 0, 0)) {
+		if (!strstr(qtree->object_path, TAGSISTANT_INODE_DELIMITER)) {
 			res = lgetxattr(qtree->object_path, name, value, size);
 			tagsistant_errno = errno;
 		} else if (qtree->full_archive_path) {
@@ -66,6 +66,8 @@ int tagsistant_link(const char *from, const char *to)
 			dbg('F', LOG_INFO, "LINK : Creating %s", to_qtree->object_path);
 			res = tagsistant_force_create_and_tag_object(to_qtree, &tagsistant_errno);
 			if (-1 == res) goto TAGSISTANT_EXIT_OPERATION;
+
+			tagsistant_delete_rds_involved(to_qtree);
 		} else
 
 		// nothing to do about tags
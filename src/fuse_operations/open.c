@@ -40,7 +40,7 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && is_error_path(path)) {
 		res = 1;
 		tagsistant_errno = 0;
 		goto TAGSISTANT_EXIT_OPERATION;
@@ -90,7 +90,8 @@ int tagsistant_open(const char *path, struct fuse_file_info *fi)
 
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
-		res = open(tagsistant.tags, fi->flags|O_RDONLY);
+		/* never pass write flags: /stats/sql can be written to reset it, tags.sql must not */
+		res = open(tagsistant.tags, O_RDONLY);
 		tagsistant_set_file_handle(fi, res);
 		tagsistant_errno = errno;
 		fi->keep_cache = 0;
@@ -0,0 +1,44 @@
+/*
+   Tagsistant (tagfs) -- fuse_operations/opendir.c
+   Copyright (C) 2006-2014 Tx0 <tx0@strumentiresistenti.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "../tagsistant.h"
+
+/**
+ * opendir equivalent. Attaches an empty listing snapshot to the
+ * directory handle, filled by the first tagsistant_readdir() call.
+ *
+ * @param path the path of the directory to be opened
+ * @param fi struct fuse_file_info used to hold the snapshot
+ * @return(0 on success, -errno otherwise)
+ */
+int tagsistant_opendir(const char *path, struct fuse_file_info *fi)
+{
+	TAGSISTANT_START("OPENDIR on %s", path);
+
+	tagsistant_dir_snapshot *snapshot = tagsistant_dir_snapshot_new();
+	if (!snapshot) {
+		TAGSISTANT_STOP_ERROR("OPENDIR on %s: %d: %s", path, ENOMEM, strerror(ENOMEM));
+		return (-ENOMEM);
+	}
+
+	fi->fh = (uint64_t) (uintptr_t) snapshot;
+
+	TAGSISTANT_STOP_OK("OPENDIR on %s: OK", path);
+	return (0);
+}
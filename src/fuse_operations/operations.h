@@ -20,9 +20,25 @@
 #define TAGSISTANT_ABORT_OPERATION(set_errno) \
 	{ res = -1; tagsistant_errno = set_errno; goto TAGSISTANT_EXIT_OPERATION; }
 
+/**
+ * The listing of a store/ query, taken by readdir() at offset 0 and
+ * kept in fi->fh from opendir() to releasedir(), so following readdir()
+ * calls can resume from their offset instead of querying again
+ */
+typedef struct {
+	GPtrArray *entries;		/**< the entry names, "." and ".." included, in listing order */
+	GStringChunk *names;	/**< the storage of the entry names */
+} tagsistant_dir_snapshot;
+
+extern tagsistant_dir_snapshot *tagsistant_dir_snapshot_new();
+extern void tagsistant_dir_snapshot_reset(tagsistant_dir_snapshot *snapshot);
+extern void tagsistant_dir_snapshot_free(tagsistant_dir_snapshot *snapshot);
+
 extern int tagsistant_getattr(const char *path, struct stat *stbuf);
 extern int tagsistant_readlink(const char *path, char *buf, size_t size);
+extern int tagsistant_opendir(const char *path, struct fuse_file_info *fi);
 extern int tagsistant_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
+extern int tagsistant_releasedir(const char *path, struct fuse_file_info *fi);
 extern int tagsistant_mknod(const char *path, mode_t mode, dev_t rdev);
 extern int tagsistant_mkdir(const char *path, mode_t mode);
 extern int tagsistant_unlink(const char *path);
@@ -45,7 +45,7 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 		TAGSISTANT_ABORT_OPERATION(ENOENT);
 
 	// -- error message --
-	if (qtree->error_message && g_regex_match_simple("@/error$", path, G_REGEX_EXTENDED, 0)) {
+	if (qtree->error_message && is_error_path(path)) {
 		memcpy(buf, qtree->error_message, strlen(qtree->error_message));
 		res = strlen(qtree->error_message);
 	}
@@ -121,55 +121,90 @@ int tagsistant_read(const char *path, char *buf, size_t size, off_t offset, stru
 	// -- stats --
 	else if (QTREE_IS_STATS(qtree)) {
 		memset(stats_buffer, 0, TAGSISTANT_STATS_BUFFER);
+		gchar *stats = stats_buffer, *sql_stats = NULL;
+
+		// -- sql --
+		if (g_str_has_suffix(path, "/sql")) {
+			stats = sql_stats = tagsistant_sql_stats_report();
+		}
 
 		// -- connections --
-		if (g_regex_match_simple("/connections$", path, 0, 0)) {
-			sprintf(stats_buffer, "# of MySQL open connections: %d\n", connections);
+		else if (g_str_has_suffix(path, "/connections")) {
+			tagsistant_db_connection_stats(stats_buffer);
 		}
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 		// -- cached_queries --
-		else if (g_regex_match_simple("/cached_queries$", path, 0, 0)) {
-			int entries = tagsistant_querytree_cache_total();
-			sprintf(stats_buffer, "# of cached queries: %d\n", entries);
+		else if (g_str_has_suffix(path, "/cached_queries")) {
+			tagsistant_querytree_cache_stats(stats_buffer);
+			sprintf(stats_buffer + strlen(stats_buffer), "# of negative cache hits: %d\n", tagsistant_negative_cache_hit_count());
 		}
 #endif /* TAGSISTANT_ENABLE_QUERYTREE_CACHE */
 
+		// -- rds --
+		else if (g_str_has_suffix(path, "/rds")) {
+			tagsistant_rds_stats(stats_buffer);
+		}
+
+		// -- plans --
+		else if (g_str_has_suffix(path, "/plans")) {
+			tagsistant_rds_plans_stats(stats_buffer);
+		}
+
+		// -- regex --
+		else if (g_str_has_suffix(path, "/regex")) {
+			tagsistant_regex_stats(stats_buffer);
+		}
+
+		// -- schema --
+		else if (g_str_has_suffix(path, "/schema")) {
+			tagsistant_migration_stats(stats_buffer);
+		}
+
 		// -- configuration --
-		else if (g_regex_match_simple("/configuration$", path, 0, 0)) {
+		else if (g_str_has_suffix(path, "/configuration")) {
 			tagsistant_read_stats_configuration(stats_buffer);
 		}
 
 		// -- objects --
-		else if (g_regex_match_simple("/objects$", path, 0, 0)) {
+		else if (g_str_has_suffix(path, "/objects")) {
 			int entries = 0;
 			tagsistant_query("select count(1) from objects", qtree->dbi, tagsistant_return_integer, &entries);
 			sprintf(stats_buffer, "# of objects: %d\n", entries);
 		}
 
 		// -- tags --
-		else if (g_regex_match_simple("/tags$", path, 0, 0)) {
+		else if (g_str_has_suffix(path, "/tags")) {
 			int entries = 2;
 			tagsistant_query("select count(1) from tags", qtree->dbi, tagsistant_return_integer, &entries);
-			sprintf(stats_buffer, "# of tags: %d\n", entries);
+			sprintf(stats_buffer, "# of tags: %d\n# of tags in the dictionary: %d\n", entries, tagsistant_tag_dictionary_size());
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+			int lists = 0, evaluations = 0;
+			gboolean ready = tagsistant_posting_stats(&lists, &evaluations);
+			sprintf(stats_buffer + strlen(stats_buffer), "# of posting lists: %d (%s)\n# of queries resolved on posting lists: %d\n",
+				lists, ready ? "loaded" : "loading", evaluations);
+#endif
 		}
 
 		// -- relations --
-		else if (g_regex_match_simple("/relations$", path, 0, 0)) {
+		else if (g_str_has_suffix(path, "/relations")) {
 			int entries = 0;
 			tagsistant_query("select count(1) from relations", qtree->dbi, tagsistant_return_integer, &entries);
 			sprintf(stats_buffer, "# of relations: %d\n", entries);
 		}
 
-		size_t stats_size = strlen(stats_buffer);
+		size_t stats_size = strlen(stats);
 		if ((size_t) offset <= stats_size) {
-			gchar *start = stats_buffer + offset;
+			gchar *start = stats + offset;
 			size_t available = stats_size - offset;
 			size_t real_size = (size > available) ? available : size;
 
 			memcpy(buf, start, real_size);
 			res = (int) real_size;
 		}
+
+		g_free_null(sql_stats);
 	}
 
 	// -- tags --
@@ -200,6 +235,12 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		"  run in foreground: %d\n"
 		"    single threaded: %d\n"
 		"    mount read-only: %d\n"
+		"       group commit: %d\n"
+		"       RDS max sets: %d\n"
+		"     RDS max tuples: %d\n"
+		"   RDS temp. tables: %d\n"
+		"    RDS parallelism: %d\n"
+		"   qtree cache size: %d entries, %d MB\n"
 		"              debug: %s\n"
 		"                     [%c] boot\n"
 		"                     [%c] cache\n"
@@ -219,6 +260,9 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		"     TAGSISTANT_ENABLE_REASONER_CACHE: %d\n"
 		"  TAGSISTANT_ENABLE_FILE_HANDLE_CACHE: %d\n"
 		"        TAGSISTANT_ENABLE_AUTOTAGGING: %d\n"
+		"      TAGSISTANT_ENABLE_NATIVE_SQLITE: %d\n"
+		"     TAGSISTANT_ENABLE_NEGATIVE_CACHE: %d\n"
+		"      TAGSISTANT_ENABLE_POSTING_LISTS: %d\n"
 		"           TAGSISTANT_QUERY_DELIMITER: %c (to avoid reasoning use: %s)\n"
 		"          TAGSISTANT_ANDSET_DELIMITER: %c\n"
 		"           TAGSISTANT_INODE_DELIMITER: '%s'\n"
@@ -228,6 +272,11 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		"       TAGSISTANT_DEFAULT_TAGS_SUFFIX: %s\n"
 		"                 TAGSISTANT_GC_TUPLES: %d\n"
 		"                    TAGSISTANT_GC_RDS: %d\n"
+		"           TAGSISTANT_RDS_GC_INTERVAL: %d\n"
+		"            TAGSISTANT_RDS_PREDICATES: %d\n"
+		"   TAGSISTANT_GROUP_COMMIT_OPERATIONS: %d\n"
+		"     TAGSISTANT_GROUP_COMMIT_INTERVAL: %d\n"
+		"       TAGSISTANT_NEGATIVE_CACHE_SIZE: %d\n"
 		"\n",
 		tagsistant.mountpoint,
 		tagsistant.repository,
@@ -236,6 +285,12 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		tagsistant.foreground,
 		tagsistant.singlethread,
 		tagsistant.readonly,
+		tagsistant.group_commit,
+		tagsistant.rds_max_sets,
+		tagsistant.rds_max_tuples,
+		tagsistant.rds_temporary_tables,
+		tagsistant.rds_parallelism,
+		tagsistant.querytree_cache_entries, tagsistant.querytree_cache_size,
 		tagsistant.debug_flags ? tagsistant.debug_flags : "-",
 		tagsistant.dbg['b'] ? 'x' : ' ',
 		tagsistant.dbg['c'] ? 'x' : ' ',
@@ -253,6 +308,9 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		TAGSISTANT_ENABLE_REASONER_CACHE,
 		TAGSISTANT_ENABLE_FILE_HANDLE_CACHE,
 		TAGSISTANT_ENABLE_AUTOTAGGING,
+		TAGSISTANT_ENABLE_NATIVE_SQLITE,
+		TAGSISTANT_ENABLE_NEGATIVE_CACHE,
+		TAGSISTANT_ENABLE_POSTING_LISTS,
 		TAGSISTANT_QUERY_DELIMITER_CHAR, TAGSISTANT_QUERY_DELIMITER_NO_REASONING,
 		TAGSISTANT_ANDSET_DELIMITER_CHAR,
 		TAGSISTANT_INODE_DELIMITER,
@@ -261,6 +319,11 @@ void tagsistant_read_stats_configuration(gchar stats_buffer[TAGSISTANT_STATS_BUF
 		TAGSISTANT_DEFAULT_TRIPLE_TAG_REGEX,
 		TAGSISTANT_DEFAULT_TAGS_SUFFIX,
 		TAGSISTANT_GC_TUPLES,
-		TAGSISTANT_GC_RDS
+		TAGSISTANT_GC_RDS,
+		TAGSISTANT_RDS_GC_INTERVAL,
+		TAGSISTANT_RDS_PREDICATES,
+		TAGSISTANT_GROUP_COMMIT_OPERATIONS,
+		TAGSISTANT_GROUP_COMMIT_INTERVAL,
+		TAGSISTANT_NEGATIVE_CACHE_SIZE
 	);
 }
@@ -28,8 +28,61 @@ struct tagsistant_use_filler_struct {
 	const char *path;				/**< the path that generates the query */
 	tagsistant_querytree *qtree;	/**< the querytree that originated the readdir() */
 	int is_alias;					/**< set to 1 if entries are aliases and must be prefixed with the alias identifier (=) */
+	tagsistant_dir_snapshot *snapshot;	/**< the snapshot to be filled instead of the libfuse buffer */
 };
 
+/**
+ * Allocate an empty listing snapshot
+ *
+ * @return the snapshot, to be freed with tagsistant_dir_snapshot_free()
+ */
+tagsistant_dir_snapshot *tagsistant_dir_snapshot_new()
+{
+	tagsistant_dir_snapshot *snapshot = g_new0(tagsistant_dir_snapshot, 1);
+	if (!snapshot) return (NULL);
+
+	snapshot->entries = g_ptr_array_new();
+	snapshot->names = g_string_chunk_new(4096);
+
+	return (snapshot);
+}
+
+/**
+ * Empty a listing snapshot before filling it again
+ *
+ * @param snapshot the snapshot
+ */
+void tagsistant_dir_snapshot_reset(tagsistant_dir_snapshot *snapshot)
+{
+	g_ptr_array_set_size(snapshot->entries, 0);
+	g_string_chunk_clear(snapshot->names);
+}
+
+/**
+ * Free a listing snapshot
+ *
+ * @param snapshot the snapshot
+ */
+void tagsistant_dir_snapshot_free(tagsistant_dir_snapshot *snapshot)
+{
+	if (!snapshot) return;
+
+	g_ptr_array_free(snapshot->entries, TRUE);
+	g_string_chunk_free(snapshot->names);
+	g_free(snapshot);
+}
+
+/**
+ * Append an entry to a listing snapshot
+ *
+ * @param snapshot the snapshot
+ * @param name the entry name, copied into the snapshot
+ */
+static void tagsistant_dir_snapshot_add(tagsistant_dir_snapshot *snapshot, const gchar *name)
+{
+	g_ptr_array_add(snapshot->entries, g_string_chunk_insert(snapshot->names, name));
+}
+
 /**
  * SQL callback. Add dir entries to libfuse buffer.
  *
@@ -40,7 +93,7 @@ struct tagsistant_use_filler_struct {
 static int tagsistant_add_entry_to_dir(void *filler_ptr, dbi_result result)
 {
 	struct tagsistant_use_filler_struct *ufs = (struct tagsistant_use_filler_struct *) filler_ptr;
-	const char *dir = dbi_result_get_string_idx(result, 1);
+	const char *dir = tagsistant_result_get_string_idx(result, 1);
 
 	/* this must be the last value, just exit */
 	if (dir == NULL) return(0);
@@ -78,50 +131,116 @@ static int tagsistant_add_entry_to_dir(void *filler_ptr, dbi_result result)
 }
 
 /**
- * Add a file entry from a GList to the readdir() buffer
+ * Add the entry of an object listed by tagsistant_rds_list(): its name,
+ * prefixed by its inode if other objects have the same name or the
+ * query asks for inodes
  *
- * @param name unused
- * @param fh_list the GList holding filenames
  * @param ufs a context structure
- * @return 0 always
+ * @param name the object name
+ * @param inode the object inode
+ * @param homonym true if other objects have the same name
+ * @param add the function adding the entry, returning non zero to stop the listing
+ * @return the result of add
  */
-static int tagsistant_readdir_on_store_filler(gchar *name, GList *fh_list, struct tagsistant_use_filler_struct *ufs)
+static int tagsistant_readdir_on_store_entry(
+	struct tagsistant_use_filler_struct *ufs,
+	const gchar *name,
+	tagsistant_inode inode,
+	int homonym,
+	int (*add)(struct tagsistant_use_filler_struct *ufs, const gchar *entry))
 {
-	(void) name;
+	// just add the filename
+	if (!homonym && !ufs->qtree->force_inode_in_filenames)
+		return (add(ufs, name));
 
-	if (!fh_list) return (0);
+	// add the inode to the filename
+	gchar *filename = g_strdup_printf("%d%s%s", inode, TAGSISTANT_INODE_DELIMITER, name);
+	int result = add(ufs, filename);
+	g_free_null(filename);
 
-	if (NULL == fh_list) return (0);
+	return (result);
+}
 
-	if (!(fh_list->next)) {
-		// just add the filename
-		tagsistant_file_handle *fh = fh_list->data;
+/**
+ * Add an entry to the readdir() buffer
+ *
+ * @return the FUSE filler result, non zero if the buffer is full
+ */
+static int tagsistant_readdir_on_store_add_to_buffer(struct tagsistant_use_filler_struct *ufs, const gchar *entry)
+{
+	return (ufs->filler(ufs->buf, entry, NULL, 0));
+}
 
-		if (!fh) return (0);
+/**
+ * Add an entry to the listing snapshot
+ *
+ * @return 0 (always, the whole listing is taken)
+ */
+static int tagsistant_readdir_on_store_add_to_snapshot(struct tagsistant_use_filler_struct *ufs, const gchar *entry)
+{
+	tagsistant_dir_snapshot_add(ufs->snapshot, entry);
+	return (0);
+}
 
-		if (ufs->qtree->force_inode_in_filenames) {
-			gchar *filename = g_strdup_printf("%d%s%s", fh->inode, TAGSISTANT_INODE_DELIMITER, fh->name);
-			ufs->filler(ufs->buf, filename, NULL, 0);
-			g_free_null(filename);
-		} else {
-			ufs->filler(ufs->buf, fh->name, NULL, 0);
-		}
+/**
+ * Add an object listed by tagsistant_rds_list() to the readdir() buffer
+ *
+ * @param ufs a context structure
+ * @param name the object name
+ * @param inode the object inode
+ * @param homonym true if other objects have the same name
+ * @return the FUSE filler result, non zero if the buffer is full
+ */
+static int tagsistant_readdir_on_store_filler(struct tagsistant_use_filler_struct *ufs, const gchar *name, tagsistant_inode inode, int homonym)
+{
+	return (tagsistant_readdir_on_store_entry(ufs, name, inode, homonym, tagsistant_readdir_on_store_add_to_buffer));
+}
 
-		return (0);
-	}
+/**
+ * Add an object listed by tagsistant_rds_list() to a listing snapshot
+ *
+ * @param ufs a context structure
+ * @param name the object name
+ * @param inode the object inode
+ * @param homonym true if other objects have the same name
+ * @return 0 (always, the whole listing is taken)
+ */
+static int tagsistant_readdir_on_store_snapshot_filler(struct tagsistant_use_filler_struct *ufs, const gchar *name, tagsistant_inode inode, int homonym)
+{
+	return (tagsistant_readdir_on_store_entry(ufs, name, inode, homonym, tagsistant_readdir_on_store_add_to_snapshot));
+}
 
-	// add inodes to filenames
-	while (fh_list) {
-		tagsistant_file_handle *fh = fh_list->data;
-		if (fh) {
-			gchar *filename = g_strdup_printf("%d%s%s", fh->inode, TAGSISTANT_INODE_DELIMITER, fh->name);
-			ufs->filler(ufs->buf, filename, NULL, 0);
-			g_free_null(filename);
-		}
-		fh_list = fh_list->next;
+/**
+ * Stream the objects of a complete store/ query starting from an offset.
+ *
+ * The listing is taken into the snapshot when the offset is 0 (a new
+ * listing or a rewinddir()) and served from the snapshot for the
+ * following offsets, so a listing which doesn't fit the kernel buffer
+ * is queried once instead of once per buffer. Each entry is passed to
+ * FUSE with the offset of the next one, which is what readdir() will be
+ * called with when the buffer is consumed.
+ *
+ * @param ufs a context structure
+ * @param is_all_path true if the query contains the ALL/ meta-tag
+ * @param offset the offset of the readdir() operation
+ */
+static void tagsistant_readdir_on_store_from_snapshot(struct tagsistant_use_filler_struct *ufs, int is_all_path, off_t offset)
+{
+	tagsistant_dir_snapshot *snapshot = ufs->snapshot;
+
+	if (!offset || !snapshot->entries->len) {
+		tagsistant_dir_snapshot_reset(snapshot);
+		tagsistant_dir_snapshot_add(snapshot, ".");
+		tagsistant_dir_snapshot_add(snapshot, "..");
+		tagsistant_rds_list(ufs->qtree, is_all_path, (tagsistant_rds_filler) tagsistant_readdir_on_store_snapshot_filler, ufs);
+
+		dbg('f', LOG_INFO, "Snapshot of %s: %u entries", ufs->path, snapshot->entries->len);
 	}
 
-	return (0);
+	off_t i;
+	for (i = offset; i < (off_t) snapshot->entries->len; i++) {
+		if (ufs->filler(ufs->buf, g_ptr_array_index(snapshot->entries, i), NULL, i + 1)) break;
+	}
 }
 
 /**
@@ -132,13 +251,7 @@ static int tagsistant_readdir_on_store_filler(gchar *name, GList *fh_list, struc
  */
 int tagsistant_do_add_operators(tagsistant_querytree *qtree)
 {
-	gchar tagsistant_check_tags_path_regex[] = "/(\\"
-		TAGSISTANT_ANDSET_DELIMITER "|"
-		TAGSISTANT_QUERY_DELIMITER "|"
-		TAGSISTANT_QUERY_DELIMITER_NO_REASONING "|"
-		TAGSISTANT_NEGATE_NEXT_TAG ")$";
-
-	if (!g_regex_match_simple(tagsistant_check_tags_path_regex, qtree->full_path, G_REGEX_EXTENDED, 0)) {
+	if (!tagsistant_regex_match(TAGSISTANT_RX_OPERATOR_SUFFIX, qtree->full_path)) {
 		if (g_strcmp0(qtree->full_path, "/tags")) {
 			if (!qtree->namespace || (qtree->namespace && qtree->value)) {
 				return (1);
@@ -154,9 +267,7 @@ int tagsistant_do_add_operators(tagsistant_querytree *qtree)
  */
 int is_inside_tag_group(gchar *path)
 {
-	if (g_regex_match_simple("/{/[^{}]+$", path, G_REGEX_EXTENDED, 0)) return (1);
-	if (g_regex_match_simple("/{$", path, G_REGEX_EXTENDED, 0)) return (1);
-	return (0);
+	return (tagsistant_regex_match(TAGSISTANT_RX_OPEN_TAG_GROUP, path) ? 1 : 0);
 }
 
 /**
@@ -213,6 +324,7 @@ gchar *tagsistant_qtree_list_tags_in_last_or_node(tagsistant_querytree *qtree)
  * @param buf FUSE buffer used by FUSE filler
  * @param filler the FUSE fuse_fill_dir_t compatible function used to fill the buffer
  * @param off_t the offset of the readdir() operation
+ * @param snapshot the listing snapshot of the directory handle, NULL if none
  * @param tagsistant_errno pointer to return the state of the errno macro
  * @return always 0
  */
@@ -222,13 +334,9 @@ int tagsistant_readdir_on_store(
 	void *buf,
 	fuse_fill_dir_t filler,
 	off_t offset,
+	tagsistant_dir_snapshot *snapshot,
 	int *tagsistant_errno)
 {
-	(void) offset;
-
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
-
 	/*
 	 * check if path contains the ALL/ meta-tag
 	 */
@@ -250,6 +358,21 @@ int tagsistant_readdir_on_store(
 	ufs->path = path;
 	ufs->qtree = qtree;
 	ufs->is_alias = 0;
+	ufs->snapshot = snapshot;
+
+	/*
+	 * complete queries are paged through the snapshot,
+	 * "." and ".." included, since libfuse does not allow
+	 * mixing entries with and without an offset
+	 */
+	if (qtree->complete && !qtree->error_message && snapshot) {
+		tagsistant_readdir_on_store_from_snapshot(ufs, is_all_path, offset);
+		g_free_null(ufs);
+		return (0);
+	}
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
 
 	if (qtree->complete) {
 
@@ -257,11 +380,8 @@ int tagsistant_readdir_on_store(
 			/* report a file with the error message */
 			filler(buf, "error", NULL, 0);
 		} else {
-			/* build the filetree */
-			GHashTable *hash_table = tagsistant_rds_new(qtree, is_all_path);
-			g_hash_table_foreach(hash_table, (GHFunc) tagsistant_readdir_on_store_filler, ufs);
-			g_hash_table_foreach(hash_table, (GHFunc) tagsistant_rds_destroy_value_list, NULL);
-			g_hash_table_destroy(hash_table);
+			/* stream the objects into the buffer */
+			tagsistant_rds_list(qtree, is_all_path, (tagsistant_rds_filler) tagsistant_readdir_on_store_filler, ufs);
 		}
 	} else {
 
@@ -605,7 +725,12 @@ int tagsistant_readdir_on_stats(
 	filler(buf, "configuration", NULL, 0);
 	filler(buf, "connections", NULL, 0);
 	filler(buf, "objects", NULL, 0);
+	filler(buf, "plans", NULL, 0);
+	filler(buf, "rds", NULL, 0);
+	filler(buf, "regex", NULL, 0);
 	filler(buf, "relations", NULL, 0);
+	filler(buf, "schema", NULL, 0);
+	filler(buf, "sql", NULL, 0);
 	filler(buf, "tags", NULL, 0);
 
 	// fill with available statistics
@@ -663,14 +788,14 @@ int tagsistant_readdir_on_alias(
  * @param buf buffer holding directory entries
  * @param filler libfuse fuse_fill_dir_t function to save entries in *buf
  * @param offset offset of next read
- * @param fi struct fuse_file_info passed by libfuse; unused.
+ * @param fi struct fuse_file_info holding the snapshot allocated by tagsistant_opendir()
  * @return(0 on success, -errno otherwise)
  */
 int tagsistant_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
 	int res = 0, tagsistant_errno = 0;
 
-	(void) fi;
+	tagsistant_dir_snapshot *snapshot = fi ? (tagsistant_dir_snapshot *) (uintptr_t) fi->fh : NULL;
 
 	TAGSISTANT_START("READDIR on %s", path);
 
@@ -698,7 +823,7 @@ int tagsistant_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_
 		filler(buf, "tags", NULL, 0);
 
 	} else if (QTREE_IS_STORE(qtree)) {
-		res = tagsistant_readdir_on_store(qtree, path, buf, filler, offset, &tagsistant_errno);
+		res = tagsistant_readdir_on_store(qtree, path, buf, filler, offset, snapshot, &tagsistant_errno);
 
 	} else if (QTREE_IS_TAGS(qtree)) {
 		res = tagsistant_readdir_on_tags(qtree, path, buf, filler, &tagsistant_errno);
@@ -0,0 +1,42 @@
+/*
+   Tagsistant (tagfs) -- fuse_operations/releasedir.c
+   Copyright (C) 2006-2014 Tx0 <tx0@strumentiresistenti.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "../tagsistant.h"
+
+/**
+ * closedir equivalent. Frees the listing snapshot attached to the
+ * directory handle by tagsistant_opendir().
+ *
+ * @param path the path of the directory to be closed
+ * @param fi struct fuse_file_info holding the snapshot
+ * @return(0 (always))
+ */
+int tagsistant_releasedir(const char *path, struct fuse_file_info *fi)
+{
+	TAGSISTANT_START("RELEASEDIR on %s", path);
+
+	tagsistant_dir_snapshot *snapshot = (tagsistant_dir_snapshot *) (uintptr_t) fi->fh;
+	if (snapshot) {
+		tagsistant_dir_snapshot_free(snapshot);
+		fi->fh = 0;
+	}
+
+	TAGSISTANT_STOP_OK("RELEASEDIR on %s: OK", path);
+	return (0);
+}
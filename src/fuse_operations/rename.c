@@ -73,11 +73,15 @@ int tagsistant_rename(const char *from, const char *to)
 				to_qtree->object_path,
 				from_qtree->inode);
 
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+			tagsistant_negative_cache_invalidate();
+#endif
+
 			// 4. deletes all the tagging between "from" file and all AND nodes in "from" path
 			tagsistant_querytree_traverse(from_qtree, tagsistant_sql_untag_object, from_qtree->inode);
 
 			// 5. adds all the tags from "to" path
-			tagsistant_querytree_traverse(to_qtree, tagsistant_sql_tag_object, from_qtree->inode);
+			tagsistant_querytree_tag_object(to_qtree, from_qtree->inode);
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
 			/*
@@ -110,19 +114,7 @@ int tagsistant_rename(const char *from, const char *to)
 			TAGSISTANT_ABORT_OPERATION(EPERM);
 		}
 
-		tagsistant_query(
-			"update tags set tagname = '%s' "
-				"where tagname = '%s'",
-			from_qtree->dbi,
-			NULL, NULL,
-			to_qtree->last_tag,
-			from_qtree->last_tag);
-
-		if (from_qtree->value) {
-			tagsistant_remove_tag_from_cache(from_qtree->namespace, from_qtree->key, from_qtree->value);
-		} else {
-			tagsistant_remove_tag_from_cache(from_qtree->last_tag, NULL, NULL);
-		}
+		tagsistant_sql_rename_tag(from_qtree->dbi, to_qtree->last_tag, from_qtree->last_tag);
 
 		// clean the RDS library
 		tagsistant_delete_rds_involved(from_qtree);
@@ -131,19 +123,7 @@ int tagsistant_rename(const char *from, const char *to)
 
 	// -- tags --
 	if (QTREE_IS_TAGS(from_qtree) && QTREE_IS_TAGS(to_qtree)) {
-		tagsistant_query(
-			"update tags set tagname = '%s' "
-				"where tagname = '%s'",
-			from_qtree->dbi,
-			NULL, NULL,
-			to_qtree->last_tag,
-			from_qtree->last_tag);
-
-		if (from_qtree->value) {
-			tagsistant_remove_tag_from_cache(from_qtree->namespace, from_qtree->key, from_qtree->value);
-		} else {
-			tagsistant_remove_tag_from_cache(from_qtree->last_tag, NULL, NULL);
-		}
+		tagsistant_sql_rename_tag(from_qtree->dbi, to_qtree->last_tag, from_qtree->last_tag);
 	} else
 
 	// -- alias --
@@ -65,11 +65,11 @@ int tagsistant_symlink(const char *from, const char *to)
 
 			if (tagsistant.multi_symlink) {
 				// 1. check if an object with the same name exists in the RDS
-				gchar *rds_id = tagsistant_get_rds_checksum(to_qtree);
+				int rds_id = tagsistant_get_rds_id(to_qtree);
 
 				tagsistant_query(
 					"select inode from rds "
-						"where id = \"%s\" and objectname = \"%s\"",
+						"where rds_id = %d and objectname = \"%s\"",
 						to_qtree->dbi,
 						tagsistant_return_integer,
 						&check_inode,
@@ -94,7 +94,7 @@ int tagsistant_symlink(const char *from, const char *to)
 						if (strcmp(symlink_target, from) == 0) {
 							// 2.1. tag the available symlink with the new tag set
 							dbg('F', LOG_INFO, "SYMLINK : Deduplicating on inode %d", check_inode);
-							tagsistant_querytree_traverse(to_qtree, tagsistant_sql_tag_object, check_inode);
+							tagsistant_querytree_tag_object(to_qtree, check_inode);
 							goto TAGSISTANT_EXIT_OPERATION;
 						} else {
 							// 2. create the object
@@ -124,7 +124,7 @@ int tagsistant_symlink(const char *from, const char *to)
 
 					// 2.1. tag the available symlink with the new tag set
 					dbg('F', LOG_INFO, "SYMLINK : Deduplicating on inode %d", check_inode);
-					tagsistant_querytree_traverse(to_qtree, tagsistant_sql_tag_object, check_inode);
+					tagsistant_querytree_tag_object(to_qtree, check_inode);
 					goto TAGSISTANT_EXIT_OPERATION;
 
 				} else {
@@ -50,6 +50,11 @@ int tagsistant_truncate(const char *path, off_t size)
 		tagsistant_errno = 0;
 	}
 
+	// -- stats (/stats/sql is truncated before being written to) --
+	else if (QTREE_IS_STATS(qtree) && g_str_has_suffix(path, "/sql")) {
+		res = 0;
+		tagsistant_errno = 0;
+	}
 
 	// -- tags --
 	// -- stats --
@@ -53,6 +53,10 @@ int tagsistant_unlink(const char *path)
 					"delete from tagging where inode = %d",
 					qtree->dbi, NULL, NULL, qtree->inode);
 
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+				tagsistant_posting_drop_object(qtree->inode);
+#endif
+
 			} else {
 
 				/*
@@ -55,9 +55,7 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 		if (path_ptr) *path_ptr = '/';
 
 		// remove double slashes
-		GRegex *rx = g_regex_new("//", 0, 0, NULL);
-		gchar *_buf2 = g_regex_replace(rx, _buf, -1, 0, "/", 0, NULL);
-		g_regex_unref(rx);
+		gchar *_buf2 = tagsistant_compress_slashes(_buf);
 		g_free(_buf);
 		_buf = _buf2;
 
@@ -111,6 +109,12 @@ int tagsistant_write(const char *path, const char *buf, size_t size, off_t offse
 #endif
 	}
 
+	// -- stats (writing to /stats/sql resets it) --
+	else if (QTREE_IS_STATS(qtree) && g_str_has_suffix(path, "/sql")) {
+		tagsistant_sql_stats_reset();
+		res = size;
+	}
+
 	// -- tags --
 	// -- stats --
 	// -- relations --
@@ -0,0 +1,185 @@
+/*
+   Tagsistant (tagfs) -- negative_cache.c
+   Copyright (C) 2006-2014 Tx0 <tx0@strumentiresistenti.org>
+
+   A cache of the tags, aliases and objects known not to exist.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/*
+ * Shells, file managers and tab completion keep on probing paths that
+ * don't exist (.git, desktop.ini, typos...). Each probe would cost one
+ * or more SQL queries, so misses are remembered here.
+ *
+ * The cache is invalidated as a whole by bumping a generation counter
+ * each time a tag, an alias or an object comes into existence. The
+ * table is emptied lazily, by the first insertion of a new generation.
+ *
+ * A miss is recorded only if the generation has not changed since the
+ * lookup started, so a concurrent creation can't be hidden by a reader
+ * which did not see it. Since readers don't see uncommitted writes, the
+ * generation is bumped again when the transaction that created
+ * something is released (see tagsistant_negative_cache_release()).
+ */
+
+/** the generation of the cache */
+static gint tagsistant_negative_cache_generation_counter = 0;
+
+/** the generation of the entries in the table */
+static gint tagsistant_negative_cache_table_generation = 0;
+
+/** the missing names, as keys built by tagsistant_negative_cache_key() */
+static GHashTable *tagsistant_negative_cache_table = NULL;
+
+/** guards the table */
+static GRWLock tagsistant_negative_cache_lock;
+
+/** lookups answered by the cache */
+static gint tagsistant_negative_cache_hits = 0;
+
+/** set in a thread that created something inside its current transaction */
+static GPrivate tagsistant_negative_cache_pending;
+
+/**
+ * Initialize the negative cache
+ */
+void tagsistant_negative_cache_init()
+{
+	tagsistant_negative_cache_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+/** stands for a NULL key or value, which is not the same as an empty one */
+#define TAGSISTANT_NEGATIVE_CACHE_NULL "\x1e"
+
+/**
+ * Build the key of a missing name
+ *
+ * @param kind one of the TAGSISTANT_NEGATIVE_* kinds
+ * @param first the tag name, the alias or the object name
+ * @param key the key of a triple tag, NULL otherwise
+ * @param value the value of a triple tag, NULL otherwise
+ * @return the key, to be freed with g_free()
+ */
+static gchar *tagsistant_negative_cache_key(gchar kind, const gchar *first, const gchar *key, const gchar *value)
+{
+	return (g_strdup_printf("%c\x1f%s\x1f%s\x1f%s", kind, first,
+		key ? key : TAGSISTANT_NEGATIVE_CACHE_NULL,
+		value ? value : TAGSISTANT_NEGATIVE_CACHE_NULL));
+}
+
+/**
+ * Return the current generation. Read it before looking up a name
+ * and pass it to tagsistant_negative_cache_add() if the lookup fails.
+ *
+ * @return the generation
+ */
+gint tagsistant_negative_cache_generation()
+{
+	return (g_atomic_int_get(&tagsistant_negative_cache_generation_counter));
+}
+
+/**
+ * Check if a name is known not to exist
+ *
+ * @param kind one of the TAGSISTANT_NEGATIVE_* kinds
+ * @param first the tag name, the alias or the object name
+ * @param key the key of a triple tag, NULL otherwise
+ * @param value the value of a triple tag, NULL otherwise
+ * @return true if the name does not exist
+ */
+gboolean tagsistant_negative_cache_lookup(gchar kind, const gchar *first, const gchar *key, const gchar *value)
+{
+	if (!first) return (FALSE);
+
+	gboolean missing = FALSE;
+	gchar *search_key = tagsistant_negative_cache_key(kind, first, key, value);
+
+	g_rw_lock_reader_lock(&tagsistant_negative_cache_lock);
+	if (tagsistant_negative_cache_table_generation == tagsistant_negative_cache_generation())
+		missing = g_hash_table_contains(tagsistant_negative_cache_table, search_key);
+	g_rw_lock_reader_unlock(&tagsistant_negative_cache_lock);
+
+	g_free(search_key);
+
+	if (missing) {
+		g_atomic_int_inc(&tagsistant_negative_cache_hits);
+		dbg('c', LOG_INFO, "Negative cache hit on %c:%s", kind, first);
+	}
+
+	return (missing);
+}
+
+/**
+ * Record a name which does not exist
+ *
+ * @param generation the generation read before looking the name up
+ * @param kind one of the TAGSISTANT_NEGATIVE_* kinds
+ * @param first the tag name, the alias or the object name
+ * @param key the key of a triple tag, NULL otherwise
+ * @param value the value of a triple tag, NULL otherwise
+ */
+void tagsistant_negative_cache_add(gint generation, gchar kind, const gchar *first, const gchar *key, const gchar *value)
+{
+	if (!first) return;
+
+	g_rw_lock_writer_lock(&tagsistant_negative_cache_lock);
+
+	if (generation == tagsistant_negative_cache_generation()) {
+		/* drop the entries of an older generation or when the table is full */
+		if ((tagsistant_negative_cache_table_generation != generation) ||
+			(g_hash_table_size(tagsistant_negative_cache_table) >= TAGSISTANT_NEGATIVE_CACHE_SIZE)) {
+			g_hash_table_remove_all(tagsistant_negative_cache_table);
+			tagsistant_negative_cache_table_generation = generation;
+		}
+
+		g_hash_table_add(tagsistant_negative_cache_table, tagsistant_negative_cache_key(kind, first, key, value));
+	}
+
+	g_rw_lock_writer_unlock(&tagsistant_negative_cache_lock);
+}
+
+/**
+ * Invalidate the cache. Must be called each time a tag, an alias
+ * or an object is created or renamed.
+ */
+void tagsistant_negative_cache_invalidate()
+{
+	g_atomic_int_inc(&tagsistant_negative_cache_generation_counter);
+	g_private_set(&tagsistant_negative_cache_pending, GINT_TO_POINTER(1));
+}
+
+/**
+ * Called when a write transaction is released: if the calling thread
+ * created something, the creation is now visible to the readers, so
+ * the misses they recorded meanwhile are invalidated.
+ */
+void tagsistant_negative_cache_release()
+{
+	if (!g_private_get(&tagsistant_negative_cache_pending)) return;
+
+	g_private_set(&tagsistant_negative_cache_pending, NULL);
+	g_atomic_int_inc(&tagsistant_negative_cache_generation_counter);
+}
+
+/**
+ * Return the number of lookups answered by the cache
+ */
+int tagsistant_negative_cache_hit_count()
+{
+	return (g_atomic_int_get(&tagsistant_negative_cache_hits));
+}
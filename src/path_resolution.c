@@ -204,6 +204,11 @@ tagsistant_inode tagsistant_guess_inode_from_and_set(qtree_and_node *and_set, db
 	 */
 	if (!and_set) return (0);
 
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	/* no object with this name exists at all */
+	if (tagsistant_negative_cache_lookup(TAGSISTANT_NEGATIVE_OBJECT, objectname, NULL, NULL)) return (0);
+#endif
+
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
 	/* check if the query has been already answered and cached */
 	gchar *search_key = tagsistant_compile_and_set(objectname, and_set);
@@ -377,23 +382,43 @@ int tagsistant_querytree_check_tagging_consistency(tagsistant_querytree *qtree)
 		qtree->is_taggable = 1;
 	}
 
-	// 2. use the object first element to guess if its tagged in the RDS
-	int materialized = 0;
-	gchar *rds_id = tagsistant_get_rds_id(qtree, &materialized);
-	if (!materialized) {
-		rds_id = tagsistant_materialize_rds(qtree);
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	// 2. skip the RDS if no object with this name exists at all
+	if (tagsistant_negative_cache_lookup(TAGSISTANT_NEGATIVE_OBJECT, object_first_element, NULL, NULL)) {
+		g_free_null(object_first_element);
+		return (0);
 	}
+	gint generation = tagsistant_negative_cache_generation();
+#endif
+
+	// 3. use the object first element to guess if its tagged in the RDS
+	int rds_id = tagsistant_get_rds_id(qtree);
+	if (!rds_id) rds_id = tagsistant_materialize_rds(qtree);
 
 	tagsistant_query(
-		"select inode from rds where objectname = \"%s\" and id = \"%s\"",
+		"select inode from rds where rds_id = %d and objectname = \"%s\"",
 		qtree->dbi, tagsistant_return_integer, &inode,
-		object_first_element, rds_id);
+		rds_id, object_first_element);
 
 	if (inode) {
 		qtree->exists = 1;
 		if (inode != qtree->inode) tagsistant_querytree_set_inode(qtree, inode);
 	}
 
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	// 4. if the object is not in the RDS, remember if it's missing at all
+	else {
+		int known = 0;
+		tagsistant_query(
+			"select 1 from objects where objectname = \"%s\" limit 1",
+			qtree->dbi, tagsistant_return_integer, &known,
+			object_first_element);
+
+		if (!known)
+			tagsistant_negative_cache_add(generation, TAGSISTANT_NEGATIVE_OBJECT, object_first_element, NULL, NULL);
+	}
+#endif
+
 	g_free_null(object_first_element);
 
 	return(qtree->exists);
@@ -424,6 +449,151 @@ int tagsistant_querytree_check_tagging_consistency(tagsistant_querytree *qtree)
 /** abort parsing a store query with an error message */
 #define TAGSISTANT_ABORT_STORE_PARSING(message) { qtree->error_message = g_strdup(message); return (0); }
 
+/**
+ * the classes of the tokens of a store/ query
+ */
+typedef enum {
+	TAGSISTANT_TOKEN_EMPTY,				/**< a zero length token, like the one between two slashes */
+	TAGSISTANT_TOKEN_QUERY_DELIMITER,	/**< @ or @@, closing the query */
+	TAGSISTANT_TOKEN_NEGATE_NEXT_TAG,	/**< -, negating the following tag */
+	TAGSISTANT_TOKEN_ANDSET_DELIMITER,	/**< +, opening a new and-set */
+	TAGSISTANT_TOKEN_TAG_GROUP_BEGIN,	/**< {, opening a tag group */
+	TAGSISTANT_TOKEN_TAG_GROUP_END,		/**< }, closing a tag group */
+	TAGSISTANT_TOKEN_NAMESPACE,			/**< the namespace of a triple tag */
+	TAGSISTANT_TOKEN_TAG				/**< a plain tag */
+} tagsistant_token_class;
+
+/**
+ * classify a token of a store/ query looking at its first
+ * character and, for tags, at its tail
+ *
+ * @param token the token to classify
+ * @return the tagsistant_token_class of the token
+ */
+static tagsistant_token_class tagsistant_classify_token(const gchar *token)
+{
+	if ('\0' == token[0]) return (TAGSISTANT_TOKEN_EMPTY);
+	if (TAGSISTANT_QUERY_DELIMITER_CHAR == token[0]) return (TAGSISTANT_TOKEN_QUERY_DELIMITER);
+
+	if ('\0' == token[1]) {
+		if (TAGSISTANT_NEGATE_NEXT_TAG_CHAR == token[0]) return (TAGSISTANT_TOKEN_NEGATE_NEXT_TAG);
+		if (TAGSISTANT_ANDSET_DELIMITER_CHAR == token[0]) return (TAGSISTANT_TOKEN_ANDSET_DELIMITER);
+		if (TAGSISTANT_TAG_GROUP_BEGIN[0] == token[0]) return (TAGSISTANT_TOKEN_TAG_GROUP_BEGIN);
+		if (TAGSISTANT_TAG_GROUP_END[0] == token[0]) return (TAGSISTANT_TOKEN_TAG_GROUP_END);
+	}
+
+	return (tagsistant_is_triple_tag(token) ? TAGSISTANT_TOKEN_NAMESPACE : TAGSISTANT_TOKEN_TAG);
+}
+
+/**
+ * a per-thread buffer holding a tokenized path, reused by every
+ * tagsistant_querytree_new() call of the thread
+ */
+typedef struct {
+	gchar *chars;		/**< a copy of the path, with slashes turned into NULs */
+	gsize chars_size;	/**< the allocated size of chars */
+	gchar **tokens;		/**< the NULL terminated array of tokens pointing inside chars */
+	gsize tokens_size;	/**< the allocated length of tokens */
+	gboolean in_use;	/**< the buffer is holding the path being parsed */
+	gboolean temporary;	/**< the buffer must be freed on release */
+} tagsistant_path_arena;
+
+/**
+ * free a tagsistant_path_arena
+ *
+ * @param data the tagsistant_path_arena to free
+ */
+static void tagsistant_path_arena_free(gpointer data)
+{
+	tagsistant_path_arena *arena = (tagsistant_path_arena *) data;
+	if (!arena) return;
+
+	g_free(arena->chars);
+	g_free(arena->tokens);
+	g_free(arena);
+}
+
+/** the tagsistant_path_arena of each thread */
+static GPrivate tagsistant_path_arena_key = G_PRIVATE_INIT(tagsistant_path_arena_free);
+
+/**
+ * get the tagsistant_path_arena of the calling thread. If the
+ * thread is already parsing a path, a temporary one is returned.
+ *
+ * @return a tagsistant_path_arena to be given back with tagsistant_path_arena_release()
+ */
+static tagsistant_path_arena *tagsistant_path_arena_acquire()
+{
+	tagsistant_path_arena *arena = g_private_get(&tagsistant_path_arena_key);
+
+	if (!arena) {
+		arena = g_new0(tagsistant_path_arena, 1);
+		g_private_set(&tagsistant_path_arena_key, arena);
+	} else if (arena->in_use) {
+		arena = g_new0(tagsistant_path_arena, 1);
+		arena->temporary = TRUE;
+	}
+
+	arena->in_use = TRUE;
+	return (arena);
+}
+
+/**
+ * give back a tagsistant_path_arena obtained by tagsistant_path_arena_acquire()
+ *
+ * @param arena the tagsistant_path_arena
+ */
+static void tagsistant_path_arena_release(tagsistant_path_arena *arena)
+{
+	if (arena->temporary) {
+		tagsistant_path_arena_free(arena);
+	} else {
+		arena->in_use = FALSE;
+	}
+}
+
+/**
+ * split a path on slashes in a single pass, like g_strsplit(path, "/", 0)
+ * but without allocating anything once the arena has grown large enough
+ *
+ * @param arena the tagsistant_path_arena holding the tokens
+ * @param path the path to split
+ * @return a NULL terminated array of tokens, valid until the arena is released
+ */
+static gchar **tagsistant_path_tokenize(tagsistant_path_arena *arena, const gchar *path)
+{
+	gsize length = strlen(path) + 1;
+	if (arena->chars_size < length) {
+		arena->chars_size = MAX(length, TAGSISTANT_PATH_ARENA_SIZE);
+		arena->chars = g_realloc(arena->chars, arena->chars_size);
+	}
+	memcpy(arena->chars, path, length);
+
+	gsize count = 0;
+	gchar *token = arena->chars;
+	gchar *cursor = arena->chars;
+
+	while (1) {
+		if ('/' == *cursor || '\0' == *cursor) {
+			/* keep room for this token and the NULL terminator */
+			if (count + 2 > arena->tokens_size) {
+				arena->tokens_size = MAX(arena->tokens_size * 2, TAGSISTANT_PATH_ARENA_TOKENS);
+				arena->tokens = g_renew(gchar *, arena->tokens, arena->tokens_size);
+			}
+			arena->tokens[count++] = token;
+
+			if ('\0' == *cursor) break;
+
+			*cursor = '\0';
+			token = cursor + 1;
+		}
+		cursor++;
+	}
+
+	arena->tokens[count] = NULL;
+	return (arena->tokens);
+}
+
 #if 0
 typedef enum {
 	BEGIN,
@@ -514,10 +684,12 @@ int tagsistant_querytree_parse_store (
 	 * begin parsing
 	 */
 	while (__TOKEN && (TAGSISTANT_QUERY_DELIMITER_CHAR != *__TOKEN)) {
-		if (strlen(__TOKEN) == 0) {
+		tagsistant_token_class token_class = tagsistant_classify_token(__TOKEN);
+
+		if (TAGSISTANT_TOKEN_EMPTY == token_class) {
 			/* ignore zero length tokens */
 
-		} else if (strcmp(__TOKEN, TAGSISTANT_NEGATE_NEXT_TAG) == 0) {
+		} else if (TAGSISTANT_TOKEN_NEGATE_NEXT_TAG == token_class) {
 			/* double negations make no sense */
 			if (qtree->negate_next_tag)
 				TAGSISTANT_ABORT_STORE_PARSING(TAGSISTANT_ERROR_DOUBLE_NEGATION);
@@ -528,7 +700,7 @@ int tagsistant_querytree_parse_store (
 
 			qtree->negate_next_tag = 1;
 
-		} else if (strcmp(__TOKEN, TAGSISTANT_ANDSET_DELIMITER) == 0) {
+		} else if (TAGSISTANT_TOKEN_ANDSET_DELIMITER == token_class) {
 			/* open new entry in OR level */
 			orcount++;
 			andcount = 0;
@@ -543,14 +715,14 @@ int tagsistant_querytree_parse_store (
 			last_or = new_or;
 			last_and = NULL;
 
-		} else if (strcmp(__TOKEN, TAGSISTANT_TAG_GROUP_BEGIN) == 0) {
+		} else if (TAGSISTANT_TOKEN_TAG_GROUP_BEGIN == token_class) {
 			/* Can't nest tag groups */
 			if (TAGSISTANT_TAG_GROUP_DONT_ADD != tag_group)
 				TAGSISTANT_ABORT_STORE_PARSING(TAGSISTANT_ERROR_NESTED_TAG_GROUP);
 
 			tag_group = TAGSISTANT_TAG_GROUP_ADD_NEW_NODE;
 
-		} else if (strcmp(__TOKEN, TAGSISTANT_TAG_GROUP_END) == 0) {
+		} else if (TAGSISTANT_TOKEN_TAG_GROUP_END == token_class) {
 			/* can't close a tag group that has not been opened */
 			if (TAGSISTANT_TAG_GROUP_DONT_ADD == tag_group)
 				TAGSISTANT_ABORT_STORE_PARSING(TAGSISTANT_ERROR_CLOSE_TAG_GROUP_NOT_OPENED);
@@ -576,9 +748,9 @@ int tagsistant_querytree_parse_store (
 			/*
 			 * check if the tag token ends with a colon (:)
 			 * if so, this tag is a triple tag and requires special
-			 * parsing ":$"
+			 * parsing
 			 */
-			if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+			if (TAGSISTANT_TOKEN_NAMESPACE == token_class) {
 				and->namespace = g_strdup(__TOKEN);
 				qtree->namespace = g_strdup(__TOKEN);
 
@@ -843,7 +1015,7 @@ int tagsistant_querytree_parse_tags (
 	gchar ***token_ptr)
 {
 	if (__TOKEN) {
-		if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+		if (tagsistant_is_triple_tag(__TOKEN)) {
 			qtree->first_tag = qtree->second_tag = qtree->last_tag = NULL;
 
 			qtree->namespace = g_strdup(__TOKEN);
@@ -932,7 +1104,7 @@ int tagsistant_querytree_parse_relations (
 {
 	/* parse a relations query */
 	if (__TOKEN) {
-		if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+		if (tagsistant_is_triple_tag(__TOKEN)) {
 			/*
 			 *  the left tag is a triple tag
 			 */
@@ -942,14 +1114,14 @@ int tagsistant_querytree_parse_relations (
 				__SLIDE_TOKEN;
 
 				/* check if relation is allowed */
-				if (!g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, __TOKEN, G_REGEX_EXTENDED, 0)) return (0);
+				if (!IS_VALID_RELATION(__TOKEN)) return (0);
 
 				qtree->relation = g_strdup(__TOKEN);
 
 				if (__NEXT_TOKEN) {
 					__SLIDE_TOKEN;
 
-					if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+					if (tagsistant_is_triple_tag(__TOKEN)) {
 						/*
 						 *  the right (related) tag is a triple tag
 						 */
@@ -979,14 +1151,14 @@ int tagsistant_querytree_parse_relations (
 				__SLIDE_TOKEN;
 
 				/* check if relation is allowed */
-				if (!g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, __TOKEN, G_REGEX_EXTENDED, 0)) return (0);
+				if (!IS_VALID_RELATION(__TOKEN)) return (0);
 
 				qtree->relation = g_strdup(__TOKEN);
 
 				if (__NEXT_TOKEN) {
 					__SLIDE_TOKEN;
 
-					if (g_regex_match_simple(tagsistant.triple_tag_regex, __TOKEN, 0, 0)) {
+					if (tagsistant_is_triple_tag(__TOKEN)) {
 						/*
 						 *  the right (related) tag is a triple tag
 						 */
@@ -1094,11 +1266,18 @@ int tagsistant_querytree_parse_archive(
  */
 gchar *tagsistant_get_reversed_inode_tree(tagsistant_inode inode)
 {
-	gchar *reversed_inode = g_strreverse(g_strdup_printf("%u", inode % TAGSISTANT_ARCHIVE_DEPTH));
-	GRegex *rx = g_regex_new("(.)", 0, G_REGEX_MATCH_NOTEMPTY, NULL);
-	gchar *relative_path = g_regex_replace(rx, reversed_inode, -1, 0, "/\\1", 0, NULL);
-	g_regex_unref(rx);
-	g_free(reversed_inode);
+	gchar digits[16];
+	int length = g_snprintf(digits, sizeof(digits), "%u", inode % TAGSISTANT_ARCHIVE_DEPTH);
+
+	/* prefix each digit, from the last to the first, with a slash */
+	gchar *relative_path = g_malloc(length * 2 + 1);
+	int i;
+	for (i = 0; i < length; i++) {
+		relative_path[i * 2] = '/';
+		relative_path[i * 2 + 1] = digits[length - 1 - i];
+	}
+	relative_path[length * 2] = '\0';
+
 	return (relative_path);
 }
 
@@ -1178,38 +1357,258 @@ void tagsistant_querytree_set_inode(tagsistant_querytree *qtree, tagsistant_inod
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 
+/*
+ * The querytree cache is split in TAGSISTANT_QUERYTREE_CACHE_SHARDS
+ * shards, picked by the hash of the path, each one guarded by its own
+ * lock. Each shard keeps its entries in a LRU queue, most recently used
+ * first, and evicts from the tail when it goes over its share of the
+ * entry and memory budgets (--querytree-cache-entries and
+ * --querytree-cache-size).
+ */
+
 /**
- * tagsistant_querytree objects cache
+ * a cached querytree
  */
-GHashTable *tagsistant_querytree_cache = NULL;
-GRWLock tagsistant_querytree_cache_lock;
+typedef struct {
+	/** the cached querytree, never handed out (lookups return a duplicate) */
+	tagsistant_querytree *qtree;
+
+	/** the link in the LRU queue of the shard, with ->data pointing to this entry */
+	GList link;
+
+	/** the memory accounted to this entry */
+	gsize bytes;
+} tagsistant_querytree_cache_entry;
 
 /**
- * Counts one single element of the querytree hashtable
+ * a shard of the querytree cache
+ */
+typedef struct {
+	/** guards the shard; lookups move entries in the queue, so it's not a GRWLock */
+	GMutex lock;
+
+	/** the entries, by path */
+	GHashTable *table;
+
+	/** the entries, most recently used first */
+	GQueue lru;
+
+	/** the memory accounted to the entries */
+	gsize bytes;
+} tagsistant_querytree_cache_shard;
+
+/** the shards of the querytree cache */
+static tagsistant_querytree_cache_shard tagsistant_querytree_cache[TAGSISTANT_QUERYTREE_CACHE_SHARDS];
+
+/** lookups answered by the cache */
+static gint tagsistant_querytree_cache_hits = 0;
+
+/** lookups not answered by the cache, including stale entries */
+static gint tagsistant_querytree_cache_misses = 0;
+
+/** entries evicted to stay inside the budgets */
+static gint tagsistant_querytree_cache_evictions = 0;
+
+/**
+ * Return the shard holding a path
  *
- * @return
+ * @param path the query path
+ * @return the tagsistant_querytree_cache_shard
+ */
+static tagsistant_querytree_cache_shard *tagsistant_querytree_cache_shard_of(const gchar *path)
+{
+	return (&tagsistant_querytree_cache[g_str_hash(path) % TAGSISTANT_QUERYTREE_CACHE_SHARDS]);
+}
+
+/**
+ * Account the memory of a qtree_and_node branch
+ *
+ * @param node the branch
+ * @return the bytes used
+ */
+static gsize tagsistant_querytree_and_node_size(qtree_and_node *node)
+{
+	gsize bytes = 0;
+
+	while (node) {
+		bytes += sizeof(qtree_and_node)
+			+ (node->tag ? strlen(node->tag) + 1 : 0)
+			+ (node->namespace ? strlen(node->namespace) + 1 : 0)
+			+ (node->key ? strlen(node->key) + 1 : 0)
+			+ (node->value ? strlen(node->value) + 1 : 0)
+			+ tagsistant_querytree_and_node_size(node->related)
+			+ tagsistant_querytree_and_node_size(node->negated);
+		node = node->next;
+	}
+
+	return (bytes);
+}
+
+/** the bytes of a string, including the NUL, 0 if NULL */
+#define tagsistant_querytree_string_size(string) ((string) ? strlen(string) + 1 : 0)
+
+/**
+ * Account the memory of a querytree
+ *
+ * @param qtree the querytree
+ * @return the bytes used
+ */
+static gsize tagsistant_querytree_size(tagsistant_querytree *qtree)
+{
+	gsize bytes = sizeof(tagsistant_querytree_cache_entry) + sizeof(tagsistant_querytree)
+		+ tagsistant_querytree_string_size(qtree->full_path)
+		+ tagsistant_querytree_string_size(qtree->expanded_full_path)
+		+ tagsistant_querytree_string_size(qtree->object_path)
+		+ tagsistant_querytree_string_size(qtree->archive_path)
+		+ tagsistant_querytree_string_size(qtree->full_archive_path)
+		+ tagsistant_querytree_string_size(qtree->last_tag)
+		+ tagsistant_querytree_string_size(qtree->first_tag)
+		+ tagsistant_querytree_string_size(qtree->second_tag)
+		+ tagsistant_querytree_string_size(qtree->namespace)
+		+ tagsistant_querytree_string_size(qtree->key)
+		+ tagsistant_querytree_string_size(qtree->value)
+		+ tagsistant_querytree_string_size(qtree->related_namespace)
+		+ tagsistant_querytree_string_size(qtree->related_key)
+		+ tagsistant_querytree_string_size(qtree->related_value)
+		+ tagsistant_querytree_string_size(qtree->relation)
+		+ tagsistant_querytree_string_size(qtree->stats_path)
+		+ tagsistant_querytree_string_size(qtree->alias)
+		+ tagsistant_querytree_string_size(qtree->error_message);
+
+	qtree_or_node *or = qtree->tree;
+	while (or) {
+		bytes += sizeof(qtree_or_node) + tagsistant_querytree_and_node_size(or->and_set);
+		or = or->next;
+	}
+
+	return (bytes);
+}
+
+/**
+ * Destroy an entry of the querytree cache, called when it's removed
+ * from the table of its shard, which must be locked
+ *
+ * @param data the tagsistant_querytree_cache_entry
+ */
+static void tagsistant_querytree_cache_entry_free(gpointer data)
+{
+	tagsistant_querytree_cache_entry *entry = (tagsistant_querytree_cache_entry *) data;
+	tagsistant_querytree_cache_shard *shard = tagsistant_querytree_cache_shard_of(entry->qtree->full_path);
+
+	g_queue_unlink(&shard->lru, &entry->link);
+	shard->bytes -= entry->bytes;
+
+	tagsistant_querytree_cache_destroy_element(entry->qtree);
+	g_free(entry);
+}
+
+/**
+ * Initialize the shards of the querytree cache
+ */
+static void tagsistant_querytree_cache_init()
+{
+	int i;
+	for (i = 0; i < TAGSISTANT_QUERYTREE_CACHE_SHARDS; i++) {
+		g_mutex_init(&tagsistant_querytree_cache[i].lock);
+		g_queue_init(&tagsistant_querytree_cache[i].lru);
+		tagsistant_querytree_cache[i].bytes = 0;
+
+		/* keys point to the full_path of the cached querytree */
+		tagsistant_querytree_cache[i].table = g_hash_table_new_full(
+			g_str_hash,
+			g_str_equal,
+			NULL,
+			tagsistant_querytree_cache_entry_free);
+	}
+}
+
+/**
+ * Save a querytree in the cache, evicting the least recently used
+ * entries of its shard if the budgets are exceeded
+ *
+ * @param qtree the querytree, owned by the cache from now on
  */
-void tagsistant_querytree_cache_counter(gpointer key, gpointer value, gpointer user_data)
+static void tagsistant_querytree_cache_insert(tagsistant_querytree *qtree)
 {
-	(void) key;
-	(void) value;
+	tagsistant_querytree_cache_shard *shard = tagsistant_querytree_cache_shard_of(qtree->full_path);
+
+	guint max_entries = MAX(1, tagsistant.querytree_cache_entries / TAGSISTANT_QUERYTREE_CACHE_SHARDS);
+	gsize max_bytes = MAX(1, (gsize) tagsistant.querytree_cache_size * 1024 * 1024 / TAGSISTANT_QUERYTREE_CACHE_SHARDS);
+
+	tagsistant_querytree_cache_entry *entry = g_new0(tagsistant_querytree_cache_entry, 1);
+	entry->qtree = qtree;
+	entry->link.data = entry;
+	entry->bytes = tagsistant_querytree_size(qtree);
+
+	g_mutex_lock(&shard->lock);
+
+	/* replace the entry of the same path, if any */
+	g_hash_table_remove(shard->table, qtree->full_path);
+
+	g_hash_table_insert(shard->table, qtree->full_path, entry);
+	g_queue_push_head_link(&shard->lru, &entry->link);
+	shard->bytes += entry->bytes;
 
- 	int *elements = (int *) user_data;
-	*elements = *elements + 1;
+	/* evict from the tail, but never the entry just added */
+	while ((shard->lru.length > max_entries || shard->bytes > max_bytes) && shard->lru.tail != &entry->link) {
+		tagsistant_querytree_cache_entry *victim = (tagsistant_querytree_cache_entry *) shard->lru.tail->data;
+		g_hash_table_remove(shard->table, victim->qtree->full_path);
+		g_atomic_int_inc(&tagsistant_querytree_cache_evictions);
+	}
+
+	g_mutex_unlock(&shard->lock);
 }
 
 /**
  * Count the elements contained in the querytree cache
  *
- * @param qtree
+ * @return the number of cached querytrees
  */
 int tagsistant_querytree_cache_total()
 {
 	int elements = 0;
-	g_hash_table_foreach(tagsistant_querytree_cache, tagsistant_querytree_cache_counter, &elements);
+	int i;
+
+	for (i = 0; i < TAGSISTANT_QUERYTREE_CACHE_SHARDS; i++) {
+		g_mutex_lock(&tagsistant_querytree_cache[i].lock);
+		elements += g_hash_table_size(tagsistant_querytree_cache[i].table);
+		g_mutex_unlock(&tagsistant_querytree_cache[i].lock);
+	}
+
 	return (elements);
 }
 
+/**
+ * Report the querytree cache in /stats/cached_queries
+ *
+ * @param stats_buffer the buffer to be filled
+ */
+void tagsistant_querytree_cache_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
+{
+	int elements = 0;
+	gsize bytes = 0;
+	int i;
+
+	for (i = 0; i < TAGSISTANT_QUERYTREE_CACHE_SHARDS; i++) {
+		g_mutex_lock(&tagsistant_querytree_cache[i].lock);
+		elements += g_hash_table_size(tagsistant_querytree_cache[i].table);
+		bytes += tagsistant_querytree_cache[i].bytes;
+		g_mutex_unlock(&tagsistant_querytree_cache[i].lock);
+	}
+
+	snprintf(stats_buffer, TAGSISTANT_STATS_BUFFER,
+		"# of cached queries: %d (max %d)\n"
+		"# of bytes used by cached queries: %lu (max %lu)\n"
+		"# of cache hits: %d\n"
+		"# of cache misses: %d\n"
+		"# of cache evictions: %d\n",
+		elements, tagsistant.querytree_cache_entries,
+		(unsigned long) bytes, (unsigned long) tagsistant.querytree_cache_size * 1024 * 1024,
+		g_atomic_int_get(&tagsistant_querytree_cache_hits),
+		g_atomic_int_get(&tagsistant_querytree_cache_misses),
+		g_atomic_int_get(&tagsistant_querytree_cache_evictions));
+}
+
 /**
  * Duplicate a qtree_and_node branch
  *
@@ -1334,42 +1733,49 @@ tagsistant_querytree *tagsistant_querytree_duplicate(tagsistant_querytree *qtree
  */
 tagsistant_querytree *tagsistant_querytree_lookup(const char *path)
 {
+	tagsistant_querytree_cache_shard *shard = tagsistant_querytree_cache_shard_of(path);
+
 	/*
-	 * lookup the querytree
+	 * lookup the querytree and duplicate it while the shard is locked,
+	 * since it could be evicted by another thread right after
 	 */
 	tagsistant_querytree *qtree = NULL;
-	g_rw_lock_reader_lock(&tagsistant_querytree_cache_lock);
-	qtree = g_hash_table_lookup (tagsistant_querytree_cache, path);
-	g_rw_lock_reader_unlock(&tagsistant_querytree_cache_lock);
+	g_mutex_lock(&shard->lock);
+	tagsistant_querytree_cache_entry *entry = g_hash_table_lookup(shard->table, path);
+	if (entry) {
+		/* move the entry on top of the LRU queue */
+		g_queue_unlink(&shard->lru, &entry->link);
+		g_queue_push_head_link(&shard->lru, &entry->link);
+
+		entry->qtree->last_access_microsecond = g_get_real_time();
+		qtree = tagsistant_querytree_duplicate(entry->qtree);
+	}
+	g_mutex_unlock(&shard->lock);
 
 	/*
 	 * not found, return and proceed to normal creation
 	 */
-	if (!qtree) return (NULL);
+	if (!qtree) {
+		g_atomic_int_inc(&tagsistant_querytree_cache_misses);
+		return (NULL);
+	}
 
 	/*
 	 * the querytree is no longer valid, so we destroy it and return NULL
 	 */
 	struct stat st;
 	if (qtree->full_archive_path && (0 != stat(qtree->full_archive_path, &st))) {
-		g_rw_lock_reader_lock(&tagsistant_querytree_cache_lock);
-		g_hash_table_remove(tagsistant_querytree_cache, path);
-		g_rw_lock_reader_unlock(&tagsistant_querytree_cache_lock);
+		g_mutex_lock(&shard->lock);
+		g_hash_table_remove(shard->table, path);
+		g_mutex_unlock(&shard->lock);
 
+		tagsistant_querytree_destroy(qtree, 0);
+		g_atomic_int_inc(&tagsistant_querytree_cache_misses);
 		return (NULL);
 	}
 
-	/*
-	 * set the last_access_microsecond time
-	 * will be used in future code to decide if a cached entry
-	 * could be removed for memory management
-	 */
-	qtree->last_access_microsecond = g_get_real_time();
-
-	/*
-	 * return a duplicate of the qtree
-	 */
-	return (tagsistant_querytree_duplicate(qtree));
+	g_atomic_int_inc(&tagsistant_querytree_cache_hits);
+	return (qtree);
 }
 
 /**
@@ -1416,42 +1822,29 @@ gboolean tagsistant_invalidate_querytree_entry(gpointer key_p, gpointer entry_p,
  */
 void tagsistant_invalidate_querytree_cache(tagsistant_querytree *qtree)
 {
-	g_rw_lock_writer_lock(&tagsistant_querytree_cache_lock);
-	g_hash_table_foreach_remove(tagsistant_querytree_cache, tagsistant_invalidate_querytree_entry, qtree);
-	g_rw_lock_writer_unlock(&tagsistant_querytree_cache_lock);
+	int i;
+	for (i = 0; i < TAGSISTANT_QUERYTREE_CACHE_SHARDS; i++) {
+		g_mutex_lock(&tagsistant_querytree_cache[i].lock);
+		g_hash_table_foreach_remove(tagsistant_querytree_cache[i].table, tagsistant_invalidate_querytree_entry, qtree);
+		g_mutex_unlock(&tagsistant_querytree_cache[i].lock);
+	}
 }
 
-#endif // TAGSISTANT_ENABLE_QUERYTREE_CACHE
-
 /**
- * Alias replacement callback
+ * Empty the querytree cache. Used by tagsistant_parse_benchmark().
  */
-gboolean  tagsistant_expand_path_callback(
-	const GMatchInfo *match_info,
-    GString *result,
-    gpointer user_data)
+static void tagsistant_querytree_cache_clear()
 {
-	tagsistant_querytree *qtree = (tagsistant_querytree *) user_data;
-
-	// fetch the pattern
-	gchar *pattern = g_match_info_fetch(match_info, 0);
-
-	// the alias is the patter excluded the identifier (thus the + 1)
-	gchar *alias = pattern + 1;
-
-	// load the expansion from the DB
-	gchar *alias_expansion = tagsistant_sql_alias_get(qtree->dbi, alias);
-
-	// replace the alias
-	g_string_append(result, alias_expansion);
-
-	// free allocated memory
-	g_free(alias_expansion);
-	g_free(pattern);
-
-	return FALSE;
+	int i;
+	for (i = 0; i < TAGSISTANT_QUERYTREE_CACHE_SHARDS; i++) {
+		g_mutex_lock(&tagsistant_querytree_cache[i].lock);
+		g_hash_table_remove_all(tagsistant_querytree_cache[i].table);
+		g_mutex_unlock(&tagsistant_querytree_cache[i].lock);
+	}
 }
 
+#endif // TAGSISTANT_ENABLE_QUERYTREE_CACHE
+
 /**
  * expand a path, resolving the aliases
  *
@@ -1460,48 +1853,41 @@ gboolean  tagsistant_expand_path_callback(
  */
 gchar *tagsistant_expand_path(tagsistant_querytree *qtree)
 {
+	// without aliases and duplicated slashes there's nothing to expand
+	if (!strstr(qtree->full_path, TAGSISTANT_ALIAS_IDENTIFIER) && !strstr(qtree->full_path, "//"))
+		return (g_strdup(qtree->full_path));
+
 	// duplicate the path to work on it
 	gchar *expanded_path = g_strdup(qtree->full_path);
 
-	// declare a regular expression to detect the aliases
-	GRegex *rx = g_regex_new(TAGSISTANT_ALIAS_IDENTIFIER "([^/]+)", 0, 0, NULL);
-
-	// apply the regular expression
+	// apply the regular expression detecting the aliases
 	GMatchInfo *match_info;
-	while (g_regex_match(rx, expanded_path, 0, &match_info)) {
+	while (g_regex_match(tagsistant_regex_registry[TAGSISTANT_RX_ALIAS], expanded_path, 0, &match_info)) {
 		// get the alias found in the path
 		gchar *pattern = g_match_info_fetch(match_info, 0);
+		g_match_info_free(match_info);
 
-		// build the GRegex of the alias
-		GRegex *replace_rx = g_regex_new(pattern, 0, 0, NULL);
+		// load the expansion from the DB, the alias is the pattern without the identifier
+		gchar *alias_expansion = tagsistant_sql_alias_get(qtree->dbi, pattern + 1);
 
-		// expand the alias
-		gchar *replaced = g_regex_replace_eval(
-			replace_rx,
-			expanded_path,
-			-1, 0, 0,
-			tagsistant_expand_path_callback,
-			qtree,
-			NULL);
+		// expand every occurrence of the alias
+		gchar **chunks = g_strsplit(expanded_path, pattern, -1);
+		gchar *replaced = g_strjoinv(alias_expansion ? alias_expansion : "", chunks);
 
 		// update the expanded path
 		g_free(expanded_path);
 		expanded_path = replaced;
 
 		// free allocated memory
+		g_strfreev(chunks);
+		g_free(alias_expansion);
 		g_free(pattern);
-		g_regex_unref(replace_rx);
 	}
-
-	// free allocated memory
 	g_match_info_free(match_info);
-	g_regex_unref(rx);
 
 	// remove duplicated slashes
-	GRegex *slash_compressor = g_regex_new("/+", 0, 0, NULL);
-	gchar *simplified_path = g_regex_replace_literal(slash_compressor, expanded_path, -1, 0, "/", 0, NULL);
+	gchar *simplified_path = tagsistant_compress_slashes(expanded_path);
 	g_free(expanded_path);
-	g_regex_unref(slash_compressor);
 
 	// return the simplified path
 	return (simplified_path);
@@ -1548,6 +1934,12 @@ tagsistant_querytree *tagsistant_querytree_new(
 
 		return (qtree);
 	}
+
+	/*
+	 * readers run concurrently with writers, so record the write
+	 * generation to know later if the database changed while parsing
+	 */
+	gint write_generation = tagsistant_db_write_generation();
 #endif
 
 	/*
@@ -1594,7 +1986,7 @@ tagsistant_querytree *tagsistant_querytree_new(
 	/*
 	 * expand the path, resolving aliases
 	 */
-	if (g_regex_match_simple("/(" TAGSISTANT_QUERY_DELIMITER "|" TAGSISTANT_QUERY_DELIMITER_NO_REASONING ")", qtree->full_path, 0, 0)) {
+	if (strstr(qtree->full_path, "/" TAGSISTANT_QUERY_DELIMITER)) {
 		qtree->expanded_full_path = tagsistant_expand_path(qtree);
 	} else {
 		qtree->expanded_full_path = g_strdup(qtree->full_path);
@@ -1605,7 +1997,8 @@ tagsistant_querytree *tagsistant_querytree_new(
 	/*
 	 * split the path
 	 */
-	gchar **splitted = g_strsplit(qtree->expanded_full_path, "/", 512); /* split up to 512 tokens */
+	tagsistant_path_arena *arena = tagsistant_path_arena_acquire();
+	gchar **splitted = tagsistant_path_tokenize(arena, qtree->expanded_full_path);
 	gchar __TOKEN = splitted + 1; /* first element is always "" since path begins with '/' */
 
 	/* guess the type of the query by first token */
@@ -1671,7 +2064,7 @@ tagsistant_querytree *tagsistant_querytree_new(
 	}
 
 RETURN:
-	g_strfreev(splitted);
+	tagsistant_path_arena_release(arena);
 
 	if (QTREE_IS_MALFORMED(qtree) && !qtree->error_message) {
 		qtree->error_message = g_strdup(TAGSISTANT_ERROR_MALFORMED_QUERY);
@@ -1679,15 +2072,15 @@ RETURN:
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 	/*
-	 * cache the querytree object
+	 * cache the querytree object, unless a write transaction was open
+	 * or has been released meanwhile, since it could have been parsed
+	 * on stale or uncommitted data
 	 */
-	if ((!qtree->points_to_object) || qtree->inode) {
+	if (((!qtree->points_to_object) || qtree->inode) && tagsistant_db_write_generation_unchanged(write_generation)) {
 		/* save the querytree in the cache */
 		tagsistant_querytree *duplicated = tagsistant_querytree_duplicate(qtree);
 
-		g_rw_lock_writer_lock(&tagsistant_querytree_cache_lock);
-		g_hash_table_insert(tagsistant_querytree_cache, duplicated->full_path, duplicated);
-		g_rw_lock_writer_unlock(&tagsistant_querytree_cache_lock);
+		tagsistant_querytree_cache_insert(duplicated);
 	}
 #endif
 
@@ -1809,6 +2202,41 @@ extern void tagsistant_querytree_traverse(
     return;
 }
 
+/**
+ * Tag an object with all the tags of a querytree, using one
+ * tagsistant_sql_tag_object_batch() call instead of one
+ * tagsistant_sql_tag_object() call per tag
+ *
+ * @param qtree the querytree holding the tags
+ * @param inode the object inode
+ */
+void tagsistant_querytree_tag_object(tagsistant_querytree *qtree, tagsistant_inode inode)
+{
+	if (!qtree) return;
+
+	tagsistant_tag_batch *batch = tagsistant_tag_batch_new();
+
+	/* the callers update the RDS with tagsistant_delete_rds_involved() */
+	batch->rds_maintained = TRUE;
+
+	qtree_or_node *ptx = qtree->tree;
+	while (NULL != ptx) {
+		qtree_and_node *andptx = ptx->and_set;
+		while (NULL != andptx) {
+			if (andptx->tag) {
+				tagsistant_tag_batch_add(batch, andptx->tag, NULL, NULL);
+			} else {
+				tagsistant_tag_batch_add(batch, andptx->namespace, andptx->key, andptx->value);
+			}
+			andptx = andptx->next;
+		}
+		ptx = ptx->next;
+	}
+
+	tagsistant_sql_tag_object_batch(qtree->dbi, batch, inode);
+	tagsistant_tag_batch_free(batch);
+}
+
 /**
  * Initialize path_resolution.c module
  */
@@ -1826,11 +2254,7 @@ void tagsistant_path_resolution_init()
 
 #if TAGSISTANT_ENABLE_QUERYTREE_CACHE
 	/* initialize the tagsistant_querytree object cache */
-	tagsistant_querytree_cache = g_hash_table_new_full(
-		g_str_hash,
-		g_str_equal,
-		NULL,
-		(GDestroyNotify) tagsistant_querytree_cache_destroy_element);
+	tagsistant_querytree_cache_init();
 #endif // TAGSISTANT_ENABLE_QUERYTREE_CACHE
 
 #if TAGSISTANT_ENABLE_AND_SET_CACHE
@@ -1838,6 +2262,119 @@ void tagsistant_path_resolution_init()
 #endif
 
 	/* compile regular expressions */
-	tagsistant_inode_extract_from_path_regex_1 = g_regex_new("^([0-9]+)" TAGSISTANT_INODE_DELIMITER, 0, 0, NULL);
-	tagsistant_inode_extract_from_path_regex_2 = g_regex_new("/([0-9]+)" TAGSISTANT_INODE_DELIMITER, 0, 0, NULL);
+	tagsistant_inode_extract_from_path_regex_1 = tagsistant_regex_compile("^([0-9]+)" TAGSISTANT_INODE_DELIMITER, G_REGEX_OPTIMIZE);
+	tagsistant_inode_extract_from_path_regex_2 = tagsistant_regex_compile("/([0-9]+)" TAGSISTANT_INODE_DELIMITER, G_REGEX_OPTIMIZE);
+}
+
+/**
+ * Time a parsing phase over a corpus of paths and print its throughput
+ *
+ * @param name the phase name
+ * @param paths the number of paths parsed
+ * @param elapsed the microseconds taken
+ */
+static void tagsistant_parse_benchmark_report(const gchar *name, guint paths, gint64 elapsed)
+{
+	fprintf(stderr, " %-24s %10u paths in %8.3f s, %12.0f paths/s, %8.0f ns/path\n",
+		name, paths, elapsed / 1000000.0,
+		elapsed ? paths * 1000000.0 / elapsed : 0.0,
+		paths ? elapsed * 1000.0 / paths : 0.0);
+}
+
+/**
+ * Measure the parse throughput over a corpus of paths, one per line,
+ * without mounting. Three phases are timed:
+ *
+ *  - the tokenizer: tagsistant_path_tokenize() and tagsistant_classify_token(),
+ *    the single pass done before touching the database;
+ *  - the same split done as before the tokenizer, with g_strsplit()
+ *    and a triple tag regex matched on every token, for comparison;
+ *  - tagsistant_querytree_new() on an empty querytree cache, i.e. the
+ *    whole parse including the tag lookups.
+ *
+ * Run by --benchmark-parser once the database has been opened.
+ *
+ * @param corpus the file holding the paths
+ * @return 0 on success, 1 if the corpus can't be read
+ */
+int tagsistant_parse_benchmark(const gchar *corpus)
+{
+	gchar *contents = NULL;
+	GError *error = NULL;
+
+	if (!g_file_get_contents(corpus, &contents, NULL, &error)) {
+		fprintf(stderr, "\n *** Can't read %s: %s ***\n", corpus, error->message);
+		g_error_free(error);
+		return (1);
+	}
+
+	/* keep the absolute paths only */
+	GPtrArray *paths = g_ptr_array_new();
+	gchar **lines = g_strsplit(contents, "\n", 0);
+	gchar **line;
+	for (line = lines; *line; line++)
+		if ('/' == **line) g_ptr_array_add(paths, *line);
+
+	fprintf(stderr, " Parsing %u paths from %s, %d rounds\n\n", paths->len, corpus, TAGSISTANT_PARSE_BENCHMARK_ROUNDS);
+
+	guint parsed = paths->len * TAGSISTANT_PARSE_BENCHMARK_ROUNDS;
+	guint namespaces = 0;
+	guint round, i;
+
+	/* the tokenizer */
+	gint64 start = g_get_monotonic_time();
+	for (round = 0; round < TAGSISTANT_PARSE_BENCHMARK_ROUNDS; round++) {
+		for (i = 0; i < paths->len; i++) {
+			tagsistant_path_arena *arena = tagsistant_path_arena_acquire();
+			gchar **token = tagsistant_path_tokenize(arena, g_ptr_array_index(paths, i));
+			for (; *token; token++)
+				if (TAGSISTANT_TOKEN_NAMESPACE == tagsistant_classify_token(*token)) namespaces++;
+			tagsistant_path_arena_release(arena);
+		}
+	}
+	tagsistant_parse_benchmark_report("tokenizer", parsed, g_get_monotonic_time() - start);
+
+	/* g_strsplit() and a regex per token */
+	gchar *escaped_suffix = g_regex_escape_string(tagsistant.triple_tag_suffix, -1);
+	gchar *triple_tag_regex = g_strdup_printf("%s$", escaped_suffix);
+	guint regex_namespaces = 0;
+
+	start = g_get_monotonic_time();
+	for (round = 0; round < TAGSISTANT_PARSE_BENCHMARK_ROUNDS; round++) {
+		for (i = 0; i < paths->len; i++) {
+			gchar **splitted = g_strsplit(g_ptr_array_index(paths, i), "/", 512);
+			gchar **token;
+			for (token = splitted; *token; token++)
+				if (g_regex_match_simple(triple_tag_regex, *token, 0, 0)) regex_namespaces++;
+			g_strfreev(splitted);
+		}
+	}
+	tagsistant_parse_benchmark_report("g_strsplit() and regex", parsed, g_get_monotonic_time() - start);
+
+	if (namespaces != regex_namespaces)
+		fprintf(stderr, " *** the tokenizer found %u namespaces, the regex %u ***\n", namespaces, regex_namespaces);
+
+	g_free(triple_tag_regex);
+	g_free(escaped_suffix);
+
+	/* the whole querytree, parsed from scratch every time */
+	gint64 elapsed = 0;
+	for (round = 0; round < TAGSISTANT_PARSE_BENCHMARK_ROUNDS; round++) {
+		for (i = 0; i < paths->len; i++) {
+#if TAGSISTANT_ENABLE_QUERYTREE_CACHE
+			tagsistant_querytree_cache_clear();
+#endif
+			start = g_get_monotonic_time();
+			tagsistant_querytree *qtree = tagsistant_querytree_new(g_ptr_array_index(paths, i), 0, 0, 1, 0);
+			tagsistant_querytree_destroy(qtree, TAGSISTANT_ROLLBACK_TRANSACTION);
+			elapsed += g_get_monotonic_time() - start;
+		}
+	}
+	tagsistant_parse_benchmark_report("tagsistant_querytree_new()", parsed, elapsed);
+
+	g_ptr_array_free(paths, TRUE);
+	g_strfreev(lines);
+	g_free(contents);
+
+	return (0);
 }
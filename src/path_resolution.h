@@ -48,7 +48,7 @@ enum {
 /**
  * guess if a relation is admitted or not
  */
-#define IS_VALID_RELATION(relation) g_regex_match_simple(TAGSISTANT_RELATION_PATTERN, relation, G_REGEX_EXTENDED, 0)
+#define IS_VALID_RELATION(relation) tagsistant_regex_match(TAGSISTANT_RX_RELATION, relation)
 
 /**
  * defines a token in a query path
@@ -301,17 +301,6 @@ typedef struct querytree {
 
 } tagsistant_querytree;
 
-/**
- * used in linked list of returned results
- *
- * Alessandro AkiRoss Re reported a conflict with the structure
- * file_handle in /usr/include/bits/fcntl.h on Fedora 15
- */
-typedef struct {
-	char name[1024];			/** object filename */
-	tagsistant_inode inode;		/** object inode */
-} tagsistant_file_handle;
-
 /**
  * reasoning structure to trace reasoning process
  */
@@ -382,6 +371,14 @@ extern void tagsistant_querytree_traverse(
 	tagsistant_querytree_traverser funcpointer,
 	tagsistant_inode opt_inode);
 
+/**
+ * tag an object with all the tags of a querytree in one pass
+ *
+ * @param qtree the querytree holding the tags
+ * @param inode the object inode
+ */
+extern void tagsistant_querytree_tag_object(tagsistant_querytree *qtree, tagsistant_inode inode);
+
 // querytree functions
 extern void						tagsistant_path_resolution_init();
 extern void						tagsistant_reasoner_init();
@@ -396,6 +393,8 @@ extern int						tagsistant_querytree_check_tagging_consistency(tagsistant_queryt
 
 extern int						tagsistant_querytree_deduplicate(tagsistant_querytree *qtree);
 extern int						tagsistant_querytree_cache_total();
+extern void						tagsistant_querytree_cache_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+extern int						tagsistant_parse_benchmark(const gchar *corpus);
 
 // caching functions
 extern void						tagsistant_invalidate_querytree_cache(tagsistant_querytree *qtree);
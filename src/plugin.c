@@ -337,14 +337,14 @@ STOP_CHAIN_TAGGING:
  * @param regex the GRegex regular expression
  * @param keyword a string with the keyword name
  * @param value a string with the keyword value
- * @param qtree the tagsistant_querytree object that could be tagged
+ * @param batch the tagsistant_tag_batch collecting the tags of the object
  */
 void tagsistant_keyword_matcher(
 	GRegex *regex,
 	const gchar *namespace,
 	const gchar *keyword,
 	const gchar *value,
-	const tagsistant_querytree *qtree)
+	tagsistant_tag_batch *batch)
 {
 	/*
 	 * if the keyword name matches the filter regular expression
@@ -373,9 +373,9 @@ void tagsistant_keyword_matcher(
 #endif
 
 		/*
-		 * then tag the file
+		 * then queue the tag
 		 */
-		tagsistant_sql_tag_object(qtree->dbi, namespace, clean_keyword, clean_value, qtree->inode);
+		tagsistant_tag_batch_add(batch, namespace, clean_keyword, clean_value);
 
 		/*
 		 * and cleanup
@@ -402,17 +402,23 @@ void tagsistant_plugin_iterator(
 	tagsistant_keyword keywords[TAGSISTANT_MAX_KEYWORDS],
 	GRegex *regex)
 {
+	tagsistant_tag_batch *batch = tagsistant_tag_batch_new();
+
 	/*
-	 * loop through the keywords to tag the file
+	 * loop through the keywords to collect the tags
 	 */
 	int c = 0;
 	for (; c < TAGSISTANT_MAX_KEYWORDS; c++) {
 		/* stop looping on the first null keyword */
 		if ('\0' == *(keywords[c].keyword)) break;
 
-		/* tag the qtree with the keyword if the regular expression matches */
-		tagsistant_keyword_matcher(regex, namespace, keywords[c].keyword, keywords[c].value, qtree);
+		/* queue the keyword as a tag if the regular expression matches */
+		tagsistant_keyword_matcher(regex, namespace, keywords[c].keyword, keywords[c].value, batch);
 	}
+
+	/* then tag the file in one pass */
+	tagsistant_sql_tag_object_batch(qtree->dbi, batch, qtree->inode);
+	tagsistant_tag_batch_free(batch);
 }
 
 /**
@@ -446,12 +452,18 @@ void tagsistant_plugin_tag_by_date(const tagsistant_querytree *qtree, const gcha
 	GError *error = NULL;
 
 	if (g_regex_match_full(tagsistant_rx_date, date, -1, 0, 0, &match_info, &error)) {
-		tagsistant_sql_tag_object(qtree->dbi, "time:", "year",   g_match_info_fetch(match_info, 1), qtree->inode);
-		tagsistant_sql_tag_object(qtree->dbi, "time:", "month",  g_match_info_fetch(match_info, 2), qtree->inode);
-		tagsistant_sql_tag_object(qtree->dbi, "time:", "day",    g_match_info_fetch(match_info, 3), qtree->inode);
-		tagsistant_sql_tag_object(qtree->dbi, "time:", "hour",   g_match_info_fetch(match_info, 4), qtree->inode);
-		tagsistant_sql_tag_object(qtree->dbi, "time:", "minute", g_match_info_fetch(match_info, 5), qtree->inode);
-//		tagsistant_sql_tag_object(qtree->dbi, "time:", "second", g_match_info_fetch(match_info, 6), qtree->inode);
+		static const gchar *date_keys[] = { "year", "month", "day", "hour", "minute", /* "second", */ NULL };
+		tagsistant_tag_batch *batch = tagsistant_tag_batch_new();
+
+		int c = 0;
+		for (; date_keys[c]; c++) {
+			gchar *value = g_match_info_fetch(match_info, c + 1);
+			tagsistant_tag_batch_add(batch, "time:", date_keys[c], value);
+			g_free(value);
+		}
+
+		tagsistant_sql_tag_object_batch(qtree->dbi, batch, qtree->inode);
+		tagsistant_tag_batch_free(batch);
 	}
 
 	g_match_info_unref(match_info);
@@ -477,11 +489,11 @@ void tagsistant_plugin_loader()
 	/*
 	 * init some useful regex
 	 */
-	tagsistant_rx_date = g_regex_new(
+	tagsistant_rx_date = tagsistant_regex_compile(
 		"^([0-9][0-9][0-9][0-9]):([0-9][0-9]):([0-9][0-9]) ([0-9][0-9]):([0-9][0-9]):([0-9][0-9])$",
-		0, 0, NULL);
+		0);
 
-	tagsistant_rx_cleaner = g_regex_new("[/ ]", 0, 0, NULL);
+	tagsistant_rx_cleaner = tagsistant_regex_compile("[/ ]", 0);
 
 	/*
 	 * get the plugin dir from the environment variable
@@ -657,6 +669,7 @@ void tagsistant_plugin_apply_regex(const tagsistant_querytree *qtree, const char
 	if (NULL != m) g_mutex_unlock(m);
 
 	/* process the matched entries */
+	tagsistant_tag_batch *batch = tagsistant_tag_batch_new();
 	while (g_match_info_matches(match_info)) {
 		gchar *raw = g_match_info_fetch(match_info, 1);
 		dbg('p', LOG_INFO, "Found raw data: %s", raw);
@@ -666,12 +679,16 @@ void tagsistant_plugin_apply_regex(const tagsistant_querytree *qtree, const char
 
 		int x = 0;
 		while (tokens[x]) {
-			if (strlen(tokens[x]) >= 3) tagsistant_sql_tag_object(qtree->dbi, tokens[x], NULL, NULL, qtree->inode);
+			if (strlen(tokens[x]) >= 3) tagsistant_tag_batch_add(batch, tokens[x], NULL, NULL);
 			x++;
 		}
 
 		g_strfreev(tokens);
 		g_match_info_next(match_info, NULL);
 	}
+
+	/* tag the object with all the tokens in one pass */
+	tagsistant_sql_tag_object_batch(qtree->dbi, batch, qtree->inode);
+	tagsistant_tag_batch_free(batch);
 }
 
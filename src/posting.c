@@ -0,0 +1,1221 @@
+/*
+   Tagsistant (tagfs) -- posting.c
+   Copyright (C) 2006-2014 Tx0 <tx0@strumentiresistenti.org>
+
+   In-memory posting lists: the sorted set of the inodes tagged by
+   each tag, used to resolve store/ queries without SQL.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/*
+ * Posting lists are compressed like roaring bitmaps: the inodes are
+ * split by their 16 high bits, and the low 16 bits of each group go in a
+ * container which is a sorted array of guint16 while the group is
+ * sparse, or a 65536 bit bitmap when it's dense. Set operations work
+ * container by container: bitmaps are combined a 64 bit word at a time
+ * in plain loops the compiler can vectorize, sorted arrays are merged,
+ * or galloped through when one is much smaller than the other.
+ *
+ * The lists are loaded from the tagging table at mount time by a
+ * background thread and kept in sync by the functions changing the
+ * tagging table, which record their changes in a per-thread log. The
+ * log is applied when the transaction is committed and thrown away on
+ * rollback. Changes committed while the lists are still loading are
+ * replayed, in order, on top of the loaded lists: since each change is
+ * idempotent, this gives the right result whenever the load has read
+ * the table.
+ *
+ * Until the lists are loaded, tagsistant_posting_evaluate() returns NULL
+ * and the query is resolved in SQL as before.
+ */
+
+/** the largest array container; larger containers are bitmaps */
+#define TAGSISTANT_POSTING_ARRAY_MAX 4096
+
+/** the words of a bitmap container */
+#define TAGSISTANT_POSTING_BITMAP_WORDS 1024
+
+/** an array container smaller than this many times another is galloped through */
+#define TAGSISTANT_POSTING_GALLOP_RATIO 32
+
+/** the inodes inserted into the rds table by one statement */
+#define TAGSISTANT_POSTING_RDS_CHUNK 512
+
+/** a container: the low 16 bits of the inodes sharing the high 16 bits */
+typedef struct {
+	/** number of inodes in the container */
+	guint32 cardinality;
+
+	/** the slots allocated in ->array */
+	guint32 capacity;
+
+	/** the sorted low bits, NULL if the container is a bitmap */
+	guint16 *array;
+
+	/** the bitmap of the low bits, NULL if the container is an array */
+	guint64 *bitmap;
+} tagsistant_posting_container;
+
+/** a posting list */
+typedef struct {
+	/** number of containers */
+	guint32 size;
+
+	/** number of inodes in the list */
+	guint32 cardinality;
+
+	/** the slots allocated in ->keys and ->containers */
+	guint32 capacity;
+
+	/** the sorted high bits of each container */
+	guint16 *keys;
+
+	/** the containers */
+	tagsistant_posting_container **containers;
+} tagsistant_posting_list;
+
+#define tagsistant_posting_popcount(word) __builtin_popcountll(word)
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Containers                                                                 ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+static tagsistant_posting_container *tagsistant_posting_container_new_array(guint32 capacity)
+{
+	tagsistant_posting_container *c = g_new0(tagsistant_posting_container, 1);
+	c->capacity = capacity ? capacity : 4;
+	c->array = g_new(guint16, c->capacity);
+	return (c);
+}
+
+static tagsistant_posting_container *tagsistant_posting_container_new_bitmap()
+{
+	tagsistant_posting_container *c = g_new0(tagsistant_posting_container, 1);
+	c->bitmap = g_new0(guint64, TAGSISTANT_POSTING_BITMAP_WORDS);
+	return (c);
+}
+
+static void tagsistant_posting_container_free(tagsistant_posting_container *c)
+{
+	if (!c) return;
+	g_free(c->array);
+	g_free(c->bitmap);
+	g_free(c);
+}
+
+static tagsistant_posting_container *tagsistant_posting_container_copy(const tagsistant_posting_container *c)
+{
+	tagsistant_posting_container *copy = g_new0(tagsistant_posting_container, 1);
+	copy->cardinality = c->cardinality;
+
+	if (c->bitmap) {
+		copy->bitmap = g_memdup(c->bitmap, TAGSISTANT_POSTING_BITMAP_WORDS * sizeof(guint64));
+	} else {
+		copy->capacity = c->cardinality ? c->cardinality : 4;
+		copy->array = g_new(guint16, copy->capacity);
+		memcpy(copy->array, c->array, c->cardinality * sizeof(guint16));
+	}
+
+	return (copy);
+}
+
+/**
+ * Return the position of the first element of a sorted array not lower than value
+ */
+static guint32 tagsistant_posting_lower_bound(const guint16 *array, guint32 from, guint32 to, guint16 value)
+{
+	while (from < to) {
+		guint32 middle = from + (to - from) / 2;
+		if (array[middle] < value) from = middle + 1; else to = middle;
+	}
+	return (from);
+}
+
+/**
+ * Turn an array container into a bitmap
+ */
+static void tagsistant_posting_container_to_bitmap(tagsistant_posting_container *c)
+{
+	guint64 *bitmap = g_new0(guint64, TAGSISTANT_POSTING_BITMAP_WORDS);
+
+	guint32 i;
+	for (i = 0; i < c->cardinality; i++)
+		bitmap[c->array[i] >> 6] |= ((guint64) 1) << (c->array[i] & 63);
+
+	g_free(c->array);
+	c->array = NULL;
+	c->capacity = 0;
+	c->bitmap = bitmap;
+}
+
+/**
+ * Turn a bitmap container into an array
+ */
+static void tagsistant_posting_container_to_array(tagsistant_posting_container *c)
+{
+	guint16 *array = g_new(guint16, c->cardinality ? c->cardinality : 4);
+	guint32 n = 0;
+
+	guint32 w;
+	for (w = 0; w < TAGSISTANT_POSTING_BITMAP_WORDS; w++) {
+		guint64 word = c->bitmap[w];
+		while (word) {
+			array[n++] = (guint16) ((w << 6) + __builtin_ctzll(word));
+			word &= word - 1;
+		}
+	}
+
+	g_free(c->bitmap);
+	c->bitmap = NULL;
+	c->array = array;
+	c->capacity = c->cardinality ? c->cardinality : 4;
+}
+
+/**
+ * Add a value to a container
+ *
+ * @return true if the value was not in the container
+ */
+static gboolean tagsistant_posting_container_add(tagsistant_posting_container *c, guint16 value)
+{
+	if (c->bitmap) {
+		guint64 bit = ((guint64) 1) << (value & 63);
+		if (c->bitmap[value >> 6] & bit) return (FALSE);
+		c->bitmap[value >> 6] |= bit;
+		c->cardinality++;
+		return (TRUE);
+	}
+
+	/* appending in order is the common case while loading */
+	guint32 position = (c->cardinality && c->array[c->cardinality - 1] < value)
+		? c->cardinality
+		: tagsistant_posting_lower_bound(c->array, 0, c->cardinality, value);
+
+	if (position < c->cardinality && c->array[position] == value) return (FALSE);
+
+	if (c->cardinality == TAGSISTANT_POSTING_ARRAY_MAX) {
+		tagsistant_posting_container_to_bitmap(c);
+		return (tagsistant_posting_container_add(c, value));
+	}
+
+	if (c->cardinality == c->capacity) {
+		c->capacity = MIN(c->capacity * 2, TAGSISTANT_POSTING_ARRAY_MAX);
+		c->array = g_renew(guint16, c->array, c->capacity);
+	}
+
+	memmove(c->array + position + 1, c->array + position, (c->cardinality - position) * sizeof(guint16));
+	c->array[position] = value;
+	c->cardinality++;
+
+	return (TRUE);
+}
+
+/**
+ * Remove a value from a container
+ *
+ * @return true if the value was in the container
+ */
+static gboolean tagsistant_posting_container_remove(tagsistant_posting_container *c, guint16 value)
+{
+	if (c->bitmap) {
+		guint64 bit = ((guint64) 1) << (value & 63);
+		if (!(c->bitmap[value >> 6] & bit)) return (FALSE);
+		c->bitmap[value >> 6] &= ~bit;
+		c->cardinality--;
+
+		/* shrink only well below the threshold, to avoid flipping back and forth */
+		if (c->cardinality < TAGSISTANT_POSTING_ARRAY_MAX / 2) tagsistant_posting_container_to_array(c);
+		return (TRUE);
+	}
+
+	guint32 position = tagsistant_posting_lower_bound(c->array, 0, c->cardinality, value);
+	if (position == c->cardinality || c->array[position] != value) return (FALSE);
+
+	memmove(c->array + position, c->array + position + 1, (c->cardinality - position - 1) * sizeof(guint16));
+	c->cardinality--;
+
+	return (TRUE);
+}
+
+/**
+ * Turn a bitmap just computed into an array if it's sparse, or free it if empty
+ */
+static tagsistant_posting_container *tagsistant_posting_container_normalize(tagsistant_posting_container *c)
+{
+	if (!c->cardinality) {
+		tagsistant_posting_container_free(c);
+		return (NULL);
+	}
+
+	if (c->bitmap && c->cardinality <= TAGSISTANT_POSTING_ARRAY_MAX)
+		tagsistant_posting_container_to_array(c);
+
+	return (c);
+}
+
+/**
+ * Intersect two sorted arrays, galloping through the larger one
+ */
+static guint32 tagsistant_posting_gallop_intersect(const guint16 *small, guint32 small_n, const guint16 *large, guint32 large_n, guint16 *out)
+{
+	guint32 n = 0, position = 0, i;
+
+	for (i = 0; i < small_n && position < large_n; i++) {
+		guint16 value = small[i];
+
+		/* exponential search for the range holding value */
+		guint32 step = 1, bound = position;
+		while (bound < large_n && large[bound] < value) {
+			position = bound + 1;
+			bound += step;
+			step <<= 1;
+		}
+
+		position = tagsistant_posting_lower_bound(large, position, MIN(bound + 1, large_n), value);
+		if (position < large_n && large[position] == value) out[n++] = value;
+	}
+
+	return (n);
+}
+
+/**
+ * Intersect two containers
+ *
+ * @return the intersection, NULL if empty
+ */
+static tagsistant_posting_container *tagsistant_posting_container_and(const tagsistant_posting_container *a, const tagsistant_posting_container *b)
+{
+	tagsistant_posting_container *result = NULL;
+
+	if (a->bitmap && b->bitmap) {
+		result = tagsistant_posting_container_new_bitmap();
+		guint64 cardinality = 0;
+
+		guint32 w;
+		for (w = 0; w < TAGSISTANT_POSTING_BITMAP_WORDS; w++) {
+			result->bitmap[w] = a->bitmap[w] & b->bitmap[w];
+			cardinality += tagsistant_posting_popcount(result->bitmap[w]);
+		}
+
+		result->cardinality = (guint32) cardinality;
+		return (tagsistant_posting_container_normalize(result));
+	}
+
+	if (a->bitmap || b->bitmap) {
+		const tagsistant_posting_container *array = a->bitmap ? b : a;
+		const tagsistant_posting_container *bitmap = a->bitmap ? a : b;
+
+		result = tagsistant_posting_container_new_array(array->cardinality);
+
+		guint32 i;
+		for (i = 0; i < array->cardinality; i++) {
+			guint16 value = array->array[i];
+			if (bitmap->bitmap[value >> 6] & (((guint64) 1) << (value & 63)))
+				result->array[result->cardinality++] = value;
+		}
+
+		return (tagsistant_posting_container_normalize(result));
+	}
+
+	const tagsistant_posting_container *small = (a->cardinality <= b->cardinality) ? a : b;
+	const tagsistant_posting_container *large = (small == a) ? b : a;
+
+	result = tagsistant_posting_container_new_array(small->cardinality);
+
+	if (small->cardinality * TAGSISTANT_POSTING_GALLOP_RATIO < large->cardinality) {
+		result->cardinality = tagsistant_posting_gallop_intersect(small->array, small->cardinality, large->array, large->cardinality, result->array);
+	} else {
+		guint32 i = 0, j = 0;
+		while (i < a->cardinality && j < b->cardinality) {
+			if (a->array[i] < b->array[j]) i++;
+			else if (a->array[i] > b->array[j]) j++;
+			else {
+				result->array[result->cardinality++] = a->array[i];
+				i++;
+				j++;
+			}
+		}
+	}
+
+	return (tagsistant_posting_container_normalize(result));
+}
+
+/**
+ * Unite two containers
+ *
+ * @return the union
+ */
+static tagsistant_posting_container *tagsistant_posting_container_or(const tagsistant_posting_container *a, const tagsistant_posting_container *b)
+{
+	tagsistant_posting_container *result = NULL;
+
+	if (a->bitmap || b->bitmap) {
+		result = tagsistant_posting_container_copy(a->bitmap ? a : b);
+		const tagsistant_posting_container *other = a->bitmap ? b : a;
+
+		if (other->bitmap) {
+			guint64 cardinality = 0;
+
+			guint32 w;
+			for (w = 0; w < TAGSISTANT_POSTING_BITMAP_WORDS; w++) {
+				result->bitmap[w] |= other->bitmap[w];
+				cardinality += tagsistant_posting_popcount(result->bitmap[w]);
+			}
+
+			result->cardinality = (guint32) cardinality;
+		} else {
+			guint32 i;
+			for (i = 0; i < other->cardinality; i++)
+				tagsistant_posting_container_add(result, other->array[i]);
+		}
+
+		return (result);
+	}
+
+	result = tagsistant_posting_container_new_array(a->cardinality + b->cardinality);
+
+	guint32 i = 0, j = 0;
+	while (i < a->cardinality || j < b->cardinality) {
+		if (j == b->cardinality || (i < a->cardinality && a->array[i] < b->array[j])) {
+			result->array[result->cardinality++] = a->array[i++];
+		} else if (i == a->cardinality || b->array[j] < a->array[i]) {
+			result->array[result->cardinality++] = b->array[j++];
+		} else {
+			result->array[result->cardinality++] = a->array[i];
+			i++;
+			j++;
+		}
+	}
+
+	if (result->cardinality > TAGSISTANT_POSTING_ARRAY_MAX) tagsistant_posting_container_to_bitmap(result);
+
+	return (result);
+}
+
+/**
+ * Subtract a container from another
+ *
+ * @return the values of a not in b, NULL if empty
+ */
+static tagsistant_posting_container *tagsistant_posting_container_andnot(const tagsistant_posting_container *a, const tagsistant_posting_container *b)
+{
+	tagsistant_posting_container *result = NULL;
+
+	if (a->bitmap) {
+		result = tagsistant_posting_container_copy(a);
+
+		if (b->bitmap) {
+			guint64 cardinality = 0;
+
+			guint32 w;
+			for (w = 0; w < TAGSISTANT_POSTING_BITMAP_WORDS; w++) {
+				result->bitmap[w] &= ~(b->bitmap[w]);
+				cardinality += tagsistant_posting_popcount(result->bitmap[w]);
+			}
+
+			result->cardinality = (guint32) cardinality;
+		} else {
+			guint32 i;
+			for (i = 0; i < b->cardinality; i++) {
+				guint16 value = b->array[i];
+				guint64 bit = ((guint64) 1) << (value & 63);
+				if (result->bitmap[value >> 6] & bit) {
+					result->bitmap[value >> 6] &= ~bit;
+					result->cardinality--;
+				}
+			}
+		}
+
+		return (tagsistant_posting_container_normalize(result));
+	}
+
+	result = tagsistant_posting_container_new_array(a->cardinality);
+
+	if (b->bitmap) {
+		guint32 i;
+		for (i = 0; i < a->cardinality; i++) {
+			guint16 value = a->array[i];
+			if (!(b->bitmap[value >> 6] & (((guint64) 1) << (value & 63))))
+				result->array[result->cardinality++] = value;
+		}
+	} else {
+		guint32 i = 0, j = 0;
+		while (i < a->cardinality) {
+			if (j == b->cardinality || a->array[i] < b->array[j]) {
+				result->array[result->cardinality++] = a->array[i++];
+			} else if (b->array[j] < a->array[i]) {
+				j++;
+			} else {
+				i++;
+				j++;
+			}
+		}
+	}
+
+	return (tagsistant_posting_container_normalize(result));
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Posting lists                                                              ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+static tagsistant_posting_list *tagsistant_posting_list_new()
+{
+	return (g_new0(tagsistant_posting_list, 1));
+}
+
+static void tagsistant_posting_list_free(tagsistant_posting_list *list)
+{
+	if (!list) return;
+
+	guint32 i;
+	for (i = 0; i < list->size; i++) tagsistant_posting_container_free(list->containers[i]);
+
+	g_free(list->keys);
+	g_free(list->containers);
+	g_free(list);
+}
+
+static tagsistant_posting_list *tagsistant_posting_list_copy(const tagsistant_posting_list *list)
+{
+	tagsistant_posting_list *copy = tagsistant_posting_list_new();
+	if (!list->size) return (copy);
+
+	copy->size = copy->capacity = list->size;
+	copy->cardinality = list->cardinality;
+	copy->keys = g_memdup(list->keys, list->size * sizeof(guint16));
+	copy->containers = g_new(tagsistant_posting_container *, list->size);
+
+	guint32 i;
+	for (i = 0; i < list->size; i++) copy->containers[i] = tagsistant_posting_container_copy(list->containers[i]);
+
+	return (copy);
+}
+
+/**
+ * Insert a container at a position of a list
+ */
+static void tagsistant_posting_list_insert(tagsistant_posting_list *list, guint32 position, guint16 key, tagsistant_posting_container *c)
+{
+	if (list->size == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 4;
+		list->keys = g_renew(guint16, list->keys, list->capacity);
+		list->containers = g_renew(tagsistant_posting_container *, list->containers, list->capacity);
+	}
+
+	memmove(list->keys + position + 1, list->keys + position, (list->size - position) * sizeof(guint16));
+	memmove(list->containers + position + 1, list->containers + position, (list->size - position) * sizeof(gpointer));
+
+	list->keys[position] = key;
+	list->containers[position] = c;
+	list->size++;
+	list->cardinality += c->cardinality;
+}
+
+/**
+ * Return the position of the first container whose key is not lower than key
+ */
+static guint32 tagsistant_posting_list_find(const tagsistant_posting_list *list, guint16 key)
+{
+	/* appending in order is the common case while loading */
+	if (list->size && list->keys[list->size - 1] < key) return (list->size);
+	return (tagsistant_posting_lower_bound(list->keys, 0, list->size, key));
+}
+
+/**
+ * Add an inode to a list
+ */
+static void tagsistant_posting_list_add(tagsistant_posting_list *list, tagsistant_inode inode)
+{
+	guint16 key = (guint16) (inode >> 16);
+	guint32 position = tagsistant_posting_list_find(list, key);
+
+	if (position == list->size || list->keys[position] != key)
+		tagsistant_posting_list_insert(list, position, key, tagsistant_posting_container_new_array(0));
+
+	if (tagsistant_posting_container_add(list->containers[position], (guint16) (inode & 0xffff)))
+		list->cardinality++;
+}
+
+/**
+ * Remove an inode from a list
+ *
+ * @return true if the inode was in the list
+ */
+static gboolean tagsistant_posting_list_remove(tagsistant_posting_list *list, tagsistant_inode inode)
+{
+	guint16 key = (guint16) (inode >> 16);
+	guint32 position = tagsistant_posting_list_find(list, key);
+
+	if (position == list->size || list->keys[position] != key) return (FALSE);
+	if (!tagsistant_posting_container_remove(list->containers[position], (guint16) (inode & 0xffff))) return (FALSE);
+	list->cardinality--;
+
+	/* drop the empty container */
+	if (!list->containers[position]->cardinality) {
+		tagsistant_posting_container_free(list->containers[position]);
+		memmove(list->keys + position, list->keys + position + 1, (list->size - position - 1) * sizeof(guint16));
+		memmove(list->containers + position, list->containers + position + 1, (list->size - position - 1) * sizeof(gpointer));
+		list->size--;
+	}
+
+	return (TRUE);
+}
+
+/**
+ * Append a container to a list being built in key order
+ */
+static void tagsistant_posting_list_append(tagsistant_posting_list *list, guint16 key, tagsistant_posting_container *c)
+{
+	if (c) tagsistant_posting_list_insert(list, list->size, key, c);
+}
+
+static tagsistant_posting_list *tagsistant_posting_list_and(const tagsistant_posting_list *a, const tagsistant_posting_list *b)
+{
+	tagsistant_posting_list *result = tagsistant_posting_list_new();
+
+	guint32 i = 0, j = 0;
+	while (i < a->size && j < b->size) {
+		if (a->keys[i] < b->keys[j]) i++;
+		else if (a->keys[i] > b->keys[j]) j++;
+		else {
+			tagsistant_posting_list_append(result, a->keys[i], tagsistant_posting_container_and(a->containers[i], b->containers[j]));
+			i++;
+			j++;
+		}
+	}
+
+	return (result);
+}
+
+static tagsistant_posting_list *tagsistant_posting_list_or(const tagsistant_posting_list *a, const tagsistant_posting_list *b)
+{
+	tagsistant_posting_list *result = tagsistant_posting_list_new();
+
+	guint32 i = 0, j = 0;
+	while (i < a->size || j < b->size) {
+		if (j == b->size || (i < a->size && a->keys[i] < b->keys[j])) {
+			tagsistant_posting_list_append(result, a->keys[i], tagsistant_posting_container_copy(a->containers[i]));
+			i++;
+		} else if (i == a->size || b->keys[j] < a->keys[i]) {
+			tagsistant_posting_list_append(result, b->keys[j], tagsistant_posting_container_copy(b->containers[j]));
+			j++;
+		} else {
+			tagsistant_posting_list_append(result, a->keys[i], tagsistant_posting_container_or(a->containers[i], b->containers[j]));
+			i++;
+			j++;
+		}
+	}
+
+	return (result);
+}
+
+static tagsistant_posting_list *tagsistant_posting_list_andnot(const tagsistant_posting_list *a, const tagsistant_posting_list *b)
+{
+	tagsistant_posting_list *result = tagsistant_posting_list_new();
+
+	guint32 i = 0, j = 0;
+	while (i < a->size) {
+		if (j == b->size || a->keys[i] < b->keys[j]) {
+			tagsistant_posting_list_append(result, a->keys[i], tagsistant_posting_container_copy(a->containers[i]));
+			i++;
+		} else if (b->keys[j] < a->keys[i]) {
+			j++;
+		} else {
+			tagsistant_posting_list_append(result, a->keys[i], tagsistant_posting_container_andnot(a->containers[i], b->containers[j]));
+			i++;
+			j++;
+		}
+	}
+
+	return (result);
+}
+
+/**
+ * Copy the inodes of a list, in ascending order, into a GArray
+ */
+static GArray *tagsistant_posting_list_to_array(const tagsistant_posting_list *list)
+{
+	GArray *inodes = g_array_sized_new(FALSE, FALSE, sizeof(tagsistant_inode), list->cardinality);
+
+	guint32 i;
+
+	for (i = 0; i < list->size; i++) {
+		tagsistant_posting_container *c = list->containers[i];
+		tagsistant_inode high = ((tagsistant_inode) list->keys[i]) << 16;
+
+		if (c->bitmap) {
+			guint32 w;
+			for (w = 0; w < TAGSISTANT_POSTING_BITMAP_WORDS; w++) {
+				guint64 word = c->bitmap[w];
+				while (word) {
+					tagsistant_inode inode = high | ((w << 6) + __builtin_ctzll(word));
+					g_array_append_val(inodes, inode);
+					word &= word - 1;
+				}
+			}
+		} else {
+			guint32 k;
+			for (k = 0; k < c->cardinality; k++) {
+				tagsistant_inode inode = high | c->array[k];
+				g_array_append_val(inodes, inode);
+			}
+		}
+	}
+
+	return (inodes);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   The index                                                                  ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/** the kinds of change to the tagging table */
+#define TAGSISTANT_POSTING_TAG			1
+#define TAGSISTANT_POSTING_UNTAG		2
+#define TAGSISTANT_POSTING_DROP_TAG		3
+#define TAGSISTANT_POSTING_DROP_OBJECT	4
+#define TAGSISTANT_POSTING_MOVE_OBJECT	5
+
+/** a change to the tagging table */
+typedef struct {
+	/** one of the TAGSISTANT_POSTING_* kinds */
+	int kind;
+
+	/** the tag_id, or the inode for DROP_OBJECT and MOVE_OBJECT */
+	guint32 first;
+
+	/** the inode, or the new inode for MOVE_OBJECT */
+	guint32 second;
+} tagsistant_posting_change;
+
+/** the posting lists, a map tag_id -> tagsistant_posting_list */
+static GHashTable *tagsistant_posting_index = NULL;
+
+/** guards the index, the ready flag and the replay log */
+static GRWLock tagsistant_posting_lock;
+
+/** true when the index has been loaded */
+static gboolean tagsistant_posting_ready = FALSE;
+
+/** the changes committed while the index is loading */
+static GArray *tagsistant_posting_replay = NULL;
+
+/** the changes of the current transaction of each thread */
+static GPrivate tagsistant_posting_pending = G_PRIVATE_INIT((GDestroyNotify) g_array_unref);
+
+/**
+ * the changes of the operations released into the shared transaction
+ * of group commit, waiting for it to be committed; guarded by the
+ * group commit lock, held by the callers
+ */
+static GArray *tagsistant_posting_group_pending = NULL;
+
+/** queries resolved by the index */
+static gint tagsistant_posting_evaluations = 0;
+
+/**
+ * Apply a change to an index
+ *
+ * @param index the index
+ * @param change the change
+ */
+static void tagsistant_posting_apply(GHashTable *index, const tagsistant_posting_change *change)
+{
+	tagsistant_posting_list *list = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	switch (change->kind) {
+		case TAGSISTANT_POSTING_TAG:
+			list = g_hash_table_lookup(index, GUINT_TO_POINTER(change->first));
+			if (!list) {
+				list = tagsistant_posting_list_new();
+				g_hash_table_insert(index, GUINT_TO_POINTER(change->first), list);
+			}
+			tagsistant_posting_list_add(list, change->second);
+			break;
+
+		case TAGSISTANT_POSTING_UNTAG:
+			list = g_hash_table_lookup(index, GUINT_TO_POINTER(change->first));
+			if (list) {
+				tagsistant_posting_list_remove(list, change->second);
+				if (!list->size) g_hash_table_remove(index, GUINT_TO_POINTER(change->first));
+			}
+			break;
+
+		case TAGSISTANT_POSTING_DROP_TAG:
+			g_hash_table_remove(index, GUINT_TO_POINTER(change->first));
+			break;
+
+		case TAGSISTANT_POSTING_DROP_OBJECT:
+		case TAGSISTANT_POSTING_MOVE_OBJECT:
+			g_hash_table_iter_init(&iter, index);
+			while (g_hash_table_iter_next(&iter, &key, &value)) {
+				list = (tagsistant_posting_list *) value;
+				if (!tagsistant_posting_list_remove(list, change->first)) continue;
+
+				if (TAGSISTANT_POSTING_MOVE_OBJECT == change->kind)
+					tagsistant_posting_list_add(list, change->second);
+				else if (!list->size)
+					g_hash_table_iter_remove(&iter);
+			}
+			break;
+	}
+}
+
+/**
+ * Record a change made by the current transaction
+ */
+static void tagsistant_posting_record(int kind, guint32 first, guint32 second)
+{
+	GArray *pending = g_private_get(&tagsistant_posting_pending);
+	if (!pending) {
+		pending = g_array_new(FALSE, FALSE, sizeof(tagsistant_posting_change));
+		g_private_set(&tagsistant_posting_pending, pending);
+	}
+
+	tagsistant_posting_change change = { kind, first, second };
+	g_array_append_val(pending, change);
+}
+
+/** record the tagging of an object */
+void tagsistant_posting_tag(tagsistant_tag_id tag_id, tagsistant_inode inode)
+{
+	tagsistant_posting_record(TAGSISTANT_POSTING_TAG, tag_id, inode);
+}
+
+/** record the untagging of an object */
+void tagsistant_posting_untag(tagsistant_tag_id tag_id, tagsistant_inode inode)
+{
+	tagsistant_posting_record(TAGSISTANT_POSTING_UNTAG, tag_id, inode);
+}
+
+/** record the deletion of all the taggings of a tag */
+void tagsistant_posting_drop_tag(tagsistant_tag_id tag_id)
+{
+	tagsistant_posting_record(TAGSISTANT_POSTING_DROP_TAG, tag_id, 0);
+}
+
+/** record the deletion of all the taggings of an object */
+void tagsistant_posting_drop_object(tagsistant_inode inode)
+{
+	tagsistant_posting_record(TAGSISTANT_POSTING_DROP_OBJECT, inode, 0);
+}
+
+/** record the move of all the taggings of an object to another object */
+void tagsistant_posting_move_object(tagsistant_inode from, tagsistant_inode to)
+{
+	tagsistant_posting_record(TAGSISTANT_POSTING_MOVE_OBJECT, from, to);
+}
+
+/**
+ * Apply committed changes to the index, or queue them for
+ * replay if the index is still loading
+ *
+ * @param pending the changes
+ */
+static void tagsistant_posting_commit(GArray *pending)
+{
+	g_rw_lock_writer_lock(&tagsistant_posting_lock);
+
+	if (tagsistant_posting_ready) {
+		guint i;
+		for (i = 0; i < pending->len; i++)
+			tagsistant_posting_apply(tagsistant_posting_index, &g_array_index(pending, tagsistant_posting_change, i));
+	} else if (tagsistant_posting_replay) {
+		g_array_append_vals(tagsistant_posting_replay, pending->data, pending->len);
+	}
+
+	g_rw_lock_writer_unlock(&tagsistant_posting_lock);
+}
+
+/**
+ * Apply or discard the changes of the current transaction.
+ * Called by tagsistant_db_end_transaction().
+ *
+ * @param commit true if the transaction has been committed
+ */
+void tagsistant_posting_end_transaction(int commit)
+{
+	GArray *pending = g_private_get(&tagsistant_posting_pending);
+	if (!pending || !pending->len) return;
+
+	if (commit) tagsistant_posting_commit(pending);
+
+	g_array_set_size(pending, 0);
+}
+
+/**
+ * Move the changes of an operation released into the shared transaction
+ * of group commit to the changes of the group, or discard them if the
+ * operation rolled back its savepoint. Called by tagsistant_db_end_transaction()
+ * with the group commit lock held.
+ *
+ * @param commit true if the savepoint has been released without rollback
+ */
+void tagsistant_posting_end_savepoint(int commit)
+{
+	GArray *pending = g_private_get(&tagsistant_posting_pending);
+	if (!pending || !pending->len) return;
+
+	if (commit) {
+		if (!tagsistant_posting_group_pending)
+			tagsistant_posting_group_pending = g_array_new(FALSE, FALSE, sizeof(tagsistant_posting_change));
+
+		g_array_append_vals(tagsistant_posting_group_pending, pending->data, pending->len);
+	}
+
+	g_array_set_size(pending, 0);
+}
+
+/**
+ * Apply or discard the changes of the operations of the shared transaction
+ * of group commit. Called when the group is flushed, with the group commit
+ * lock held.
+ *
+ * @param commit true if the shared transaction has been committed
+ */
+void tagsistant_posting_end_group(int commit)
+{
+	if (!tagsistant_posting_group_pending || !tagsistant_posting_group_pending->len) return;
+
+	if (commit) tagsistant_posting_commit(tagsistant_posting_group_pending);
+
+	g_array_set_size(tagsistant_posting_group_pending, 0);
+}
+
+/**
+ * SQL callback. Load a (tag_id, inode) row into an index.
+ *
+ * @param index_pointer the index
+ * @param result the row
+ */
+static int tagsistant_posting_load_callback(void *index_pointer, dbi_result result)
+{
+	GHashTable *index = (GHashTable *) index_pointer;
+
+	/* rows come sorted by tag_id, so the last list is cached */
+	static __thread guint32 last_tag_id = 0;
+	static __thread tagsistant_posting_list *last_list = NULL;
+
+	guint32 tag_id = tagsistant_result_get_uint_idx(result, 1);
+	tagsistant_inode inode = tagsistant_result_get_uint_idx(result, 2);
+
+	if (!last_list || tag_id != last_tag_id) {
+		last_list = g_hash_table_lookup(index, GUINT_TO_POINTER(tag_id));
+		if (!last_list) {
+			last_list = tagsistant_posting_list_new();
+			g_hash_table_insert(index, GUINT_TO_POINTER(tag_id), last_list);
+		}
+		last_tag_id = tag_id;
+	}
+
+	tagsistant_posting_list_add(last_list, inode);
+	return (0);
+}
+
+/**
+ * Load the index from the tagging table
+ *
+ * @param data unused
+ */
+static gpointer tagsistant_posting_load(gpointer data)
+{
+	(void) data;
+
+	gint64 start = g_get_monotonic_time();
+	GHashTable *index = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) tagsistant_posting_list_free);
+
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	int rows = tagsistant_query(
+		"select tag_id, inode from tagging order by tag_id, inode",
+		dbi, tagsistant_posting_load_callback, index);
+	tagsistant_db_connection_release(dbi, 0);
+
+	/* replay the changes committed meanwhile and publish the index */
+	g_rw_lock_writer_lock(&tagsistant_posting_lock);
+
+	guint i;
+	for (i = 0; i < tagsistant_posting_replay->len; i++)
+		tagsistant_posting_apply(index, &g_array_index(tagsistant_posting_replay, tagsistant_posting_change, i));
+
+	g_array_free(tagsistant_posting_replay, TRUE);
+	tagsistant_posting_replay = NULL;
+
+	tagsistant_posting_index = index;
+	tagsistant_posting_ready = TRUE;
+
+	g_rw_lock_writer_unlock(&tagsistant_posting_lock);
+
+	dbg('s', LOG_INFO, "Posting lists loaded: %d taggings of %d tags in %" G_GINT64_FORMAT " ms",
+		rows, g_hash_table_size(index), (g_get_monotonic_time() - start) / 1000);
+
+	return (NULL);
+}
+
+/**
+ * Start loading the posting lists in the background.
+ * Called from the FUSE init() hook, before any operation is served.
+ */
+void tagsistant_posting_init()
+{
+	g_rw_lock_writer_lock(&tagsistant_posting_lock);
+	tagsistant_posting_replay = g_array_new(FALSE, FALSE, sizeof(tagsistant_posting_change));
+	g_rw_lock_writer_unlock(&tagsistant_posting_lock);
+
+	g_thread_new("Posting lists loader", tagsistant_posting_load, NULL);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Query evaluation                                                           ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/**
+ * Return true if a node can't be answered by its tag_id alone
+ * (the range and contains operators of triple tags)
+ */
+static gboolean tagsistant_posting_needs_sql(qtree_and_node *node)
+{
+	return (node->value && strlen(node->value) && (TAGSISTANT_EQUAL_TO != node->operator));
+}
+
+/**
+ * SQL callback. Add an inode to a posting list.
+ */
+static int tagsistant_posting_add_callback(void *list, dbi_result result)
+{
+	tagsistant_posting_list_add((tagsistant_posting_list *) list, tagsistant_result_get_uint_idx(result, 1));
+	return (0);
+}
+
+/**
+ * Resolve in SQL a node which needs it, saving its posting list in a map
+ *
+ * @param node the node
+ * @param dbi the connection
+ * @param resolved a map qtree_and_node -> tagsistant_posting_list
+ */
+static void tagsistant_posting_resolve_sql(qtree_and_node *node, dbi_conn dbi, GHashTable *resolved)
+{
+	if (!tagsistant_posting_needs_sql(node) || g_hash_table_contains(resolved, node)) return;
+
+	GString *statement = g_string_sized_new(1024);
+	g_string_append(statement, "select distinct tagging.inode from tagging join tags on tags.tag_id = tagging.tag_id where ");
+	tagsistant_query_add_and_set(statement, node);
+
+	tagsistant_posting_list *list = tagsistant_posting_list_new();
+	tagsistant_query_sql(statement->str, dbi, tagsistant_posting_add_callback, list);
+	g_string_free(statement, TRUE);
+
+	g_hash_table_insert(resolved, node, list);
+}
+
+/**
+ * Resolve in SQL all the nodes of a query which need it
+ */
+static void tagsistant_posting_resolve_sql_nodes(tagsistant_querytree *qtree, GHashTable *resolved)
+{
+	qtree_or_node *query;
+	for (query = qtree->tree; query; query = query->next) {
+		qtree_and_node *and;
+		for (and = query->and_set; and; and = and->next) {
+			qtree_and_node *node;
+			for (node = and; node; node = node->related)
+				tagsistant_posting_resolve_sql(node, qtree->dbi, resolved);
+
+			qtree_and_node *negated;
+			for (negated = and->negated; negated; negated = negated->negated)
+				for (node = negated; node; node = node->related)
+					tagsistant_posting_resolve_sql(node, qtree->dbi, resolved);
+		}
+	}
+}
+
+/**
+ * Return the posting list of a node and its ->related nodes
+ *
+ * @param node the node
+ * @param resolved the lists of the nodes resolved in SQL
+ * @return a new posting list
+ */
+static tagsistant_posting_list *tagsistant_posting_evaluate_related(qtree_and_node *node, GHashTable *resolved)
+{
+	tagsistant_posting_list *result = NULL;
+
+	for (; node; node = node->related) {
+		const tagsistant_posting_list *list = tagsistant_posting_needs_sql(node)
+			? g_hash_table_lookup(resolved, node)
+			: g_hash_table_lookup(tagsistant_posting_index, GUINT_TO_POINTER(node->tag_id));
+
+		if (!list || !list->size) continue;
+
+		if (!result) {
+			result = tagsistant_posting_list_copy(list);
+		} else {
+			tagsistant_posting_list *united = tagsistant_posting_list_or(result, list);
+			tagsistant_posting_list_free(result);
+			result = united;
+		}
+	}
+
+	return (result ? result : tagsistant_posting_list_new());
+}
+
+/**
+ * Resolve a query on the posting lists: each OR section is the
+ * intersection of its AND nodes (each one united with its ->related
+ * nodes) minus its ->negated nodes, and the result is the union
+ * of the OR sections.
+ *
+ * @param qtree the querytree
+ * @return the matching inodes in ascending order, to be freed with
+ *   g_array_free(), or NULL if the posting lists are not available
+ */
+GArray *tagsistant_posting_evaluate(tagsistant_querytree *qtree)
+{
+	if (!qtree || !qtree->tree || !g_atomic_int_get(&tagsistant_posting_ready)) return (NULL);
+
+	/* the nodes needing SQL are resolved first, without holding the lock */
+	GHashTable *resolved = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) tagsistant_posting_list_free);
+	tagsistant_posting_resolve_sql_nodes(qtree, resolved);
+
+	g_rw_lock_reader_lock(&tagsistant_posting_lock);
+
+	tagsistant_posting_list *result = tagsistant_posting_list_new();
+
+	qtree_or_node *query;
+	for (query = qtree->tree; query; query = query->next) {
+		tagsistant_posting_list *section = tagsistant_posting_evaluate_related(query->and_set, resolved);
+
+		qtree_and_node *and;
+		for (and = query->and_set->next; and && section->size; and = and->next) {
+			tagsistant_posting_list *list = tagsistant_posting_evaluate_related(and, resolved);
+			tagsistant_posting_list *intersection = tagsistant_posting_list_and(section, list);
+			tagsistant_posting_list_free(list);
+			tagsistant_posting_list_free(section);
+			section = intersection;
+		}
+
+		for (and = query->and_set; and && section->size; and = and->next) {
+			qtree_and_node *negated;
+			for (negated = and->negated; negated; negated = negated->negated) {
+				tagsistant_posting_list *list = tagsistant_posting_evaluate_related(negated, resolved);
+				tagsistant_posting_list *difference = tagsistant_posting_list_andnot(section, list);
+				tagsistant_posting_list_free(list);
+				tagsistant_posting_list_free(section);
+				section = difference;
+			}
+		}
+
+		tagsistant_posting_list *united = tagsistant_posting_list_or(result, section);
+		tagsistant_posting_list_free(result);
+		tagsistant_posting_list_free(section);
+		result = united;
+	}
+
+	g_rw_lock_reader_unlock(&tagsistant_posting_lock);
+
+	GArray *inodes = tagsistant_posting_list_to_array(result);
+	tagsistant_posting_list_free(result);
+	g_hash_table_destroy(resolved);
+
+	g_atomic_int_inc(&tagsistant_posting_evaluations);
+
+	return (inodes);
+}
+
+/**
+ * Materialize the RDS of a query from the posting lists
+ *
+ * @param qtree the querytree
+ * @param rds_id the id of the RDS, already registered
+ * @return true if the RDS has been materialized, false if the
+ *   posting lists are not available
+ */
+gboolean tagsistant_posting_materialize_rds(tagsistant_querytree *qtree, int rds_id)
+{
+	GArray *inodes = tagsistant_posting_evaluate(qtree);
+	if (!inodes) return (FALSE);
+
+	guint i = 0;
+	while (i < inodes->len) {
+		GString *statement = g_string_sized_new(8192);
+		g_string_append_printf(statement, "select %d, inode, objectname from objects where inode in (", rds_id);
+
+		guint chunk;
+		for (chunk = 0; chunk < TAGSISTANT_POSTING_RDS_CHUNK && i < inodes->len; chunk++, i++)
+			g_string_append_printf(statement, chunk ? ", %u" : "%u", g_array_index(inodes, tagsistant_inode, i));
+
+		g_string_append(statement, ")");
+
+		tagsistant_query("insert into rds %s", qtree->dbi, NULL, NULL, statement->str);
+		g_string_free(statement, TRUE);
+	}
+
+	g_array_free(inodes, TRUE);
+	return (TRUE);
+}
+
+/**
+ * Return the number of objects tagged by a tag. The count is kept
+ * by each posting list as changes are applied, so it's exact as of
+ * the last committed transaction.
+ *
+ * @param tag_id the tag
+ * @return the number of objects, -1 if the posting lists are not loaded
+ */
+gint tagsistant_posting_cardinality(tagsistant_tag_id tag_id)
+{
+	gint cardinality = -1;
+
+	g_rw_lock_reader_lock(&tagsistant_posting_lock);
+	if (tagsistant_posting_ready) {
+		tagsistant_posting_list *list = g_hash_table_lookup(tagsistant_posting_index, GUINT_TO_POINTER(tag_id));
+		cardinality = list ? (gint) list->cardinality : 0;
+	}
+	g_rw_lock_reader_unlock(&tagsistant_posting_lock);
+
+	return (cardinality);
+}
+
+/**
+ * Report the state of the posting lists
+ *
+ * @param lists filled with the number of posting lists
+ * @param evaluations filled with the number of queries resolved
+ * @return true if the posting lists are loaded
+ */
+gboolean tagsistant_posting_stats(int *lists, int *evaluations)
+{
+	g_rw_lock_reader_lock(&tagsistant_posting_lock);
+	gboolean ready = tagsistant_posting_ready;
+	*lists = ready ? (int) g_hash_table_size(tagsistant_posting_index) : 0;
+	g_rw_lock_reader_unlock(&tagsistant_posting_lock);
+
+	*evaluations = g_atomic_int_get(&tagsistant_posting_evaluations);
+	return (ready);
+}
@@ -28,240 +28,1514 @@
 /************************************************************************************/
 
 /**
- * add a file to the file tree (callback function)
+ * The state of a listing streamed by tagsistant_rds_list().
  *
- * @param hash_table_pointer a GHashTable to hold results
+ * Rows are read sorted by objectname, so all the objects sharing a
+ * name come in a row: only the current name and its inodes are kept,
+ * in buffers reused for every name. The names already listed are
+ * interned in a string chunk, just in case the database collation
+ * doesn't keep equal names together.
+ */
+typedef struct {
+	/** the name being collected */
+	GString *name;
+
+	/** the inodes of the objects named ->name */
+	GArray *inodes;
+
+	/** the names already listed, interned in ->interned */
+	GHashTable *listed;
+
+	/** storage for the names in ->listed */
+	GStringChunk *interned;
+
+	/** the function receiving the entries */
+	tagsistant_rds_filler filler;
+
+	/** the data passed to ->filler */
+	void *data;
+
+	/** set when ->filler asks to stop */
+	int stop;
+} tagsistant_rds_cursor;
+
+/**
+ * Pass the objects collected in a tagsistant_rds_cursor to its filler
+ *
+ * @param cursor the cursor
+ */
+static void tagsistant_rds_cursor_flush(tagsistant_rds_cursor *cursor)
+{
+	if (!cursor->inodes->len) return;
+
+	/* a name listed before or shared by more objects needs the inodes */
+	int homonym = (cursor->inodes->len > 1);
+	if (g_hash_table_contains(cursor->listed, cursor->name->str)) {
+		homonym = 1;
+	} else {
+		g_hash_table_add(cursor->listed, g_string_chunk_insert(cursor->interned, cursor->name->str));
+	}
+
+	guint i;
+	for (i = 0; i < cursor->inodes->len && !cursor->stop; i++) {
+		tagsistant_inode inode = g_array_index(cursor->inodes, tagsistant_inode, i);
+		cursor->stop = cursor->filler(cursor->data, cursor->name->str, inode, homonym);
+	}
+
+	g_array_set_size(cursor->inodes, 0);
+}
+
+/**
+ * SQL callback. Add an (objectname, inode) row to a tagsistant_rds_cursor
+ *
+ * @param cursor_pointer the tagsistant_rds_cursor
  * @param result a DBI result
  */
-static int tagsistant_add_to_fileset(void *hash_table_pointer, dbi_result result)
+static int tagsistant_rds_cursor_add(void *cursor_pointer, dbi_result result)
+{
+	tagsistant_rds_cursor *cursor = (tagsistant_rds_cursor *) cursor_pointer;
+
+	/* the name is borrowed from the result, it's copied only when it changes */
+	const gchar *name = tagsistant_result_get_string_idx(result, 1);
+	if (!name) return (0);
+
+	tagsistant_inode inode = tagsistant_result_get_uint_idx(result, 2);
+
+	if (cursor->inodes->len && (g_strcmp0(cursor->name->str, name) == 0)) {
+		/* skip the duplicates due to reasoning results */
+		if (g_array_index(cursor->inodes, tagsistant_inode, cursor->inodes->len - 1) == inode) return (0);
+	} else {
+		tagsistant_rds_cursor_flush(cursor);
+		if (cursor->stop) return (TAGSISTANT_STOP_QUERY);
+
+		g_string_assign(cursor->name, name);
+	}
+
+	g_array_append_val(cursor->inodes, inode);
+
+	return (0);
+}
+
+/**
+ * Add a range criterion on the typed values of a triple tag, if the
+ * operand has a type and the tag_values table is complete
+ *
+ * @param statement a GString object holding the building query statement
+ * @param and_set the qtree_and_node object with the range operator
+ * @param operator the SQL comparison operator
+ * @return true if the criterion was added
+ */
+static gboolean tagsistant_query_add_typed_range(GString *statement, qtree_and_node *and_set, const gchar *operator)
+{
+	gdouble typed = 0;
+	int type = tagsistant_sql_value_type(and_set->value, &typed);
+	if (!type || !tagsistant_sql_typed_values_ready()) return (FALSE);
+
+	gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_dtostr(number, sizeof(number), typed);
+
+	g_string_append(statement, "tags.tag_id in (select tag_id from tag_values where tagname = ");
+	tagsistant_sql_append_literal(statement, and_set->namespace);
+	g_string_append(statement, " and `key` = ");
+	tagsistant_sql_append_literal(statement, and_set->key);
+	g_string_append_printf(statement, " and value_type = %d and typed_value %s %s) ", type, operator, number);
+
+	return (TRUE);
+}
+
+/**
+ * Restrict a contains criterion to the tags having all the trigrams
+ * of its operand, if it has any and the tag_trigrams table is complete
+ *
+ * @param statement a GString object holding the building query statement
+ * @param value the operand of the contains operator
+ */
+static void tagsistant_query_add_trigrams(GString *statement, const gchar *value)
+{
+	if (!tagsistant_sql_trigrams_ready()) return;
+
+	GArray *trigrams = tagsistant_sql_trigrams(value);
+
+	if (trigrams->len) {
+		g_string_append(statement, "tags.tag_id in (select tag_id from tag_trigrams where trigram in (");
+
+		guint i;
+		for (i = 0; i < trigrams->len; i++)
+			g_string_append_printf(statement, "%s%u", i ? ", " : "", g_array_index(trigrams, guint32, i));
+
+		g_string_append_printf(statement, ") group by tag_id having count(*) = %u) and ", trigrams->len);
+	}
+
+	g_array_free(trigrams, TRUE);
+}
+
+/**
+ * Add a filter criterion to a WHERE clause based on a qtree_and_node object.
+ * Strings are added as escaped literals, so the statement must be run
+ * by tagsistant_query_sql().
+ *
+ * @param statement a GString object holding the building query statement
+ * @param and_set the qtree_and_node object describing the tag to be added as a criterion
+ */
+void tagsistant_query_add_and_set(GString *statement, qtree_and_node *and_set)
+{
+	if (and_set->value && strlen(and_set->value)) {
+		/* the typed range replaces the whole criterion */
+		if (TAGSISTANT_GREATER_THAN == and_set->operator && tagsistant_query_add_typed_range(statement, and_set, ">")) return;
+		if (TAGSISTANT_SMALLER_THAN == and_set->operator && tagsistant_query_add_typed_range(statement, and_set, "<")) return;
+
+		g_string_append(statement, "tagname = ");
+		tagsistant_sql_append_literal(statement, and_set->namespace);
+		g_string_append(statement, " and `key` = ");
+		tagsistant_sql_append_literal(statement, and_set->key);
+		g_string_append(statement, " and ");
+
+		switch (and_set->operator) {
+			case TAGSISTANT_EQUAL_TO:
+				g_string_append(statement, "value = ");
+				tagsistant_sql_append_literal(statement, and_set->value);
+				break;
+			case TAGSISTANT_CONTAINS: {
+				tagsistant_query_add_trigrams(statement, and_set->value);
+				gchar *pattern = g_strdup_printf("%%%s%%", and_set->value);
+				g_string_append(statement, "value like ");
+				tagsistant_sql_append_literal(statement, pattern);
+				g_free(pattern);
+				break;
+			}
+			case TAGSISTANT_GREATER_THAN:
+				g_string_append(statement, "value > ");
+				tagsistant_sql_append_literal(statement, and_set->value);
+				break;
+			case TAGSISTANT_SMALLER_THAN:
+				g_string_append(statement, "value < ");
+				tagsistant_sql_append_literal(statement, and_set->value);
+				break;
+			default:
+				/* no operator, nothing can match */
+				g_string_append(statement, "1 = 0");
+				break;
+		}
+
+		g_string_append_c(statement, ' ');
+	} else if (and_set->tag) {
+		g_string_append(statement, "tagname = ");
+		tagsistant_sql_append_literal(statement, and_set->tag);
+		g_string_append_c(statement, ' ');
+	} else if (and_set->tag_id) {
+		g_string_append_printf(statement, "tagging.tag_id = %d ", and_set->tag_id);
+	}
+}
+
+/*
+ * Return the query portion up to the delimiter token
+ *
+ * @param qtree the tagsistant_querytree object
+ * @return a string containing the query up to the delimiter token
+ */
+gchar *tagsistant_rds_path(tagsistant_querytree *qtree)
+{
+	gchar *path = g_strdup(qtree->expanded_full_path);
+	gchar *delimiter = strstr(path, TAGSISTANT_QUERY_DELIMITER);
+	if (delimiter) { *delimiter = '\0'; }
+	return (path);
+}
+
+/*
+ * Compute the checksum identifying a RDS
+ *
+ * @param qtree the tagsistant_querytree object
+ * @return a string containing the checksum
+ */
+gchar *tagsistant_get_rds_checksum(tagsistant_querytree *qtree)
+{
+	/*
+	 * Extract the path to be looked up
+	 */
+	gchar *path = tagsistant_rds_path(qtree);
+
+	/*
+	 * compute the checksum
+	 */
+	gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+
+	g_free(path);
+	return (checksum);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** RDS cache policy                                                             ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * The RDS are shared by all the connections and accounted in memory:
+ * when they were last used, how many tuples they hold and how long they
+ * took to be materialized. A background thread keeps the totals within
+ * tagsistant.rds_max_sets and tagsistant.rds_max_tuples, evicting first
+ * the RDS with the highest idle time per microsecond of materialization
+ * cost, so a cheap RDS goes before an expensive one used as long ago.
+ *
+ * The thread deletes the victims on a connection of its own. A RDS used
+ * in the last second is never evicted, so the operation which looked it
+ * up can still read it. The same thread deletes the RDS materialized
+ * but never published (see tagsistant_rds_publish()).
+ */
+
+/** the accounting of a RDS */
+typedef struct {
+	/** the RDS id */
+	int rds_id;
+
+	/** true if the RDS can be found by its checksum */
+	gboolean published;
+
+	/** the last time the RDS has been used, in monotonic microseconds */
+	gint64 last_access;
+
+	/** the microseconds spent materializing the RDS */
+	gint64 cost;
+
+	/** the tuples of the RDS */
+	int tuples;
+} tagsistant_rds_entry;
+
+/** the RDS cache */
+static struct {
+	/** guards the other fields */
+	GMutex lock;
+
+	/** wakes the eviction thread up */
+	GCond wakeup;
+
+	/** a map rds_id -> tagsistant_rds_entry */
+	GHashTable *entries;
+
+	/** the last RDS id assigned */
+	gint last_id;
+
+	/** the RDS accounted */
+	int sets;
+
+	/** the tuples of the RDS accounted */
+	gint64 tuples;
+
+	/** RDS found materialized */
+	gint hits;
+
+	/** RDS materialized */
+	gint misses;
+
+	/** RDS materialized by another connection at the same time */
+	gint duplicates;
+
+	/** RDS not published since the database changed meanwhile */
+	gint unpublished;
+
+	/** RDS evicted */
+	gint evictions;
+} tagsistant_rds_cache;
+
+/**
+ * Account a RDS just materialized
+ *
+ * @param rds_id the RDS id
+ * @param published true if the RDS has been published
+ * @param tuples the tuples of the RDS
+ * @param cost the microseconds spent materializing the RDS
+ */
+static void tagsistant_rds_cache_add(int rds_id, gboolean published, int tuples, gint64 cost)
+{
+	tagsistant_rds_entry *entry = g_new0(tagsistant_rds_entry, 1);
+	entry->rds_id = rds_id;
+	entry->published = published;
+	entry->last_access = g_get_monotonic_time();
+	entry->cost = cost;
+	entry->tuples = tuples;
+
+	g_mutex_lock(&tagsistant_rds_cache.lock);
+
+	g_hash_table_insert(tagsistant_rds_cache.entries, GINT_TO_POINTER(rds_id), entry);
+	tagsistant_rds_cache.sets++;
+	tagsistant_rds_cache.tuples += tuples;
+	tagsistant_rds_cache.misses++;
+	if (!published) tagsistant_rds_cache.unpublished++;
+
+	if ((tagsistant_rds_cache.sets > tagsistant.rds_max_sets) || (tagsistant_rds_cache.tuples > tagsistant.rds_max_tuples))
+		g_cond_signal(&tagsistant_rds_cache.wakeup);
+
+	g_mutex_unlock(&tagsistant_rds_cache.lock);
+}
+
+/**
+ * Account the use of a RDS
+ */
+static void tagsistant_rds_cache_hit(int rds_id)
+{
+	g_mutex_lock(&tagsistant_rds_cache.lock);
+
+	tagsistant_rds_entry *entry = g_hash_table_lookup(tagsistant_rds_cache.entries, GINT_TO_POINTER(rds_id));
+	if (entry) entry->last_access = g_get_monotonic_time();
+	tagsistant_rds_cache.hits++;
+
+	g_mutex_unlock(&tagsistant_rds_cache.lock);
+}
+
+/**
+ * Account a change in the tuples of a RDS
+ */
+static void tagsistant_rds_cache_resize(int rds_id, int delta)
+{
+	g_mutex_lock(&tagsistant_rds_cache.lock);
+
+	tagsistant_rds_entry *entry = g_hash_table_lookup(tagsistant_rds_cache.entries, GINT_TO_POINTER(rds_id));
+	if (entry && (entry->tuples + delta >= 0)) {
+		entry->tuples += delta;
+		tagsistant_rds_cache.tuples += delta;
+	}
+
+	g_mutex_unlock(&tagsistant_rds_cache.lock);
+}
+
+/**
+ * Stop accounting a RDS.
+ * Must be called holding tagsistant_rds_cache.lock.
+ */
+static void tagsistant_rds_cache_unlink(tagsistant_rds_entry *entry)
+{
+	tagsistant_rds_cache.sets--;
+	tagsistant_rds_cache.tuples -= entry->tuples;
+	g_hash_table_remove(tagsistant_rds_cache.entries, GINT_TO_POINTER(entry->rds_id));
+}
+
+/**
+ * Stop accounting a RDS being deleted
+ */
+static void tagsistant_rds_cache_remove(int rds_id)
+{
+	g_mutex_lock(&tagsistant_rds_cache.lock);
+
+	tagsistant_rds_entry *entry = g_hash_table_lookup(tagsistant_rds_cache.entries, GINT_TO_POINTER(rds_id));
+	if (entry) tagsistant_rds_cache_unlink(entry);
+
+	g_mutex_unlock(&tagsistant_rds_cache.lock);
+}
+
+static void tagsistant_rds_delete(dbi_conn dbi, int rds_id);
+
+/** the time the eviction thread is sorting the RDS at */
+static gint64 tagsistant_rds_cache_now = 0;
+
+/**
+ * Sort RDS entries by eviction priority, the first to be evicted first
+ */
+static gint tagsistant_rds_cache_compare(gconstpointer a, gconstpointer b)
+{
+	const tagsistant_rds_entry *first = *((tagsistant_rds_entry **) a);
+	const tagsistant_rds_entry *second = *((tagsistant_rds_entry **) b);
+
+	/* idle time per microsecond of cost: the higher, the sooner evicted */
+	double first_score = (double) (tagsistant_rds_cache_now - first->last_access) / (double) (first->cost + 1);
+	double second_score = (double) (tagsistant_rds_cache_now - second->last_access) / (double) (second->cost + 1);
+
+	if (first_score > second_score) return (-1);
+	if (first_score < second_score) return (1);
+	return (0);
+}
+
+/**
+ * Pick the RDS to be deleted: the ones never published and, if the cache
+ * is over its limits, the ones needed to bring it back within them.
+ * Must be called holding tagsistant_rds_cache.lock.
+ *
+ * @param victims the array receiving the ids of the victims
+ */
+static void tagsistant_rds_cache_evict(GArray *victims)
+{
+	/* go a bit below the limits, not to run again on the next RDS */
+	int max_sets = tagsistant.rds_max_sets - tagsistant.rds_max_sets / 10;
+	gint64 max_tuples = tagsistant.rds_max_tuples - tagsistant.rds_max_tuples / 10;
+	gboolean over_limits = (tagsistant_rds_cache.sets > tagsistant.rds_max_sets) || (tagsistant_rds_cache.tuples > tagsistant.rds_max_tuples);
+
+	tagsistant_rds_cache_now = g_get_monotonic_time();
+
+	GPtrArray *candidates = g_ptr_array_sized_new(tagsistant_rds_cache.sets);
+
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, tagsistant_rds_cache.entries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		tagsistant_rds_entry *entry = (tagsistant_rds_entry *) value;
+
+		/* a RDS used in the last second could still be read */
+		if (tagsistant_rds_cache_now - entry->last_access < G_TIME_SPAN_SECOND) continue;
+
+		if (!entry->published) {
+			g_array_append_val(victims, entry->rds_id);
+			tagsistant_rds_cache.sets--;
+			tagsistant_rds_cache.tuples -= entry->tuples;
+			g_hash_table_iter_remove(&iter);
+		} else if (over_limits) {
+			g_ptr_array_add(candidates, entry);
+		}
+	}
+
+	g_ptr_array_sort(candidates, tagsistant_rds_cache_compare);
+
+	guint i;
+	for (i = 0; i < candidates->len; i++) {
+		if ((tagsistant_rds_cache.sets <= max_sets) && (tagsistant_rds_cache.tuples <= max_tuples)) break;
+
+		tagsistant_rds_entry *victim = g_ptr_array_index(candidates, i);
+		g_array_append_val(victims, victim->rds_id);
+		tagsistant_rds_cache.evictions++;
+
+		tagsistant_rds_cache_unlink(victim);
+	}
+
+	g_ptr_array_free(candidates, TRUE);
+}
+
+/**
+ * The eviction thread
+ *
+ * @param data unused
+ */
+static gpointer tagsistant_rds_cache_loop(gpointer data)
+{
+	(void) data;
+
+	GArray *victims = g_array_new(FALSE, FALSE, sizeof(int));
+
+	while (1) {
+		g_mutex_lock(&tagsistant_rds_cache.lock);
+		g_cond_wait_until(&tagsistant_rds_cache.wakeup, &tagsistant_rds_cache.lock,
+			g_get_monotonic_time() + TAGSISTANT_RDS_GC_INTERVAL * G_TIME_SPAN_SECOND);
+
+		tagsistant_rds_cache_evict(victims);
+		g_mutex_unlock(&tagsistant_rds_cache.lock);
+
+		if (!victims->len) continue;
+
+		dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+
+		guint i;
+		for (i = 0; i < victims->len; i++) {
+			dbg('f', LOG_INFO, "RDS cache: deleting rds %d", g_array_index(victims, int, i));
+			tagsistant_rds_delete(dbi, g_array_index(victims, int, i));
+		}
+
+		tagsistant_db_connection_release(dbi, 0);
+		g_array_set_size(victims, 0);
+	}
+
+	g_array_free(victims, TRUE);
+
+	return (NULL);
+}
+
+static void tagsistant_rds_workers_init();
+
+/**
+ * Initialize the RDS cache and start its eviction thread and the
+ * workers selecting the subqueries. Called from the FUSE init() hook,
+ * before any operation is served.
+ */
+void tagsistant_rds_cache_init()
+{
+	tagsistant_rds_cache.entries = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	g_thread_new("RDS cache", tagsistant_rds_cache_loop, NULL);
+
+	tagsistant_rds_workers_init();
+}
+
+/*
+ * Lookup the id of the RDS of a query.
+ *
+ * @param qtree the query that generates the RDS
+ * @return the RDS id, 0 if the RDS has not been materialized
+ */
+int tagsistant_get_rds_id(tagsistant_querytree *qtree)
+{
+	int rds_id = 0;
+	gchar *checksum = tagsistant_get_rds_checksum(qtree);
+
+	if (qtree->transaction_started) tagsistant_db_claim_rds_store(qtree->dbi);
+
+	tagsistant_query(
+		"select rds_id from rds_catalog where checksum = \"%s\" and reasoned = %d",
+		qtree->dbi, tagsistant_return_integer, &rds_id, checksum, qtree->do_reasoning);
+
+	if (rds_id) tagsistant_rds_cache_hit(rds_id);
+
+	g_free(checksum);
+	return (rds_id);
+}
+
+/**
+ * Add the name of a tag to the set of the sources involved by a query
+ */
+static void tagsistant_rds_add_source(GHashTable *sources, qtree_and_node *node)
+{
+	gchar *tag = (node->tag && strlen(node->tag)) ? node->tag : node->namespace;
+	if (tag) g_hash_table_add(sources, tag);
+}
+
+/**
+ * Return the names of the tags involved by a query: every tag,
+ * every related tag and even negated tags
+ *
+ * @param qtree the querytree
+ * @return a set of names borrowed from qtree
+ */
+static GHashTable *tagsistant_rds_involved_sources(tagsistant_querytree *qtree)
+{
+	GHashTable *sources = g_hash_table_new(g_str_hash, g_str_equal);
+
+	qtree_or_node *query;
+	for (query = qtree->tree; query; query = query->next) {
+		qtree_and_node *and;
+		for (and = query->and_set; and; and = and->next) {
+			tagsistant_rds_add_source(sources, and);
+
+			qtree_and_node *related;
+			for (related = and->related; related; related = related->related)
+				tagsistant_rds_add_source(sources, related);
+
+			qtree_and_node *negated;
+			for (negated = and->negated; negated; negated = negated->negated)
+				tagsistant_rds_add_source(sources, negated);
+		}
+	}
+
+	return (sources);
+}
+
+/**
+ * SQL callback. Append an integer to a GArray.
+ */
+static int tagsistant_rds_add_id(void *ids, dbi_result result)
+{
+	int id = tagsistant_result_get_uint_idx(result, 1);
+	g_array_append_val((GArray *) ids, id);
+	return (0);
+}
+
+/**
+ * Delete a RDS
+ *
+ * @param dbi the connection
+ * @param rds_id the RDS id
+ */
+static void tagsistant_rds_delete(dbi_conn dbi, int rds_id)
+{
+	tagsistant_rds_cache_remove(rds_id);
+
+	/* the catalog row goes first, so the RDS can't be found half deleted */
+	tagsistant_query("delete from rds_catalog where rds_id = %d", dbi, NULL, NULL, rds_id);
+	tagsistant_query("delete from rds_sources where rds_id = %d", dbi, NULL, NULL, rds_id);
+	tagsistant_query("delete from rds where rds_id = %d", dbi, NULL, NULL, rds_id);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** Incremental maintenance                                                      ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * When an object gains or loses a tag, the RDS involving that tag are
+ * not thrown away: the object alone is checked against the query of each
+ * RDS, and added to or removed from it.
+ *
+ * To do so, the query of each RDS is saved as a predicate on the tag_ids
+ * of an object. RDS whose query can't be told by tag_ids alone (contains
+ * and range operators on triple tags, tags not existing yet) and RDS
+ * whose predicate has been dropped to make room are deleted as before.
+ */
+
+/** a section of a RDS predicate, matching a qtree_or_node */
+typedef struct {
+	/** one GArray of tag_ids for each AND node and its ->related nodes */
+	GPtrArray *required;
+
+	/** one GArray of tag_ids for each ->negated node and its ->related nodes */
+	GPtrArray *excluded;
+} tagsistant_rds_section;
+
+/** the predicates, a map "checksum/reasoned" -> GPtrArray of tagsistant_rds_section */
+static GHashTable *tagsistant_rds_predicates = NULL;
+
+/** guards tagsistant_rds_predicates */
+static GMutex tagsistant_rds_predicates_lock;
+
+/** the work done by tagsistant_delete_rds_involved() */
+static struct {
+	/** objects checked against the RDS involving their tags */
+	gint objects;
+
+	/** RDS updated in place */
+	gint updated;
+
+	/** RDS deleted */
+	gint deleted;
+} tagsistant_rds_maintenance_stats = { 0, 0, 0 };
+
+static void tagsistant_rds_section_free(tagsistant_rds_section *section)
+{
+	g_ptr_array_free(section->required, TRUE);
+	g_ptr_array_free(section->excluded, TRUE);
+	g_free(section);
+}
+
+/**
+ * Return the tag_ids of a node and its ->related nodes
+ *
+ * @param node the node
+ * @return a GArray of tagsistant_tag_id, or NULL if a node can't be
+ *   told by its tag_id
+ */
+static GArray *tagsistant_rds_predicate_group(qtree_and_node *node)
+{
+	GArray *group = g_array_new(FALSE, FALSE, sizeof(tagsistant_tag_id));
+
+	for (; node; node = node->related) {
+		gboolean by_value = node->value && strlen(node->value) && (TAGSISTANT_EQUAL_TO != node->operator);
+
+		if (by_value || !node->tag_id) {
+			g_array_free(group, TRUE);
+			return (NULL);
+		}
+
+		g_array_append_val(group, node->tag_id);
+	}
+
+	return (group);
+}
+
+/**
+ * Save the predicate of a RDS
+ *
+ * @param qtree the querytree of the RDS
+ * @param checksum the RDS checksum
+ */
+static void tagsistant_rds_register(tagsistant_querytree *qtree, const gchar *checksum)
+{
+	GPtrArray *predicate = g_ptr_array_new_with_free_func((GDestroyNotify) tagsistant_rds_section_free);
+	gboolean exact = TRUE;
+
+	qtree_or_node *query;
+	for (query = qtree->tree; query && exact; query = query->next) {
+		tagsistant_rds_section *section = g_new0(tagsistant_rds_section, 1);
+		section->required = g_ptr_array_new_with_free_func((GDestroyNotify) g_array_unref);
+		section->excluded = g_ptr_array_new_with_free_func((GDestroyNotify) g_array_unref);
+		g_ptr_array_add(predicate, section);
+
+		qtree_and_node *and;
+		for (and = query->and_set; and && exact; and = and->next) {
+			GArray *group = tagsistant_rds_predicate_group(and);
+			if (group) g_ptr_array_add(section->required, group); else exact = FALSE;
+
+			qtree_and_node *negated;
+			for (negated = and->negated; negated && exact; negated = negated->negated) {
+				group = tagsistant_rds_predicate_group(negated);
+				if (group) g_ptr_array_add(section->excluded, group); else exact = FALSE;
+			}
+		}
+	}
+
+	gchar *key = g_strdup_printf("%s/%d", checksum, qtree->do_reasoning);
+
+	g_mutex_lock(&tagsistant_rds_predicates_lock);
+
+	if (!tagsistant_rds_predicates)
+		tagsistant_rds_predicates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+
+	/* forgetting the predicates only makes the RDS be deleted */
+	if (g_hash_table_size(tagsistant_rds_predicates) >= TAGSISTANT_RDS_PREDICATES)
+		g_hash_table_remove_all(tagsistant_rds_predicates);
+
+	if (exact) {
+		g_hash_table_insert(tagsistant_rds_predicates, key, predicate);
+	} else {
+		g_hash_table_remove(tagsistant_rds_predicates, key);
+		g_free(key);
+		g_ptr_array_unref(predicate);
+	}
+
+	g_mutex_unlock(&tagsistant_rds_predicates_lock);
+}
+
+/**
+ * Check if a group of tag_ids has one in a set
+ */
+static gboolean tagsistant_rds_group_matches(GArray *group, GHashTable *tag_ids)
+{
+	guint i;
+	for (i = 0; i < group->len; i++)
+		if (g_hash_table_contains(tag_ids, GUINT_TO_POINTER(g_array_index(group, tagsistant_tag_id, i))))
+			return (TRUE);
+
+	return (FALSE);
+}
+
+/**
+ * Check if an object belongs to a RDS
+ *
+ * @param key the RDS key, as "checksum/reasoned"
+ * @param tag_ids the set of the tag_ids of the object
+ * @param member set to true if the object belongs to the RDS
+ * @return false if the RDS has no predicate
+ */
+static gboolean tagsistant_rds_check_object(const gchar *key, GHashTable *tag_ids, gboolean *member)
+{
+	g_mutex_lock(&tagsistant_rds_predicates_lock);
+
+	GPtrArray *predicate = tagsistant_rds_predicates ? g_hash_table_lookup(tagsistant_rds_predicates, key) : NULL;
+
+	*member = FALSE;
+	guint i, j;
+	for (i = 0; predicate && i < predicate->len && !*member; i++) {
+		tagsistant_rds_section *section = g_ptr_array_index(predicate, i);
+		gboolean matches = TRUE;
+
+		for (j = 0; j < section->required->len && matches; j++)
+			matches = tagsistant_rds_group_matches(g_ptr_array_index(section->required, j), tag_ids);
+
+		for (j = 0; j < section->excluded->len && matches; j++)
+			matches = !tagsistant_rds_group_matches(g_ptr_array_index(section->excluded, j), tag_ids);
+
+		*member = matches;
+	}
+
+	g_mutex_unlock(&tagsistant_rds_predicates_lock);
+
+	return (predicate ? TRUE : FALSE);
+}
+
+/**
+ * SQL callback. Add a tag_id to a set.
+ */
+static int tagsistant_rds_add_tag_id(void *tag_ids, dbi_result result)
+{
+	g_hash_table_add((GHashTable *) tag_ids, GUINT_TO_POINTER(tagsistant_result_get_uint_idx(result, 1)));
+	return (0);
+}
+
+/**
+ * SQL callback. Map a RDS id to its "checksum/reasoned" key.
+ */
+static int tagsistant_rds_add_key(void *keys, dbi_result result)
+{
+	const gchar *checksum = tagsistant_result_get_string_idx(result, 2);
+	if (!checksum) return (0);
+
+	g_hash_table_insert((GHashTable *) keys,
+		GUINT_TO_POINTER(tagsistant_result_get_uint_idx(result, 1)),
+		g_strdup_printf("%s/%d", checksum, tagsistant_result_get_uint_idx(result, 3)));
+
+	return (0);
+}
+
+/**
+ * Update the RDS involved by a query pointing to an object, after the
+ * object has been tagged, untagged, renamed or deleted. The object is
+ * added to or removed from each RDS having a predicate, and the other
+ * RDS are deleted.
+ *
+ * @param qtree the querytree pointing to the object
+ */
+static void tagsistant_rds_update_object(tagsistant_querytree *qtree)
+{
+	/* collect the RDS involved, as a map rds_id -> "checksum/reasoned" */
+	GHashTable *keys = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	GHashTable *sources = tagsistant_rds_involved_sources(qtree);
+
+	GHashTableIter iter;
+	gpointer source, rds_id, key;
+	g_hash_table_iter_init(&iter, sources);
+	while (g_hash_table_iter_next(&iter, &source, NULL)) {
+		tagsistant_query(
+			"select rds_catalog.rds_id, checksum, reasoned from rds_sources "
+				"join rds_catalog on rds_catalog.rds_id = rds_sources.rds_id "
+				"where tagname = \"%s\"",
+			qtree->dbi, tagsistant_rds_add_key, keys, (gchar *) source);
+	}
+
+	g_hash_table_destroy(sources);
+
+	/* load the tags of the object as they are now */
+	GHashTable *tag_ids = g_hash_table_new(NULL, NULL);
+	if (g_hash_table_size(keys)) {
+		tagsistant_query(
+			"select tag_id from tagging where inode = %d",
+			qtree->dbi, tagsistant_rds_add_tag_id, tag_ids, qtree->inode);
+	}
+
+	g_hash_table_iter_init(&iter, keys);
+	while (g_hash_table_iter_next(&iter, &rds_id, &key)) {
+		gboolean member = FALSE;
+
+		if (tagsistant_rds_check_object((gchar *) key, tag_ids, &member)) {
+			/* the object is removed anyway, so a rename is applied too */
+			int present = 0;
+			tagsistant_query(
+				"select 1 from rds where rds_id = %d and inode = %d limit 1",
+				qtree->dbi, tagsistant_return_integer, &present, GPOINTER_TO_UINT(rds_id), qtree->inode);
+
+			tagsistant_query(
+				"delete from rds where rds_id = %d and inode = %d",
+				qtree->dbi, NULL, NULL, GPOINTER_TO_UINT(rds_id), qtree->inode);
+
+			if (member) {
+				tagsistant_query(
+					"insert into rds select %d, inode, objectname from objects where inode = %d",
+					qtree->dbi, NULL, NULL, GPOINTER_TO_UINT(rds_id), qtree->inode);
+			}
+
+			tagsistant_rds_cache_resize(GPOINTER_TO_UINT(rds_id), (member ? 1 : 0) - present);
+
+			g_atomic_int_inc(&tagsistant_rds_maintenance_stats.updated);
+		} else {
+			tagsistant_rds_delete(qtree->dbi, GPOINTER_TO_UINT(rds_id));
+			g_atomic_int_inc(&tagsistant_rds_maintenance_stats.deleted);
+		}
+	}
+
+	g_atomic_int_inc(&tagsistant_rds_maintenance_stats.objects);
+
+	g_hash_table_destroy(tag_ids);
+	g_hash_table_destroy(keys);
+}
+
+/*
+ * Publish a RDS just filled, so the other operations can find it:
+ * its sources are registered first, then its rds_catalog row.
+ *
+ * A RDS computed while a writer committed could be stale, so it's not
+ * published at all. The generation is checked again once the rds_catalog
+ * row is in: the insert can wait for a writer holding the RDS store, and
+ * a RDS found stale by then is withdrawn. If another connection published
+ * the same query meanwhile, the unique index on rds_catalog keeps only
+ * the first RDS and this one is dropped.
+ *
+ * @param qtree the querytree object
+ * @param rds_id the RDS id
+ * @param generation the write generation read before filling the RDS
+ * @return the id of the RDS published for the query, 0 if none
+ */
+static int tagsistant_rds_publish(tagsistant_querytree *qtree, int rds_id, gint generation)
+{
+	if (!tagsistant_db_write_generation_unchanged(generation)) {
+		dbg('f', LOG_INFO, "RDS %d not published: the database changed meanwhile", rds_id);
+		return (0);
+	}
+
+	gchar *checksum = tagsistant_get_rds_checksum(qtree);
+
+	/*
+	 * register the source tags of the RDS
+	 */
+	GHashTable *sources = tagsistant_rds_involved_sources(qtree);
+
+	GHashTableIter iter;
+	gpointer source;
+	g_hash_table_iter_init(&iter, sources);
+	while (g_hash_table_iter_next(&iter, &source, NULL)) {
+		tagsistant_query(
+			"insert into rds_sources (tagname, rds_id) values (\"%s\", %d)",
+			qtree->dbi, NULL, NULL, (gchar *) source, rds_id);
+	}
+
+	g_hash_table_destroy(sources);
+
+	switch (tagsistant.sql_database_driver) {
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			tagsistant_query(
+				"insert into rds_catalog (rds_id, checksum, reasoned, creation) values (%d, \"%s\", %d, now())",
+				qtree->dbi, NULL, NULL, rds_id, checksum, qtree->do_reasoning);
+			break;
+		default:
+			tagsistant_query(
+				"insert into rds_catalog (rds_id, checksum, reasoned, creation) values (%d, \"%s\", %d, datetime(\"now\"))",
+				qtree->dbi, NULL, NULL, rds_id, checksum, qtree->do_reasoning);
+			break;
+	}
+
+	int published = 0;
+	tagsistant_query(
+		"select rds_id from rds_catalog where checksum = \"%s\" and reasoned = %d",
+		qtree->dbi, tagsistant_return_integer, &published, checksum, qtree->do_reasoning);
+
+	if ((published == rds_id) && !tagsistant_db_write_generation_unchanged(generation)) {
+		dbg('f', LOG_INFO, "RDS %d withdrawn: the database changed while publishing it", rds_id);
+		tagsistant_query("delete from rds_catalog where rds_id = %d", qtree->dbi, NULL, NULL, rds_id);
+		published = 0;
+	}
+
+	if (published == rds_id) {
+		tagsistant_rds_register(qtree, checksum);
+	} else {
+		tagsistant_query("delete from rds_sources where rds_id = %d", qtree->dbi, NULL, NULL, rds_id);
+	}
+
+	g_free(checksum);
+	return (published);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/*** Query planning                                                               ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * Before a RDS is filled, the AND nodes of each subquery are sorted by
+ * the number of objects they match, the smallest first, so the filling
+ * starts from the smallest set instead of the first tag typed. The
+ * counts are those of the posting lists (see tagsistant_posting_cardinality()),
+ * kept up to date by the tagging write paths. A subquery requiring a tag
+ * with no objects matches nothing, and if all the subqueries do, the RDS
+ * is left empty without running any query.
+ *
+ * Until the posting lists are loaded, for nodes requiring SQL (the
+ * range and contains operators), or when the query runs inside a
+ * transaction and could see taggings the posting lists don't know
+ * about yet, nothing is known and the typed order is kept. The last plans are shown in /stats/plans.
+ */
+
+/** an AND node being planned */
+typedef struct {
+	/** the node */
+	qtree_and_node *node;
+
+	/** the objects it matches, -1 if unknown */
+	gint64 estimate;
+
+	/** its position as typed */
+	guint position;
+} tagsistant_rds_planned_node;
+
+/** the last plans, for /stats/plans */
+static struct {
+	/** guards the other fields */
+	GMutex lock;
+
+	/** the plans, a ring */
+	gchar *plans[TAGSISTANT_RDS_PLANS];
+
+	/** the slot of the next plan */
+	guint next;
+} tagsistant_rds_plans;
+
+/**
+ * Estimate the objects matched by a node and its related nodes
+ *
+ * @param node the node
+ * @return the objects, -1 if unknown
+ */
+static gint64 tagsistant_rds_estimate(qtree_and_node *node)
+{
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	gint64 estimate = 0;
+
+	for (; node; node = node->related) {
+		if (!node->tag_id || (node->value && strlen(node->value) && (TAGSISTANT_EQUAL_TO != node->operator)))
+			return (-1);
+
+		gint cardinality = tagsistant_posting_cardinality(node->tag_id);
+		if (cardinality < 0) return (-1);
+
+		estimate += cardinality;
+	}
+
+	return (estimate);
+#else
+	(void) node;
+	return (-1);
+#endif
+}
+
+/**
+ * Sort planned nodes: known estimates first, the smallest first,
+ * then the unknown ones in typed order
+ */
+static gint tagsistant_rds_planned_node_compare(gconstpointer a, gconstpointer b)
+{
+	const tagsistant_rds_planned_node *first = (const tagsistant_rds_planned_node *) a;
+	const tagsistant_rds_planned_node *second = (const tagsistant_rds_planned_node *) b;
+
+	if ((first->estimate < 0) != (second->estimate < 0)) return ((first->estimate < 0) ? 1 : -1);
+	if (first->estimate < second->estimate) return (-1);
+	if (first->estimate > second->estimate) return (1);
+	return ((gint) first->position - (gint) second->position);
+}
+
+/**
+ * Remember a plan for /stats/plans
+ *
+ * @param plan the plan, taken over
+ */
+static void tagsistant_rds_remember_plan(gchar *plan)
+{
+	g_mutex_lock(&tagsistant_rds_plans.lock);
+
+	g_free(tagsistant_rds_plans.plans[tagsistant_rds_plans.next]);
+	tagsistant_rds_plans.plans[tagsistant_rds_plans.next] = plan;
+	tagsistant_rds_plans.next = (tagsistant_rds_plans.next + 1) % TAGSISTANT_RDS_PLANS;
+
+	g_mutex_unlock(&tagsistant_rds_plans.lock);
+}
+
+/**
+ * Plan a query: sort the AND nodes of each subquery, in place,
+ * by the objects they match
+ *
+ * @param qtree the querytree object, private to the caller
+ * @param uncommitted true if the query can see uncommitted taggings
+ * @return true if the query can't match any object
+ */
+static gboolean tagsistant_rds_plan(tagsistant_querytree *qtree, gboolean uncommitted)
+{
+	gboolean empty = TRUE;
+
+	gchar *path = tagsistant_rds_path(qtree);
+	GString *plan = g_string_sized_new(256);
+	g_string_append_printf(plan, "%s\n", path);
+	g_free(path);
+
+	GArray *nodes = g_array_new(FALSE, FALSE, sizeof(tagsistant_rds_planned_node));
+
+	qtree_or_node *query;
+	for (query = qtree->tree; query; query = query->next) {
+		g_array_set_size(nodes, 0);
+
+		qtree_and_node *and;
+		for (and = query->and_set; and; and = and->next) {
+			tagsistant_rds_planned_node planned = { and, uncommitted ? -1 : tagsistant_rds_estimate(and), nodes->len };
+			g_array_append_val(nodes, planned);
+		}
+
+		if (!nodes->len) continue;
+
+		g_array_sort(nodes, tagsistant_rds_planned_node_compare);
+
+		/* relink the nodes in the new order */
+		guint i;
+		for (i = 0; i < nodes->len; i++) {
+			g_array_index(nodes, tagsistant_rds_planned_node, i).node->next = (i + 1 < nodes->len)
+				? g_array_index(nodes, tagsistant_rds_planned_node, i + 1).node
+				: NULL;
+		}
+		query->and_set = g_array_index(nodes, tagsistant_rds_planned_node, 0).node;
+
+		/* the smallest node comes first, so an empty subquery starts with a zero */
+		gboolean matches_nothing = (0 == g_array_index(nodes, tagsistant_rds_planned_node, 0).estimate);
+		if (!matches_nothing) empty = FALSE;
+
+		g_string_append(plan, "  ");
+		for (i = 0; i < nodes->len; i++) {
+			tagsistant_rds_planned_node *planned = &g_array_index(nodes, tagsistant_rds_planned_node, i);
+			const gchar *name = planned->node->tag ? planned->node->tag : planned->node->namespace;
+
+			if (planned->estimate < 0)
+				g_string_append_printf(plan, "%s%s(?)", i ? " + " : "", name);
+			else
+				g_string_append_printf(plan, "%s%s(%" G_GINT64_FORMAT ")", i ? " + " : "", name, planned->estimate);
+		}
+		g_string_append(plan, matches_nothing ? " => empty\n" : "\n");
+	}
+
+	g_array_free(nodes, TRUE);
+
+	if (empty) g_string_append(plan, "  nothing to do\n");
+	tagsistant_rds_remember_plan(g_string_free(plan, FALSE));
+
+	return (empty);
+}
+
+/**
+ * Report the last query plans
+ *
+ * @param stats_buffer the buffer receiving the report
+ */
+void tagsistant_rds_plans_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
 {
-	/* Cast the hash table */
-	GHashTable *hash_table = (GHashTable *) hash_table_pointer;
+	GString *report = g_string_sized_new(TAGSISTANT_STATS_BUFFER);
 
-	/* fetch query results */
-	gchar *name = dbi_result_get_string_copy_idx(result, 1);
-	if (!name) return (0);
+	g_mutex_lock(&tagsistant_rds_plans.lock);
 
-	tagsistant_inode inode = dbi_result_get_uint_idx(result, 2);
+	/* the most recent first */
+	guint i;
+	for (i = 1; i <= TAGSISTANT_RDS_PLANS; i++) {
+		gchar *plan = tagsistant_rds_plans.plans[(tagsistant_rds_plans.next + TAGSISTANT_RDS_PLANS - i) % TAGSISTANT_RDS_PLANS];
+		if (plan) g_string_append(report, plan);
+	}
 
-	/* lookup the GList object */
-	GList *list = g_hash_table_lookup(hash_table, name);
+	g_mutex_unlock(&tagsistant_rds_plans.lock);
 
-	/* look for duplicates due to reasoning results */
-	GList *list_tmp = list;
-	while (list_tmp) {
-		tagsistant_file_handle *fh_tmp = (tagsistant_file_handle *) list_tmp->data;
+	g_strlcpy(stats_buffer, report->str, TAGSISTANT_STATS_BUFFER);
+	g_string_free(report, TRUE);
+}
 
-		if (fh_tmp && (fh_tmp->inode == inode)) {
-			g_free_null(name);
-			return (0);
-		}
+/************************************************************************************/
+/***                                                                              ***/
+/*** Query compilation                                                            ***/
+/***                                                                              ***/
+/************************************************************************************/
 
-		list_tmp = list_tmp->next;
-	}
+/*
+ * A RDS is filled by a single statement, compiled from the querytree as
+ * set algebra: each subquery is the intersection of the sets of objects
+ * tagged by its tags, minus the sets of its negated tags, and the RDS is
+ * the union of the subqueries. Backends having INTERSECT and EXCEPT get
+ * them over indexed tagging lookups; the others (MySQL) get a single
+ * scan of tagging per subquery, grouped by inode and filtered by HAVING.
+ *
+ * The old strategy, a temporary table per subquery filtered by a delete
+ * per tag, is still available with --rds-temporary-tables.
+ *
+ * With --rds-parallelism greater than 1, the subqueries of a query are
+ * instead selected by a pool of workers, each on a read connection of
+ * its own, and their union is done in memory.
+ */
 
-	/* fetch query results into tagsistant_file_handle struct */
-	tagsistant_file_handle *fh = g_new0(tagsistant_file_handle, 1);
-	if (!fh) {
-		g_free_null(name);
-		return (0);
-	}
+/** the ways a RDS can be filled */
+enum {
+	TAGSISTANT_RDS_BY_POSTING_LISTS,
+	TAGSISTANT_RDS_BY_SET_ALGEBRA,
+	TAGSISTANT_RDS_BY_PARALLEL_SUBQUERIES,
+	TAGSISTANT_RDS_BY_TEMPORARY_TABLES,
+	TAGSISTANT_RDS_BY_PLANNING,
+	TAGSISTANT_RDS_METHODS
+};
 
-	g_strlcpy(fh->name, name, 1024);
-	fh->inode = inode;
-	g_free_null(name);
+/** the RDS filled by each method and the microseconds spent */
+static struct {
+	/** guards the other fields */
+	GMutex lock;
 
-	/* add the new element */
-	// TODO valgrind says: check for leaks
-	g_hash_table_insert(hash_table, g_strdup(fh->name), g_list_prepend(list, fh));
+	/** the RDS filled */
+	int count[TAGSISTANT_RDS_METHODS];
 
-//	dbg('f', LOG_INFO, "adding (%d,%s) to filetree", fh->inode, fh->name);
+	/** the microseconds spent filling them */
+	gint64 elapsed[TAGSISTANT_RDS_METHODS];
+} tagsistant_rds_methods;
 
-	return (0);
+/**
+ * Add the condition matching a tag or any of its related tags
+ *
+ * @param statement the statement being built
+ * @param node the tag
+ */
+static void tagsistant_rds_add_condition(GString *statement, qtree_and_node *node)
+{
+	g_string_append(statement, "(");
+	tagsistant_query_add_and_set(statement, node);
+
+	qtree_and_node *related;
+	for (related = node->related; related; related = related->related) {
+		g_string_append(statement, " or ");
+		tagsistant_query_add_and_set(statement, related);
+	}
+
+	g_string_append(statement, ")");
 }
 
 /**
- * Add a filter criterion to a WHERE clause based on a qtree_and_node object
+ * Add the select of the inodes tagged by a tag or any of its related tags
  *
- * @param statement a GString object holding the building query statement
- * @param and_set the qtree_and_node object describing the tag to be added as a criterion
+ * @param statement the statement being built
+ * @param node the tag
  */
-void tagsistant_query_add_and_set(GString *statement, qtree_and_node *and_set)
+static void tagsistant_rds_add_tagged_set(GString *statement, qtree_and_node *node)
 {
-	if (and_set->value && strlen(and_set->value)) {
-		switch (and_set->operator) {
-			case TAGSISTANT_EQUAL_TO:
-				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value = \"%s\" ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
-				break;
-			case TAGSISTANT_CONTAINS:
-				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value like '%%%s%%' ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
-				break;
-			case TAGSISTANT_GREATER_THAN:
-				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value > \"%s\" ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
-				break;
-			case TAGSISTANT_SMALLER_THAN:
-				g_string_append_printf(statement,
-					"tagname = \"%s\" and `key` = \"%s\" and value < \"%s\" ",
-					and_set->namespace,
-					and_set->key,
-					and_set->value);
-				break;
+	g_string_append(statement,
+		"select tagging.inode from tagging "
+			"join tags on tags.tag_id = tagging.tag_id "
+			"where ");
+	tagsistant_rds_add_condition(statement, node);
+}
+
+/**
+ * Compile a subquery with INTERSECT and EXCEPT
+ *
+ * @param statement the statement being built
+ * @param query the subquery
+ */
+static void tagsistant_rds_compile_intersect(GString *statement, qtree_or_node *query)
+{
+	/* operators are applied left to right: (A intersect B) except N */
+	g_string_append(statement, "select inode from (");
+
+	qtree_and_node *and;
+	for (and = query->and_set; and; and = and->next) {
+		if (and != query->and_set) g_string_append(statement, " intersect ");
+		tagsistant_rds_add_tagged_set(statement, and);
+	}
+
+	for (and = query->and_set; and; and = and->next) {
+		qtree_and_node *negated;
+		for (negated = and->negated; negated; negated = negated->negated) {
+			g_string_append(statement, " except ");
+			tagsistant_rds_add_tagged_set(statement, negated);
 		}
-	} else if (and_set->tag) {
-		g_string_append_printf(statement, "tagname = \"%s\" ", and_set->tag);
-	} else if (and_set->tag_id) {
-		g_string_append_printf(statement, "tagging.tag_id = %d ", and_set->tag_id);
 	}
+
+	g_string_append(statement, ")");
 }
 
-/*
- * Return the query portion up to the delimiter token
+/**
+ * Compile a subquery with GROUP BY and HAVING, for backends
+ * lacking INTERSECT: an object is kept if, among its taggings,
+ * each tag of the subquery matches at least once.
  *
- * @param qtree the tagsistant_querytree object
- * @return a string containing the query up to the delimiter token
+ * @param statement the statement being built
+ * @param query the subquery
  */
-gchar *tagsistant_rds_path(tagsistant_querytree *qtree)
+static void tagsistant_rds_compile_group(GString *statement, qtree_or_node *query)
 {
-	gchar *path = g_strdup(qtree->expanded_full_path);
-	gchar *delimiter = strstr(path, TAGSISTANT_QUERY_DELIMITER);
-	if (delimiter) { *delimiter = '\0'; }
-	return (path);
+	g_string_append(statement,
+		"select tagging.inode from tagging "
+			"join tags on tags.tag_id = tagging.tag_id "
+			"where (");
+
+	qtree_and_node *and;
+	for (and = query->and_set; and; and = and->next) {
+		if (and != query->and_set) g_string_append(statement, " or ");
+		tagsistant_rds_add_condition(statement, and);
+	}
+
+	g_string_append(statement, ")");
+
+	for (and = query->and_set; and; and = and->next) {
+		qtree_and_node *negated;
+		for (negated = and->negated; negated; negated = negated->negated) {
+			g_string_append(statement, " and tagging.inode not in (");
+			tagsistant_rds_add_tagged_set(statement, negated);
+			g_string_append(statement, ")");
+		}
+	}
+
+	g_string_append(statement, " group by tagging.inode having ");
+
+	for (and = query->and_set; and; and = and->next) {
+		if (and != query->and_set) g_string_append(statement, " and ");
+		g_string_append(statement, "max(case when ");
+		tagsistant_rds_add_condition(statement, and);
+		g_string_append(statement, " then 1 else 0 end) = 1");
+	}
 }
 
-/*
- * Compute the checksum identifying a RDS
+/**
+ * Compile a querytree into the select of the tuples of its RDS
  *
- * @param qtree the tagsistant_querytree object
- * @return a string containing the checksum
+ * @param qtree the querytree object
+ * @param rds_id the RDS id
+ * @return the statement, to be freed with g_string_free()
  */
-gchar *tagsistant_get_rds_checksum(tagsistant_querytree *qtree)
+static GString *tagsistant_rds_compile(tagsistant_querytree *qtree, int rds_id)
 {
-	/*
-	 * Extract the path to be looked up
-	 */
-	gchar *path = tagsistant_rds_path(qtree);
+	GString *statement = g_string_sized_new(10240);
+	g_string_append_printf(statement,
+		"select %d, objects.inode, objects.objectname from objects "
+			"where objects.inode in (",
+		rds_id);
+
+	qtree_or_node *query;
+	for (query = qtree->tree; query; query = query->next) {
+		if (query != qtree->tree) g_string_append(statement, " union ");
+
+		if (tagsistant.sql_backend_have_intersect)
+			tagsistant_rds_compile_intersect(statement, query);
+		else
+			tagsistant_rds_compile_group(statement, query);
+	}
 
-	/*
-	 * compute the checksum
-	 */
-	gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+	g_string_append(statement, ")");
 
-	g_free(path);
-	return (checksum);
+	return (statement);
 }
 
 /*
- * Lookup the id of the RDS of a query.
+ * Fill a RDS with a single statement
  *
- * @param query the query that generates the RDS
- * @param materialized set to one if the RDS exists
- * @return the RDS id
+ * @param qtree the querytree object
+ * @param rds_id the RDS id
  */
-gchar *tagsistant_get_rds_id(tagsistant_querytree *qtree, int *materialized)
+static void tagsistant_rds_fill_by_set_algebra(tagsistant_querytree *qtree, int rds_id)
 {
-	/*
-	 * compute the checksum
-	 */
-	gchar *checksum = tagsistant_get_rds_checksum(qtree);
+	GString *statement = tagsistant_rds_compile(qtree, rds_id);
+	g_string_prepend(statement, "insert into rds ");
+	tagsistant_query_sql(statement->str, qtree->dbi, NULL, NULL);
+	g_string_free(statement, TRUE);
+}
 
-	/*
-	 * check if the RDS has been materialized
-	 */
-	tagsistant_query(
-		"select 1 from rds where id = \"%s\" and reasoned = %d limit 1",
-		qtree->dbi, tagsistant_return_integer, materialized, checksum, qtree->do_reasoning);
+/** the workers selecting the subqueries, NULL if not running */
+static GThreadPool *tagsistant_rds_workers = NULL;
 
-	return (checksum);
+/** a query whose subqueries are selected by the workers */
+typedef struct {
+	/** guards pending */
+	GMutex lock;
+
+	/** signaled when the last subquery is done */
+	GCond done;
+
+	/** the subqueries not done yet */
+	int pending;
+} tagsistant_rds_parallel_query;
+
+/** a subquery assigned to a worker */
+typedef struct {
+	/** the query the subquery belongs to */
+	tagsistant_rds_parallel_query *query;
+
+	/** the subquery */
+	qtree_or_node *subquery;
+
+	/** the inodes selected by the subquery */
+	GArray *inodes;
+} tagsistant_rds_branch;
+
+/**
+ * Worker. Select the inodes of a subquery on a read connection.
+ *
+ * @param data the tagsistant_rds_branch
+ * @param user_data unused
+ */
+static void tagsistant_rds_select_branch(gpointer data, gpointer user_data)
+{
+	(void) user_data;
+
+	tagsistant_rds_branch *branch = (tagsistant_rds_branch *) data;
+
+	GString *statement = g_string_sized_new(4096);
+	if (tagsistant.sql_backend_have_intersect)
+		tagsistant_rds_compile_intersect(statement, branch->subquery);
+	else
+		tagsistant_rds_compile_group(statement, branch->subquery);
+
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	tagsistant_query_sql(statement->str, dbi, tagsistant_rds_add_id, branch->inodes);
+	tagsistant_db_connection_release(dbi, 0);
+
+	g_string_free(statement, TRUE);
+
+	g_mutex_lock(&branch->query->lock);
+	if (0 == --branch->query->pending) g_cond_signal(&branch->query->done);
+	g_mutex_unlock(&branch->query->lock);
 }
 
-/*
- * Append a tag to a sources GString
+/**
+ * Start the workers selecting the subqueries, if --rds-parallelism
+ * asks for more than one.
  *
- * @param sources a GString object containing the source string
- * @param and a qtree_and_node to be added to the source string
+ * With --group-commit the workers are not started: a reader joins
+ * the shared transaction while it's open, and its lock can be held
+ * by the thread waiting for them.
  */
-void tagsistant_register_rds_source(GString *sources, qtree_and_node *and)
+static void tagsistant_rds_workers_init()
 {
-	gchar *tag = (and->namespace && strlen(and->namespace)) ? and->namespace : and->tag;
-	g_string_append(sources, tag);
-	g_string_append(sources, "|");
+	if (tagsistant.rds_parallelism <= 1 || tagsistant.group_commit) return;
+
+	tagsistant_rds_workers = g_thread_pool_new(tagsistant_rds_select_branch, NULL, tagsistant.rds_parallelism, FALSE, NULL);
 }
 
-/*
- * Create a new RDS for the query and return its id.
+/**
+ * Fill a RDS selecting its subqueries in parallel. The inodes selected
+ * by more subqueries are added once, and the RDS is filled on the query
+ * connection by TAGSISTANT_RDS_PARALLEL_CHUNK inodes per statement.
  *
- * @param query the query that generates the RDS
- * @return the RDS id
+ * The workers select on their own connections, so they don't see the
+ * uncommitted changes of the query transaction: queries running inside
+ * a transaction are never filled this way (see tagsistant_materialize_rds()).
+ *
+ * @param qtree the querytree object
+ * @param rds_id the RDS id
  */
-gchar *tagsistant_compute_rds_sources(tagsistant_querytree *qtree)
+static void tagsistant_rds_fill_by_parallel_subqueries(tagsistant_querytree *qtree, int rds_id)
 {
-	GString *sources = g_string_sized_new(64000);
-	g_string_append(sources, "|");
+	tagsistant_rds_parallel_query query;
+	g_mutex_init(&query.lock);
+	g_cond_init(&query.done);
+	query.pending = 0;
+
+	GPtrArray *branches = g_ptr_array_new();
+
+	qtree_or_node *subquery;
+	for (subquery = qtree->tree; subquery; subquery = subquery->next) {
+		tagsistant_rds_branch *branch = g_new0(tagsistant_rds_branch, 1);
+		branch->query = &query;
+		branch->subquery = subquery;
+		branch->inodes = g_array_new(FALSE, FALSE, sizeof(int));
+		g_ptr_array_add(branches, branch);
+	}
+
+	query.pending = branches->len;
+
+	guint i;
+	for (i = 0; i < branches->len; i++)
+		g_thread_pool_push(tagsistant_rds_workers, g_ptr_array_index(branches, i), NULL);
+
+	g_mutex_lock(&query.lock);
+	while (query.pending) g_cond_wait(&query.done, &query.lock);
+	g_mutex_unlock(&query.lock);
 
 	/*
-	 * For every subquery, save the source tags
+	 * union the subqueries, adding each inode once
 	 */
-	qtree_or_node *query = qtree->tree;
-	while (query) {
-		/*
-		 * Register every tag...
-		 */
-		qtree_and_node *and = query->and_set;
+	GHashTable *added = g_hash_table_new(NULL, NULL);
+	GString *inodes = g_string_sized_new(TAGSISTANT_RDS_PARALLEL_CHUNK * 8);
+	int chunked = 0;
 
-		while (and) {
-			tagsistant_register_rds_source(sources, and);
+	for (i = 0; i < branches->len; i++) {
+		tagsistant_rds_branch *branch = g_ptr_array_index(branches, i);
 
-			/*
-			 * ... and every related tag ...
-			 */
-			qtree_and_node *related = and->related;
-			while (related) {
-				tagsistant_register_rds_source(sources, related);
-				related = related->related;
-			}
+		guint j;
+		for (j = 0; j < branch->inodes->len; j++) {
+			int inode = g_array_index(branch->inodes, int, j);
+			if (g_hash_table_contains(added, GINT_TO_POINTER(inode))) continue;
+			g_hash_table_add(added, GINT_TO_POINTER(inode));
 
-			/*
-			 * ... and even negated tags.
-			 */
-			qtree_and_node *negated = and->negated;
-			while (negated) {
-				tagsistant_register_rds_source(sources, negated);
-				negated = negated->negated;
-			}
+			g_string_append_printf(inodes, chunked ? ", %d" : "%d", inode);
+			if (++chunked < TAGSISTANT_RDS_PARALLEL_CHUNK) continue;
 
-			and = and->next;
+			tagsistant_query(
+				"insert into rds select %d, inode, objectname from objects where inode in (%s)",
+				qtree->dbi, NULL, NULL, rds_id, inodes->str);
+
+			g_string_truncate(inodes, 0);
+			chunked = 0;
 		}
-		query = query->next;
+
+		g_array_free(branch->inodes, TRUE);
+		g_free(branch);
 	}
 
-	/*
-	 * Free the GString object and return the sources string
-	 */
-	gchar *source_string = sources->str;
-	g_string_free(sources, FALSE);
+	if (chunked) {
+		tagsistant_query(
+			"insert into rds select %d, inode, objectname from objects where inode in (%s)",
+			qtree->dbi, NULL, NULL, rds_id, inodes->str);
+	}
 
-	return (source_string);
+	g_string_free(inodes, TRUE);
+	g_hash_table_destroy(added);
+	g_ptr_array_free(branches, TRUE);
+
+	g_cond_clear(&query.done);
+	g_mutex_clear(&query.lock);
 }
 
 /*
- * Materialize the RDS of a query
+ * Fill a RDS with a temporary table per subquery
  *
  * @param qtree the querytree object
- * @return the RDS checksum id
+ * @param rds_id the RDS id
  */
-gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
+static void tagsistant_rds_fill_by_temporary_tables(tagsistant_querytree *qtree, int rds_id)
 {
 	/*
 	 * PHASE 1.
@@ -295,7 +1569,7 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 		/*
 		 * create the table and dispose the statement GString
 		 */
-		tagsistant_query(create_base_table->str, qtree->dbi, NULL, NULL);
+		tagsistant_query_sql(create_base_table->str, qtree->dbi, NULL, NULL);
 		g_string_free(create_base_table, TRUE);
 
 		/*
@@ -334,7 +1608,7 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 			/*
 			 * apply the query and dispose the statement GString
 			 */
-			tagsistant_query(cross_tag->str, qtree->dbi, NULL, NULL);
+			tagsistant_query_sql(cross_tag->str, qtree->dbi, NULL, NULL);
 			g_string_free(cross_tag, TRUE);
 
 			next = next->next;
@@ -378,7 +1652,7 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 				/*
 				 * apply the query and dispose the statement GString
 				 */
-				tagsistant_query(cross_tag->str, qtree->dbi, NULL, NULL);
+				tagsistant_query_sql(cross_tag->str, qtree->dbi, NULL, NULL);
 				g_string_free(cross_tag, TRUE);
 
 				negated = negated->negated;
@@ -396,12 +1670,6 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 	/*
 	 * PHASE 2.
 	 *
-	 * Create a new RDS
-	 */
-	gchar *checksum = tagsistant_get_rds_checksum(qtree);
-	gchar *sources = tagsistant_compute_rds_sources(qtree);
-
-	/*
 	 * format the main statement which reads from the temporary
 	 * tables using UNION and ordering the files
 	 */
@@ -410,23 +1678,9 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 	query = qtree->tree;
 
 	while (query) {
-		switch (tagsistant.sql_database_driver) {
-			case TAGSISTANT_DBI_SQLITE_BACKEND:
-				g_string_append_printf(view_statement,
-					"select \"%s\", %d, inode, objectname, \"%s\", datetime(\"now\") from tv%.16" PRIxPTR,
-					checksum, qtree->do_reasoning, sources, (uintptr_t) query);
-				break;
-			case TAGSISTANT_DBI_MYSQL_BACKEND:
-				g_string_append_printf(view_statement,
-					"select \"%s\", %d, inode, objectname, \"%s\", now() from tv%.16" PRIxPTR,
-					checksum, qtree->do_reasoning, sources, (uintptr_t) query);
-				break;
-			default:
-				g_string_append_printf(view_statement,
-					"select \"%s\", %d, inode, objectname, \"%s\", \"\" from tv%.16" PRIxPTR,
-					checksum, qtree->do_reasoning, sources, (uintptr_t) query);
-				break;
-		}
+		g_string_append_printf(view_statement,
+			"select %d, inode, objectname from tv%.16" PRIxPTR,
+			rds_id, (uintptr_t) query);
 
 		if (query->next) g_string_append(view_statement, " union ");
 		query = query->next;
@@ -443,7 +1697,6 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 	 * free the SQL statement and any other intermediate string
 	 */
 	g_string_free(view_statement, TRUE);
-	g_free(sources);
 
 	/*
 	 * PHASE 3.
@@ -456,147 +1709,270 @@ gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree)
 		query = query->next;
 	}
 
-	return (checksum);
 }
 
-/**
- * Deletes the oldest RDS from the rds table
+/*
+ * Materialize the RDS of a query
  *
- * @param qtree the querytree object used for DBI access
+ * @param qtree the querytree object
+ * @return the RDS id
  */
-void
-tagsistant_rds_delete_oldest(tagsistant_querytree *qtree)
+int tagsistant_materialize_rds(tagsistant_querytree *qtree)
 {
-	int rds_id;
-	tagsistant_query("select min(id) from rds", qtree->dbi, tagsistant_return_integer, &rds_id);
-	dbg('f', LOG_INFO, "Garbage collector: deleting rds %d", rds_id);
-	tagsistant_query("delete from rds where id = %d", qtree->dbi, NULL, NULL, rds_id);
-}
+	gint generation = tagsistant_db_write_generation();
+	gint64 start = g_get_monotonic_time();
 
-/**
- * RDS garbage collector
- *
- * @param qtree the querytree object used for DBI access
- */
-void
-tagsistant_rds_garbage_collector(tagsistant_querytree *qtree)
-{
-	int declared_rds = 0;
-	tagsistant_query("select count(distinct id) from rds", qtree->dbi, tagsistant_return_integer, &declared_rds);
+	if (qtree->transaction_started) tagsistant_db_claim_rds_store(qtree->dbi);
 
-	while (declared_rds > TAGSISTANT_GC_RDS) {
-		tagsistant_rds_delete_oldest(qtree);
-		declared_rds--;
-	}
+	/*
+	 * a query running inside a transaction, its own or the shared one of
+	 * group commit, sees taggings the posting lists don't know about yet
+	 */
+	gboolean uncommitted = qtree->transaction_started || tagsistant_db_in_transaction(qtree->dbi);
 
-	int stored_tuples = 0;
-	tagsistant_query("select count(*) from rds", qtree->dbi, tagsistant_return_integer, &stored_tuples);
+	int rds_id = g_atomic_int_add(&tagsistant_rds_cache.last_id, 1) + 1;
 
-	if (stored_tuples > TAGSISTANT_GC_TUPLES) {
-		tagsistant_rds_delete_oldest(qtree);
-	}
-}
+	int method = TAGSISTANT_RDS_BY_SET_ALGEBRA;
+	if (tagsistant.rds_temporary_tables) method = TAGSISTANT_RDS_BY_TEMPORARY_TABLES;
 
-/**
- * build a linked list of filenames that satisfy the querytree
- * object. This is translated in a two phase flow:
- *
- * 1. each qtree_and_node list is translated into one
- * (temporary) table
- *
- * 2. the content of all tables are read in with a UNION
- * chain inside a super-select to apply the ORDER BY clause.
- *
- * 3. all the (temporary) tables are removed
- *
- * @param query the qtree_or_node query structure to be resolved
- * @param conn a libDBI dbi_conn handle
- * @param is_all_path is true when the path includes the ALL/ tag
- * @return a pointer to a GHashTable of tagsistant_file_handle objects
- */
-GHashTable *tagsistant_rds_new(tagsistant_querytree *qtree, int is_all_path)
-{
 	/*
-	 * Calls the garbage collector
+	 * Start from the smallest tags, or skip the filling if the query can't match
 	 */
-	tagsistant_rds_garbage_collector(qtree);
+	if (tagsistant_rds_plan(qtree, uncommitted))
+		method = TAGSISTANT_RDS_BY_PLANNING;
 
+#if TAGSISTANT_ENABLE_POSTING_LISTS
 	/*
-	 * If the query contains the ALL meta-tag, just select all the available
-	 * objects and return them
+	 * Resolve the query on the in-memory posting lists, if loaded
 	 */
-	if (is_all_path) {
-		GHashTable *file_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	else if (!uncommitted && tagsistant_posting_materialize_rds(qtree, rds_id))
+		method = TAGSISTANT_RDS_BY_POSTING_LISTS;
+#endif
 
-		tagsistant_query(
-			"select objectname, inode from objects",
-			qtree->dbi, tagsistant_add_to_fileset, file_hash);
+	/*
+	 * Select the subqueries in parallel, if there's more than one and
+	 * the query has no transaction whose changes the workers can't see
+	 */
+	if ((TAGSISTANT_RDS_BY_SET_ALGEBRA == method) && tagsistant_rds_workers && !uncommitted && qtree->tree && qtree->tree->next)
+		method = TAGSISTANT_RDS_BY_PARALLEL_SUBQUERIES;
+
+	if (TAGSISTANT_RDS_BY_SET_ALGEBRA == method)
+		tagsistant_rds_fill_by_set_algebra(qtree, rds_id);
+	else if (TAGSISTANT_RDS_BY_PARALLEL_SUBQUERIES == method)
+		tagsistant_rds_fill_by_parallel_subqueries(qtree, rds_id);
+	else if (TAGSISTANT_RDS_BY_TEMPORARY_TABLES == method)
+		tagsistant_rds_fill_by_temporary_tables(qtree, rds_id);
 
-		return(file_hash);
+	g_mutex_lock(&tagsistant_rds_methods.lock);
+	tagsistant_rds_methods.count[method]++;
+	tagsistant_rds_methods.elapsed[method] += g_get_monotonic_time() - start;
+	g_mutex_unlock(&tagsistant_rds_methods.lock);
+
+	int published = tagsistant_rds_publish(qtree, rds_id, generation);
+
+	/*
+	 * another connection published the same RDS first: use that one
+	 */
+	if (published && (published != rds_id)) {
+		tagsistant_query("delete from rds where rds_id = %d", qtree->dbi, NULL, NULL, rds_id);
+		g_atomic_int_inc(&tagsistant_rds_cache.duplicates);
+		tagsistant_rds_cache_hit(published);
+		return (published);
 	}
 
+	/*
+	 * account the RDS, even if it was not published, to have it deleted
+	 */
+	int tuples = 0;
+	tagsistant_query("select count(*) from rds where rds_id = %d", qtree->dbi, tagsistant_return_integer, &tuples, rds_id);
+	tagsistant_rds_cache_add(rds_id, published != 0, tuples, g_get_monotonic_time() - start);
+
+	return (rds_id);
+}
+
+/**
+ * Report the work done maintaining the RDS
+ *
+ * @param stats_buffer the buffer receiving the report
+ */
+void tagsistant_rds_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
+{
+	g_mutex_lock(&tagsistant_rds_predicates_lock);
+	int predicates = tagsistant_rds_predicates ? (int) g_hash_table_size(tagsistant_rds_predicates) : 0;
+	g_mutex_unlock(&tagsistant_rds_predicates_lock);
+
+	g_mutex_lock(&tagsistant_rds_cache.lock);
+	int sets = tagsistant_rds_cache.sets;
+	gint64 tuples = tagsistant_rds_cache.tuples;
+	int hits = tagsistant_rds_cache.hits;
+	int misses = tagsistant_rds_cache.misses;
+	int unpublished = tagsistant_rds_cache.unpublished;
+	int evictions = tagsistant_rds_cache.evictions;
+	g_mutex_unlock(&tagsistant_rds_cache.lock);
+
+	g_mutex_lock(&tagsistant_rds_methods.lock);
+	int by_posting_lists = tagsistant_rds_methods.count[TAGSISTANT_RDS_BY_POSTING_LISTS];
+	gint64 posting_lists_elapsed = tagsistant_rds_methods.elapsed[TAGSISTANT_RDS_BY_POSTING_LISTS];
+	int by_set_algebra = tagsistant_rds_methods.count[TAGSISTANT_RDS_BY_SET_ALGEBRA];
+	gint64 set_algebra_elapsed = tagsistant_rds_methods.elapsed[TAGSISTANT_RDS_BY_SET_ALGEBRA];
+	int by_parallel_subqueries = tagsistant_rds_methods.count[TAGSISTANT_RDS_BY_PARALLEL_SUBQUERIES];
+	gint64 parallel_subqueries_elapsed = tagsistant_rds_methods.elapsed[TAGSISTANT_RDS_BY_PARALLEL_SUBQUERIES];
+	int by_temporary_tables = tagsistant_rds_methods.count[TAGSISTANT_RDS_BY_TEMPORARY_TABLES];
+	gint64 temporary_tables_elapsed = tagsistant_rds_methods.elapsed[TAGSISTANT_RDS_BY_TEMPORARY_TABLES];
+	int by_planning = tagsistant_rds_methods.count[TAGSISTANT_RDS_BY_PLANNING];
+	g_mutex_unlock(&tagsistant_rds_methods.lock);
+
+	g_snprintf(stats_buffer, TAGSISTANT_STATS_BUFFER,
+		"# of RDS: %d (limit: %d)\n"
+		"# of RDS tuples: %" G_GINT64_FORMAT " (limit: %d)\n"
+		"# of RDS hits: %d\n"
+		"# of RDS misses: %d\n"
+		"# of RDS materialized twice at the same time: %d\n"
+		"# of RDS not published since the database changed: %d\n"
+		"# of RDS evicted: %d\n"
+		"# of RDS filled on posting lists: %d (%" G_GINT64_FORMAT " microseconds)\n"
+		"# of RDS filled by a single statement: %d (%" G_GINT64_FORMAT " microseconds)\n"
+		"# of RDS filled by parallel subqueries: %d (%" G_GINT64_FORMAT " microseconds)\n"
+		"# of RDS filled by temporary tables: %d (%" G_GINT64_FORMAT " microseconds)\n"
+		"# of RDS left empty by the planner: %d\n"
+		"# of RDS with a predicate: %d\n"
+		"# of objects checked against their RDS: %d\n"
+		"# of RDS updated in place: %d\n"
+		"# of RDS deleted: %d\n",
+		sets, tagsistant.rds_max_sets,
+		tuples, tagsistant.rds_max_tuples,
+		hits,
+		misses,
+		g_atomic_int_get(&tagsistant_rds_cache.duplicates),
+		unpublished,
+		evictions,
+		by_posting_lists, posting_lists_elapsed,
+		by_set_algebra, set_algebra_elapsed,
+		by_parallel_subqueries, parallel_subqueries_elapsed,
+		by_temporary_tables, temporary_tables_elapsed,
+		by_planning,
+		predicates,
+		g_atomic_int_get(&tagsistant_rds_maintenance_stats.objects),
+		g_atomic_int_get(&tagsistant_rds_maintenance_stats.updated),
+		g_atomic_int_get(&tagsistant_rds_maintenance_stats.deleted));
+}
+
+/**
+ * List the objects that satisfy the querytree, streaming them to a
+ * filler function as they are read from the database. The RDS of the
+ * query is materialized first, if not already available.
+ *
+ * The filler gets each object with its name and inode, and a flag set
+ * when the name is shared by more objects, so the inode must be used
+ * to tell them apart. If the filler returns non zero, the listing stops.
+ *
+ * @param qtree the querytree to be resolved
+ * @param is_all_path is true when the path includes the ALL/ tag
+ * @param filler the function receiving the objects
+ * @param data passed to the filler as first argument
+ */
+void tagsistant_rds_list(tagsistant_querytree *qtree, int is_all_path, tagsistant_rds_filler filler, void *data)
+{
 	/*
 	 * a NULL query can't be processed
 	 */
 	if (!qtree) {
 		dbg('f', LOG_ERR, "NULL tagsistant_querytree object provided to %s", __func__);
-		return(NULL);
+		return;
 	}
 
-	qtree_or_node *query = qtree->tree;
+	tagsistant_rds_cursor cursor;
+	cursor.name = g_string_sized_new(1024);
+	cursor.inodes = g_array_new(FALSE, FALSE, sizeof(tagsistant_inode));
+	cursor.listed = g_hash_table_new(g_str_hash, g_str_equal);
+	cursor.interned = g_string_chunk_new(4096);
+	cursor.filler = filler;
+	cursor.data = data;
+	cursor.stop = 0;
+
+	if (is_all_path) {
+		/*
+		 * If the query contains the ALL meta-tag, just select all the available
+		 * objects
+		 */
+		tagsistant_query(
+			"select objectname, inode from objects order by objectname, inode",
+			qtree->dbi, tagsistant_rds_cursor_add, &cursor);
 
-	if (!query) {
+	} else if (!qtree->tree) {
 		dbg('f', LOG_ERR, "NULL qtree_or_node object provided to %s", __func__);
-		return(NULL);
-	}
 
-	/*
-	 * Get the RDS id
-	 */
-	int materialized = 0;
-	gchar *rds_id = tagsistant_get_rds_id(qtree, &materialized);
+	} else {
+		/*
+		 * Get the RDS id and materialize the RDS if required
+		 */
+		int rds_id = tagsistant_get_rds_id(qtree);
+		if (!rds_id) rds_id = tagsistant_materialize_rds(qtree);
 
-	/*
-	 * If the rds_id is not zero, load the objects from the RDS and return them
-	 */
-	if (!materialized) {
-		rds_id = tagsistant_materialize_rds(qtree);
+		/* the order is served by rds_index1 */
+		tagsistant_query(
+			"select objectname, inode from rds where rds_id = %d order by objectname, inode",
+			qtree->dbi, tagsistant_rds_cursor_add, &cursor, rds_id);
 	}
 
-	GHashTable *file_hash = g_hash_table_new(g_str_hash, g_str_equal);
-
-	tagsistant_query(
-		"select objectname, inode from rds where id = \"%s\" and reasoned = %d",
-		qtree->dbi, tagsistant_add_to_fileset, file_hash, rds_id, qtree->do_reasoning);
+	if (!cursor.stop) tagsistant_rds_cursor_flush(&cursor);
 
-	return (file_hash);
+	g_string_free(cursor.name, TRUE);
+	g_array_free(cursor.inodes, TRUE);
+	g_hash_table_destroy(cursor.listed);
+	g_string_chunk_free(cursor.interned);
 }
 
 /**
- * Destroy a filetree element GList list of tagsistant_file_handle.
- * This will free the GList data structure by first calling
- * tagsistant_filetree_destroy_value() on each linked node.
+ * Deletes every RDS having a tag among its sources
  *
- * @param key the entry of the GHashTable element to be cleared
- * @param list the value of the GHashTable element to be cleared which is a GList object
- * @param data unused
+ * @param tagname the name of the tag, or the namespace of a triple tag
+ * @param dbi the connection
  */
-void tagsistant_rds_destroy_value_list(gchar *key, GList *list, gpointer data)
+static void tagsistant_rds_delete_by_tagname(const gchar *tagname, dbi_conn dbi)
 {
-	(void) data;
+	/* served by the primary key of rds_sources */
+	GArray *rds_ids = g_array_new(FALSE, FALSE, sizeof(int));
+	tagsistant_query(
+		"select rds_id from rds_sources where tagname = \"%s\"",
+		dbi, tagsistant_rds_add_id, rds_ids, tagname);
 
-	g_free_null(key);
+	guint i;
+	for (i = 0; i < rds_ids->len; i++)
+		tagsistant_rds_delete(dbi, g_array_index(rds_ids, int, i));
 
-	if (list) g_list_free_full(list, (GDestroyNotify) g_free /* was tagsistant_filetree_destroy_value */);
+	g_array_free(rds_ids, TRUE);
 }
 
+/**
+ * Deletes every RDS having a tag among its sources
+ *
+ * @param node the node of the tag
+ * @param dbi the connection
+ */
 void tagsistant_delete_rds_by_source(qtree_and_node *node, dbi_conn dbi)
 {
 	gchar *tag = (node->tag && strlen(node->tag)) ? node->tag : node->namespace;
+	if (!tag) return;
 
-	tagsistant_query(
-		"delete from rds where tagset like \"%%|%s|%%\"",
-		dbi, NULL, NULL, tag);
+	tagsistant_rds_delete_by_tagname(tag, dbi);
+}
+
+/**
+ * Deletes every RDS having a tag among its sources, after an object
+ * has been tagged outside a query, like the plugins do. Empty RDS
+ * included: they are cached too, and the query planner trusts them.
+ * Works inside a write transaction, claiming the RDS store.
+ *
+ * @param tagname the name of the tag, or the namespace of a triple tag
+ * @param dbi the connection
+ */
+void tagsistant_delete_rds_by_tagname(const gchar *tagname, dbi_conn dbi)
+{
+	if (!tagname) return;
+
+	tagsistant_db_claim_rds_store(dbi);
+	tagsistant_rds_delete_by_tagname(tagname, dbi);
 }
 
 /**
@@ -606,10 +1982,20 @@ void tagsistant_delete_rds_by_source(qtree_and_node *node, dbi_conn dbi)
  */
 void tagsistant_delete_rds_involved(tagsistant_querytree *qtree)
 {
+	if (qtree->transaction_started) tagsistant_db_claim_rds_store(qtree->dbi);
+
+	/*
+	 * An object changed: update the RDS in place
+	 */
+	if (QTREE_POINTS_TO_OBJECT(qtree) && qtree->inode) {
+		tagsistant_rds_update_object(qtree);
+		return;
+	}
+
 #if 0
 	tagsistant_query("delete from rds", qtree->dbi, NULL, NULL);
-	tagsistant_query("delete from rds_index", qtree->dbi, NULL, NULL);
-	tagsistant_query("delete from rds_tags", qtree->dbi, NULL, NULL);
+	tagsistant_query("delete from rds_sources", qtree->dbi, NULL, NULL);
+	tagsistant_query("delete from rds_catalog", qtree->dbi, NULL, NULL);
 
 	return;
 #endif
@@ -172,9 +172,10 @@ static int tagsistant_add_reasoned_tag(tagsistant_tag *T, tagsistant_reasoning *
 
 /**
  * SQL callback. Add new tag derived from reasoning to a qtree_and_node_t structure.
+ * The tag is resolved from its tag_id by the tag dictionary.
  *
  * @param _reasoning pointer to be casted to reasoning_t* structure
- * @param result dbi_result pointer
+ * @param result dbi_result pointer, holding the related tag_id
  * @return 0 always, due to SQLite policy, may change in the future
  */
 static int tagsistant_add_reasoned_tag_callback(void *_reasoning, dbi_result result)
@@ -182,21 +183,24 @@ static int tagsistant_add_reasoned_tag_callback(void *_reasoning, dbi_result res
 	/* point to a reasoning_t structure */
 	tagsistant_reasoning *reasoning = (tagsistant_reasoning *) _reasoning;
 
+	/* resolve the related tag, skipping relations pointing to deleted tags */
+	const tagsistant_tag_entry *entry = tagsistant_sql_get_tag(reasoning->conn, tagsistant_result_get_uint_idx(result, 1));
+	if (!entry) return (0);
+
 	/*
 	 * create a buffer object to pass the query results
 	 * to tagsistant_add_reasoned_tag()
 	 */
 	tagsistant_tag *T = g_new0(tagsistant_tag, 1);
 
-	tagsistant_return_integer(&T->tag_id, result);
-	const gchar *tag_or_namespace = dbi_result_get_string_idx(result, 2);
+	T->tag_id = g_atomic_int_get(&(entry->tag_id));
 
-	if (g_regex_match_simple(tagsistant.triple_tag_regex, tag_or_namespace, 0, 0)) {
-		strcpy(T->namespace, tag_or_namespace);
-		strcpy(T->key, dbi_result_get_string_idx(result, 3));
-		strcpy(T->value, dbi_result_get_string_idx(result, 4));
+	if (tagsistant_is_triple_tag(entry->tagname)) {
+		g_strlcpy(T->namespace, entry->tagname, 1024);
+		g_strlcpy(T->key, entry->key, 1024);
+		g_strlcpy(T->value, entry->value, 1024);
 	} else {
-		strcpy(T->tag, tag_or_namespace);
+		g_strlcpy(T->tag, entry->tagname, 1024);
 	}
 
 	/* add the tag */
@@ -270,12 +274,10 @@ int tagsistant_reasoner_inner(tagsistant_reasoning *reasoning, int do_caching)
 		 */
 		reasoning->negate = 0;
 		tagsistant_query(
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag2_id "
+			"select tag2_id from relations "
 				"where tag1_id = %d and relation in (\"includes\", \"is_equivalent\") "
 			"union "
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag1_id "
+			"select tag1_id from relations "
 				"where tag2_id = %d and relation = \"is_equivalent\" ",
 			reasoning->conn,
 			tagsistant_add_reasoned_tag_callback,
@@ -288,13 +290,11 @@ int tagsistant_reasoner_inner(tagsistant_reasoning *reasoning, int do_caching)
 		 */
 		reasoning->negate = 1;
 		tagsistant_query(
-			"select tag_id, tagname, `key`, value from tags "
-				"join relations on tags.tag_id = relations.tag2_id "
+			"select tag2_id from relations "
 				"where tag1_id = %d and relation = \"excludes\"",
 			reasoning->conn,
 			tagsistant_add_reasoned_tag_callback,
 			reasoning,
-			other_tag_id,
 			other_tag_id);
 
 		/*
@@ -25,11 +25,49 @@
 
 #define TAGSISTANT_SCHEMA_VERSION "0.8.2.1"
 
+/** how long (in milliseconds) a native SQLite connection waits on a locked database */
+#define TAGSISTANT_SQLITE_BUSY_TIMEOUT 30000
+
 #if TAGSISTANT_USE_QUERY_MUTEX
 GMutex tagsistant_query_mutex;
 #endif
 
-GRWLock tagsistant_query_rwlock;
+/**
+ * SQLite allows one writer at a time. Write transactions are serialized
+ * here, inside Tagsistant, instead of letting connections spin on
+ * SQLITE_BUSY. Readers never take it: they work on WAL snapshots.
+ */
+GMutex tagsistant_sqlite_writer_lock;
+
+/**
+ * The write generation works like a seqlock: it's bumped by two when a
+ * write transaction begins and again when it's released, and reads as
+ * odd while any write transaction is open (see tagsistant_db_write_generation()).
+ */
+static gint tagsistant_write_generation = 0;
+
+/** the write transactions open, the shared one of group commit included */
+static gint tagsistant_open_writers = 0;
+
+/**
+ * Account the beginning of a write transaction. The writer is
+ * counted before the generation moves.
+ */
+static void tagsistant_db_writer_enter()
+{
+	g_atomic_int_inc(&tagsistant_open_writers);
+	g_atomic_int_add(&tagsistant_write_generation, 2);
+}
+
+/**
+ * Account the end of a write transaction. The generation
+ * moves before the writer is discounted.
+ */
+static void tagsistant_db_writer_leave()
+{
+	g_atomic_int_add(&tagsistant_write_generation, 2);
+	g_atomic_int_add(&tagsistant_open_writers, -1);
+}
 
 /**
  * check if requested driver is provided by local DBI installation
@@ -81,13 +119,342 @@ struct {
 	gchar *password;
 } dboptions;
 
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-/** a map tag_name -> tag_id */
-GHashTable *tagsistant_tag_cache = NULL;
-#endif
+/****************************************************************************/
+/***                                                                      ***/
+/***   Call site statement registry                                       ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+/**
+ * Placeholder used in cached formats instead of the single and double
+ * quotes of the original SQL format. It's a control char, unlikely but
+ * still legal in a path: statements whose arguments carry it are
+ * rejected by tagsistant_sql_render(), since it would be turned into
+ * a quote. Prepared statements bind their arguments and don't care.
+ */
+#define TAGSISTANT_SQL_QUOTE_PLACEHOLDER '\x01'
+
+/** the statement registry, a map call site -> tagsistant_sql_statement */
+GHashTable *tagsistant_sql_statements = NULL;
+GRWLock tagsistant_sql_statements_lock;
+
+/**
+ * Hash a call site
+ *
+ * @param key a tagsistant_sql_statement cast to gconstpointer
+ * @return the hash value
+ */
+static guint tagsistant_sql_statement_hash(gconstpointer key)
+{
+	const tagsistant_sql_statement *statement = (const tagsistant_sql_statement *) key;
+	return (g_direct_hash(statement->file) ^ (guint) statement->line);
+}
+
+/**
+ * Compare two call sites. File names are string literals coming
+ * from the __FILE__ macro, so they can be compared by pointer.
+ *
+ * @param a first tagsistant_sql_statement
+ * @param b second tagsistant_sql_statement
+ * @return TRUE if the two call sites are the same
+ */
+static gboolean tagsistant_sql_statement_equal(gconstpointer a, gconstpointer b)
+{
+	const tagsistant_sql_statement *sa = (const tagsistant_sql_statement *) a;
+	const tagsistant_sql_statement *sb = (const tagsistant_sql_statement *) b;
+	return ((sa->line == sb->line) && (sa->file == sb->file));
+}
+
+/**
+ * Free a registry entry
+ *
+ * @param data the tagsistant_sql_statement to be freed
+ */
+static void tagsistant_sql_statement_free(gpointer data)
+{
+	tagsistant_sql_statement *statement = (tagsistant_sql_statement *) data;
+	g_free_null(statement->format);
+	g_free_null(statement->escaped_format);
+	g_free_null(statement->bound_sql);
+	g_free_null(statement->params);
+	g_free(statement);
+}
+
+/**
+ * Replace every single and double quote of a SQL format
+ * with TAGSISTANT_SQL_QUOTE_PLACEHOLDER
+ *
+ * @param format the SQL format
+ * @return the escaped format (must be freed)
+ */
+static gchar *tagsistant_sql_escape_format(const char *format)
+{
+	gchar *escaped_format = g_strdup(format);
+
+	gchar *c = escaped_format;
+	while (*c) {
+		if ('\'' == *c || '"' == *c) *c = TAGSISTANT_SQL_QUOTE_PLACEHOLDER;
+		c++;
+	}
+
+	return (escaped_format);
+}
+
+/**
+ * Parse a printf-like conversion, like %s, %d or %llu
+ *
+ * @param c pointer to the % sign
+ * @param length returns the length of the conversion
+ * @return the argument type, 0 if the conversion can't be bound
+ */
+static gchar tagsistant_sql_parse_conversion(const char *c, int *length)
+{
+	if (g_str_has_prefix(c, "%s"))   { *length = 2; return ('s'); }
+	if (g_str_has_prefix(c, "%d"))   { *length = 2; return ('d'); }
+	if (g_str_has_prefix(c, "%u"))   { *length = 2; return ('u'); }
+	if (g_str_has_prefix(c, "%ld"))  { *length = 3; return ('l'); }
+	if (g_str_has_prefix(c, "%lu"))  { *length = 3; return ('L'); }
+	if (g_str_has_prefix(c, "%lld")) { *length = 4; return ('q'); }
+	if (g_str_has_prefix(c, "%llu")) { *length = 4; return ('Q'); }
+
+	*length = 0;
+	return (0);
+}
+
+/**
+ * Turn the format of a statement into SQL suitable for a prepared
+ * statement: each quoted conversion ('%s', "%d") and each bare
+ * numeric conversion (%d, %lu) becomes a ? placeholder and its
+ * type is appended to statement->params.
+ *
+ * Formats using conversions inside larger literals (like '%%|%s|%%'),
+ * bare %s (SQL fragments) or any other conversion are left unbound
+ * and will be formatted as text.
+ *
+ * @param statement the statement to be compiled
+ */
+static void tagsistant_sql_statement_compile(tagsistant_sql_statement *statement)
+{
+	GString *sql = g_string_sized_new(strlen(statement->format));
+	GString *params = g_string_sized_new(8);
+	const char *c = statement->format;
+	int length = 0;
+	gchar type = 0;
+
+	while (*c) {
+		if ('\'' == *c || '"' == *c) {
+			const char *end = strchr(c + 1, *c);
+			if (!end) goto NOT_BINDABLE;
+
+			gchar *literal = g_strndup(c + 1, end - c - 1);
+			if (strchr(literal, '%')) {
+				type = tagsistant_sql_parse_conversion(literal, &length);
+				if (!type || (int) strlen(literal) != length) {
+					g_free(literal);
+					goto NOT_BINDABLE;
+				}
+				g_string_append_c(sql, '?');
+				g_string_append_c(params, type);
+			} else {
+				g_string_append_c(sql, '\'');
+				g_string_append(sql, literal);
+				g_string_append_c(sql, '\'');
+			}
+			g_free(literal);
+
+			c = end + 1;
+		} else if ('%' == *c) {
+			if ('%' == *(c + 1)) {
+				g_string_append_c(sql, '%');
+				c += 2;
+				continue;
+			}
+
+			type = tagsistant_sql_parse_conversion(c, &length);
+			if (!type || 's' == type) goto NOT_BINDABLE;
+
+			g_string_append_c(sql, '?');
+			g_string_append_c(params, type);
+			c += length;
+		} else {
+			g_string_append_c(sql, *c);
+			c++;
+		}
+	}
+
+	statement->bound_sql = g_string_free(sql, FALSE);
+	statement->params = g_string_free(params, FALSE);
+	statement->bindable = 1;
+	return;
+
+NOT_BINDABLE:
+	g_string_free(sql, TRUE);
+	g_string_free(params, TRUE);
+	statement->bindable = 0;
+}
+
+/**
+ * Lookup the statement registered by a call site, registering
+ * it on first use. The returned statement is owned by the registry.
+ *
+ * Some call sites pick their format among several ones (like
+ * "commit" or "rollback"), so the format changes between calls: those
+ * are flagged as dynamic and their format is escaped on every call.
+ *
+ * Formats are string literals (SQL built at runtime goes through
+ * tagsistant_query_sql() and its constant format), so the same pointer
+ * as the first call means the same format and strcmp() is skipped.
+ *
+ * @param format the SQL format
+ * @param file the calling file
+ * @param line the calling line
+ * @return the tagsistant_sql_statement of the call site
+ */
+tagsistant_sql_statement *tagsistant_sql_statement_lookup(const char *format, const char *file, int line)
+{
+	tagsistant_sql_statement search = { .file = file, .line = line };
+
+	g_rw_lock_reader_lock(&tagsistant_sql_statements_lock);
+	tagsistant_sql_statement *statement = g_hash_table_lookup(tagsistant_sql_statements, &search);
+	g_rw_lock_reader_unlock(&tagsistant_sql_statements_lock);
+
+	if (statement) {
+		if (format != statement->caller_format && !g_atomic_int_get(&(statement->dynamic)) && strcmp(statement->format, format) != 0) {
+			dbg('s', LOG_INFO, "Call site %s:%d uses a dynamic SQL format", file, line);
+			g_atomic_int_set(&(statement->dynamic), 1);
+		}
+		g_atomic_int_inc(&(statement->calls));
+		return (statement);
+	}
+
+	g_rw_lock_writer_lock(&tagsistant_sql_statements_lock);
+
+	/* another thread could have registered the call site meanwhile */
+	statement = g_hash_table_lookup(tagsistant_sql_statements, &search);
+	if (!statement) {
+		statement = g_new0(tagsistant_sql_statement, 1);
+		statement->file = file;
+		statement->line = line;
+		statement->caller_format = format;
+		statement->format = g_strdup(format);
+		statement->escaped_format = tagsistant_sql_escape_format(format);
+		tagsistant_sql_statement_compile(statement);
+		g_hash_table_insert(tagsistant_sql_statements, statement, statement);
+	}
+
+	g_rw_lock_writer_unlock(&tagsistant_sql_statements_lock);
+
+	g_atomic_int_inc(&(statement->calls));
+	return (statement);
+}
+
+/**
+ * Count the quote placeholders in a string
+ *
+ * @param string the string to be scanned
+ * @return the number of TAGSISTANT_SQL_QUOTE_PLACEHOLDER chars found
+ */
+static guint tagsistant_sql_count_placeholders(const gchar *string)
+{
+	guint count = 0;
+	const gchar *c;
+	for (c = string; *c; c++)
+		if (TAGSISTANT_SQL_QUOTE_PLACEHOLDER == *c) count++;
+
+	return (count);
+}
+
+/**
+ * Render the final SQL statement in a single pass: single quotes
+ * coming from the arguments are doubled, while the placeholders
+ * in the format are turned back into single quotes.
+ *
+ * @param statement the formatted statement, as returned by g_strdup_vprintf()
+ * @return the escaped statement (must be freed)
+ */
+static gchar *tagsistant_sql_escape_statement(const gchar *statement)
+{
+	GString *escaped = g_string_sized_new(strlen(statement) + 16);
+
+	const gchar *c = statement;
+	while (*c) {
+		if (TAGSISTANT_SQL_QUOTE_PLACEHOLDER == *c) {
+			g_string_append_c(escaped, '\'');
+		} else if ('\'' == *c) {
+			g_string_append_len(escaped, "''", 2);
+		} else {
+			g_string_append_c(escaped, *c);
+		}
+		c++;
+	}
+
+	return (g_string_free(escaped, FALSE));
+}
+
+/**
+ * Append a string literal to a statement built at runtime and run by
+ * tagsistant_query_sql(). The literal is single quoted, its single
+ * quotes are doubled and, on MySQL, its backslashes too.
+ *
+ * @param statement the statement being built
+ * @param value the literal, NULL is appended as an empty string
+ */
+void tagsistant_sql_append_literal(GString *statement, const gchar *value)
+{
+	g_string_append_c(statement, '\'');
+
+	const gchar *c;
+	for (c = value ? value : ""; *c; c++) {
+		if ('\'' == *c) {
+			g_string_append_len(statement, "''", 2);
+		} else if ('\\' == *c && TAGSISTANT_DBI_MYSQL_BACKEND == tagsistant.sql_database_driver) {
+			g_string_append_len(statement, "\\\\", 2);
+		} else {
+			g_string_append_c(statement, *c);
+		}
+	}
+
+	g_string_append_c(statement, '\'');
+}
+
+/**
+ * Format a statement as SQL text, escaping its arguments
+ *
+ * @param registered the call site statement
+ * @param format the SQL format
+ * @param ap the arguments of the format
+ * @return the SQL text (must be freed) or NULL on error
+ */
+static gchar *tagsistant_sql_render(tagsistant_sql_statement *registered, const char *format, va_list ap)
+{
+	/* statements run by tagsistant_query_sql() are already escaped */
+	if (TAGSISTANT_SQL_VERBATIM_MARKER == format[0]) {
+		const gchar *sql = va_arg(ap, const gchar *);
+		return (sql ? g_strdup(sql) : NULL);
+	}
+
+	gchar *escaped_format = g_atomic_int_get(&(registered->dynamic)) ? tagsistant_sql_escape_format(format) : NULL;
+
+	/* format the statement */
+	const gchar *used_format = escaped_format ? escaped_format : registered->escaped_format;
+	gchar *statement = g_strdup_vprintf(used_format, ap);
+	guint format_placeholders = tagsistant_sql_count_placeholders(used_format);
+	g_free_null(escaped_format);
+	if (NULL == statement) return (NULL);
 
-/** regular expressions used to escape query parameters */
-GRegex *RX1, *RX2, *RX3;
+	/* a placeholder coming from an argument would be turned into a quote */
+	if (tagsistant_sql_count_placeholders(statement) != format_placeholders) {
+		dbg('s', LOG_ERR, "SQL from %s:%d rejected: an argument contains the quote placeholder", registered->file, registered->line);
+		g_free(statement);
+		return (NULL);
+	}
+
+	/* double the quotes inside the arguments and restore the quotes of the format */
+	gchar *escaped_statement = tagsistant_sql_escape_statement(statement);
+	g_free(statement);
+
+	return (escaped_statement);
+}
 
 /**
  * Initialize libDBI structures
@@ -105,10 +472,6 @@ void tagsistant_db_init()
 	g_mutex_init(&tagsistant_query_mutex);
 #endif
 
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	tagsistant_tag_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-#endif
-
 	// by default, DBI backend provides intersect
 	tagsistant.sql_backend_have_intersect = 1;
 	tagsistant.sql_database_driver = TAGSISTANT_NULL_BACKEND;
@@ -202,476 +565,2063 @@ void tagsistant_db_init()
 	}
 #endif
 
-	/* initialize the regular expressions used to escape the SQL queries */
-	RX1 = g_regex_new("[\"']", 0, 0, NULL);
-	RX2 = g_regex_new("'", 0, 0, NULL);
-	RX3 = g_regex_new("<><>", 0, 0, NULL);
+	/* initialize the call site statement registry */
+	tagsistant_sql_statements = g_hash_table_new_full(
+		tagsistant_sql_statement_hash,
+		tagsistant_sql_statement_equal,
+		NULL,
+		tagsistant_sql_statement_free);
 }
 
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
 /**
- * This single linked list holds the connection pool
+ * Finalize a prepared statement when its connection is closed
+ *
+ * @param data the sqlite3_stmt to be finalized
  */
-GList *tagsistant_connection_pool = NULL;
-GMutex tagsistant_connection_pool_lock;
-int connections = 0;
+static void tagsistant_sqlite_finalize(gpointer data)
+{
+	sqlite3_finalize((sqlite3_stmt *) data);
+}
 
 /**
- * Parse command line options, create connection object,
- * start the connection and finally create database schema
+ * Open a native connection to the SQLite database inside the repository
  *
- * @return DBI connection handle
+ * @return the connection, cast to dbi_conn
  */
-dbi_conn *tagsistant_db_connection(int start_transaction)
+static dbi_conn tagsistant_sqlite_connect()
 {
-	/* DBI connection handler used by subsequent calls to dbi_* functions */
-	dbi_conn dbi = NULL;
-
-	if (start_transaction) {
-		g_rw_lock_writer_lock(&(tagsistant_query_rwlock));
-	} else {
-		g_rw_lock_reader_lock(&(tagsistant_query_rwlock));
-	}
+	tagsistant_sqlite_conn *conn = g_new0(tagsistant_sqlite_conn, 1);
+	gchar *db_path = g_strdup_printf("%s/tags.sql", tagsistant.repository);
 
-	/* lock the pool */
-	g_mutex_lock(&tagsistant_connection_pool_lock);
+	/*
+	 * connections are used by one thread at a time (they're taken
+	 * from the pool), so SQLite internal mutexes are not needed
+	 */
+	int res = sqlite3_open_v2(db_path, &(conn->db),
+		SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_NOMUTEX, NULL);
 
-	GList *pool = tagsistant_connection_pool;
-	while (pool) {
-		dbi = (dbi_conn) pool->data;
+	if (SQLITE_OK != res) {
+		dbg('s', LOG_ERR, "Could not open SQLite database %s: %s", db_path, sqlite3_errstr(res));
+		exit(1);
+	}
 
-		/* check if the connection is still alive */
-		if (!dbi_conn_ping(dbi) && dbi_conn_connect(dbi) < 0) {
-			dbi_conn_close(dbi);
-			tagsistant_connection_pool = g_list_delete_link(tagsistant_connection_pool, pool);
-			connections--;
-		} else {
-//			dbg('s', LOG_INFO, "Reusing DBI connection (currently %d created", connections);
-			tagsistant_connection_pool = g_list_remove_link(tagsistant_connection_pool, pool);
-			g_list_free_1(pool);
-			break;
-		}
+	g_free(db_path);
 
-		pool = pool->next;
-	}
+	sqlite3_busy_timeout(conn->db, TAGSISTANT_SQLITE_BUSY_TIMEOUT);
 
-	/*
-	 * unlock the pool mutex only if the backend is not SQLite
-	 */
-////	if (tagsistant.sql_database_driver != TAGSISTANT_DBI_SQLITE_BACKEND)
-		g_mutex_unlock(&tagsistant_connection_pool_lock);
+	/* let readers work on snapshots while a writer is active */
+	sqlite3_exec(conn->db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
 
-	if (!dbi) {
-		// initialize DBI drivers
-		if (TAGSISTANT_DBI_MYSQL_BACKEND == dboptions.backend) {
-			if (!tagsistant_driver_is_available("mysql")) {
-				fprintf(stderr, "MySQL driver not installed\n");
-				dbg('s', LOG_ERR, "MySQL driver not installed");
-				exit (1);
-			}
+	/* the statement cache of this connection */
+	conn->statements = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, tagsistant_sqlite_finalize);
 
-			// unlucky, MySQL does not provide INTERSECT operator
-			tagsistant.sql_backend_have_intersect = 0;
+	return ((dbi_conn) conn);
+}
+#endif /* TAGSISTANT_ENABLE_NATIVE_SQLITE */
 
-			// create connection
-#if TAGSISTANT_REENTRANT_DBI
-			dbi = dbi_conn_new_r("mysql", tagsistant.dbi_instance);
-#else
-			dbi = dbi_conn_new("mysql");
-#endif
-			if (NULL == dbi) {
-				dbg('s', LOG_ERR, "Error creating MySQL connection");
-				exit (1);
-			}
+/**
+ * This single linked list holds the shared connection pool. Threads
+ * first use the connection bound to them (see below) and get here
+ * only when they need a second connection or don't have one yet.
+ */
+GList *tagsistant_connection_pool = NULL;
+GMutex tagsistant_connection_pool_lock;
+int connections = 0;
 
-			// set connection options
-			dbi_conn_set_option(dbi, "host",     dboptions.host);
-			dbi_conn_set_option(dbi, "dbname",   dboptions.db);
-			dbi_conn_set_option(dbi, "username", dboptions.username);
-			dbi_conn_set_option(dbi, "password", dboptions.password);
-			dbi_conn_set_option(dbi, "encoding", "UTF-8");
-
-		} else if (TAGSISTANT_DBI_SQLITE_BACKEND == dboptions.backend) {
-			if (!tagsistant_driver_is_available("sqlite3")) {
-				fprintf(stderr, "SQLite3 driver not installed\n");
-				dbg('s', LOG_ERR, "SQLite3 driver not installed");
-				exit(1);
-			}
+/** connection manager counters, exposed in /stats/connections */
+struct {
+	/** connections bound to a thread */
+	gint bound;
 
-			// create connection
-#if TAGSISTANT_REENTRANT_DBI
-			dbi = dbi_conn_new_r("sqlite3", tagsistant.dbi_instance);
-#else
-			dbi = dbi_conn_new("sqlite3");
-#endif
-			if (NULL == dbi) {
-				dbg('s', LOG_ERR, "Error connecting to SQLite3");
-				exit (1);
-			}
+	/** checkouts served by the connection bound to the calling thread */
+	gint thread_checkouts;
 
-			// set connection options
-			dbi_conn_set_option(dbi, "dbname", "tags.sql");
-			dbi_conn_set_option(dbi, "sqlite3_dbdir", tagsistant.repository);
+	/** checkouts served by the shared pool (guarded by the pool lock) */
+	guint64 pool_checkouts;
 
-		} else {
+	/** microseconds spent waiting on the pool lock (guarded by the pool lock) */
+	guint64 pool_wait;
 
-			dbg('s', LOG_ERR, "No or wrong database family specified!");
-			exit (1);
-		}
+	/** connections found dead and re-established */
+	gint reconnects;
 
-		// try to connect
-		if (dbi_conn_connect(dbi) < 0) {
-			int error = dbi_conn_error(dbi, NULL);
-			dbg('s', LOG_ERR, "Could not connect to DB (error %d). Please check the --db settings", error);
-			exit(1);
-		}
+	/** SQLite write transactions (guarded by the writer lock) */
+	guint64 writer_transactions;
 
-		connections++;
+	/** microseconds spent waiting on the SQLite writer lock (guarded by the writer lock) */
+	guint64 writer_wait;
+} tagsistant_connection_stats;
 
-		dbg('s', LOG_INFO, "SQL connection established");
-	}
+/**
+ * The connection bound to a thread. It's taken and given back
+ * without any lock, since only its thread can touch it.
+ */
+typedef struct {
+	/** the connection */
+	dbi_conn dbi;
 
-	/* start a transaction */
-	if (start_transaction) {
-#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
-		switch (tagsistant.sql_database_driver) {
-			case TAGSISTANT_DBI_SQLITE_BACKEND:
-				tagsistant_query("begin transaction", dbi, NULL, NULL);
-				break;
+	/** true while the thread is using it */
+	int in_use;
+} tagsistant_thread_connection;
 
-			case TAGSISTANT_DBI_MYSQL_BACKEND:
-				tagsistant_query("start transaction", dbi, NULL, NULL);
-				break;
-		}
-#else
-		dbi_conn_transaction_begin(dbi);
-#endif
-	}
+static void tagsistant_thread_connection_free(gpointer data);
 
-	return(dbi);
-}
+/** the thread local slot holding a tagsistant_thread_connection */
+static GPrivate tagsistant_thread_connection_key = G_PRIVATE_INIT(tagsistant_thread_connection_free);
 
 /**
- * Release a DBI connection
+ * Give the connection of an exiting thread back to the shared pool
  *
- * @param dbi the connection to be released
+ * @param data the tagsistant_thread_connection of the thread
  */
-void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_locked)
+static void tagsistant_thread_connection_free(gpointer data)
 {
-	/* lock the pool if the backend is not SQLite */
-	//// if (tagsistant.sql_database_driver != TAGSISTANT_DBI_SQLITE_BACKEND)
-		g_mutex_lock(&tagsistant_connection_pool_lock);
-
-	/* release the connection back to the pool */
-	tagsistant_connection_pool = g_list_prepend(tagsistant_connection_pool, dbi);
+	tagsistant_thread_connection *bound = (tagsistant_thread_connection *) data;
 
-	/* unlock the pool */
-	g_mutex_unlock(&tagsistant_connection_pool_lock);
+	if (bound->dbi) {
+		g_mutex_lock(&tagsistant_connection_pool_lock);
+		tagsistant_connection_pool = g_list_prepend(tagsistant_connection_pool, bound->dbi);
+		g_mutex_unlock(&tagsistant_connection_pool_lock);
 
-	if (is_writer_locked) {
-		g_rw_lock_writer_unlock(&tagsistant_query_rwlock);
-	} else {
-		g_rw_lock_reader_unlock(&tagsistant_query_rwlock);
+		g_atomic_int_add(&tagsistant_connection_stats.bound, -1);
 	}
+
+	g_free(bound);
 }
 
 /**
- * Create DB schema
+ * Attach the shared RDS store to a SQLite connection. The store is a
+ * database of its own, so materializing a RDS doesn't contend for the
+ * write lock of tags.sql, and it's not synced since it's emptied on
+ * mount anyway.
+ *
+ * @param dbi the connection
  */
-void tagsistant_create_schema()
+static void tagsistant_attach_rds_store(dbi_conn dbi)
 {
-	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
-	gchar *current_schema_version = NULL;
+	tagsistant_query("attach database \"%s/rds.sql\" as rds_store", dbi, NULL, NULL, tagsistant.repository);
+	tagsistant_query("PRAGMA rds_store.journal_mode=WAL", dbi, NULL, NULL);
+	tagsistant_query("PRAGMA rds_store.synchronous=OFF", dbi, NULL, NULL);
+}
 
-	// create database schema
+/**
+ * Create the RDS tables, shared by all the connections, and empty
+ * them, since the RDS accounting of the last mount has been lost.
+ * On SQLite the tables live in the rds_store database attached by
+ * tagsistant_attach_rds_store(), on MySQL they are MEMORY tables.
+ *
+ * Each RDS has a row in rds_catalog, one row per source tag in
+ * rds_sources, used to find the RDS involved by a tag, and one row
+ * per object in rds. RDS ids are assigned by tagsistant_materialize_rds(),
+ * which adds the rds_catalog row last, so a RDS is never found before
+ * being complete.
+ *
+ * @param dbi the connection
+ */
+static void tagsistant_create_rds_tables(dbi_conn dbi)
+{
 	switch (tagsistant.sql_database_driver) {
 		case TAGSISTANT_DBI_SQLITE_BACKEND:
-			/*
-			 * Create schema table and check current schema compatiblity
-			 */
 			tagsistant_query(
-				"create table if not exists schema_version (version varchar(32))",
+				"create table if not exists rds_store.rds_catalog ("
+					"rds_id integer primary key not null, "
+					"checksum varchar(32) not null, "
+					"reasoned integer not null, "
+					"creation datetime not null default CURRENT_DATE)",
 				dbi, NULL, NULL);
 
 			tagsistant_query(
-				"select version from schema_version",
-				dbi, tagsistant_return_string, &current_schema_version);
-
-			if (current_schema_version && g_strcmp0(TAGSISTANT_SCHEMA_VERSION, current_schema_version) != 0) {
-				dbg('s', LOG_ERR,
-					"Required schema version %s differs from current schema version %s",
-					TAGSISTANT_SCHEMA_VERSION, current_schema_version);
-				exit(1);
-			}
-
-			/*
-			 * Tags table
-			 */
-			tagsistant_query(
-				"create table if not exists tags ("
-					"tag_id integer primary key autoincrement not null, "
+				"create table if not exists rds_store.rds_sources ("
 					"tagname varchar(65) not null, "
-					"key varchar(65) not null default '', "
-					"value varchar(65) not null default '', "
-					"constraint Tag_key unique (tagname, key, value))",
+					"rds_id integer not null, "
+					"primary key (tagname, rds_id))",
 				dbi, NULL, NULL);
 
-			/*
-			 * Objects table
-			 */
 			tagsistant_query(
-				"create table if not exists objects ("
-					"inode integer not null primary key autoincrement, "
-					"objectname text(255) not null, "
-					"last_autotag timestamp not null default 0, "
-					"checksum text(40) not null default '', "
-					"symlink text(1024) not null default '')",
+				"create table if not exists rds_store.rds ("
+					"rds_id integer not null, "
+					"inode integer not null, "
+					"objectname text(255) not null)",
 				dbi, NULL, NULL);
 
-			/*
-			 * Tagging table
-			 */
-			tagsistant_query(
-				"create table if not exists tagging ("
-					"inode integer not null, "
-					"tag_id integer not null, "
-					"constraint Tagging_key unique (inode, tag_id))",
-				dbi, NULL, NULL);
+			tagsistant_query("create unique index if not exists rds_store.rds_catalog_index on rds_catalog (checksum, reasoned)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists rds_store.rds_sources_index on rds_sources (rds_id)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists rds_store.rds_index1 on rds (rds_id, objectname, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists rds_store.rds_index2 on rds (rds_id, inode)", dbi, NULL, NULL);
+			break;
 
-			/*
-			 * Relations table
-			 */
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
 			tagsistant_query(
-				"create table if not exists relations ("
-					"relation_id integer primary key autoincrement not null, "
-					"tag1_id integer not null, "
-					"relation varchar not null, "
-					"tag2_id integer not null)",
+				"create table if not exists rds_catalog ("
+					"rds_id integer primary key not null, "
+					"checksum varchar(32) not null, "
+					"reasoned integer not null, "
+					"creation datetime not null) ENGINE = MEMORY",
 				dbi, NULL, NULL);
 
-			/*
-			 * Aliases table
-			 */
 			tagsistant_query(
-				"create table if not exists aliases ("
-					"alias varchar(65) primary key not null, "
-					"query varchar(%d) not null)",
-				dbi, NULL, NULL, TAGSISTANT_ALIAS_MAX_LENGTH);
+				"create table if not exists rds_sources ("
+					"tagname varchar(65) not null, "
+					"rds_id integer not null, "
+					"primary key (tagname, rds_id)) ENGINE = MEMORY",
+				dbi, NULL, NULL);
 
-			/*
-			 * RDS table
-			 */
 			tagsistant_query(
-				"create temporary table if not exists rds ("
-					"id varchar(32) not null, "
-					"reasoned integer not null, "
+				"create table if not exists rds ("
+					"rds_id integer not null, "
 					"inode integer not null, "
-					"objectname text(255) not null, "
-					"tagset text not null, "
-					"creation datetime not null default CURRENT_DATE)",
+					"objectname varchar(255) not null) ENGINE = MEMORY",
 				dbi, NULL, NULL);
 
-			/*
-			 * Index declarations
-			 */
-			tagsistant_query("create index if not exists relations_index on relations (tag1_id, tag2_id)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists objectname_index on objects (objectname)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists symlink_index on objects (symlink, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists checksum_index on objects (checksum, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists relations_type_index on relations (relation)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists aliases_index on aliases (alias)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists rds_index1 on rds (id, reasoned, objectname, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index if not exists rds_index2 on rds (id, reasoned, inode, objectname)", dbi, NULL, NULL);
+			tagsistant_query("create unique index rds_catalog_index on rds_catalog (checksum, reasoned)", dbi, NULL, NULL);
+			tagsistant_query("create index rds_sources_index on rds_sources (rds_id)", dbi, NULL, NULL);
+			tagsistant_query("create index rds_index1 on rds (rds_id, objectname, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index rds_index2 on rds (rds_id, inode)", dbi, NULL, NULL);
+			break;
+	}
 
-			tagsistant_query("delete from schema_version", dbi, NULL, NULL);
-			tagsistant_query("insert into schema_version (version) values (\"%s\")",
-				dbi, NULL, NULL, TAGSISTANT_SCHEMA_VERSION);
+	tagsistant_query("delete from rds", dbi, NULL, NULL);
+	tagsistant_query("delete from rds_sources", dbi, NULL, NULL);
+	tagsistant_query("delete from rds_catalog", dbi, NULL, NULL);
+}
 
-			break;
+/**
+ * Open a new connection to the database
+ *
+ * @return the DBI connection handle
+ */
+static dbi_conn tagsistant_db_connect()
+{
+	dbi_conn dbi = NULL;
 
-		case TAGSISTANT_DBI_MYSQL_BACKEND:
-			/*
-			 * Create schema table and check current schema compatiblity
-			 */
-			tagsistant_query(
-				"create table if not exists schema_version (version varchar(32))",
-				dbi, NULL, NULL);
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite()) {
+		dbi = tagsistant_sqlite_connect();
+	} else
+#endif
+	// initialize DBI drivers
+	if (TAGSISTANT_DBI_MYSQL_BACKEND == dboptions.backend) {
+		if (!tagsistant_driver_is_available("mysql")) {
+			fprintf(stderr, "MySQL driver not installed\n");
+			dbg('s', LOG_ERR, "MySQL driver not installed");
+			exit (1);
+		}
 
-			tagsistant_query(
-				"select version from schema_version",
-				dbi, tagsistant_return_string, &current_schema_version);
+		// unlucky, MySQL does not provide INTERSECT operator
+		tagsistant.sql_backend_have_intersect = 0;
 
-			if (current_schema_version && g_strcmp0(TAGSISTANT_SCHEMA_VERSION, current_schema_version) != 0) {
-				dbg('s', LOG_ERR,
-					"Required schema version %s differs from current schema version %s",
-					TAGSISTANT_SCHEMA_VERSION, current_schema_version);
-				exit(1);
-			}
+		// create connection
+#if TAGSISTANT_REENTRANT_DBI
+		dbi = dbi_conn_new_r("mysql", tagsistant.dbi_instance);
+#else
+		dbi = dbi_conn_new("mysql");
+#endif
+		if (NULL == dbi) {
+			dbg('s', LOG_ERR, "Error creating MySQL connection");
+			exit (1);
+		}
 
-			/*
-			 * Tags table
-			 */
-			tagsistant_query(
-				"create table if not exists tags ("
-					"tag_id integer primary key auto_increment not null, "
-					"tagname varchar(65) not null, "
-					"`key` varchar(65) not null, "
-					"value varchar(65) not null, "
-					"constraint Tag_key unique `key` (tagname, `key`, value))",
-				dbi, NULL, NULL);
+		// set connection options
+		dbi_conn_set_option(dbi, "host",     dboptions.host);
+		dbi_conn_set_option(dbi, "dbname",   dboptions.db);
+		dbi_conn_set_option(dbi, "username", dboptions.username);
+		dbi_conn_set_option(dbi, "password", dboptions.password);
+		dbi_conn_set_option(dbi, "encoding", "UTF-8");
+
+	} else if (TAGSISTANT_DBI_SQLITE_BACKEND == dboptions.backend) {
+		if (!tagsistant_driver_is_available("sqlite3")) {
+			fprintf(stderr, "SQLite3 driver not installed\n");
+			dbg('s', LOG_ERR, "SQLite3 driver not installed");
+			exit(1);
+		}
 
-			/*
-			 * Objects table
-			 */
-			tagsistant_query(
-				"create table if not exists objects ("
-					"inode integer not null primary key auto_increment, "
-					"objectname varchar(255) not null, "
-					"last_autotag timestamp not null default 0, "
-					"checksum varchar(40) not null default '', "
-					"symlink varchar(1024) not null default '')",
-				dbi, NULL, NULL);
+		// create connection
+#if TAGSISTANT_REENTRANT_DBI
+		dbi = dbi_conn_new_r("sqlite3", tagsistant.dbi_instance);
+#else
+		dbi = dbi_conn_new("sqlite3");
+#endif
+		if (NULL == dbi) {
+			dbg('s', LOG_ERR, "Error connecting to SQLite3");
+			exit (1);
+		}
 
-			/*
-			 * Tagging table
-			 */
-			tagsistant_query(
-				"create table if not exists tagging ("
-					"inode integer not null, "
-					"tag_id integer not null, "
-					"constraint Tagging_key unique key (inode, tag_id))",
-				dbi, NULL, NULL);
+		// set connection options
+		dbi_conn_set_option(dbi, "dbname", "tags.sql");
+		dbi_conn_set_option(dbi, "sqlite3_dbdir", tagsistant.repository);
+		dbi_conn_set_option_numeric(dbi, "sqlite3_timeout", TAGSISTANT_SQLITE_BUSY_TIMEOUT);
 
-			/*
-			 * Relations table
-			 */
-			tagsistant_query(
-				"create table if not exists relations ("
-					"relation_id integer primary key auto_increment not null, "
-					"tag1_id integer not null, "
-					"relation varchar(32) not null, "
-					"tag2_id integer not null)",
-				dbi, NULL, NULL);
+	} else {
 
-			/*
-			 * Aliases table
-			 */
-			tagsistant_query(
-				"create table if not exists aliases ("
-					"alias varchar(65) primary key not null, "
-					"query varchar(%d) not null)",
-				dbi, NULL, NULL, TAGSISTANT_ALIAS_MAX_LENGTH);
+		dbg('s', LOG_ERR, "No or wrong database family specified!");
+		exit (1);
+	}
 
-			/*
-			 * RDS table
-			 */
-			tagsistant_query(
-				"create temporary table if not exists rds ("
-					"id varchar(32) not null, "
-					"reasoned integer not null, "
-					"inode integer not null, "
-					"objectname text(255) not null, "
-					"tagset text not null, "
-					"creation datetime not null) ENGINE = MEMORY",
-				dbi, NULL, NULL);
+	// try to connect
+	if (!tagsistant_is_native_sqlite() && dbi_conn_connect(dbi) < 0) {
+		int error = dbi_conn_error(dbi, NULL);
+		dbg('s', LOG_ERR, "Could not connect to DB (error %d). Please check the --db settings", error);
+		exit(1);
+	}
+
+	g_atomic_int_inc(&connections);
+
+	dbg('s', LOG_INFO, "SQL connection established");
+
+	/* native connections already did it in tagsistant_sqlite_connect() */
+	if (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver && !tagsistant_is_native_sqlite())
+		tagsistant_query("PRAGMA journal_mode=WAL", dbi, NULL, NULL);
+
+	if (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver)
+		tagsistant_attach_rds_store(dbi);
+
+	return (dbi);
+}
+
+/**
+ * Take a connection from the shared pool, or create a new one
+ *
+ * @return the connection
+ */
+static dbi_conn tagsistant_db_pool_checkout()
+{
+	dbi_conn dbi = NULL;
+
+	gint64 start = g_get_monotonic_time();
+	g_mutex_lock(&tagsistant_connection_pool_lock);
+
+	tagsistant_connection_stats.pool_wait += g_get_monotonic_time() - start;
+	tagsistant_connection_stats.pool_checkouts++;
+
+	if (tagsistant_connection_pool) {
+		dbi = (dbi_conn) tagsistant_connection_pool->data;
+		tagsistant_connection_pool = g_list_delete_link(tagsistant_connection_pool, tagsistant_connection_pool);
+	}
+
+	g_mutex_unlock(&tagsistant_connection_pool_lock);
+
+	/* or create a new one */
+	if (!dbi) dbi = tagsistant_db_connect();
+
+	return (dbi);
+}
+
+/**
+ * Give a connection back to the shared pool
+ *
+ * @param dbi the connection
+ */
+static void tagsistant_db_pool_checkin(dbi_conn dbi)
+{
+	g_mutex_lock(&tagsistant_connection_pool_lock);
+	tagsistant_connection_pool = g_list_prepend(tagsistant_connection_pool, dbi);
+	g_mutex_unlock(&tagsistant_connection_pool_lock);
+}
+
+/**
+ * The connections holding an open transaction. A connection gone in
+ * the middle of a transaction takes the transaction with it: it's not
+ * re-established, nor are its queries retried, until the transaction
+ * ends, otherwise the rest of the transaction would run in autocommit
+ * mode on a new connection. The transaction is marked lost instead,
+ * and tagsistant_db_end_transaction() rolls it back.
+ */
+static GHashTable *tagsistant_open_transactions = NULL;
+static GMutex tagsistant_open_transactions_lock;
+
+/** the states of an open transaction */
+#define TAGSISTANT_TRANSACTION_OPEN 1
+#define TAGSISTANT_TRANSACTION_LOST 2
+
+/**
+ * Set the state of the transaction of a connection
+ *
+ * @param dbi the connection
+ * @param state TAGSISTANT_TRANSACTION_OPEN, TAGSISTANT_TRANSACTION_LOST
+ *        or 0 when the transaction ends
+ */
+static void tagsistant_db_transaction_set_state(dbi_conn dbi, int state)
+{
+	g_mutex_lock(&tagsistant_open_transactions_lock);
+
+	if (!tagsistant_open_transactions)
+		tagsistant_open_transactions = g_hash_table_new(NULL, NULL);
+
+	if (state)
+		g_hash_table_insert(tagsistant_open_transactions, dbi, GINT_TO_POINTER(state));
+	else
+		g_hash_table_remove(tagsistant_open_transactions, dbi);
+
+	g_mutex_unlock(&tagsistant_open_transactions_lock);
+}
+
+/**
+ * Return the state of the transaction of a connection
+ *
+ * @param dbi the connection
+ * @return TAGSISTANT_TRANSACTION_OPEN, TAGSISTANT_TRANSACTION_LOST or 0 if none is open
+ */
+static int tagsistant_db_transaction_get_state(dbi_conn dbi)
+{
+	g_mutex_lock(&tagsistant_open_transactions_lock);
+
+	int state = tagsistant_open_transactions ?
+		GPOINTER_TO_INT(g_hash_table_lookup(tagsistant_open_transactions, dbi)) : 0;
+
+	g_mutex_unlock(&tagsistant_open_transactions_lock);
+
+	return (state);
+}
+
+/**
+ * Has a connection a transaction open? Its queries can then see changes
+ * not committed yet, like the operations waiting in the shared transaction
+ * of group commit, that the in-memory posting lists learn only on commit.
+ *
+ * @param dbi the connection
+ * @return true if a transaction is open, or lost, on the connection
+ */
+gboolean tagsistant_db_in_transaction(dbi_conn dbi)
+{
+	return (0 != tagsistant_db_transaction_get_state(dbi));
+}
+
+/**
+ * Start a transaction on a connection
+ *
+ * @param dbi the connection
+ */
+static void tagsistant_db_begin_transaction(dbi_conn dbi)
+{
+#if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
+	/* ended by tagsistant_db_end_transaction() */
+	tagsistant_db_transaction_set_state(dbi, TAGSISTANT_TRANSACTION_OPEN);
 
+	switch (tagsistant.sql_database_driver) {
+		case TAGSISTANT_DBI_SQLITE_BACKEND:
 			/*
-			 * Index declarations
+			 * A plain begin: "begin immediate" would lock the attached
+			 * rds_store too, and readers filling their RDS would wait for
+			 * the whole write transaction. Writers don't need it on the
+			 * main database, they are serialized by tagsistant_sqlite_writer_lock,
+			 * and the RDS store is claimed only by the transactions using
+			 * it (see tagsistant_db_claim_rds_store()).
 			 */
-			tagsistant_query("create index relations_index on relations (tag1_id, tag2_id)", dbi, NULL, NULL);
-			tagsistant_query("create index objectname_index on objects (objectname)", dbi, NULL, NULL);
-			tagsistant_query("create index symlink_index on objects (symlink, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index checksum_index on objects (checksum, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index relations_type_index on relations (relation)", dbi, NULL, NULL);
-			tagsistant_query("create index aliases_index on aliases (alias)", dbi, NULL, NULL);
-			tagsistant_query("create index rds_index1 on rds (id, reasoned, objectname, inode)", dbi, NULL, NULL);
-			tagsistant_query("create index rds_index2 on rds (id, reasoned, inode, objectname)", dbi, NULL, NULL);
+			tagsistant_query("begin transaction", dbi, NULL, NULL);
+			break;
+
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			tagsistant_query("start transaction", dbi, NULL, NULL);
+			break;
+	}
+#else
+	dbi_conn_transaction_begin(dbi);
+#endif
+}
+
+/**
+ * Take the write lock of the RDS store inside a write transaction.
+ * Must be called before the transaction reads the RDS store for the
+ * first time: the readers publish their RDS meanwhile, and a SQLite
+ * transaction can't write on a WAL snapshot gone stale, so the RDS
+ * invalidated later by the writer would fail with SQLITE_BUSY_SNAPSHOT.
+ * The lock is held until the end of the transaction; claiming it
+ * again is harmless. Does nothing on MySQL.
+ *
+ * @param dbi the connection holding the write transaction
+ */
+void tagsistant_db_claim_rds_store(dbi_conn dbi)
+{
+	if (TAGSISTANT_DBI_SQLITE_BACKEND != tagsistant.sql_database_driver) return;
+
+	/* deletes nothing, RDS ids start from 1, but takes the write lock */
+	tagsistant_query("delete from rds_catalog where rds_id = 0", dbi, NULL, NULL);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Group commit                                                       ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+/**
+ * With --group-commit, the write transactions of many FUSE operations
+ * are coalesced into a single transaction opened on a dedicated
+ * connection. Each operation runs inside a savepoint of the shared
+ * transaction, so it can still be rolled back alone. The shared
+ * transaction is committed when TAGSISTANT_GROUP_COMMIT_OPERATIONS
+ * operations have joined it, when it has been open for
+ * TAGSISTANT_GROUP_COMMIT_INTERVAL microseconds, or when someone asks
+ * for durability with tagsistant_db_barrier() (fsync()).
+ *
+ * While the shared transaction is open, readers are served by its
+ * connection too, otherwise they would not see the metadata written
+ * by the operations still waiting to be committed. A writer holds the
+ * group lock from join to leave, so its savepoint is not mixed with
+ * other statements, while a reader takes it only for each query it
+ * runs (see tagsistant_real_query()): readers no longer wait for each
+ * other's whole operation, just for the connection to be free.
+ */
+struct {
+	/** true if group commit is active */
+	int enabled;
+
+	/** guards everything below and the use of dbi; recursive since a reader can be nested inside a writer */
+	GRecMutex lock;
+
+	/** the connection dedicated to the shared transaction, set once by tagsistant_group_commit_init() */
+	dbi_conn dbi;
+
+	/** true while the shared transaction is open, read by readers without the lock */
+	gint open;
+
+	/** operations joined to the shared transaction */
+	int operations;
+
+	/** when the shared transaction was opened */
+	gint64 opened;
+
+	/** shared transactions committed so far */
+	guint64 commits;
+
+	/** operations committed so far */
+	guint64 committed_operations;
+} tagsistant_group_commit;
+
+/**
+ * Commit the shared transaction. Must be called with the group lock held.
+ */
+static void tagsistant_group_commit_flush()
+{
+	if (!tagsistant_group_commit.open) return;
+
+	dbg('s', LOG_INFO, "Group commit of %d operations", tagsistant_group_commit.operations);
+
+	if (TAGSISTANT_TRANSACTION_LOST != tagsistant_db_transaction_get_state(tagsistant_group_commit.dbi))
+		tagsistant_query("commit", tagsistant_group_commit.dbi, NULL, NULL);
+
+	/* the connection could have gone while committing too */
+	int committed = (TAGSISTANT_TRANSACTION_LOST != tagsistant_db_transaction_get_state(tagsistant_group_commit.dbi));
+	if (!committed) {
+		dbg('s', LOG_ERR, "Group transaction of %d operations lost with its connection", tagsistant_group_commit.operations);
+		tagsistant_query("rollback", tagsistant_group_commit.dbi, NULL, NULL);
+	}
+	tagsistant_db_transaction_set_state(tagsistant_group_commit.dbi, 0);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	/* the posting lists learn the operations of the group only now */
+	tagsistant_posting_end_group(committed);
+#endif
+	tagsistant_tag_dictionary_end_group(committed);
+
+	/* the operations of the group are visible to everyone now */
+	tagsistant_db_writer_leave();
+
+	tagsistant_group_commit.commits++;
+	tagsistant_group_commit.committed_operations += tagsistant_group_commit.operations;
+
+	g_atomic_int_set(&tagsistant_group_commit.open, 0);
+	tagsistant_group_commit.operations = 0;
+}
+
+/**
+ * Commit the shared transaction once it gets too old,
+ * even if no more operations come to join it
+ */
+static gpointer tagsistant_group_commit_loop(gpointer data)
+{
+	(void) data;
+
+	while (1) {
+		g_usleep(TAGSISTANT_GROUP_COMMIT_INTERVAL);
+
+		g_rec_mutex_lock(&tagsistant_group_commit.lock);
+		if (tagsistant_group_commit.open &&
+			(g_get_monotonic_time() - tagsistant_group_commit.opened >= TAGSISTANT_GROUP_COMMIT_INTERVAL))
+				tagsistant_group_commit_flush();
+		g_rec_mutex_unlock(&tagsistant_group_commit.lock);
+	}
+
+	return (NULL);
+}
+
+/**
+ * Turn group commit on, if requested by --group-commit.
+ * Called after the schema has been created.
+ */
+void tagsistant_group_commit_init()
+{
+	if (!tagsistant.group_commit) return;
+
+	g_rec_mutex_init(&tagsistant_group_commit.lock);
+	tagsistant_group_commit.dbi = tagsistant_db_pool_checkout();
+	tagsistant_group_commit.enabled = 1;
+
+	g_thread_new("Group commit thread", tagsistant_group_commit_loop, NULL);
+}
+
+/**
+ * Join the shared transaction. Writers open it if it's not open yet
+ * and get a savepoint of their own, holding the group lock until they
+ * leave. Readers join it only if it's open, without taking the lock.
+ *
+ * @param start_transaction true for writers
+ * @return the connection of the shared transaction, or NULL if
+ *         a reader found no transaction open
+ */
+static dbi_conn tagsistant_group_commit_join(int start_transaction)
+{
+	if (!start_transaction)
+		return (g_atomic_int_get(&tagsistant_group_commit.open) ? tagsistant_group_commit.dbi : NULL);
+
+	g_rec_mutex_lock(&tagsistant_group_commit.lock);
+
+	if (!tagsistant_group_commit.open) {
+		tagsistant_group_commit.opened = g_get_monotonic_time();
+		tagsistant_db_writer_enter();
+		tagsistant_db_begin_transaction(tagsistant_group_commit.dbi);
+
+		/* readers use the RDS on this connection too, so it's claimed now */
+		tagsistant_db_claim_rds_store(tagsistant_group_commit.dbi);
+
+		g_atomic_int_set(&tagsistant_group_commit.open, 1);
+	}
+
+	tagsistant_query("savepoint tagsistant_operation", tagsistant_group_commit.dbi, NULL, NULL);
+
+	return (tagsistant_group_commit.dbi);
+}
+
+/**
+ * Leave the shared transaction, committing it if it's big or old enough.
+ * Called by writers only, with the group lock held since they joined.
+ */
+static void tagsistant_group_commit_leave()
+{
+	tagsistant_group_commit.operations++;
+
+	if ((tagsistant_group_commit.operations >= TAGSISTANT_GROUP_COMMIT_OPERATIONS) ||
+		(g_get_monotonic_time() - tagsistant_group_commit.opened >= TAGSISTANT_GROUP_COMMIT_INTERVAL))
+			tagsistant_group_commit_flush();
+
+	g_rec_mutex_unlock(&tagsistant_group_commit.lock);
+}
+
+/**
+ * Make all the operations done so far durable. Does nothing
+ * unless group commit is active.
+ */
+void tagsistant_db_barrier()
+{
+	if (!tagsistant_group_commit.enabled) return;
+
+	g_rec_mutex_lock(&tagsistant_group_commit.lock);
+	tagsistant_group_commit_flush();
+	g_rec_mutex_unlock(&tagsistant_group_commit.lock);
+}
+
+/**
+ * Close the transaction of an operation. With group commit active,
+ * only the savepoint of the operation is closed.
+ *
+ * @param dbi the connection
+ * @param commit TAGSISTANT_COMMIT_TRANSACTION or TAGSISTANT_ROLLBACK_TRANSACTION
+ */
+void tagsistant_db_end_transaction(dbi_conn dbi, int commit)
+{
+	/* a transaction lost with its connection can only be rolled back */
+	if (commit && (TAGSISTANT_TRANSACTION_LOST == tagsistant_db_transaction_get_state(dbi))) {
+		dbg('s', LOG_ERR, "Transaction lost with its connection, rolling back");
+		commit = 0;
+	}
+
+	/* the shared connection never changes, and writers using it hold the group lock */
+	if (tagsistant_group_commit.enabled && (dbi == tagsistant_group_commit.dbi)) {
+		if (!commit) tagsistant_query("rollback to savepoint tagsistant_operation", dbi, NULL, NULL);
+		tagsistant_query("release savepoint tagsistant_operation", dbi, NULL, NULL);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+		/* nothing is committed yet: the changes wait for the group flush */
+		tagsistant_posting_end_savepoint(commit);
+#endif
+		tagsistant_tag_dictionary_end_savepoint(commit);
+	} else {
+		tagsistant_query(commit ? "commit" : "rollback", dbi, NULL, NULL);
+
+		/* the connection could have gone while committing too */
+		if (TAGSISTANT_TRANSACTION_LOST == tagsistant_db_transaction_get_state(dbi)) commit = 0;
+		tagsistant_db_transaction_set_state(dbi, 0);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+		tagsistant_posting_end_transaction(commit);
+#endif
+		tagsistant_tag_dictionary_end_transaction(commit);
+	}
+}
+
+/**
+ * Get a connection to the database. The connection bound to the
+ * calling thread is used if available, so the common case takes
+ * no lock at all. Otherwise a connection is taken from the shared
+ * pool or a new one is created.
+ *
+ * Connections are not checked for liveness here: a dead connection
+ * is detected and re-established by tagsistant_real_query() when a
+ * query fails on it.
+ *
+ * Readers take no lock. On SQLite the database runs in WAL mode, so
+ * a reader keeps working on its snapshot while a writer is active,
+ * and write transactions are serialized on tagsistant_sqlite_writer_lock.
+ * On MySQL writers are not serialized at all: InnoDB row locking lets
+ * independent transactions proceed concurrently.
+ *
+ * @param start_transaction if true, a transaction is started
+ * @return DBI connection handle
+ */
+dbi_conn *tagsistant_db_connection(int start_transaction)
+{
+	/* DBI connection handler used by subsequent calls to dbi_* functions */
+	dbi_conn dbi = NULL;
+
+	/* the tags learnt from now on wait for the commit */
+	if (start_transaction) tagsistant_tag_dictionary_begin_transaction();
+
+	/* nothing read from now on can be cached, until the transaction is released */
+	if (start_transaction) tagsistant_db_writer_enter();
+
+	/* join the shared transaction, if group commit is active */
+	if (tagsistant_group_commit.enabled && (start_transaction || g_atomic_int_get(&tagsistant_group_commit.open))) {
+		dbi = tagsistant_group_commit_join(start_transaction);
+		if (dbi) return (dbi);
+	}
+
+	/* SQLite writers wait for their turn */
+	if (start_transaction && (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver)) {
+		gint64 start = g_get_monotonic_time();
+		g_mutex_lock(&tagsistant_sqlite_writer_lock);
+
+		tagsistant_connection_stats.writer_wait += g_get_monotonic_time() - start;
+		tagsistant_connection_stats.writer_transactions++;
+	}
+
+	/* use the connection bound to this thread, if it's free */
+	tagsistant_thread_connection *bound = g_private_get(&tagsistant_thread_connection_key);
+	if (bound && bound->dbi && !bound->in_use) {
+		bound->in_use = 1;
+		dbi = bound->dbi;
+		g_atomic_int_inc(&tagsistant_connection_stats.thread_checkouts);
+	} else {
+		dbi = tagsistant_db_pool_checkout();
+	}
+
+	/* start a transaction */
+	if (start_transaction) tagsistant_db_begin_transaction(dbi);
+
+	return(dbi);
+}
+
+/**
+ * Release a DBI connection. If the calling thread has no connection
+ * bound yet, this one gets bound to it; otherwise it goes back to
+ * the shared pool.
+ *
+ * @param dbi the connection to be released
+ * @param is_writer_locked true if the connection was taken with a transaction
+ *        (the transaction must have been committed or rolled back already)
+ */
+void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_locked)
+{
+	if (is_writer_locked) {
+		tagsistant_db_writer_leave();
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+		tagsistant_negative_cache_release();
+#endif
+	}
+
+	/* the shared connection is never released, writers leave the group holding its lock */
+	if (tagsistant_group_commit.enabled && (dbi == tagsistant_group_commit.dbi)) {
+		if (is_writer_locked) tagsistant_group_commit_leave();
+		return;
+	}
+
+	tagsistant_thread_connection *bound = g_private_get(&tagsistant_thread_connection_key);
+	if (!bound) {
+		bound = g_new0(tagsistant_thread_connection, 1);
+		g_private_set(&tagsistant_thread_connection_key, bound);
+	}
+
+	if (bound->dbi == dbi) {
+		/* the connection of this thread is free again */
+		bound->in_use = 0;
+	} else if (!bound->dbi) {
+		/* bind the connection to this thread */
+		bound->dbi = dbi;
+		bound->in_use = 0;
+		g_atomic_int_inc(&tagsistant_connection_stats.bound);
+	} else {
+		/* release the connection back to the shared pool */
+		tagsistant_db_pool_checkin(dbi);
+	}
+
+	if (is_writer_locked && (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver))
+		g_mutex_unlock(&tagsistant_sqlite_writer_lock);
+}
+
+/**
+ * Return the write generation, a counter moving each time a write
+ * transaction begins or is released. Since readers run concurrently
+ * with writers, a reader can compare the generation before and after
+ * its work to know if the database could have changed meanwhile, with
+ * tagsistant_db_write_generation_unchanged().
+ *
+ * The generation is odd while a write transaction is open: what's read
+ * then could be rolled back, or be about to change, and must not be
+ * cached. The writers are read first: a writer entering later moves
+ * the generation again when it leaves.
+ *
+ * @return the current write generation
+ */
+gint tagsistant_db_write_generation()
+{
+	gint writers = g_atomic_int_get(&tagsistant_open_writers);
+	gint generation = g_atomic_int_get(&tagsistant_write_generation);
+
+	return (writers ? (generation | 1) : generation);
+}
+
+/**
+ * Check if what has been read since a write generation can be cached:
+ * no write transaction was open then, and none began or ended since.
+ *
+ * @param generation the generation returned by tagsistant_db_write_generation()
+ * @return true if the database didn't change
+ */
+gboolean tagsistant_db_write_generation_unchanged(gint generation)
+{
+	return (!(generation & 1) && (generation == tagsistant_db_write_generation()));
+}
+
+/**
+ * Check a connection after a failed query and reconnect it if it's gone.
+ * Since the connection is brand new, the RDS store is attached again.
+ *
+ * @param dbi the connection
+ * @return true if the connection has been re-established
+ */
+static int tagsistant_db_reconnect(dbi_conn dbi)
+{
+	if (dbi_conn_ping(dbi)) return (0);
+
+	dbg('s', LOG_ERR, "DBI connection has gone, reconnecting");
+
+	if (dbi_conn_connect(dbi) < 0) {
+		dbg('s', LOG_ERR, "ERROR! DBI connection can't be re-established!");
+		return (0);
+	}
+
+	g_atomic_int_inc(&tagsistant_connection_stats.reconnects);
+	if (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver)
+		tagsistant_attach_rds_store(dbi);
+
+	return (1);
+}
+
+/**
+ * Print the connection manager counters
+ *
+ * @param stats_buffer the buffer to be filled
+ */
+void tagsistant_db_connection_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
+{
+	g_mutex_lock(&tagsistant_connection_pool_lock);
+
+	guint pooled = g_list_length(tagsistant_connection_pool);
+	guint64 pool_checkouts = tagsistant_connection_stats.pool_checkouts;
+	guint64 pool_wait = tagsistant_connection_stats.pool_wait;
+
+	g_mutex_unlock(&tagsistant_connection_pool_lock);
+
+	g_rec_mutex_lock(&tagsistant_group_commit.lock);
+
+	guint64 group_commits = tagsistant_group_commit.commits;
+	guint64 group_operations = tagsistant_group_commit.committed_operations;
+	int group_pending = tagsistant_group_commit.operations;
+
+	g_rec_mutex_unlock(&tagsistant_group_commit.lock);
+
+	/* read without the writer lock, a stats reader must not wait for a writer */
+	guint64 writer_transactions = tagsistant_connection_stats.writer_transactions;
+	guint64 writer_wait = tagsistant_connection_stats.writer_wait;
+
+	snprintf(stats_buffer, TAGSISTANT_STATS_BUFFER,
+		"# of open connections: %d\n"
+		"# of connections bound to a thread: %d\n"
+		"# of idle connections in the shared pool: %u\n"
+		"# of checkouts served by the thread connection: %d\n"
+		"# of checkouts served by the shared pool: %" PRIu64 "\n"
+		"total wait on the shared pool (microseconds): %" PRIu64 "\n"
+		"# of reconnections: %d\n"
+		"# of serialized SQLite write transactions: %" PRIu64 "\n"
+		"total wait on the SQLite writer lock (microseconds): %" PRIu64 "\n"
+		"write generation: %d\n"
+		"group commit: %s\n"
+		"# of group commits: %" PRIu64 "\n"
+		"# of operations committed in groups: %" PRIu64 "\n"
+		"# of operations waiting for the next group commit: %d\n",
+		g_atomic_int_get(&connections),
+		g_atomic_int_get(&tagsistant_connection_stats.bound),
+		pooled,
+		g_atomic_int_get(&tagsistant_connection_stats.thread_checkouts),
+		pool_checkouts,
+		pool_wait,
+		g_atomic_int_get(&tagsistant_connection_stats.reconnects),
+		writer_transactions,
+		writer_wait,
+		g_atomic_int_get(&tagsistant_write_generation),
+		tagsistant_group_commit.enabled ? "enabled" : "disabled",
+		group_commits,
+		group_operations,
+		group_pending);
+}
+
+/**
+ * Create DB schema
+ */
+void tagsistant_create_schema()
+{
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
+	gchar *current_schema_version = NULL;
+
+	// create database schema
+	switch (tagsistant.sql_database_driver) {
+		case TAGSISTANT_DBI_SQLITE_BACKEND:
+			/*
+			 * Create schema table and check current schema compatiblity
+			 */
+			tagsistant_query(
+				"create table if not exists schema_version (version varchar(32))",
+				dbi, NULL, NULL);
+
+			tagsistant_query(
+				"select version from schema_version",
+				dbi, tagsistant_return_string, &current_schema_version);
+
+			tagsistant_query(
+				"create table if not exists schema_migrations ("
+					"migration integer primary key not null, "
+					"description varchar(255) not null)",
+				dbi, NULL, NULL);
+
+			if (current_schema_version && g_strcmp0(TAGSISTANT_SCHEMA_VERSION, current_schema_version) != 0) {
+				dbg('s', LOG_ERR,
+					"Required schema version %s differs from current schema version %s",
+					TAGSISTANT_SCHEMA_VERSION, current_schema_version);
+				exit(1);
+			}
+
+			/*
+			 * Tags table
+			 */
+			tagsistant_query(
+				"create table if not exists tags ("
+					"tag_id integer primary key autoincrement not null, "
+					"tagname varchar(65) not null, "
+					"key varchar(65) not null default '', "
+					"value varchar(65) not null default '', "
+					"constraint Tag_key unique (tagname, key, value))",
+				dbi, NULL, NULL);
+
+			/*
+			 * Objects table
+			 */
+			tagsistant_query(
+				"create table if not exists objects ("
+					"inode integer not null primary key autoincrement, "
+					"objectname text(255) not null, "
+					"last_autotag timestamp not null default 0, "
+					"checksum text(40) not null default '', "
+					"symlink text(1024) not null default '')",
+				dbi, NULL, NULL);
+
+			/*
+			 * Tagging table
+			 */
+			tagsistant_query(
+				"create table if not exists tagging ("
+					"inode integer not null, "
+					"tag_id integer not null, "
+					"constraint Tagging_key unique (inode, tag_id))",
+				dbi, NULL, NULL);
+
+			/*
+			 * Relations table
+			 */
+			tagsistant_query(
+				"create table if not exists relations ("
+					"relation_id integer primary key autoincrement not null, "
+					"tag1_id integer not null, "
+					"relation varchar not null, "
+					"tag2_id integer not null)",
+				dbi, NULL, NULL);
+
+			/*
+			 * Aliases table
+			 */
+			tagsistant_query(
+				"create table if not exists aliases ("
+					"alias varchar(65) primary key not null, "
+					"query varchar(%d) not null)",
+				dbi, NULL, NULL, TAGSISTANT_ALIAS_MAX_LENGTH);
+
+			/*
+			 * Index declarations
+			 */
+			tagsistant_query("create index if not exists relations_index on relations (tag1_id, tag2_id)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists objectname_index on objects (objectname)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists symlink_index on objects (symlink, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists checksum_index on objects (checksum, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists relations_type_index on relations (relation)", dbi, NULL, NULL);
+			tagsistant_query("create index if not exists aliases_index on aliases (alias)", dbi, NULL, NULL);
+
+			tagsistant_query("delete from schema_version", dbi, NULL, NULL);
+			tagsistant_query("insert into schema_version (version) values (\"%s\")",
+				dbi, NULL, NULL, TAGSISTANT_SCHEMA_VERSION);
+
+			break;
+
+		case TAGSISTANT_DBI_MYSQL_BACKEND:
+			/*
+			 * Create schema table and check current schema compatiblity
+			 */
+			tagsistant_query(
+				"create table if not exists schema_version (version varchar(32))",
+				dbi, NULL, NULL);
+
+			tagsistant_query(
+				"select version from schema_version",
+				dbi, tagsistant_return_string, &current_schema_version);
+
+			tagsistant_query(
+				"create table if not exists schema_migrations ("
+					"migration integer primary key not null, "
+					"description varchar(255) not null)",
+				dbi, NULL, NULL);
+
+			if (current_schema_version && g_strcmp0(TAGSISTANT_SCHEMA_VERSION, current_schema_version) != 0) {
+				dbg('s', LOG_ERR,
+					"Required schema version %s differs from current schema version %s",
+					TAGSISTANT_SCHEMA_VERSION, current_schema_version);
+				exit(1);
+			}
+
+			/*
+			 * Tags table
+			 */
+			tagsistant_query(
+				"create table if not exists tags ("
+					"tag_id integer primary key auto_increment not null, "
+					"tagname varchar(65) not null, "
+					"`key` varchar(65) not null, "
+					"value varchar(65) not null, "
+					"constraint Tag_key unique `key` (tagname, `key`, value))",
+				dbi, NULL, NULL);
+
+			/*
+			 * Objects table
+			 */
+			tagsistant_query(
+				"create table if not exists objects ("
+					"inode integer not null primary key auto_increment, "
+					"objectname varchar(255) not null, "
+					"last_autotag timestamp not null default 0, "
+					"checksum varchar(40) not null default '', "
+					"symlink varchar(1024) not null default '')",
+				dbi, NULL, NULL);
+
+			/*
+			 * Tagging table
+			 */
+			tagsistant_query(
+				"create table if not exists tagging ("
+					"inode integer not null, "
+					"tag_id integer not null, "
+					"constraint Tagging_key unique key (inode, tag_id))",
+				dbi, NULL, NULL);
+
+			/*
+			 * Relations table
+			 */
+			tagsistant_query(
+				"create table if not exists relations ("
+					"relation_id integer primary key auto_increment not null, "
+					"tag1_id integer not null, "
+					"relation varchar(32) not null, "
+					"tag2_id integer not null)",
+				dbi, NULL, NULL);
+
+			/*
+			 * Aliases table
+			 */
+			tagsistant_query(
+				"create table if not exists aliases ("
+					"alias varchar(65) primary key not null, "
+					"query varchar(%d) not null)",
+				dbi, NULL, NULL, TAGSISTANT_ALIAS_MAX_LENGTH);
+
+			/*
+			 * Index declarations
+			 */
+			tagsistant_query("create index relations_index on relations (tag1_id, tag2_id)", dbi, NULL, NULL);
+			tagsistant_query("create index objectname_index on objects (objectname)", dbi, NULL, NULL);
+			tagsistant_query("create index symlink_index on objects (symlink, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index checksum_index on objects (checksum, inode)", dbi, NULL, NULL);
+			tagsistant_query("create index relations_type_index on relations (relation)", dbi, NULL, NULL);
+			tagsistant_query("create index aliases_index on aliases (alias)", dbi, NULL, NULL);
+
+			/*
+			 * Schema version update
+			 */
+			tagsistant_query("delete from schema_version", dbi, NULL, NULL);
+			tagsistant_query("insert into schema_version (version) values (\"%s\")",
+				dbi, NULL, NULL, TAGSISTANT_SCHEMA_VERSION);
+
+			break;
+
+		default:
+			break;
+	}
+
+	tagsistant_create_rds_tables(dbi);
+
+	tagsistant_commit_transaction(dbi);
+	tagsistant_db_connection_release(dbi, 1);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Schema migrations                                                          ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * The base schema is created by tagsistant_create_schema() and tagged
+ * with TAGSISTANT_SCHEMA_VERSION. Any later change to the schema is a
+ * migration, applied in place on mount and recorded in the
+ * schema_migrations table, so a repository never needs to be dumped
+ * and reloaded to get a new index.
+ *
+ * Migrations are applied in order by a background thread, one step per
+ * write transaction, so the filesystem keeps working while a big table
+ * is being indexed. Steps must be idempotent: if the filesystem is
+ * unmounted in the middle, the whole migration is run again on next
+ * mount. On MySQL, which can't create an index "if not exists", a step
+ * is skipped if its information_schema check finds it done. A backfill
+ * step, for data that can't be migrated in SQL, runs in chunks of
+ * TAGSISTANT_MIGRATION_CHUNK tags, each in a write transaction of its
+ * own, so the writer lock is never held for a whole table. A failing
+ * step stops the migrations. The progress is reported in /stats/schema.
+ */
+
+/** the maximum number of steps of a migration */
+#define TAGSISTANT_MIGRATION_STEPS 8
+
+/** the tags processed by each transaction of a backfill */
+#define TAGSISTANT_MIGRATION_CHUNK 1000
+
+/** the migration adding the tag_values table */
+#define TAGSISTANT_MIGRATION_TYPED_VALUES 2
+
+/** the migration adding the tag_trigrams table */
+#define TAGSISTANT_MIGRATION_TRIGRAMS 3
+
+/** a schema migration */
+typedef struct {
+	/** the migration number, starting from 1 */
+	int id;
+
+	/** what the migration does */
+	const gchar *description;
+
+	/** the SQLite statements, NULL terminated */
+	const gchar *sqlite[TAGSISTANT_MIGRATION_STEPS + 1];
+
+	/** the MySQL statements, NULL terminated */
+	const gchar *mysql[TAGSISTANT_MIGRATION_STEPS + 1];
+
+	/**
+	 * for each MySQL statement, a query on information_schema returning
+	 * a non zero count if what the statement creates is already there;
+	 * NULL for statements idempotent by themselves. MySQL DDL commits
+	 * implicitly and has no "if not exists" for indexes.
+	 */
+	const gchar *mysql_done[TAGSISTANT_MIGRATION_STEPS + 1];
+
+	/**
+	 * an optional last step, for data that can't be migrated in SQL:
+	 * processes the next TAGSISTANT_MIGRATION_CHUNK tags after the
+	 * tag_id pointed by its second argument, moves it to the last tag
+	 * processed and returns the tags read, 0 once done
+	 */
+	int (*backfill)(dbi_conn dbi, tagsistant_inode *last_tag_id);
+} tagsistant_migration;
+
+static int tagsistant_sql_type_all_tags(dbi_conn dbi, tagsistant_inode *last_tag_id);
+static int tagsistant_sql_index_all_trigrams(dbi_conn dbi, tagsistant_inode *last_tag_id);
+
+/** count the indexes named index on table in the current MySQL database */
+#define TAGSISTANT_MYSQL_INDEX_EXISTS(table, index) \
+	"select count(*) from information_schema.statistics " \
+		"where table_schema = database() and table_name = '" table "' and index_name = '" index "'"
+
+/** the migrations, in the order they must be applied */
+static const tagsistant_migration tagsistant_migrations[] = {
+	{
+		1, "covering indexes for RDS materialization, tag deletion and reasoning",
+		{
+			"create index if not exists tagging_tag_index on tagging (tag_id, inode)",
+			"create index if not exists relations_tag1_index on relations (tag1_id, relation, tag2_id)",
+			"create index if not exists relations_tag2_index on relations (tag2_id, relation, tag1_id)",
+			NULL
+		},
+		{
+			"create index tagging_tag_index on tagging (tag_id, inode)",
+			"create index relations_tag1_index on relations (tag1_id, relation, tag2_id)",
+			"create index relations_tag2_index on relations (tag2_id, relation, tag1_id)",
+			NULL
+		},
+		{
+			TAGSISTANT_MYSQL_INDEX_EXISTS("tagging", "tagging_tag_index"),
+			TAGSISTANT_MYSQL_INDEX_EXISTS("relations", "relations_tag1_index"),
+			TAGSISTANT_MYSQL_INDEX_EXISTS("relations", "relations_tag2_index"),
+			NULL
+		},
+		NULL
+	},
+	{
+		TAGSISTANT_MIGRATION_TYPED_VALUES, "typed values of triple tags for range operators",
+		{
+			"create table if not exists tag_values ("
+				"tag_id integer primary key not null, "
+				"tagname varchar(65) not null, "
+				"`key` varchar(65) not null, "
+				"value_type integer not null, "
+				"typed_value real not null)",
+			"create index if not exists tag_values_index on tag_values (tagname, `key`, value_type, typed_value)",
+			NULL
+		},
+		{
+			"create table if not exists tag_values ("
+				"tag_id integer primary key not null, "
+				"tagname varchar(65) not null, "
+				"`key` varchar(65) not null, "
+				"value_type integer not null, "
+				"typed_value double not null)",
+			"create index tag_values_index on tag_values (tagname, `key`, value_type, typed_value)",
+			NULL
+		},
+		{
+			NULL,
+			TAGSISTANT_MYSQL_INDEX_EXISTS("tag_values", "tag_values_index"),
+			NULL
+		},
+		tagsistant_sql_type_all_tags
+	},
+	{
+		TAGSISTANT_MIGRATION_TRIGRAMS, "trigram index of triple tag values for the contains operator",
+		{
+			"create table if not exists tag_trigrams ("
+				"trigram integer not null, "
+				"tag_id integer not null, "
+				"primary key (trigram, tag_id))",
+			"create index if not exists tag_trigrams_tag_index on tag_trigrams (tag_id)",
+			NULL
+		},
+		{
+			/* not used on MySQL, see tagsistant_sql_trigrams_ready() */
+			NULL
+		},
+		{
+			NULL
+		},
+		tagsistant_sql_index_all_trigrams
+	},
+};
+
+#define TAGSISTANT_MIGRATIONS (sizeof(tagsistant_migrations) / sizeof(tagsistant_migration))
+
+/** the progress of the migrations, reported in /stats/schema */
+static struct {
+	/** guards the other fields */
+	GMutex lock;
+
+	/** the last migration applied */
+	int applied;
+
+	/** the migration being applied, NULL if none */
+	const tagsistant_migration *running;
+
+	/** the steps of the running migration done so far */
+	int step;
+
+	/** the steps of the running migration */
+	int steps;
+
+	/** the tags processed so far by the backfill of the running migration */
+	int backfilled;
+} tagsistant_migration_progress;
+
+/**
+ * Return true if a migration has been applied
+ *
+ * @param id the migration number
+ */
+static gboolean tagsistant_migration_applied(int id)
+{
+	g_mutex_lock(&tagsistant_migration_progress.lock);
+	gboolean applied = (tagsistant_migration_progress.applied >= id);
+	g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+	return (applied);
+}
+
+/**
+ * Return true if a migration has been applied, or is being applied
+ * and its first step, creating its table, is done
+ *
+ * @param id the migration number
+ */
+static gboolean tagsistant_migration_started(int id)
+{
+	g_mutex_lock(&tagsistant_migration_progress.lock);
+	gboolean started = (tagsistant_migration_progress.applied >= id) ||
+		(tagsistant_migration_progress.running &&
+		 tagsistant_migration_progress.running->id == id &&
+		 tagsistant_migration_progress.step > 0);
+	g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+	return (started);
+}
+
+/**
+ * Return the statements of a migration for the current backend
+ *
+ * @param migration the migration
+ * @return a NULL terminated array of statements
+ */
+static const gchar * const *tagsistant_migration_statements(const tagsistant_migration *migration)
+{
+	if (TAGSISTANT_DBI_MYSQL_BACKEND == tagsistant.sql_database_driver)
+		return (migration->mysql);
+
+	return (migration->sqlite);
+}
+
+/**
+ * Check if a MySQL migration statement has already been applied
+ *
+ * @param migration the migration
+ * @param step the statement
+ * @return true if what the statement creates is already there
+ */
+static gboolean tagsistant_migration_step_done(const tagsistant_migration *migration, int step)
+{
+	if (TAGSISTANT_DBI_MYSQL_BACKEND != tagsistant.sql_database_driver) return (FALSE);
+	if (!migration->mysql_done[step]) return (FALSE);
+
+	int found = 0;
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	tagsistant_query(migration->mysql_done[step], dbi, tagsistant_return_integer, &found);
+	tagsistant_db_connection_release(dbi, 0);
+
+	return (found > 0);
+}
+
+/**
+ * Run a migration step in a write transaction
+ *
+ * @param migration the migration
+ * @param step the statement to run, or the backfill if past the statements
+ * @param last_tag_id the last tag processed by the backfill
+ * @return the tags read by the backfill (1 for statements), -1 on error
+ */
+static int tagsistant_migration_run_step(const tagsistant_migration *migration, int step, tagsistant_inode *last_tag_id)
+{
+	const gchar * const *statements = tagsistant_migration_statements(migration);
+	guint errors = tagsistant_sql_thread_errors();
+	int done = 1;
+
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
+	if (statements[step])
+		tagsistant_query(statements[step], dbi, NULL, NULL);
+	else
+		done = migration->backfill(dbi, last_tag_id);
+
+	if (tagsistant_sql_thread_errors() != errors) {
+		tagsistant_rollback_transaction(dbi);
+		tagsistant_db_connection_release(dbi, 1);
+		return (-1);
+	}
+
+	tagsistant_commit_transaction(dbi);
+	tagsistant_db_connection_release(dbi, 1);
+
+	return (done);
+}
+
+/**
+ * Apply the pending migrations. A failing step stops the migrations:
+ * the failed one is not recorded, so it's run again on next mount.
+ *
+ * @param data unused
+ */
+static gpointer tagsistant_migrate_schema_loop(gpointer data)
+{
+	(void) data;
+
+	guint i;
+	for (i = 0; i < TAGSISTANT_MIGRATIONS; i++) {
+		const tagsistant_migration *migration = &tagsistant_migrations[i];
+		if (migration->id <= tagsistant_migration_progress.applied) continue;
+
+		const gchar * const *statements = tagsistant_migration_statements(migration);
+
+		int statement_steps = 0;
+		while (statements[statement_steps]) statement_steps++;
+
+		int steps = statement_steps + (migration->backfill ? 1 : 0);
+
+		g_mutex_lock(&tagsistant_migration_progress.lock);
+		tagsistant_migration_progress.running = migration;
+		tagsistant_migration_progress.step = 0;
+		tagsistant_migration_progress.steps = steps;
+		tagsistant_migration_progress.backfilled = 0;
+		g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+		dbg('s', LOG_INFO, "Applying schema migration %d: %s", migration->id, migration->description);
+
+		int step;
+		for (step = 0; step < steps; step++) {
+			if ((step < statement_steps) && tagsistant_migration_step_done(migration, step)) {
+				dbg('s', LOG_INFO, "Schema migration %d, step %d already applied", migration->id, step + 1);
+			} else {
+				/* statements run once, the backfill until it finds no more tags */
+				tagsistant_inode last_tag_id = 0;
+				int done;
+				do {
+					done = tagsistant_migration_run_step(migration, step, &last_tag_id);
+
+					if (done < 0) {
+						g_mutex_lock(&tagsistant_migration_progress.lock);
+						tagsistant_migration_progress.running = NULL;
+						g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+						dbg('s', LOG_ERR, "Schema migration %d failed at step %d, migrations stopped", migration->id, step + 1);
+						return (NULL);
+					}
+
+					if (step >= statement_steps) {
+						g_mutex_lock(&tagsistant_migration_progress.lock);
+						tagsistant_migration_progress.backfilled += done;
+						g_mutex_unlock(&tagsistant_migration_progress.lock);
+					}
+				} while ((step >= statement_steps) && (done > 0));
+			}
+
+			g_mutex_lock(&tagsistant_migration_progress.lock);
+			tagsistant_migration_progress.step = step + 1;
+			g_mutex_unlock(&tagsistant_migration_progress.lock);
+		}
+
+		/* record the migration */
+		dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_START_TRANSACTION);
+		tagsistant_query(
+			"insert into schema_migrations (migration, description) values (%d, '%s')",
+			dbi, NULL, NULL, migration->id, migration->description);
+		tagsistant_commit_transaction(dbi);
+		tagsistant_db_connection_release(dbi, 1);
+
+		g_mutex_lock(&tagsistant_migration_progress.lock);
+		tagsistant_migration_progress.applied = migration->id;
+		tagsistant_migration_progress.running = NULL;
+		g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+		dbg('s', LOG_INFO, "Schema migration %d applied", migration->id);
+	}
+
+	return (NULL);
+}
+
+/**
+ * Start applying the pending schema migrations in the background.
+ * Called from the FUSE init() hook, after the schema has been created.
+ */
+void tagsistant_migrate_schema()
+{
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+	int applied = 0;
+	tagsistant_query("select max(migration) from schema_migrations", dbi, tagsistant_return_integer, &applied);
+	tagsistant_db_connection_release(dbi, 0);
+
+	g_mutex_lock(&tagsistant_migration_progress.lock);
+	tagsistant_migration_progress.applied = applied;
+	g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+	if (applied >= tagsistant_migrations[TAGSISTANT_MIGRATIONS - 1].id) {
+		dbg('s', LOG_INFO, "Schema is up to date (migration %d)", applied);
+		return;
+	}
+
+	g_thread_new("Schema migration thread", tagsistant_migrate_schema_loop, NULL);
+}
+
+/**
+ * Report the progress of the schema migrations
+ *
+ * @param stats_buffer the buffer to be filled
+ */
+void tagsistant_migration_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
+{
+	g_mutex_lock(&tagsistant_migration_progress.lock);
+
+	gchar *running = tagsistant_migration_progress.running
+		? g_strdup_printf("%d (%s), step %d of %d, %d tags backfilled",
+			tagsistant_migration_progress.running->id,
+			tagsistant_migration_progress.running->description,
+			tagsistant_migration_progress.step,
+			tagsistant_migration_progress.steps,
+			tagsistant_migration_progress.backfilled)
+		: g_strdup("none");
+
+	snprintf(stats_buffer, TAGSISTANT_STATS_BUFFER,
+		"schema version: %s\n"
+		"migrations applied: %d of %d\n"
+		"running migration: %s\n",
+		TAGSISTANT_SCHEMA_VERSION,
+		tagsistant_migration_progress.applied,
+		tagsistant_migrations[TAGSISTANT_MIGRATIONS - 1].id,
+		running);
+
+	g_mutex_unlock(&tagsistant_migration_progress.lock);
+
+	g_free(running);
+}
+
+/** the queries failed so far in each thread */
+static __thread guint tagsistant_sql_failed_queries = 0;
+
+/**
+ * Return the number of queries failed so far in the calling thread.
+ * Compare the value before and after a sequence of queries to
+ * know if any of them failed.
+ *
+ * @return the number of failed queries
+ */
+guint tagsistant_sql_thread_errors()
+{
+	return (tagsistant_sql_failed_queries);
+}
+
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+/**
+ * Bind the arguments of a call site to its prepared statement
+ *
+ * @param stmt the prepared statement
+ * @param registered the call site statement
+ * @param ap the arguments
+ */
+static void tagsistant_sqlite_bind(sqlite3_stmt *stmt, tagsistant_sql_statement *registered, va_list ap)
+{
+	const gchar *type = registered->params;
+	int position = 1;
+
+	while (*type) {
+		switch (*type) {
+			case 's': {
+				/* printf() turns NULL strings into "(null)", do the same */
+				const char *string = va_arg(ap, const char *);
+				sqlite3_bind_text(stmt, position, string ? string : "(null)", -1, SQLITE_STATIC);
+				break;
+			}
+			case 'd':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, int));
+				break;
+			case 'u':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, unsigned int));
+				break;
+			case 'l':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, long));
+				break;
+			case 'L':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, unsigned long));
+				break;
+			case 'q':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, long long));
+				break;
+			case 'Q':
+				sqlite3_bind_int64(stmt, position, va_arg(ap, unsigned long long));
+				break;
+		}
+		type++;
+		position++;
+	}
+}
+
+/**
+ * Perform a query on a native SQLite connection. Statements of bindable
+ * call sites are prepared once per connection and reused, binding the
+ * arguments instead of escaping them. Other statements are formatted
+ * as text, prepared and finalized on each call.
+ *
+ * Rows are stepped one by one and handed to the callback as the
+ * sqlite3_stmt itself, so no column is copied. If the callback returns
+ * TAGSISTANT_STOP_QUERY, the remaining rows are skipped.
+ *
+ * @return the number of rows passed to the callback
+ */
+static int tagsistant_sqlite_query(
+	tagsistant_sqlite_conn *conn,
+	tagsistant_sql_statement *registered,
+	const char *format,
+	int (*callback)(void *, dbi_result),
+	const char *file,
+	int line,
+	void *firstarg,
+	va_list ap)
+{
+	sqlite3_stmt *stmt = NULL;
+	int cached = 0;
+
+	/* look for a prepared statement or prepare it */
+	if (registered->bindable && !g_atomic_int_get(&(registered->dynamic))) {
+		stmt = (sqlite3_stmt *) g_hash_table_lookup(conn->statements, registered);
+
+		if (!stmt) {
+			if (SQLITE_OK == sqlite3_prepare_v2(conn->db, registered->bound_sql, -1, &stmt, NULL)) {
+				g_hash_table_insert(conn->statements, registered, stmt);
+			} else {
+				dbg('s', LOG_INFO, "SQL from %s:%d can't be prepared (%s), using plain text", file, line, sqlite3_errmsg(conn->db));
+				registered->bindable = 0;
+				stmt = NULL;
+			}
+		}
+
+		if (stmt) {
+			cached = 1;
+			tagsistant_sqlite_bind(stmt, registered, ap);
+			dbg('s', LOG_INFO, "SQL from %s:%d: [%s] (prepared)", file, line, registered->bound_sql);
+		}
+	}
+
+	/* no prepared statement available, format the SQL as text */
+	if (!stmt) {
+		gchar *statement = tagsistant_sql_render(registered, format, ap);
+		if (NULL == statement) {
+			dbg('s', LOG_ERR, "Null SQL statement");
+			return (0);
+		}
+
+		dbg('s', LOG_INFO, "SQL from %s:%d: [%s]", file, line, statement);
+		tagsistant_dirty_logging(statement);
+
+		if (SQLITE_OK != sqlite3_prepare_v2(conn->db, statement, -1, &stmt, NULL)) {
+			dbg('s', LOG_ERR, "Error: %s.", sqlite3_errmsg(conn->db));
+			tagsistant_sql_failed_queries++;
+			g_free(statement);
+			return (0);
+		}
+
+		g_free(statement);
+	}
+
+	/* step the rows */
+	int rows = 0, res = 0;
+	while (SQLITE_ROW == (res = sqlite3_step(stmt))) {
+		if (!callback) continue;
+
+		rows++;
+		if (TAGSISTANT_STOP_QUERY == callback(firstarg, stmt)) {
+			res = SQLITE_DONE;
+			break;
+		}
+	}
+
+	if (SQLITE_DONE != res) {
+		dbg('s', LOG_ERR, "Error: %s.", sqlite3_errmsg(conn->db));
+		tagsistant_sql_failed_queries++;
+	}
+
+	/* prepared statements are kept for the next call */
+	if (cached) {
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	} else {
+		sqlite3_finalize(stmt);
+	}
+
+	return (rows);
+}
+#endif /* TAGSISTANT_ENABLE_NATIVE_SQLITE */
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   SQL statistics                                                             ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * Each thread records the statements it runs in its own
+ * tagsistant_sql_site_stats block, one per call site, so recording
+ * takes no lock and writes no shared memory. The blocks of a call site
+ * are chained on its tagsistant_sql_statement and merged when /stats/sql
+ * is read. When a thread exits, its blocks are adopted by the next
+ * threads, so the number of blocks follows the number of live threads.
+ *
+ * Latencies are counted in log-linear buckets, like HDR histograms:
+ * values below twice TAGSISTANT_SQL_HISTOGRAM_SUB microseconds have their
+ * own bucket, larger ones share TAGSISTANT_SQL_HISTOGRAM_SUB buckets per
+ * power of two, which keeps the error below 1/TAGSISTANT_SQL_HISTOGRAM_SUB.
+ *
+ * Writing to /stats/sql bumps the statistics epoch: blocks of an older
+ * epoch are skipped by the readers and cleared by their owner on next use.
+ */
+
+#define TAGSISTANT_SQL_HISTOGRAM_SUB_BITS 3
+#define TAGSISTANT_SQL_HISTOGRAM_SUB (1 << TAGSISTANT_SQL_HISTOGRAM_SUB_BITS)
+#define TAGSISTANT_SQL_HISTOGRAM_BUCKETS (2 * TAGSISTANT_SQL_HISTOGRAM_SUB + (31 - TAGSISTANT_SQL_HISTOGRAM_SUB_BITS) * TAGSISTANT_SQL_HISTOGRAM_SUB)
+
+/** the statistics of a call site recorded by one thread */
+typedef struct tagsistant_sql_site_stats {
+	/** the next block of the same call site */
+	struct tagsistant_sql_site_stats *next;
+
+	/** true while a thread owns the block */
+	gint owned;
+
+	/** the epoch the counters belong to */
+	gint epoch;
+
+	/** number of statements run */
+	guint calls;
+
+	/** number of rows returned */
+	guint64 rows;
+
+	/** total time, in microseconds */
+	guint64 total;
+
+	/** slowest statement, in microseconds */
+	guint max;
+
+	/** the latency histogram */
+	guint histogram[TAGSISTANT_SQL_HISTOGRAM_BUCKETS];
+} tagsistant_sql_site_stats;
+
+/** the statistics epoch, bumped by tagsistant_sql_stats_reset() */
+static gint tagsistant_sql_stats_epoch = 0;
+
+/**
+ * Release the blocks of an exiting thread, to be adopted by others
+ *
+ * @param blocks the GHashTable tagsistant_sql_statement -> tagsistant_sql_site_stats of the thread
+ */
+static void tagsistant_sql_stats_thread_free(gpointer blocks)
+{
+	GHashTableIter iter;
+	gpointer statement, block;
+
+	g_hash_table_iter_init(&iter, (GHashTable *) blocks);
+	while (g_hash_table_iter_next(&iter, &statement, &block))
+		g_atomic_int_set(&(((tagsistant_sql_site_stats *) block)->owned), 0);
+
+	g_hash_table_destroy((GHashTable *) blocks);
+}
+
+/** the blocks of the current thread */
+static GPrivate tagsistant_sql_stats_key = G_PRIVATE_INIT(tagsistant_sql_stats_thread_free);
+
+/**
+ * Return the bucket of a latency
+ *
+ * @param usec the latency in microseconds
+ * @return the bucket index
+ */
+static guint tagsistant_sql_histogram_bucket(guint usec)
+{
+	if (usec < 2 * TAGSISTANT_SQL_HISTOGRAM_SUB) return (usec);
+
+	guint exponent = g_bit_storage(usec) - 1;
+	guint sub = (usec >> (exponent - TAGSISTANT_SQL_HISTOGRAM_SUB_BITS)) & (TAGSISTANT_SQL_HISTOGRAM_SUB - 1);
+
+	return (2 * TAGSISTANT_SQL_HISTOGRAM_SUB + (exponent - TAGSISTANT_SQL_HISTOGRAM_SUB_BITS - 1) * TAGSISTANT_SQL_HISTOGRAM_SUB + sub);
+}
+
+/**
+ * Return the highest latency counted in a bucket
+ *
+ * @param bucket the bucket index
+ * @return the latency in microseconds
+ */
+static guint tagsistant_sql_histogram_value(guint bucket)
+{
+	if (bucket < 2 * TAGSISTANT_SQL_HISTOGRAM_SUB) return (bucket);
+
+	bucket -= 2 * TAGSISTANT_SQL_HISTOGRAM_SUB;
+	guint shift = bucket / TAGSISTANT_SQL_HISTOGRAM_SUB + 1;
+	guint sub = bucket % TAGSISTANT_SQL_HISTOGRAM_SUB;
+
+	return (((TAGSISTANT_SQL_HISTOGRAM_SUB + sub + 1) << shift) - 1);
+}
+
+/**
+ * Return the block of the current thread for a call site,
+ * adopting an orphan block or chaining a new one if needed
+ *
+ * @param statement the call site
+ * @return the block
+ */
+static tagsistant_sql_site_stats *tagsistant_sql_stats_block(tagsistant_sql_statement *statement)
+{
+	GHashTable *blocks = g_private_get(&tagsistant_sql_stats_key);
+	if (!blocks) {
+		blocks = g_hash_table_new(NULL, NULL);
+		g_private_set(&tagsistant_sql_stats_key, blocks);
+	}
+
+	tagsistant_sql_site_stats *block = g_hash_table_lookup(blocks, statement);
+	if (block) return (block);
+
+	/* adopt the block of a thread which has exited */
+	for (block = g_atomic_pointer_get(&(statement->stats)); block; block = block->next)
+		if (g_atomic_int_compare_and_exchange(&(block->owned), 0, 1)) break;
+
+	/* or chain a new one */
+	if (!block) {
+		block = g_new0(tagsistant_sql_site_stats, 1);
+		block->owned = 1;
+		block->epoch = g_atomic_int_get(&tagsistant_sql_stats_epoch);
+		do {
+			block->next = g_atomic_pointer_get(&(statement->stats));
+		} while (!g_atomic_pointer_compare_and_exchange(&(statement->stats), block->next, block));
+	}
+
+	g_hash_table_insert(blocks, statement, block);
+	return (block);
+}
+
+/**
+ * Record a statement run by a call site
+ *
+ * @param statement the call site
+ * @param rows the rows returned
+ * @param usec the latency in microseconds
+ */
+static void tagsistant_sql_stats_record(tagsistant_sql_statement *statement, int rows, gint64 usec)
+{
+	tagsistant_sql_site_stats *block = tagsistant_sql_stats_block(statement);
+
+	guint latency = (usec < 0) ? 0 : (usec > G_MAXINT32) ? G_MAXINT32 : (guint) usec;
+
+	/* the statistics have been reset since the last record */
+	gint epoch = g_atomic_int_get(&tagsistant_sql_stats_epoch);
+	if (block->epoch != epoch) {
+		block->calls = 0;
+		block->rows = 0;
+		block->total = 0;
+		block->max = 0;
+		memset(block->histogram, 0, sizeof(block->histogram));
+		g_atomic_int_set(&(block->epoch), epoch);
+	}
+
+	block->calls++;
+	block->rows += rows;
+	block->total += latency;
+	if (latency > block->max) block->max = latency;
+	block->histogram[tagsistant_sql_histogram_bucket(latency)]++;
+}
+
+/**
+ * Reset the SQL statistics
+ */
+void tagsistant_sql_stats_reset()
+{
+	g_atomic_int_inc(&tagsistant_sql_stats_epoch);
+	dbg('s', LOG_INFO, "SQL statistics reset");
+}
+
+/** the statistics of a call site merged by tagsistant_sql_stats_report() */
+typedef struct {
+	tagsistant_sql_statement *statement;
+	guint calls;
+	guint64 rows;
+	guint64 total;
+	guint max;
+	guint histogram[TAGSISTANT_SQL_HISTOGRAM_BUCKETS];
+} tagsistant_sql_site_report;
+
+/**
+ * Sort the call sites by total time, slowest first
+ */
+static gint tagsistant_sql_site_report_compare(gconstpointer a, gconstpointer b)
+{
+	const tagsistant_sql_site_report *ra = *((tagsistant_sql_site_report **) a);
+	const tagsistant_sql_site_report *rb = *((tagsistant_sql_site_report **) b);
+
+	if (ra->total == rb->total) return (0);
+	return ((ra->total < rb->total) ? 1 : -1);
+}
+
+/**
+ * Return the latency below which a share of the statements fall
+ *
+ * @param site the merged statistics
+ * @param permille the share, in thousandths
+ * @return the latency in microseconds
+ */
+static guint tagsistant_sql_site_report_percentile(tagsistant_sql_site_report *site, guint permille)
+{
+	guint64 threshold = ((guint64) site->calls * permille + 999) / 1000;
+	guint64 seen = 0;
+
+	guint bucket;
+	for (bucket = 0; bucket < TAGSISTANT_SQL_HISTOGRAM_BUCKETS; bucket++) {
+		seen += site->histogram[bucket];
+		if (seen >= threshold) return (MIN(tagsistant_sql_histogram_value(bucket), site->max));
+	}
+
+	return (site->max);
+}
+
+/**
+ * Build the content of /stats/sql: one line per call site, slowest first
+ *
+ * @return the report, at most TAGSISTANT_SQL_STATS_BUFFER bytes long (must be freed)
+ */
+gchar *tagsistant_sql_stats_report()
+{
+	GPtrArray *sites = g_ptr_array_new_with_free_func(g_free);
+	gint epoch = g_atomic_int_get(&tagsistant_sql_stats_epoch);
+
+	/* merge the blocks of each call site */
+	g_rw_lock_reader_lock(&tagsistant_sql_statements_lock);
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, tagsistant_sql_statements);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		tagsistant_sql_statement *statement = (tagsistant_sql_statement *) value;
+		tagsistant_sql_site_report *site = NULL;
+
+		tagsistant_sql_site_stats *block;
+		for (block = g_atomic_pointer_get(&(statement->stats)); block; block = block->next) {
+			if (g_atomic_int_get(&(block->epoch)) != epoch || !block->calls) continue;
+
+			if (!site) {
+				site = g_new0(tagsistant_sql_site_report, 1);
+				site->statement = statement;
+				g_ptr_array_add(sites, site);
+			}
+
+			site->calls += block->calls;
+			site->rows += block->rows;
+			site->total += block->total;
+			if (block->max > site->max) site->max = block->max;
 
-			/*
-			 * Schema version update
-			 */
-			tagsistant_query("delete from schema_version", dbi, NULL, NULL);
-			tagsistant_query("insert into schema_version (version) values (\"%s\")",
-				dbi, NULL, NULL, TAGSISTANT_SCHEMA_VERSION);
+			guint bucket;
+			for (bucket = 0; bucket < TAGSISTANT_SQL_HISTOGRAM_BUCKETS; bucket++)
+				site->histogram[bucket] += block->histogram[bucket];
+		}
+	}
 
-			break;
+	g_rw_lock_reader_unlock(&tagsistant_sql_statements_lock);
 
-		default:
-			break;
+	g_ptr_array_sort(sites, tagsistant_sql_site_report_compare);
+
+	/* format the report */
+	GString *report = g_string_sized_new(4096);
+	g_string_append(report, "     calls       rows   total_ms   p50_us   p99_us   max_us  call site\n");
+
+	guint i;
+	for (i = 0; i < sites->len; i++) {
+		tagsistant_sql_site_report *site = g_ptr_array_index(sites, i);
+		gchar *line = g_strdup_printf("%10u %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %8u %8u %8u  %s:%d\n",
+			site->calls,
+			site->rows,
+			site->total / 1000,
+			tagsistant_sql_site_report_percentile(site, 500),
+			tagsistant_sql_site_report_percentile(site, 990),
+			site->max,
+			site->statement->file,
+			site->statement->line);
+
+		gboolean fits = (report->len + strlen(line) < TAGSISTANT_SQL_STATS_BUFFER);
+		if (fits) g_string_append(report, line);
+		g_free(line);
+
+		if (!fits) break;
 	}
 
-	tagsistant_commit_transaction(dbi);
-	tagsistant_db_connection_release(dbi, 1);
+	g_ptr_array_free(sites, TRUE);
+
+	return (g_string_free(report, FALSE));
 }
 
 /**
- * Prepare SQL queries and perform them.
+ * Run a statement on the backend of the connection.
+ * See tagsistant_real_query() for the parameters.
  *
- * @param format printf-like string of SQL query
- * @param callback pointer to function to be called on results of SQL query
- * @param firstarg pointer to buffer for callback returned data
- * @return 0 (always, due to SQLite policy)
+ * @return the number of rows passed to the callback
  */
-int tagsistant_real_query(
+static int tagsistant_sql_execute(
 	dbi_conn dbi,
+	tagsistant_sql_statement *registered,
 	const char *format,
 	int (*callback)(void *, dbi_result),
 	char *file,
 	int line,
 	void *firstarg,
-	...)
+	va_list ap)
 {
-	va_list ap;
-	va_start(ap, firstarg);
-
-	/* check if connection has been created */
-	if (NULL == dbi) {
-		dbg('s', LOG_ERR, "ERROR! DBI connection was not initialized!");
-		return(0);
-	}
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite())
+		return (tagsistant_sqlite_query((tagsistant_sqlite_conn *) dbi, registered, format, callback, file, line, firstarg, ap));
+#endif
 
 #if TAGSISTANT_USE_QUERY_MUTEX
 	/* lock the connection mutex */
 	g_mutex_lock(&tagsistant_query_mutex);
 #endif
 
-	/* check if the connection is alive */
-	if (!dbi_conn_ping(dbi)	&& dbi_conn_connect(dbi) < 0) {
-#if TAGSISTANT_USE_QUERY_MUTEX
-		g_mutex_unlock(&tagsistant_query_mutex);
-#endif
-		dbg('s', LOG_ERR, "ERROR! DBI Connection has gone!");
-		return(0);
-	}
-
-	/* replace all the single or double quotes with "<><>" in the format */
-	gchar *escaped_format = g_regex_replace_literal(RX1, format, -1, 0, "<><>", 0, NULL);
-
 	/* format the statement */
-	gchar *statement = g_strdup_vprintf(escaped_format, ap);
-	if (NULL == statement) {
+	gchar *escaped_statement = tagsistant_sql_render(registered, format, ap);
+	if (NULL == escaped_statement) {
 #if TAGSISTANT_USE_QUERY_MUTEX
 		/* lock the connection mutex */
 		g_mutex_unlock(&tagsistant_query_mutex);
 #endif
 		dbg('s', LOG_ERR, "Null SQL statement");
-		g_free(escaped_format);
 		return(0);
 	}
 
-	/* prepend a backslash to all the single quotes inside the arguments */
-	gchar *escaped_statement_tmp = g_regex_replace_literal(RX2, statement, -1, 0, "''", 0, NULL);
-
-	/* replace "<><>" with a single quote */
-	gchar *escaped_statement = g_regex_replace_literal(RX3, escaped_statement_tmp, -1, 0, "'", 0, NULL);
-
 	/* log and do the query */
 	dbg('s', LOG_INFO, "SQL from %s:%d: [%s]", file, line, escaped_statement);
 	dbi_result result = dbi_conn_query(dbi, escaped_statement);
 
+	/*
+	 * if the query failed because the connection has gone, reconnect and retry,
+	 * unless a transaction is open: it's gone too, and the caller must roll back
+	 */
+	if (!result) {
+		if (!tagsistant_db_transaction_get_state(dbi)) {
+			if (tagsistant_db_reconnect(dbi)) result = dbi_conn_query(dbi, escaped_statement);
+		} else if (dbi_conn_ping(dbi) == 0) {
+			dbg('s', LOG_ERR, "DBI connection has gone inside a transaction, not retrying");
+			tagsistant_db_transaction_set_state(dbi, TAGSISTANT_TRANSACTION_LOST);
+		}
+	}
+
 	tagsistant_dirty_logging(escaped_statement);
 
-	g_free_null(escaped_format);
-	g_free_null(escaped_statement_tmp);
 	g_free_null(escaped_statement);
 
 	/* call the callback function on results or report an error */
@@ -680,8 +2630,8 @@ int tagsistant_real_query(
 
 		if (callback) {
 			while (dbi_result_next_row(result)) {
-				callback(firstarg, result);
 				rows++;
+				if (TAGSISTANT_STOP_QUERY == callback(firstarg, result)) break;
 			}
 		}
 		dbi_result_free(result);
@@ -692,6 +2642,7 @@ int tagsistant_real_query(
 		const char *errmsg = NULL;
 		dbi_conn_error(dbi, &errmsg);
 		if (errmsg) dbg('s', LOG_ERR, "Error: %s.", errmsg);
+		tagsistant_sql_failed_queries++;
 
 	}
 
@@ -702,11 +2653,64 @@ int tagsistant_real_query(
 	return(rows);
 }
 
+/**
+ * Prepare SQL queries and perform them.
+ *
+ * @param format printf-like string of SQL query
+ * @param callback pointer to function to be called on results of SQL query
+ * @param firstarg pointer to buffer for callback returned data
+ * @return the number of rows passed to the callback
+ */
+int tagsistant_real_query(
+	dbi_conn dbi,
+	const char *format,
+	int (*callback)(void *, dbi_result),
+	char *file,
+	int line,
+	void *firstarg,
+	...)
+{
+	va_list ap;
+
+	/* check if connection has been created */
+	if (NULL == dbi) {
+		dbg('s', LOG_ERR, "ERROR! DBI connection was not initialized!");
+		return(0);
+	}
+
+	/*
+	 * get the call site statement: its format has all the single or
+	 * double quotes already replaced by TAGSISTANT_SQL_QUOTE_PLACEHOLDER
+	 */
+	tagsistant_sql_statement *registered = tagsistant_sql_statement_lookup(format, file, line);
+
+	gint64 started = g_get_monotonic_time();
+
+	/* the shared connection of group commit runs one query at a time */
+	gboolean shared = tagsistant_group_commit.enabled && (dbi == tagsistant_group_commit.dbi);
+	if (shared) g_rec_mutex_lock(&tagsistant_group_commit.lock);
+
+	va_start(ap, firstarg);
+	int rows = tagsistant_sql_execute(dbi, registered, format, callback, file, line, firstarg, ap);
+	va_end(ap);
+
+	if (shared) g_rec_mutex_unlock(&tagsistant_group_commit.lock);
+
+	tagsistant_sql_stats_record(registered, rows, g_get_monotonic_time() - started);
+
+	return(rows);
+}
+
 /**
  * return(last insert row inode)
  */
 tagsistant_inode tagsistant_last_insert_id(dbi_conn conn)
 {
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite())
+		return(sqlite3_last_insert_rowid(((tagsistant_sqlite_conn *) conn)->db));
+#endif
+
 	return(dbi_conn_sequence_last(conn, NULL));
 
 #if 0
@@ -740,6 +2744,14 @@ int tagsistant_return_integer(void *return_integer, dbi_result result)
 	uint32_t *buffer = (uint32_t *) return_integer;
 	*buffer = 0;
 
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite()) {
+		*buffer = sqlite3_column_int64((sqlite3_stmt *) result, 0);
+		dbg('s', LOG_INFO, "Returning integer: %d", *buffer);
+		return (0);
+	}
+#endif
+
 	unsigned int type = dbi_result_get_field_type_idx(result, 1);
 	if (type == DBI_TYPE_INTEGER) {
 		unsigned int size = dbi_result_get_field_attribs_idx(result, 1);
@@ -780,31 +2792,476 @@ int tagsistant_return_integer(void *return_integer, dbi_result result)
 		dbg('s', LOG_INFO, "tagsistant_return_integer called on non integer field");
 	}
 
-	dbg('s', LOG_INFO, "Returning integer: %d", *buffer);
+	dbg('s', LOG_INFO, "Returning integer: %d", *buffer);
+
+	return (0);
+}
+
+/**
+ * SQL callback. Return a string from a query
+ * Should be called as in:
+ *
+ *   gchar *string;
+ *   tagsistant_query("SQL statement", return_string, &string); // note the &
+ * 
+ * @param return_string string pointer cast to void* which holds the string to be returned
+ * @param result dbi_result pointer
+ * @return 0 (always, due to SQLite policy, may change in the future)
+ */
+int tagsistant_return_string(void *return_string, dbi_result result)
+{
+	gchar **result_string = (gchar **) return_string;
+
+	*result_string = tagsistant_result_get_string_copy_idx(result, 1);
+
+	dbg('s', LOG_INFO, "Returning string: %s", *result_string);
+
+	return (0);
+}
+
+/**
+ * Get a string column of a result row. The string is owned by
+ * the backend and must not be freed.
+ *
+ * @param result the result passed to a tagsistant_query() callback
+ * @param idx the column index, starting from 1
+ * @return the string
+ */
+const gchar *tagsistant_result_get_string_idx(dbi_result result, unsigned int idx)
+{
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite())
+		return ((const gchar *) sqlite3_column_text((sqlite3_stmt *) result, idx - 1));
+#endif
+
+	return (dbi_result_get_string_idx(result, idx));
+}
+
+/**
+ * Get a copy of a string column of a result row
+ *
+ * @param result the result passed to a tagsistant_query() callback
+ * @param idx the column index, starting from 1
+ * @return the string (must be freed)
+ */
+gchar *tagsistant_result_get_string_copy_idx(dbi_result result, unsigned int idx)
+{
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite())
+		return (g_strdup((const gchar *) sqlite3_column_text((sqlite3_stmt *) result, idx - 1)));
+#endif
+
+	return (dbi_result_get_string_copy_idx(result, idx));
+}
+
+/**
+ * Get an unsigned integer column of a result row
+ *
+ * @param result the result passed to a tagsistant_query() callback
+ * @param idx the column index, starting from 1
+ * @return the integer
+ */
+tagsistant_inode tagsistant_result_get_uint_idx(dbi_result result, unsigned int idx)
+{
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+	if (tagsistant_is_native_sqlite())
+		return ((tagsistant_inode) sqlite3_column_int64((sqlite3_stmt *) result, idx - 1));
+#endif
+
+	return (dbi_result_get_uint_idx(result, idx));
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Typed values of triple tags                                                ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * The values of triple tags are strings, so the range operators would
+ * compare them as strings (year/gt/999 does not match 2014) without
+ * using an index. Values looking like numbers or timestamps are also
+ * saved as numbers in the tag_values table, one row per tag, indexed by
+ * (tagname, key, value_type, typed_value), and range operators with
+ * a typed operand are resolved on it.
+ *
+ * Values are typed when their tag is created. The tags created before
+ * the tag_values table are typed by its migration, and until the
+ * migration is done the range operators keep comparing strings.
+ */
+
+/**
+ * Infer the type of the value of a triple tag. Integers and reals are
+ * both numeric. Timestamps are YYYY-MM-DD or YYYY:MM:DD dates,
+ * optionally followed by HH:MM or HH:MM:SS, and are taken as UTC.
+ *
+ * @param value the value
+ * @param typed returns the value as a number (seconds since the epoch for timestamps)
+ * @return one of TAGSISTANT_UNTYPED_VALUE, TAGSISTANT_NUMERIC_VALUE and TAGSISTANT_TIMESTAMP_VALUE
+ */
+int tagsistant_sql_value_type(const gchar *value, gdouble *typed)
+{
+	if (!value || !strlen(value)) return (TAGSISTANT_UNTYPED_VALUE);
+
+	/*
+	 * numbers, in the C locale, without hex notation, infinity and NaN;
+	 * overflowing numbers like 1e999 are parsed as infinity, and would be
+	 * stored and compared as "inf", so they are not numbers either
+	 */
+	if (strspn(value, "0123456789+-.eE") == strlen(value)) {
+		gchar *end = NULL;
+		gdouble number = g_ascii_strtod(value, &end);
+		if (end != value && '\0' == *end && isfinite(number)) {
+			*typed = number;
+			return (TAGSISTANT_NUMERIC_VALUE);
+		}
+	}
+
+	/* the date */
+	int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0, length = 0;
+	if ((sscanf(value, "%4d-%2d-%2d%n", &year, &month, &day, &length) != 3) &&
+		(sscanf(value, "%4d:%2d:%2d%n", &year, &month, &day, &length) != 3))
+			return (TAGSISTANT_UNTYPED_VALUE);
+
+	if (10 != length || !g_ascii_isdigit(*value)) return (TAGSISTANT_UNTYPED_VALUE);
+
+	/* the optional time */
+	const gchar *time = value + length;
+	if (' ' == *time || 'T' == *time) {
+		length = 0;
+		if ((sscanf(time + 1, "%2d:%2d%n", &hour, &minute, &length) != 2) || (5 != length))
+			return (TAGSISTANT_UNTYPED_VALUE);
+		time += 1 + length;
+
+		if (':' == *time) {
+			length = 0;
+			if ((sscanf(time + 1, "%2d%n", &second, &length) != 1) || (2 != length))
+				return (TAGSISTANT_UNTYPED_VALUE);
+			time += 1 + length;
+		}
+	}
+
+	if ('\0' != *time) return (TAGSISTANT_UNTYPED_VALUE);
+
+	GDateTime *datetime = g_date_time_new_utc(year, month, day, hour, minute, second);
+	if (!datetime) return (TAGSISTANT_UNTYPED_VALUE);
+
+	*typed = g_date_time_to_unix(datetime);
+	g_date_time_unref(datetime);
+
+	return (TAGSISTANT_TIMESTAMP_VALUE);
+}
+
+/**
+ * Return true if the typed values of all the tags are in tag_values,
+ * so the range operators can be resolved on it
+ */
+gboolean tagsistant_sql_typed_values_ready()
+{
+	return (tagsistant_migration_applied(TAGSISTANT_MIGRATION_TYPED_VALUES));
+}
+
+/**
+ * Return true if the tag_values table exists, so the values of new
+ * tags must be saved in it
+ */
+static gboolean tagsistant_sql_typed_values_exist()
+{
+	return (tagsistant_migration_started(TAGSISTANT_MIGRATION_TYPED_VALUES));
+}
+
+/**
+ * Save the typed value of a tag. A value already saved is kept.
+ *
+ * @param conn dbi_conn reference
+ * @param tag_id the tag id
+ * @param type the value type
+ * @param typed the value as a number
+ */
+static void tagsistant_sql_save_typed_value(dbi_conn conn, tagsistant_inode tag_id, int type, gdouble typed)
+{
+	gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_dtostr(number, sizeof(number), typed);
+
+	tagsistant_query(
+		"%s into tag_values (tag_id, tagname, `key`, value_type, typed_value) "
+			"select tag_id, tagname, `key`, %d, %s from tags where tag_id = %d",
+		conn, NULL, NULL,
+		(TAGSISTANT_DBI_MYSQL_BACKEND == tagsistant.sql_database_driver) ? "insert ignore" : "insert or ignore",
+		type, number, tag_id);
+}
+
+/**
+ * Save the typed value of a new tag, if it has one
+ *
+ * @param conn dbi_conn reference
+ * @param tag_id the tag id
+ * @param value the tag value
+ */
+static void tagsistant_sql_type_tag(dbi_conn conn, tagsistant_inode tag_id, const gchar *value)
+{
+	gdouble typed = 0;
+	int type = tagsistant_sql_value_type(value, &typed);
+	if (!type || !tag_id || !tagsistant_sql_typed_values_exist()) return;
+
+	tagsistant_sql_save_typed_value(conn, tag_id, type, typed);
+}
+
+/** a typed value found by tagsistant_sql_type_all_tags() */
+typedef struct {
+	tagsistant_inode tag_id;
+	int type;
+	gdouble typed;
+} tagsistant_typed_value;
+
+/** the chunk of tags read by tagsistant_sql_type_all_tags() */
+typedef struct {
+	/** the typed values found, a GArray of tagsistant_typed_value */
+	GArray *typed_values;
+
+	/** the tags read */
+	int tags;
+
+	/** the last tag read */
+	tagsistant_inode last_tag_id;
+} tagsistant_typed_chunk;
+
+/**
+ * SQL callback. Save the typed value of a tag, if it has one.
+ *
+ * @param chunk a tagsistant_typed_chunk
+ * @param result the row: tag_id, value
+ */
+static int tagsistant_sql_collect_typed_value(void *chunk, dbi_result result)
+{
+	tagsistant_typed_chunk *typed_chunk = (tagsistant_typed_chunk *) chunk;
+
+	tagsistant_typed_value typed_value;
+	typed_value.tag_id = tagsistant_result_get_uint_idx(result, 1);
+	typed_value.type = tagsistant_sql_value_type(tagsistant_result_get_string_idx(result, 2), &typed_value.typed);
+
+	if (typed_value.type) g_array_append_val(typed_chunk->typed_values, typed_value);
+
+	typed_chunk->tags++;
+	typed_chunk->last_tag_id = typed_value.tag_id;
+
+	return (0);
+}
+
+/**
+ * Save the typed values of the next chunk of tags. Backfill of the
+ * migration adding tag_values.
+ *
+ * @param dbi the connection
+ * @param last_tag_id the last tag processed, moved forward
+ * @return the tags read, 0 once all the tags have been processed
+ */
+static int tagsistant_sql_type_all_tags(dbi_conn dbi, tagsistant_inode *last_tag_id)
+{
+	tagsistant_typed_chunk chunk = { g_array_new(FALSE, FALSE, sizeof(tagsistant_typed_value)), 0, *last_tag_id };
+
+	tagsistant_query(
+		"select tag_id, value from tags where value <> '' and tag_id > %d order by tag_id limit %d",
+		dbi, tagsistant_sql_collect_typed_value, &chunk, *last_tag_id, TAGSISTANT_MIGRATION_CHUNK);
+
+	guint i;
+	for (i = 0; i < chunk.typed_values->len; i++) {
+		tagsistant_typed_value *typed_value = &g_array_index(chunk.typed_values, tagsistant_typed_value, i);
+		tagsistant_sql_save_typed_value(dbi, typed_value->tag_id, typed_value->type, typed_value->typed);
+	}
+
+	if (chunk.tags) dbg('s', LOG_INFO, "Typed the values of %u tags up to tag %d", chunk.typed_values->len, chunk.last_tag_id);
+
+	g_array_free(chunk.typed_values, TRUE);
+
+	*last_tag_id = chunk.last_tag_id;
+	return (chunk.tags);
+}
+
+/************************************************************************************/
+/***                                                                              ***/
+/***   Trigram index of triple tag values                                         ***/
+/***                                                                              ***/
+/************************************************************************************/
+
+/*
+ * The contains operator is a LIKE '%...%', which can't use an index and
+ * scans all the tags. The trigrams of each triple tag value, packed
+ * into integers, are saved in the tag_trigrams table, so a contains
+ * lookup first selects the tags having all the trigrams of its operand
+ * and then checks only them with LIKE, which keeps the results the same.
+ *
+ * LIKE ignores the case of ASCII letters on SQLite, so trigrams are
+ * lowercase. Trigrams with a non ASCII byte or a LIKE wildcard are not
+ * used: an operand made only of them is resolved by LIKE alone. On
+ * MySQL the collations fold much more than ASCII case, so the index is
+ * not used at all.
+ */
+
+/**
+ * Return true if the trigrams of all the tags are in tag_trigrams,
+ * so the contains operator can be resolved on it
+ */
+gboolean tagsistant_sql_trigrams_ready()
+{
+	return ((TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver) &&
+		tagsistant_migration_applied(TAGSISTANT_MIGRATION_TRIGRAMS));
+}
+
+/**
+ * Return true if the tag_trigrams table exists, so the trigrams of
+ * new tags must be saved in it
+ */
+static gboolean tagsistant_sql_trigrams_exist()
+{
+	return ((TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver) &&
+		tagsistant_migration_started(TAGSISTANT_MIGRATION_TRIGRAMS));
+}
+
+/**
+ * GCompareFunc for trigrams
+ */
+static gint tagsistant_sql_trigram_compare(gconstpointer a, gconstpointer b)
+{
+	guint32 first = *((const guint32 *) a), second = *((const guint32 *) b);
+	return ((first > second) - (first < second));
+}
+
+/**
+ * Return the usable trigrams of a string, sorted and without duplicates
+ *
+ * @param value the string
+ * @return a GArray of guint32, to be freed with g_array_free()
+ */
+GArray *tagsistant_sql_trigrams(const gchar *value)
+{
+	GArray *trigrams = g_array_new(FALSE, FALSE, sizeof(guint32));
+	if (!value) return (trigrams);
+
+	size_t length = strlen(value);
+	size_t i;
+	for (i = 0; i + 3 <= length; i++) {
+		guint32 trigram = 0;
+
+		int j;
+		for (j = 0; j < 3; j++) {
+			guchar c = (guchar) value[i + j];
+			if ((c >= 0x80) || ('%' == c) || ('_' == c) || ('\\' == c)) break;
+			trigram = (trigram << 8) | (guchar) g_ascii_tolower(c);
+		}
+
+		if (3 == j) g_array_append_val(trigrams, trigram);
+	}
+
+	g_array_sort(trigrams, tagsistant_sql_trigram_compare);
+
+	/* drop the duplicates */
+	guint read, kept = 0;
+	for (read = 0; read < trigrams->len; read++) {
+		if (kept && g_array_index(trigrams, guint32, kept - 1) == g_array_index(trigrams, guint32, read)) continue;
+		g_array_index(trigrams, guint32, kept++) = g_array_index(trigrams, guint32, read);
+	}
+	g_array_set_size(trigrams, kept);
+
+	return (trigrams);
+}
+
+/**
+ * Save the trigrams of the value of a tag
+ *
+ * @param conn dbi_conn reference
+ * @param tag_id the tag id
+ * @param value the tag value
+ */
+static void tagsistant_sql_index_trigrams(dbi_conn conn, tagsistant_inode tag_id, const gchar *value)
+{
+	GArray *trigrams = tagsistant_sql_trigrams(value);
+
+	if (trigrams->len) {
+		GString *values = g_string_sized_new(trigrams->len * 24);
+
+		guint i;
+		for (i = 0; i < trigrams->len; i++)
+			g_string_append_printf(values, "%s(%u, %d)", i ? ", " : "", g_array_index(trigrams, guint32, i), tag_id);
+
+		tagsistant_query("insert or ignore into tag_trigrams (trigram, tag_id) values %s", conn, NULL, NULL, values->str);
+		g_string_free(values, TRUE);
+	}
+
+	g_array_free(trigrams, TRUE);
+}
+
+/** a tag value found by tagsistant_sql_index_all_trigrams() */
+typedef struct {
+	tagsistant_inode tag_id;
+	gchar *value;
+} tagsistant_tag_value;
+
+/**
+ * SQL callback. Collect the id and the value of a tag.
+ *
+ * @param tag_values a GArray of tagsistant_tag_value
+ * @param result the row: tag_id, value
+ */
+static int tagsistant_sql_collect_tag_value(void *tag_values, dbi_result result)
+{
+	tagsistant_tag_value tag_value;
+	tag_value.tag_id = tagsistant_result_get_uint_idx(result, 1);
+	tag_value.value = g_strdup(tagsistant_result_get_string_idx(result, 2));
+
+	g_array_append_val((GArray *) tag_values, tag_value);
 
 	return (0);
 }
 
 /**
- * SQL callback. Return a string from a query
- * Should be called as in:
+ * Save the trigrams of the next chunk of tags. Backfill of the
+ * migration adding tag_trigrams.
  *
- *   gchar *string;
- *   tagsistant_query("SQL statement", return_string, &string); // note the &
- * 
- * @param return_string string pointer cast to void* which holds the string to be returned
- * @param result dbi_result pointer
- * @return 0 (always, due to SQLite policy, may change in the future)
+ * @param dbi the connection
+ * @param last_tag_id the last tag processed, moved forward
+ * @return the tags read, 0 once all the tags have been processed
  */
-int tagsistant_return_string(void *return_string, dbi_result result)
+static int tagsistant_sql_index_all_trigrams(dbi_conn dbi, tagsistant_inode *last_tag_id)
 {
-	gchar **result_string = (gchar **) return_string;
+	if (TAGSISTANT_DBI_SQLITE_BACKEND != tagsistant.sql_database_driver) return (0);
 
-	*result_string = dbi_result_get_string_copy_idx(result, 1);
+	GArray *tag_values = g_array_new(FALSE, FALSE, sizeof(tagsistant_tag_value));
 
-	dbg('s', LOG_INFO, "Returning string: %s", *result_string);
+	tagsistant_query(
+		"select tag_id, value from tags where length(value) >= 3 and tag_id > %d order by tag_id limit %d",
+		dbi, tagsistant_sql_collect_tag_value, tag_values, *last_tag_id, TAGSISTANT_MIGRATION_CHUNK);
+
+	guint i;
+	for (i = 0; i < tag_values->len; i++) {
+		tagsistant_tag_value *tag_value = &g_array_index(tag_values, tagsistant_tag_value, i);
+		tagsistant_sql_index_trigrams(dbi, tag_value->tag_id, tag_value->value);
+		*last_tag_id = tag_value->tag_id;
+		g_free(tag_value->value);
+	}
 
-	return (0);
+	if (tag_values->len) dbg('s', LOG_INFO, "Indexed the trigrams of %u tags up to tag %d", tag_values->len, *last_tag_id);
+
+	int tags = tag_values->len;
+	g_array_free(tag_values, TRUE);
+
+	return (tags);
+}
+
+/**
+ * Index the value of a new tag: save its typed value and its trigrams
+ *
+ * @param conn dbi_conn reference
+ * @param tag_id the tag id
+ * @param value the tag value
+ */
+static void tagsistant_sql_index_tag_value(dbi_conn conn, tagsistant_inode tag_id, const gchar *value)
+{
+	if (!tag_id || !value || !strlen(value)) return;
+
+	tagsistant_sql_type_tag(conn, tag_id, value);
+
+	if (tagsistant_sql_trigrams_exist()) tagsistant_sql_index_trigrams(conn, tag_id, value);
 }
 
 /**
@@ -828,6 +3285,28 @@ void tagsistant_sql_create_tag(dbi_conn conn, const gchar *namespace, const gcha
 		namespace,
 		_safe_string(key),
 		_safe_string(value));
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	tagsistant_negative_cache_invalidate();
+#endif
+
+	if (!value || !strlen(value)) return;
+
+	/*
+	 * fetch the id straight from SQL: the negative cache could still
+	 * report the tag as missing if a concurrent lookup recorded it again
+	 */
+	tagsistant_inode tag_id = 0;
+	tagsistant_query(
+		"select tag_id from tags where `tagname` = '%s' and `key` = '%s' and `value` = '%s' limit 1",
+		conn,
+		tagsistant_return_integer,
+		&tag_id,
+		namespace,
+		_safe_string(key),
+		value);
+
+	tagsistant_sql_index_tag_value(conn, tag_id, value);
 }
 
 /**
@@ -876,6 +3355,31 @@ int tagsistant_object_is_tagged_as(dbi_conn conn, tagsistant_inode inode, tagsis
 void tagsistant_full_untag_object(dbi_conn conn, tagsistant_inode inode)
 {
 	tagsistant_query("delete from tagging where inode = %d", conn, NULL, NULL, inode);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_drop_object(inode);
+#endif
+}
+
+/**
+ * Learn a tag read on a connection. Writers log what they learn and
+ * apply it when their transaction commits (see tag_dictionary.c), but
+ * a reader of the shared transaction of group commit can read a tag
+ * created by an operation not committed yet: if that operation rolled
+ * back, the dictionary would keep an id that doesn't exist and could
+ * later be given to another tag, so the tag is not learnt at all.
+ *
+ * @param conn the connection the tag has been read on
+ * @param tag_id the tag_id
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ */
+static void tagsistant_sql_learn_tag(dbi_conn conn, tagsistant_inode tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	if (!tagsistant_tag_dictionary_logging() && tagsistant_db_in_transaction(conn)) return;
+
+	tagsistant_tag_dictionary_learn(tag_id, tagname, key, value);
 }
 
 /**
@@ -890,15 +3394,15 @@ void tagsistant_full_untag_object(dbi_conn conn, tagsistant_inode inode)
 tagsistant_inode tagsistant_sql_get_tag_id(dbi_conn conn, const gchar *tagname, const gchar *key, const gchar *value)
 {
 #if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	gchar *tag_key = tagsistant_make_tag_key(_safe_string(tagname), _safe_string(key), _safe_string(value));
-
-	// lookup in the cache
-	tagsistant_inode *tag_value = (tagsistant_inode *) g_hash_table_lookup(tagsistant_tag_cache, tag_key);
+	// lookup in the tag dictionary
+	tagsistant_inode known_tag_id = tagsistant_tag_dictionary_lookup(tagname, key, value);
+	if (known_tag_id) return (known_tag_id);
+#endif
 
-	if (tag_value && *tag_value) {
-		g_free(tag_key);
-		return (*tag_value);
-	}
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	// is the tag known to be missing?
+	if (tagsistant_negative_cache_lookup(TAGSISTANT_NEGATIVE_TAG, tagname, key, value)) return (0);
+	gint generation = tagsistant_negative_cache_generation();
 #endif
 
 	// fetch the tag_id from SQL
@@ -916,27 +3420,97 @@ tagsistant_inode tagsistant_sql_get_tag_id(dbi_conn conn, const gchar *tagname,
 			"select tag_id from tags where `tagname` = '%s' limit 1",
 			conn, tagsistant_return_integer, &tag_id, tagname);
 
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	// save the key and the value in the cache
-	if (tag_id) {
-		tag_value = g_new0(tagsistant_inode, 1);
-		*tag_value = tag_id;
-		g_hash_table_insert(tagsistant_tag_cache, tag_key, tag_value);
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	if (!tag_id) {
+		tagsistant_negative_cache_add(generation, TAGSISTANT_NEGATIVE_TAG, tagname, key, value);
+		return (0);
 	}
 #endif
 
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	// save the tag in the dictionary
+	tagsistant_sql_learn_tag(conn, tag_id, tagname, key, value);
+#endif
+
 	return (tag_id);
 }
 
+/** the last tag read by tagsistant_sql_get_tag() on this thread */
+static __thread tagsistant_tag_entry tagsistant_sql_last_tag;
+
+/** arguments of tagsistant_sql_get_tag_callback() */
+typedef struct {
+	/** the connection the tag is read on */
+	dbi_conn conn;
+
+	/** returns the tag read */
+	tagsistant_tag_entry *tag;
+} tagsistant_sql_get_tag_data;
+
+/**
+ * SQL callback. Learn the tag returned by tagsistant_sql_get_tag()
+ * and keep a copy for the caller.
+ *
+ * @param data a tagsistant_sql_get_tag_data
+ * @param result the row: tag_id, tagname, key, value
+ */
+static int tagsistant_sql_get_tag_callback(void *data, dbi_result result)
+{
+	tagsistant_sql_get_tag_data *get_tag = (tagsistant_sql_get_tag_data *) data;
+	tagsistant_tag_entry *tag = get_tag->tag;
+
+	g_free_null(tag->tagname);
+	g_free_null(tag->key);
+	g_free_null(tag->value);
+
+	tag->tag_id = tagsistant_result_get_uint_idx(result, 1);
+	tag->tagname = g_strdup(tagsistant_result_get_string_idx(result, 2));
+	tag->key = g_strdup(_safe_string(tagsistant_result_get_string_idx(result, 3)));
+	tag->value = g_strdup(_safe_string(tagsistant_result_get_string_idx(result, 4)));
+
+	tagsistant_sql_learn_tag(get_tag->conn, tag->tag_id, tag->tagname, tag->key, tag->value);
+
+	return (TAGSISTANT_STOP_QUERY);
+}
+
+/**
+ * Return the tag owning a tag_id, from the tag dictionary or from SQL.
+ * A tag the dictionary has not learnt yet, like one created inside a
+ * transaction still open, is returned in a per-thread copy valid until
+ * the next call.
+ *
+ * @param conn dbi_conn reference
+ * @param tag_id the tag_id
+ * @return the tag, or NULL if the tag does not exist
+ */
+const tagsistant_tag_entry *tagsistant_sql_get_tag(dbi_conn conn, tagsistant_inode tag_id)
+{
+	const tagsistant_tag_entry *entry = tagsistant_tag_dictionary_reverse_lookup(tag_id);
+	if (entry) return (entry);
+
+	tagsistant_sql_get_tag_data get_tag = { conn, &tagsistant_sql_last_tag };
+	tagsistant_sql_last_tag.tag_id = 0;
+
+	tagsistant_query(
+		"select tag_id, tagname, `key`, value from tags where tag_id = %d",
+		conn, tagsistant_sql_get_tag_callback, &get_tag, tag_id);
+
+	entry = tagsistant_tag_dictionary_reverse_lookup(tag_id);
+	if (entry) return (entry);
+
+	return ((tag_id == (tagsistant_inode) tagsistant_sql_last_tag.tag_id) ? &tagsistant_sql_last_tag : NULL);
+}
+
+/**
+ * Drop a tag from the tag dictionary
+ *
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ */
 void tagsistant_remove_tag_from_cache(const gchar *tagname, const gchar *key, const gchar *value)
 {
-#if TAGSISTANT_ENABLE_TAG_ID_CACHE
-	gchar *tag_key = tagsistant_make_tag_key(tagname, _safe_string(key), _safe_string(value));
-	g_hash_table_remove(tagsistant_tag_cache, tag_key);
-	g_free(tag_key);
-#else
-	(void) tagname;
-#endif
+	tagsistant_tag_dictionary_forget(tagname, key, value);
 }
 
 /**
@@ -960,6 +3534,16 @@ void tagsistant_sql_delete_tag(dbi_conn conn, const gchar *tagname, const gchar
 		"delete from tagging where tag_id = '%d'",
 		conn, NULL, NULL, tag_id);
 
+	if (tagsistant_sql_typed_values_exist())
+		tagsistant_query("delete from tag_values where tag_id = %d", conn, NULL, NULL, tag_id);
+
+	if (tagsistant_sql_trigrams_exist())
+		tagsistant_query("delete from tag_trigrams where tag_id = %d", conn, NULL, NULL, tag_id);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_drop_tag(tag_id);
+#endif
+
 	tagsistant_query(
 		"delete from relations where tag1_id = '%d' or tag2_id = '%d'",
 		conn, NULL, NULL, tag_id, tag_id);
@@ -995,6 +3579,328 @@ void tagsistant_sql_tag_object(
 	}
 
 	tagsistant_query("insert into tagging(tag_id, inode) values('%d', '%d')", conn, NULL, NULL, tag_id, inode);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_tag(tag_id, inode);
+#endif
+
+	/* the RDS of the tag don't hold the object yet */
+	tagsistant_delete_rds_by_tagname(tagname, conn);
+}
+
+/****************************************************************************/
+/***                                                                      ***/
+/***   Bulk tagging                                                       ***/
+/***                                                                      ***/
+/****************************************************************************/
+
+/**
+ * How many tags are resolved or inserted by a single statement.
+ * Keeps the statements well below the SQLite expression depth
+ * and compound select limits.
+ */
+#define TAGSISTANT_TAG_BATCH_CHUNK 128
+
+/**
+ * Create an empty tag batch
+ *
+ * @return the batch, to be freed with tagsistant_tag_batch_free()
+ */
+tagsistant_tag_batch *tagsistant_tag_batch_new()
+{
+	tagsistant_tag_batch *batch = g_new0(tagsistant_tag_batch, 1);
+
+	batch->entries = g_ptr_array_new();
+	batch->index = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return (batch);
+}
+
+/**
+ * Queue a tag in a batch. Strings are copied, and tags
+ * already queued are skipped.
+ *
+ * @param batch the batch
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ */
+void tagsistant_tag_batch_add(tagsistant_tag_batch *batch, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	if (!batch || !tagname) return;
+
+	gchar *tag_key = tagsistant_make_tag_key(tagname, _safe_string(key), _safe_string(value));
+	if (g_hash_table_lookup(batch->index, tag_key)) {
+		g_free(tag_key);
+		return;
+	}
+
+	tagsistant_tag_batch_entry *entry = g_new0(tagsistant_tag_batch_entry, 1);
+	entry->tagname = g_strdup(tagname);
+	entry->key = g_strdup(_safe_string(key));
+	entry->value = g_strdup(_safe_string(value));
+	entry->tag_key = tag_key;
+
+	g_ptr_array_add(batch->entries, entry);
+	g_hash_table_insert(batch->index, entry->tag_key, entry);
+}
+
+/**
+ * Free a tag batch
+ *
+ * @param batch the batch
+ */
+void tagsistant_tag_batch_free(tagsistant_tag_batch *batch)
+{
+	if (!batch) return;
+
+	guint i;
+	for (i = 0; i < batch->entries->len; i++) {
+		tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+		g_free(entry->tagname);
+		g_free(entry->key);
+		g_free(entry->value);
+		g_free(entry->tag_key);
+		g_free(entry);
+	}
+
+	g_ptr_array_free(batch->entries, TRUE);
+	g_hash_table_destroy(batch->index);
+	g_free(batch);
+}
+
+/**
+ * Save the id of a tag returned by tagsistant_tag_batch_resolve()
+ *
+ * @param data the tagsistant_tag_batch
+ * @param result the row: tag_id, tagname, key, value
+ */
+static int tagsistant_tag_batch_resolve_callback(void *data, dbi_result result)
+{
+	tagsistant_tag_batch *batch = (tagsistant_tag_batch *) data;
+
+	gchar *tag_key = tagsistant_make_tag_key(
+		tagsistant_result_get_string_idx(result, 2),
+		_safe_string(tagsistant_result_get_string_idx(result, 3)),
+		_safe_string(tagsistant_result_get_string_idx(result, 4)));
+
+	tagsistant_tag_batch_entry *entry = g_hash_table_lookup(batch->index, tag_key);
+	if (entry) entry->tag_id = tagsistant_result_get_uint_idx(result, 1);
+
+	g_free(tag_key);
+	return (0);
+}
+
+/**
+ * Resolve the ids of all the unresolved tags of a batch,
+ * TAGSISTANT_TAG_BATCH_CHUNK tags per query
+ *
+ * @param conn dbi_conn reference
+ * @param batch the batch
+ */
+static void tagsistant_tag_batch_resolve(dbi_conn conn, tagsistant_tag_batch *batch)
+{
+	GString *statement = NULL;
+	int chunk = 0;
+
+	guint i;
+	for (i = 0; i < batch->entries->len; i++) {
+		tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+		if (entry->tag_id) continue;
+
+		if (!statement) {
+			statement = g_string_sized_new(4096);
+			g_string_append(statement, "select tag_id, tagname, `key`, value from tags where ");
+		} else {
+			g_string_append(statement, " or ");
+		}
+
+		g_string_append(statement, "(tagname = ");
+		tagsistant_sql_append_literal(statement, entry->tagname);
+		g_string_append(statement, " and `key` = ");
+		tagsistant_sql_append_literal(statement, entry->key);
+		g_string_append(statement, " and value = ");
+		tagsistant_sql_append_literal(statement, entry->value);
+		g_string_append_c(statement, ')');
+
+		if (++chunk == TAGSISTANT_TAG_BATCH_CHUNK) {
+			tagsistant_query_sql(statement->str, conn, tagsistant_tag_batch_resolve_callback, batch);
+			g_string_free(statement, TRUE);
+			statement = NULL;
+			chunk = 0;
+		}
+	}
+
+	if (statement) {
+		tagsistant_query_sql(statement->str, conn, tagsistant_tag_batch_resolve_callback, batch);
+		g_string_free(statement, TRUE);
+	}
+}
+
+/**
+ * Create all the unresolved tags of a batch, TAGSISTANT_TAG_BATCH_CHUNK
+ * tags per statement. Tags created meanwhile by someone else are skipped.
+ *
+ * @param conn dbi_conn reference
+ * @param batch the batch
+ * @return the number of tags to be created
+ */
+static int tagsistant_tag_batch_create(dbi_conn conn, tagsistant_tag_batch *batch)
+{
+	GString *statement = NULL;
+	int chunk = 0, created = 0;
+
+	guint i;
+	for (i = 0; i < batch->entries->len; i++) {
+		tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+		if (entry->tag_id) continue;
+
+		if (!statement) {
+			statement = g_string_sized_new(4096);
+			if (TAGSISTANT_DBI_MYSQL_BACKEND == tagsistant.sql_database_driver)
+				g_string_append(statement, "insert ignore into tags(tagname, `key`, value) values ");
+			else
+				g_string_append(statement, "insert or ignore into tags(tagname, `key`, value) values ");
+		} else {
+			g_string_append(statement, ", ");
+		}
+
+		g_string_append_c(statement, '(');
+		tagsistant_sql_append_literal(statement, entry->tagname);
+		g_string_append(statement, ", ");
+		tagsistant_sql_append_literal(statement, entry->key);
+		g_string_append(statement, ", ");
+		tagsistant_sql_append_literal(statement, entry->value);
+		g_string_append_c(statement, ')');
+
+		entry->created = TRUE;
+		created++;
+
+		if (++chunk == TAGSISTANT_TAG_BATCH_CHUNK) {
+			tagsistant_query_sql(statement->str, conn, NULL, NULL);
+			g_string_free(statement, TRUE);
+			statement = NULL;
+			chunk = 0;
+		}
+	}
+
+	if (statement) {
+		tagsistant_query_sql(statement->str, conn, NULL, NULL);
+		g_string_free(statement, TRUE);
+	}
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	if (created) tagsistant_negative_cache_invalidate();
+#endif
+
+	return (created);
+}
+
+/**
+ * Run a multi-row insert into the tagging table. Taggings already
+ * there are skipped, so one of them does not fail the whole statement.
+ *
+ * @param conn dbi_conn reference
+ * @param values the rows as "(tag_id, inode), ..." (freed here)
+ */
+static void tagsistant_tag_batch_insert_tagging(dbi_conn conn, GString *values)
+{
+	if (TAGSISTANT_DBI_MYSQL_BACKEND == tagsistant.sql_database_driver)
+		tagsistant_query("insert ignore into tagging(tag_id, inode) values %s", conn, NULL, NULL, values->str);
+	else
+		tagsistant_query("insert or ignore into tagging(tag_id, inode) values %s", conn, NULL, NULL, values->str);
+
+	g_string_free(values, TRUE);
+}
+
+/**
+ * Tag an object with all the tags of a batch. Tag ids are taken from
+ * the tag dictionary or resolved with one query, missing tags are created with
+ * one statement, and the object is tagged with one multi-row insert
+ * (each per TAGSISTANT_TAG_BATCH_CHUNK tags).
+ *
+ * @param conn dbi_conn reference
+ * @param batch the tags
+ * @param inode the object inode
+ */
+void tagsistant_sql_tag_object_batch(dbi_conn conn, tagsistant_tag_batch *batch, tagsistant_inode inode)
+{
+	if (!batch || !batch->entries->len) return;
+
+	guint i;
+
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+	/* take what's known from the tag dictionary */
+	for (i = 0; i < batch->entries->len; i++) {
+		tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+		entry->tag_id = tagsistant_tag_dictionary_lookup(entry->tagname, entry->key, entry->value);
+	}
+#endif
+
+	/* resolve the remaining tags, then create what's still missing and resolve it */
+	tagsistant_tag_batch_resolve(conn, batch);
+	if (tagsistant_tag_batch_create(conn, batch)) tagsistant_tag_batch_resolve(conn, batch);
+
+	GString *values = NULL;
+	int chunk = 0;
+
+	for (i = 0; i < batch->entries->len; i++) {
+		tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+
+		/*
+		 * a tag the batch query can't match back (like on a case
+		 * insensitive collation) is resolved the old way
+		 */
+		if (!entry->tag_id)
+			entry->tag_id = tagsistant_sql_get_tag_id(conn, entry->tagname, entry->key, entry->value);
+
+		if (!entry->tag_id) {
+			dbg('s', LOG_ERR, "Can't resolve tag %s:%s=%s", entry->tagname, entry->key, entry->value);
+			continue;
+		}
+
+#if TAGSISTANT_ENABLE_TAG_ID_CACHE
+		tagsistant_sql_learn_tag(conn, entry->tag_id, entry->tagname, entry->key, entry->value);
+#endif
+
+		if (entry->created) tagsistant_sql_index_tag_value(conn, entry->tag_id, entry->value);
+
+		if (!values) {
+			values = g_string_sized_new(1024);
+		} else {
+			g_string_append(values, ", ");
+		}
+		g_string_append_printf(values, "(%d, %d)", entry->tag_id, inode);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+		tagsistant_posting_tag(entry->tag_id, inode);
+#endif
+
+		if (++chunk == TAGSISTANT_TAG_BATCH_CHUNK) {
+			tagsistant_tag_batch_insert_tagging(conn, values);
+			values = NULL;
+			chunk = 0;
+		}
+	}
+
+	if (values) tagsistant_tag_batch_insert_tagging(conn, values);
+
+	/* the RDS of the tags don't hold the object yet, unless the caller updates them */
+	if (!batch->rds_maintained) {
+		GHashTable *tagnames = g_hash_table_new(g_str_hash, g_str_equal);
+
+		for (i = 0; i < batch->entries->len; i++) {
+			tagsistant_tag_batch_entry *entry = g_ptr_array_index(batch->entries, i);
+			if (!g_hash_table_contains(tagnames, entry->tagname)) {
+				g_hash_table_add(tagnames, entry->tagname);
+				tagsistant_delete_rds_by_tagname(entry->tagname, conn);
+			}
+		}
+
+		g_hash_table_destroy(tagnames);
+	}
+
+	dbg('s', LOG_INFO, "Tagged object %d with %u tags", inode, batch->entries->len);
 }
 
 /**
@@ -1019,6 +3925,10 @@ void tagsistant_sql_untag_object(dbi_conn conn, const gchar *tagname, const gcha
 	tagsistant_query(
 		"delete from tagging where tag_id = '%d' and inode = '%d'",
 		conn, NULL, NULL, tag_id, inode);
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_untag(tag_id, inode);
+#endif
 }
 
 /**
@@ -1031,6 +3941,16 @@ void tagsistant_sql_untag_object(dbi_conn conn, const gchar *tagname, const gcha
 void tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, const gchar *oldtagname)
 {
 	tagsistant_query("update tags set tagname = '%s' where tagname = '%s'", conn, NULL, NULL, tagname, oldtagname);
+
+	if (tagsistant_sql_typed_values_exist())
+		tagsistant_query("update tag_values set tagname = '%s' where tagname = '%s'", conn, NULL, NULL, tagname, oldtagname);
+
+	/* the renamed tags will be learnt again on their next lookup */
+	tagsistant_tag_dictionary_forget_tagname(oldtagname);
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	tagsistant_negative_cache_invalidate();
+#endif
 }
 
 /**
@@ -1042,10 +3962,20 @@ void tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, const gchar
  */
 int tagsistant_sql_alias_exists(dbi_conn conn, const gchar *alias)
 {
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	if (tagsistant_negative_cache_lookup(TAGSISTANT_NEGATIVE_ALIAS, alias, NULL, NULL)) return (0);
+	gint generation = tagsistant_negative_cache_generation();
+#endif
+
 	int exists = 0;
 	tagsistant_query(
 		"select 1 from aliases where alias = '%s'",
 		conn, tagsistant_return_integer, &exists, alias);
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	if (!exists) tagsistant_negative_cache_add(generation, TAGSISTANT_NEGATIVE_ALIAS, alias, NULL, NULL);
+#endif
+
 	return (exists);
 }
 
@@ -1061,6 +3991,10 @@ void tagsistant_sql_alias_create(dbi_conn conn, const gchar *alias)
 	tagsistant_query(
 		"insert into aliases (alias, query) values ('%s', '')",
 		conn, NULL, NULL, alias);
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+	tagsistant_negative_cache_invalidate();
+#endif
 }
 
 /**
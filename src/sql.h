@@ -20,6 +20,10 @@
 
 #include <dbi/dbi.h>
 
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+#include <sqlite3.h>
+#endif
+
 #if  LIBDBI_LIB_CURRENT > 1
 #define TAGSISTANT_REENTRANT_DBI 1
 #else
@@ -43,13 +47,111 @@
 extern void tagsistant_db_init();
 extern dbi_conn *tagsistant_db_connection(int start_transaction);
 extern void tagsistant_create_schema();
+extern void tagsistant_migrate_schema();
+extern void tagsistant_migration_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+
+/** the types of the values of triple tags, see tagsistant_sql_value_type() */
+#define TAGSISTANT_UNTYPED_VALUE	0
+#define TAGSISTANT_NUMERIC_VALUE	1
+#define TAGSISTANT_TIMESTAMP_VALUE	2
+
+extern int tagsistant_sql_value_type(const gchar *value, gdouble *typed);
+extern gboolean tagsistant_sql_typed_values_ready();
+extern gboolean tagsistant_sql_trigrams_ready();
+extern GArray *tagsistant_sql_trigrams(const gchar *value);
 
 #define _safe_string(string) string ? string : ""
 
+/* return it from a tagsistant_query() callback to skip the remaining rows */
+#define TAGSISTANT_STOP_QUERY -1
+
 /* execute SQL statements auto formatting the SQL string and adding file:line coords */
 #define tagsistant_query(format, conn, callback, firstarg, ...) \
 	tagsistant_real_query(conn, format, callback, __FILE__, __LINE__, firstarg, ## __VA_ARGS__)
 
+/* starts the format of a statement whose only argument is SQL to be run as is */
+#define TAGSISTANT_SQL_VERBATIM_MARKER '\x02'
+#define TAGSISTANT_SQL_VERBATIM_FORMAT "\x02%s"
+
+/* execute a SQL statement built at runtime with tagsistant_sql_append_literal(), without escaping it again */
+#define tagsistant_query_sql(sql, conn, callback, firstarg) \
+	tagsistant_real_query(conn, TAGSISTANT_SQL_VERBATIM_FORMAT, callback, __FILE__, __LINE__, firstarg, sql)
+
+/* append a quoted and escaped string literal to a statement run by tagsistant_query_sql() */
+extern void tagsistant_sql_append_literal(GString *statement, const gchar *value);
+
+/**
+ * A statement registered by a tagsistant_query() call site.
+ * The registry is keyed by the __FILE__:__LINE__ couple the
+ * macro passes to tagsistant_real_query(), so the quote escaping
+ * of the format is done only once per call site.
+ */
+typedef struct {
+	/** the calling file (a __FILE__ literal) */
+	const char *file;
+
+	/** the calling line */
+	int line;
+
+	/** the format pointer passed on first call, compared before the format itself */
+	const char *caller_format;
+
+	/** a copy of the format seen on first call */
+	gchar *format;
+
+	/** the format with quotes replaced by a placeholder */
+	gchar *escaped_format;
+
+	/** true if the call site uses more than one format (accessed with g_atomic_int_*) */
+	gint dynamic;
+
+	/** true if the format can be turned into a prepared statement */
+	int bindable;
+
+	/** the format with each argument replaced by a ? placeholder */
+	gchar *bound_sql;
+
+	/** the type of each argument, one char each (see tagsistant_sql_statement_compile()) */
+	gchar *params;
+
+	/** how many times the call site has been used */
+	gint calls;
+
+	/** the latency statistics recorded by each thread (see tagsistant_sql_stats_record()) */
+	gpointer stats;
+} tagsistant_sql_statement;
+
+extern tagsistant_sql_statement *tagsistant_sql_statement_lookup(const char *format, const char *file, int line);
+
+#if TAGSISTANT_ENABLE_NATIVE_SQLITE
+/**
+ * A native SQLite connection. It's handed around as a dbi_conn
+ * (which is just a void pointer) so the rest of Tagsistant doesn't
+ * have to know which backend is serving the queries.
+ */
+typedef struct {
+	/** the SQLite handle */
+	sqlite3 *db;
+
+	/** prepared statements, a map tagsistant_sql_statement -> sqlite3_stmt */
+	GHashTable *statements;
+} tagsistant_sqlite_conn;
+
+/** true if SQLite is reached through libsqlite3 */
+#	define tagsistant_is_native_sqlite() (TAGSISTANT_DBI_SQLITE_BACKEND == tagsistant.sql_database_driver)
+#else
+#	define tagsistant_is_native_sqlite() 0
+#endif /* TAGSISTANT_ENABLE_NATIVE_SQLITE */
+
+/*
+ * Access the columns of a result row from a tagsistant_query() callback.
+ * Columns are numbered from 1, as in libDBI. Strings are borrowed from
+ * the backend and are valid only inside the callback.
+ */
+extern const gchar *		tagsistant_result_get_string_idx(dbi_result result, unsigned int idx);
+extern gchar *				tagsistant_result_get_string_copy_idx(dbi_result result, unsigned int idx);
+extern tagsistant_inode		tagsistant_result_get_uint_idx(dbi_result result, unsigned int idx);
+
 /* number of active connections */
 extern int connections;
 
@@ -70,6 +172,17 @@ extern int tagsistant_return_string(void *return_string, dbi_result result);
 extern int tagsistant_return_integer(void *return_integer, dbi_result result);
 
 extern void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_locked);
+extern void tagsistant_db_connection_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+extern guint tagsistant_sql_thread_errors();
+extern gint tagsistant_db_write_generation();
+extern gboolean tagsistant_db_write_generation_unchanged(gint generation);
+extern void tagsistant_db_claim_rds_store(dbi_conn dbi);
+extern gboolean tagsistant_db_in_transaction(dbi_conn dbi);
+extern void tagsistant_db_end_transaction(dbi_conn dbi, int commit);
+extern void tagsistant_group_commit_init();
+extern void tagsistant_db_barrier();
+extern gchar *tagsistant_sql_stats_report();
+extern void tagsistant_sql_stats_reset();
 
 /**
  * transactions are started by default in tagsistant_db_connection()
@@ -78,14 +191,61 @@ extern void tagsistant_db_connection_release(dbi_conn dbi, gboolean is_writer_lo
 #define TAGSISTANT_USE_INTERNAL_TRANSACTIONS 1
 
 #if TAGSISTANT_USE_INTERNAL_TRANSACTIONS
-#	define tagsistant_commit_transaction(dbi_conn) tagsistant_query("commit", dbi_conn, NULL, NULL)
-#	define tagsistant_rollback_transaction(dbi_conn) tagsistant_query("rollback", dbi_conn, NULL, NULL)
+#	define tagsistant_commit_transaction(dbi_conn) tagsistant_db_end_transaction(dbi_conn, TAGSISTANT_COMMIT_TRANSACTION)
+#	define tagsistant_rollback_transaction(dbi_conn) tagsistant_db_end_transaction(dbi_conn, TAGSISTANT_ROLLBACK_TRANSACTION)
 #else
 #	define tagsistant_commit_transaction(dbi_conn) dbi_conn_transaction_commit(dbi_conn)
 #	define tagsistant_rollback_transaction(dbi_conn) dbi_conn_transaction_rollback(dbi_conn)
 #endif /* TAGSISTANT_USE_INTERNAL_TRANSACTIONS */
 
 
+/**
+ * A tag known to the tag dictionary (see tag_dictionary.c).
+ * Entries and their strings live until the filesystem is unmounted.
+ */
+typedef struct {
+	/** the tag name or the namespace of a triple tag */
+	gchar *tagname;
+
+	/** the key of a triple tag ("" for plain tags) */
+	gchar *key;
+
+	/** the value of a triple tag ("" for plain tags) */
+	gchar *value;
+
+	/** the hash of the three strings */
+	guint hash;
+
+	/** the id of the tag, 0 if the tag has been forgotten (read it atomically) */
+	gint tag_id;
+} tagsistant_tag_entry;
+
+extern void						tagsistant_tag_dictionary_init();
+extern tagsistant_inode			tagsistant_tag_dictionary_lookup(const gchar *tagname, const gchar *key, const gchar *value);
+extern const tagsistant_tag_entry *tagsistant_tag_dictionary_reverse_lookup(tagsistant_inode tag_id);
+extern void						tagsistant_tag_dictionary_learn(tagsistant_inode tag_id, const gchar *tagname, const gchar *key, const gchar *value);
+extern gboolean					tagsistant_tag_dictionary_logging();
+extern void						tagsistant_tag_dictionary_forget(const gchar *tagname, const gchar *key, const gchar *value);
+extern void						tagsistant_tag_dictionary_forget_tagname(const gchar *tagname);
+extern int						tagsistant_tag_dictionary_size();
+extern void						tagsistant_tag_dictionary_begin_transaction();
+extern void						tagsistant_tag_dictionary_end_transaction(int commit);
+extern void						tagsistant_tag_dictionary_end_savepoint(int commit);
+extern void						tagsistant_tag_dictionary_end_group(int commit);
+
+/* the kinds of names remembered by the negative cache (see negative_cache.c) */
+#define TAGSISTANT_NEGATIVE_TAG		't'
+#define TAGSISTANT_NEGATIVE_ALIAS	'a'
+#define TAGSISTANT_NEGATIVE_OBJECT	'o'
+
+extern void		tagsistant_negative_cache_init();
+extern gint		tagsistant_negative_cache_generation();
+extern gboolean	tagsistant_negative_cache_lookup(gchar kind, const gchar *first, const gchar *key, const gchar *value);
+extern void		tagsistant_negative_cache_add(gint generation, gchar kind, const gchar *first, const gchar *key, const gchar *value);
+extern void		tagsistant_negative_cache_invalidate();
+extern void		tagsistant_negative_cache_release();
+extern int		tagsistant_negative_cache_hit_count();
+
 /***************\
  * SQL QUERIES *
 \***************/
@@ -96,6 +256,7 @@ extern void				tagsistant_sql_delete_tag(dbi_conn conn, const gchar *tagname, co
 extern void				tagsistant_sql_tag_object(dbi_conn conn, const gchar *tagname, const gchar *key, const gchar *value, tagsistant_inode inode);
 extern void				tagsistant_sql_untag_object(dbi_conn conn, const gchar *tagname, const gchar *key, const gchar *value, tagsistant_inode inode);
 extern void				tagsistant_sql_rename_tag(dbi_conn conn, const gchar *tagname, const gchar *oldtagname);
+extern const tagsistant_tag_entry *tagsistant_sql_get_tag(dbi_conn conn, tagsistant_inode tag_id);
 extern tagsistant_inode	tagsistant_last_insert_id(dbi_conn conn);
 extern int				tagsistant_object_is_tagged(dbi_conn conn, tagsistant_inode inode);
 extern int				tagsistant_object_is_tagged_as(dbi_conn conn, tagsistant_inode inode, tagsistant_inode tag_id);
@@ -108,6 +269,49 @@ extern void				tagsistant_sql_alias_set(dbi_conn conn, const gchar *alias, const
 extern gchar *			tagsistant_sql_alias_get(dbi_conn conn, const gchar *alias);
 extern size_t			tagsistant_sql_alias_get_length(dbi_conn conn, const gchar *alias);
 
+/**
+ * A tag queued in a tagsistant_tag_batch
+ */
+typedef struct {
+	/** the tag name or the namespace of a triple tag */
+	gchar *tagname;
+
+	/** the key of a triple tag ("" for plain tags) */
+	gchar *key;
+
+	/** the value of a triple tag ("" for plain tags) */
+	gchar *value;
+
+	/** the key of the entry in the batch index (see tagsistant_make_tag_key()) */
+	gchar *tag_key;
+
+	/** the id of the tag, 0 until resolved */
+	tagsistant_inode tag_id;
+
+	/** true if the tag was missing and the batch created it */
+	gboolean created;
+} tagsistant_tag_batch_entry;
+
+/**
+ * A set of tags to be applied to an object in one pass
+ * by tagsistant_sql_tag_object_batch()
+ */
+typedef struct {
+	/** the queued tags, as tagsistant_tag_batch_entry pointers */
+	GPtrArray *entries;
+
+	/** the same entries indexed by their tag key, to skip duplicates */
+	GHashTable *index;
+
+	/** true if the caller updates the RDS itself with tagsistant_delete_rds_involved() */
+	gboolean rds_maintained;
+} tagsistant_tag_batch;
+
+extern tagsistant_tag_batch *	tagsistant_tag_batch_new();
+extern void						tagsistant_tag_batch_add(tagsistant_tag_batch *batch, const gchar *tagname, const gchar *key, const gchar *value);
+extern void						tagsistant_tag_batch_free(tagsistant_tag_batch *batch);
+extern void						tagsistant_sql_tag_object_batch(dbi_conn conn, tagsistant_tag_batch *batch, tagsistant_inode inode);
+
 /**
  * Prepare a key for saving a tag_id inside the cache
  *
@@ -0,0 +1,612 @@
+/*
+   Tagsistant (tagfs) -- tag_dictionary.c
+   Copyright (C) 2006-2014 Tx0 <tx0@strumentiresistenti.org>
+
+   An in-memory dictionary of the tags: (tagname, key, value) -> tag_id
+   and tag_id -> (tagname, key, value).
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+#include "tagsistant.h"
+
+/*
+ * The dictionary is read by every FUSE worker on every tag lookup, so
+ * reads take no lock and allocate nothing:
+ *
+ *  - entries hold the interned strings of a tag and are never freed
+ *    while the filesystem is mounted; a deleted or renamed tag is just
+ *    forgotten by zeroing its tag_id, and learning it again reuses the
+ *    same entry;
+ *  - the forward map is an open addressing hash table kept at most half
+ *    full, the reverse map is an array indexed by tag_id; both are only
+ *    written by a writer holding tagsistant_tag_dictionary_lock, which
+ *    publishes a slot only after the entry is complete;
+ *  - when a map must grow, a bigger copy is published and the old one
+ *    is retired, not freed, since a reader could still be walking it.
+ *    Maps grow geometrically, so retired maps take less memory than
+ *    the live ones.
+ *
+ * The dictionary is a cache: a miss is not authoritative and callers
+ * fall back to SQL (see tagsistant_sql_get_tag_id()).
+ *
+ * A tag learnt inside a write transaction may not survive it: its id
+ * could come from a row the transaction is going to roll back. So the
+ * changes made by a thread holding a write transaction are logged and
+ * applied when the transaction commits, like the posting lists do, and
+ * dropped if it rolls back. A forgotten tag is forgotten at once too,
+ * since a miss is always safe.
+ */
+
+/** the initial number of slots of the forward map (must be a power of two) */
+#define TAGSISTANT_TAG_DICTIONARY_SLOTS 1024
+
+/** the forward map */
+typedef struct {
+	/** number of slots, a power of two */
+	guint size;
+
+	/** number of used slots */
+	guint used;
+
+	/** the slots, each one NULL or a tagsistant_tag_entry */
+	gpointer *slots;
+} tagsistant_tag_forward_map;
+
+/** the reverse map */
+typedef struct {
+	/** number of slots, the highest tag_id it can hold plus one */
+	guint size;
+
+	/** the slots, each one NULL or a tagsistant_tag_entry */
+	gpointer *slots;
+} tagsistant_tag_reverse_map;
+
+static tagsistant_tag_forward_map *tagsistant_tag_forward = NULL;
+static tagsistant_tag_reverse_map *tagsistant_tag_reverse = NULL;
+
+/** serializes the writers */
+static GMutex tagsistant_tag_dictionary_lock;
+
+/** maps replaced by a bigger copy, still reachable by late readers */
+static GSList *tagsistant_tag_dictionary_retired = NULL;
+
+/** number of tags currently known */
+static gint tagsistant_tag_dictionary_known = 0;
+
+/** the kinds of the changes logged inside a write transaction */
+#define TAGSISTANT_TAG_DICTIONARY_LEARN				1
+#define TAGSISTANT_TAG_DICTIONARY_FORGET			2
+#define TAGSISTANT_TAG_DICTIONARY_FORGET_TAGNAME	3
+
+/** a change logged inside a write transaction */
+typedef struct {
+	/** one of the TAGSISTANT_TAG_DICTIONARY_* kinds */
+	int kind;
+
+	/** the tag_id learnt */
+	tagsistant_inode tag_id;
+
+	/** the tag */
+	gchar *tagname;
+	gchar *key;
+	gchar *value;
+} tagsistant_tag_dictionary_change;
+
+/**
+ * Free a logged change
+ *
+ * @param data the tagsistant_tag_dictionary_change
+ */
+static void tagsistant_tag_dictionary_change_free(gpointer data)
+{
+	tagsistant_tag_dictionary_change *change = (tagsistant_tag_dictionary_change *) data;
+
+	g_free(change->tagname);
+	g_free(change->key);
+	g_free(change->value);
+	g_free(change);
+}
+
+/** the changes logged by the write transaction of a thread, NULL if none is open */
+static GPrivate tagsistant_tag_dictionary_pending = G_PRIVATE_INIT((GDestroyNotify) g_ptr_array_unref);
+
+/**
+ * the changes of the operations released into the shared transaction
+ * of group commit, waiting for it to be committed; guarded by the
+ * group commit lock, held by the callers
+ */
+static GPtrArray *tagsistant_tag_dictionary_group_pending = NULL;
+
+/**
+ * Hash a tag without building a key string
+ *
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ * @return the hash
+ */
+static guint tagsistant_tag_dictionary_hash(const gchar *tagname, const gchar *key, const gchar *value)
+{
+	guint hash = 5381;
+	const gchar *c;
+
+	for (c = tagname; *c; c++) hash = (hash << 5) + hash + *c;
+	hash = (hash << 5) + hash;
+	for (c = key; *c; c++) hash = (hash << 5) + hash + *c;
+	hash = (hash << 5) + hash;
+	for (c = value; *c; c++) hash = (hash << 5) + hash + *c;
+
+	return (hash);
+}
+
+/**
+ * Find the entry of a tag in the forward map. Lock free.
+ *
+ * @param map the forward map
+ * @param hash the hash of the tag
+ * @return the entry or NULL
+ */
+static tagsistant_tag_entry *tagsistant_tag_dictionary_find(
+	tagsistant_tag_forward_map *map,
+	guint hash,
+	const gchar *tagname,
+	const gchar *key,
+	const gchar *value)
+{
+	if (!map) return (NULL);
+
+	guint mask = map->size - 1;
+	guint slot = hash & mask;
+
+	while (1) {
+		tagsistant_tag_entry *entry = g_atomic_pointer_get(&(map->slots[slot]));
+		if (!entry) return (NULL);
+
+		if ((entry->hash == hash) &&
+			(strcmp(entry->tagname, tagname) == 0) &&
+			(strcmp(entry->key, key) == 0) &&
+			(strcmp(entry->value, value) == 0))
+				return (entry);
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+/**
+ * Put an entry in a forward map which has room for it.
+ * Must be called with the writer lock held.
+ *
+ * @param map the forward map
+ * @param entry the entry
+ */
+static void tagsistant_tag_dictionary_place(tagsistant_tag_forward_map *map, tagsistant_tag_entry *entry)
+{
+	guint mask = map->size - 1;
+	guint slot = entry->hash & mask;
+
+	while (map->slots[slot]) slot = (slot + 1) & mask;
+
+	g_atomic_pointer_set(&(map->slots[slot]), entry);
+	map->used++;
+}
+
+/**
+ * Make room for one more entry in the forward map, replacing it with
+ * a copy twice as big when it's half full. Must be called with the
+ * writer lock held.
+ */
+static void tagsistant_tag_dictionary_grow_forward()
+{
+	tagsistant_tag_forward_map *map = tagsistant_tag_forward;
+	if (map && (map->used + 1) * 2 <= map->size) return;
+
+	tagsistant_tag_forward_map *bigger = g_new0(tagsistant_tag_forward_map, 1);
+	bigger->size = map ? map->size * 2 : TAGSISTANT_TAG_DICTIONARY_SLOTS;
+	bigger->slots = g_new0(gpointer, bigger->size);
+
+	if (map) {
+		guint i;
+		for (i = 0; i < map->size; i++)
+			if (map->slots[i]) tagsistant_tag_dictionary_place(bigger, map->slots[i]);
+
+		tagsistant_tag_dictionary_retired = g_slist_prepend(tagsistant_tag_dictionary_retired, map->slots);
+		tagsistant_tag_dictionary_retired = g_slist_prepend(tagsistant_tag_dictionary_retired, map);
+	}
+
+	g_atomic_pointer_set(&tagsistant_tag_forward, bigger);
+}
+
+/**
+ * Make room for tag_id in the reverse map. Must be called with
+ * the writer lock held.
+ *
+ * @param tag_id the tag_id
+ */
+static void tagsistant_tag_dictionary_grow_reverse(tagsistant_inode tag_id)
+{
+	tagsistant_tag_reverse_map *map = tagsistant_tag_reverse;
+	if (map && tag_id < map->size) return;
+
+	tagsistant_tag_reverse_map *bigger = g_new0(tagsistant_tag_reverse_map, 1);
+	bigger->size = map ? map->size : TAGSISTANT_TAG_DICTIONARY_SLOTS;
+	while (bigger->size <= tag_id) bigger->size *= 2;
+	bigger->slots = g_new0(gpointer, bigger->size);
+
+	if (map) {
+		memcpy(bigger->slots, map->slots, map->size * sizeof(gpointer));
+
+		tagsistant_tag_dictionary_retired = g_slist_prepend(tagsistant_tag_dictionary_retired, map->slots);
+		tagsistant_tag_dictionary_retired = g_slist_prepend(tagsistant_tag_dictionary_retired, map);
+	}
+
+	g_atomic_pointer_set(&tagsistant_tag_reverse, bigger);
+}
+
+/**
+ * Return the id of a tag. Lock free, allocation free.
+ *
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag (NULL for plain tags)
+ * @param value the value of a triple tag (NULL for plain tags)
+ * @return the tag_id, or 0 if the tag is not known
+ */
+tagsistant_inode tagsistant_tag_dictionary_lookup(const gchar *tagname, const gchar *key, const gchar *value)
+{
+	if (!tagname) return (0);
+
+	key = _safe_string(key);
+	value = _safe_string(value);
+
+	tagsistant_tag_entry *entry = tagsistant_tag_dictionary_find(
+		g_atomic_pointer_get(&tagsistant_tag_forward),
+		tagsistant_tag_dictionary_hash(tagname, key, value),
+		tagname, key, value);
+
+	return (entry ? (tagsistant_inode) g_atomic_int_get(&(entry->tag_id)) : 0);
+}
+
+/**
+ * Return the tag owning a tag_id. Lock free, allocation free.
+ * The strings of the entry are valid until the filesystem is unmounted.
+ *
+ * @param tag_id the tag_id
+ * @return the entry, or NULL if the tag_id is not known
+ */
+const tagsistant_tag_entry *tagsistant_tag_dictionary_reverse_lookup(tagsistant_inode tag_id)
+{
+	tagsistant_tag_reverse_map *map = g_atomic_pointer_get(&tagsistant_tag_reverse);
+	if (!map || !tag_id || tag_id >= map->size) return (NULL);
+
+	tagsistant_tag_entry *entry = g_atomic_pointer_get(&(map->slots[tag_id]));
+	if (!entry || ((tagsistant_inode) g_atomic_int_get(&(entry->tag_id)) != tag_id)) return (NULL);
+
+	return (entry);
+}
+
+/**
+ * Record the id of a tag. Must be called with tag_id and tagname set.
+ *
+ * @param tag_id the tag_id
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag (NULL for plain tags)
+ * @param value the value of a triple tag (NULL for plain tags)
+ */
+static void tagsistant_tag_dictionary_apply_learn(tagsistant_inode tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	key = _safe_string(key);
+	value = _safe_string(value);
+	guint hash = tagsistant_tag_dictionary_hash(tagname, key, value);
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_tag_entry *entry = tagsistant_tag_dictionary_find(tagsistant_tag_forward, hash, tagname, key, value);
+	if (!entry) {
+		entry = g_new0(tagsistant_tag_entry, 1);
+		entry->tagname = g_strdup(tagname);
+		entry->key = g_strdup(key);
+		entry->value = g_strdup(value);
+		entry->hash = hash;
+
+		tagsistant_tag_dictionary_grow_forward();
+		tagsistant_tag_dictionary_place(tagsistant_tag_forward, entry);
+	}
+
+	if (!entry->tag_id) tagsistant_tag_dictionary_known++;
+	g_atomic_int_set(&(entry->tag_id), tag_id);
+
+	tagsistant_tag_dictionary_grow_reverse(tag_id);
+	g_atomic_pointer_set(&(tagsistant_tag_reverse->slots[tag_id]), entry);
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+}
+
+/**
+ * Log a change of the write transaction of the calling thread
+ *
+ * @param kind one of the TAGSISTANT_TAG_DICTIONARY_* kinds
+ * @param tag_id the tag_id learnt
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag
+ * @param value the value of a triple tag
+ * @return true if the change has been logged, false if the
+ *   thread holds no write transaction
+ */
+static gboolean tagsistant_tag_dictionary_log(int kind, tagsistant_inode tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	GPtrArray *pending = g_private_get(&tagsistant_tag_dictionary_pending);
+	if (!pending) return (FALSE);
+
+	tagsistant_tag_dictionary_change *change = g_new0(tagsistant_tag_dictionary_change, 1);
+	change->kind = kind;
+	change->tag_id = tag_id;
+	change->tagname = g_strdup(tagname);
+	change->key = g_strdup(key);
+	change->value = g_strdup(value);
+
+	g_ptr_array_add(pending, change);
+	return (TRUE);
+}
+
+/**
+ * Is the calling thread logging the changes of a write transaction?
+ *
+ * @return true if the thread holds a write transaction
+ */
+gboolean tagsistant_tag_dictionary_logging()
+{
+	return (NULL != g_private_get(&tagsistant_tag_dictionary_pending));
+}
+
+/**
+ * Record the id of a tag. Inside a write transaction, the tag
+ * is learnt only when the transaction commits.
+ *
+ * @param tag_id the tag_id
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag (NULL for plain tags)
+ * @param value the value of a triple tag (NULL for plain tags)
+ */
+void tagsistant_tag_dictionary_learn(tagsistant_inode tag_id, const gchar *tagname, const gchar *key, const gchar *value)
+{
+	if (!tag_id || !tagname) return;
+
+	if (tagsistant_tag_dictionary_log(TAGSISTANT_TAG_DICTIONARY_LEARN, tag_id, tagname, key, value)) return;
+
+	tagsistant_tag_dictionary_apply_learn(tag_id, tagname, key, value);
+}
+
+/**
+ * Forget an entry. Must be called with the writer lock held.
+ *
+ * @param entry the entry
+ */
+static void tagsistant_tag_dictionary_forget_entry(tagsistant_tag_entry *entry)
+{
+	tagsistant_inode tag_id = entry->tag_id;
+	if (!tag_id) return;
+
+	g_atomic_int_set(&(entry->tag_id), 0);
+	tagsistant_tag_dictionary_known--;
+
+	if (tagsistant_tag_reverse && tag_id < tagsistant_tag_reverse->size &&
+		(tagsistant_tag_reverse->slots[tag_id] == entry))
+			g_atomic_pointer_set(&(tagsistant_tag_reverse->slots[tag_id]), NULL);
+}
+
+/**
+ * Forget a tag
+ *
+ * @param tagname the tag name or the namespace of a triple tag
+ * @param key the key of a triple tag (NULL for plain tags)
+ * @param value the value of a triple tag (NULL for plain tags)
+ */
+void tagsistant_tag_dictionary_forget(const gchar *tagname, const gchar *key, const gchar *value)
+{
+	if (!tagname) return;
+
+	/* forgotten again at commit, after the tags learnt meanwhile */
+	tagsistant_tag_dictionary_log(TAGSISTANT_TAG_DICTIONARY_FORGET, 0, tagname, key, value);
+
+	key = _safe_string(key);
+	value = _safe_string(value);
+	guint hash = tagsistant_tag_dictionary_hash(tagname, key, value);
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_tag_entry *entry = tagsistant_tag_dictionary_find(tagsistant_tag_forward, hash, tagname, key, value);
+	if (entry) tagsistant_tag_dictionary_forget_entry(entry);
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+}
+
+/**
+ * Forget all the tags with a given tag name, i.e. a plain tag
+ * or all the triple tags of a namespace. Used when renaming.
+ *
+ * @param tagname the tag name or the namespace
+ */
+void tagsistant_tag_dictionary_forget_tagname(const gchar *tagname)
+{
+	if (!tagname) return;
+
+	/* forgotten again at commit, after the tags learnt meanwhile */
+	tagsistant_tag_dictionary_log(TAGSISTANT_TAG_DICTIONARY_FORGET_TAGNAME, 0, tagname, NULL, NULL);
+
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+
+	tagsistant_tag_forward_map *map = tagsistant_tag_forward;
+	if (map) {
+		guint i;
+		for (i = 0; i < map->size; i++) {
+			tagsistant_tag_entry *entry = map->slots[i];
+			if (entry && (strcmp(entry->tagname, tagname) == 0))
+				tagsistant_tag_dictionary_forget_entry(entry);
+		}
+	}
+
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+}
+
+/**
+ * Apply the logged changes of a committed transaction, in order
+ *
+ * @param pending the changes
+ */
+static void tagsistant_tag_dictionary_commit(GPtrArray *pending)
+{
+	guint i;
+	for (i = 0; i < pending->len; i++) {
+		tagsistant_tag_dictionary_change *change = g_ptr_array_index(pending, i);
+
+		switch (change->kind) {
+			case TAGSISTANT_TAG_DICTIONARY_LEARN:
+				tagsistant_tag_dictionary_apply_learn(change->tag_id, change->tagname, change->key, change->value);
+				break;
+			case TAGSISTANT_TAG_DICTIONARY_FORGET:
+				tagsistant_tag_dictionary_forget(change->tagname, change->key, change->value);
+				break;
+			case TAGSISTANT_TAG_DICTIONARY_FORGET_TAGNAME:
+				tagsistant_tag_dictionary_forget_tagname(change->tagname);
+				break;
+		}
+	}
+}
+
+/**
+ * Start logging the changes of the write transaction of the calling
+ * thread. Called by tagsistant_db_connection().
+ */
+void tagsistant_tag_dictionary_begin_transaction()
+{
+	GPtrArray *pending = g_private_get(&tagsistant_tag_dictionary_pending);
+	if (pending) return;
+
+	pending = g_ptr_array_new_with_free_func(tagsistant_tag_dictionary_change_free);
+	g_private_set(&tagsistant_tag_dictionary_pending, pending);
+}
+
+/**
+ * Apply or discard the changes logged by the write transaction of the
+ * calling thread, and stop logging. Called by tagsistant_db_end_transaction().
+ *
+ * @param commit true if the transaction has been committed
+ */
+void tagsistant_tag_dictionary_end_transaction(int commit)
+{
+	GPtrArray *pending = g_private_get(&tagsistant_tag_dictionary_pending);
+	if (!pending) return;
+
+	/* stop logging first, the changes are applied for real */
+	g_private_set(&tagsistant_tag_dictionary_pending, NULL);
+
+	if (commit) tagsistant_tag_dictionary_commit(pending);
+
+	g_ptr_array_unref(pending);
+}
+
+/**
+ * Move the changes logged by an operation released into the shared
+ * transaction of group commit to the changes of the group, or discard
+ * them if the operation rolled back its savepoint, and stop logging.
+ * Called by tagsistant_db_end_transaction() with the group commit lock held.
+ *
+ * @param commit true if the savepoint has been released without rollback
+ */
+void tagsistant_tag_dictionary_end_savepoint(int commit)
+{
+	GPtrArray *pending = g_private_get(&tagsistant_tag_dictionary_pending);
+	if (!pending) return;
+
+	g_private_set(&tagsistant_tag_dictionary_pending, NULL);
+
+	if (commit) {
+		if (!tagsistant_tag_dictionary_group_pending)
+			tagsistant_tag_dictionary_group_pending = g_ptr_array_new_with_free_func(tagsistant_tag_dictionary_change_free);
+
+		/* the changes are moved, not copied, so the thread log must not free them */
+		g_ptr_array_set_free_func(pending, NULL);
+
+		guint i;
+		for (i = 0; i < pending->len; i++)
+			g_ptr_array_add(tagsistant_tag_dictionary_group_pending, g_ptr_array_index(pending, i));
+	}
+
+	g_ptr_array_unref(pending);
+}
+
+/**
+ * Apply or discard the changes of the operations of the shared transaction
+ * of group commit. Called when the group is flushed, with the group commit
+ * lock held.
+ *
+ * @param commit true if the shared transaction has been committed
+ */
+void tagsistant_tag_dictionary_end_group(int commit)
+{
+	if (!tagsistant_tag_dictionary_group_pending || !tagsistant_tag_dictionary_group_pending->len) return;
+
+	if (commit) tagsistant_tag_dictionary_commit(tagsistant_tag_dictionary_group_pending);
+
+	g_ptr_array_set_size(tagsistant_tag_dictionary_group_pending, 0);
+}
+
+/**
+ * Return the number of tags in the dictionary
+ */
+int tagsistant_tag_dictionary_size()
+{
+	g_mutex_lock(&tagsistant_tag_dictionary_lock);
+	int known = tagsistant_tag_dictionary_known;
+	g_mutex_unlock(&tagsistant_tag_dictionary_lock);
+
+	return (known);
+}
+
+/**
+ * SQL callback. Load a tag in the dictionary.
+ *
+ * @param data unused
+ * @param result the row: tag_id, tagname, key, value
+ */
+static int tagsistant_tag_dictionary_load_callback(void *data, dbi_result result)
+{
+	(void) data;
+
+	tagsistant_tag_dictionary_learn(
+		tagsistant_result_get_uint_idx(result, 1),
+		tagsistant_result_get_string_idx(result, 2),
+		tagsistant_result_get_string_idx(result, 3),
+		tagsistant_result_get_string_idx(result, 4));
+
+	return (0);
+}
+
+/**
+ * Load all the tags in the dictionary. Called at mount time,
+ * once the schema is ready.
+ */
+void tagsistant_tag_dictionary_init()
+{
+	dbi_conn dbi = tagsistant_db_connection(TAGSISTANT_DONT_START_TRANSACTION);
+
+	tagsistant_query(
+		"select tag_id, tagname, `key`, value from tags",
+		dbi, tagsistant_tag_dictionary_load_callback, NULL);
+
+	tagsistant_db_connection_release(dbi, 0);
+
+	dbg('b', LOG_INFO, "Tag dictionary loaded with %d tags", tagsistant_tag_dictionary_size());
+}
@@ -33,13 +33,14 @@ struct tagsistant tagsistant;
 
 static int tagsistant_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
 {
-    /* Just a stub.  This method is optional and can safely be left unimplemented */
-
     (void) path;
     (void) isdatasync;
     (void) fi;
 
-	return(0); /* REMOVE ME AFTER CODING */
+	/* make the metadata of pending operations durable */
+	tagsistant_db_barrier();
+
+	return(0);
 }
 
 #if FUSE_VERSION >= 26
@@ -47,6 +48,15 @@ static int tagsistant_fsync(const char *path, int isdatasync, struct fuse_file_i
 static void *tagsistant_init(struct fuse_conn_info *conn)
 {
 	(void) conn;
+
+	/* after daemonizing, so the background threads survive the fork */
+	tagsistant_migrate_schema();
+	tagsistant_rds_cache_init();
+
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_init();
+#endif
+
 	return(NULL);
 }
 
@@ -54,6 +64,11 @@ static void *tagsistant_init(struct fuse_conn_info *conn)
 
 static void *tagsistant_init(void)
 {
+	tagsistant_migrate_schema();
+	tagsistant_rds_cache_init();
+#if TAGSISTANT_ENABLE_POSTING_LISTS
+	tagsistant_posting_init();
+#endif
 	return(NULL);
 }
 
@@ -66,7 +81,9 @@ static void *tagsistant_init(void)
 static struct fuse_operations tagsistant_oper = {
     .getattr	= tagsistant_getattr,
     .readlink	= tagsistant_readlink,
+    .opendir	= tagsistant_opendir,
     .readdir	= tagsistant_readdir,
+    .releasedir	= tagsistant_releasedir,
     .mknod		= tagsistant_mknod,
     .mkdir		= tagsistant_mkdir,
     .symlink	= tagsistant_symlink,
@@ -145,10 +162,14 @@ void tagsistant_usage(gchar *progname, int verbose)
 		"    --open-permission, -P    relax metadirectories permissions to 0777 \n"
 		"    --multi-symlink, -m      create multiple symlink with the same name if\n"
 		"                               their targets differ \n"
+		"    --group-commit, -g       coalesce the metadata writes of many operations\n"
+		"                               into one transaction (durable on fsync/close)\n"
 		"    --tags-suffix=string     set the string to be appended to list a path tags \n"
 		"                               (defaults to .tags)\n"
 		"    --show-config, -p        print the content of the repository.ini file\n"
 		"    --namespace-suffix, -n   the namespace suffix (defaults to ':')\n"
+		"    --benchmark-parser=file  time the path parser on a file of paths, one\n"
+		"                               per line, and exit without mounting\n"
 #if HAVE_SYS_XATTR_H
 		"    --enable-xattr, -x       enable extended attributes (needed for POSIX ACL)\n"
 #endif
@@ -234,6 +255,14 @@ static GOptionEntry tagsistant_options[] =
   { "namespace-suffix", 'n', 0, G_OPTION_ARG_STRING,			&tagsistant.namespace_suffix,	"The namespace suffix (defaults to ':')", NULL },
   { "fuse-opt", 'o', 0, 		G_OPTION_ARG_STRING_ARRAY, 		&tagsistant.fuse_opts, 			"Pass options to FUSE", "allow_other, allow_root, ..." },
   { "multi-symlink", 'm', 0,	G_OPTION_ARG_NONE,				&tagsistant.multi_symlink,		"Allow multiple symlink with the same name but different targets", NULL },
+  { "group-commit", 'g', 0,		G_OPTION_ARG_NONE,				&tagsistant.group_commit,		"Coalesce the metadata writes of many operations into one transaction", NULL },
+  { "rds-max-sets", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.rds_max_sets,		"The cached query results kept (default 50000)", "<sets>" },
+  { "rds-max-tuples", 0, 0,		G_OPTION_ARG_INT,				&tagsistant.rds_max_tuples,		"The objects kept in cached query results (default 1000000)", "<tuples>" },
+  { "rds-temporary-tables", 0, 0, G_OPTION_ARG_NONE,			&tagsistant.rds_temporary_tables, "Resolve queries with a temporary table per subquery instead of a single statement", NULL },
+  { "rds-parallelism", 0, 0,	G_OPTION_ARG_INT,				&tagsistant.rds_parallelism,	"The threads evaluating the subqueries of a query (default 1)", "<threads>" },
+  { "querytree-cache-entries", 0, 0, G_OPTION_ARG_INT,			&tagsistant.querytree_cache_entries, "The parsed paths kept in the querytree cache (default 100000)", "<entries>" },
+  { "querytree-cache-size", 0, 0, G_OPTION_ARG_INT,			&tagsistant.querytree_cache_size, "The megabytes used by the querytree cache (default 64)", "<megabytes>" },
+  { "benchmark-parser", 0, 0,	G_OPTION_ARG_FILENAME,			&tagsistant.benchmark_parser,	"Time the path parser on a file of paths, one per line, without mounting", "<corpus>" },
 #if HAVE_SYS_XATTR_H
   { "enable-xattr", 'x', 0,		G_OPTION_ARG_NONE,				&tagsistant.enable_xattr,		"Enable extended attribute support (required for POSIX ACL)", NULL },
 #endif
@@ -362,6 +391,9 @@ int main(int argc, char *argv[])
 
 			// fprintf(stderr, "\n *** mountpoint %s *** \n\n", tagsistant.mountpoint);
 		}
+	} else if (tagsistant.benchmark_parser) {
+		/* the parser benchmark never mounts, so it runs in the foreground */
+		tagsistant.foreground = TRUE;
 	} else {
 		fprintf(stderr, "\n *** No mountpoint provided *** \n");
 		tagsistant_usage(argv[0], 0);
@@ -383,13 +415,27 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * compute the triple tag detector regexp
+	 * default RDS cache limits
+	 */
+	if (tagsistant.rds_max_sets <= 0) tagsistant.rds_max_sets = TAGSISTANT_GC_RDS;
+	if (tagsistant.rds_max_tuples <= 0) tagsistant.rds_max_tuples = TAGSISTANT_GC_TUPLES;
+	if (tagsistant.rds_parallelism <= 0) tagsistant.rds_parallelism = TAGSISTANT_RDS_PARALLELISM;
+
+	/*
+	 * default querytree cache limits
 	 */
-	if (tagsistant.namespace_suffix) {
-		tagsistant.triple_tag_regex = g_strdup_printf("\\%s$", tagsistant.namespace_suffix);
+	if (tagsistant.querytree_cache_entries <= 0) tagsistant.querytree_cache_entries = TAGSISTANT_QUERYTREE_CACHE_ENTRIES;
+	if (tagsistant.querytree_cache_size <= 0) tagsistant.querytree_cache_size = TAGSISTANT_QUERYTREE_CACHE_SIZE;
+
+	/*
+	 * compute the triple tag detector suffix
+	 */
+	if (tagsistant.namespace_suffix && strlen(tagsistant.namespace_suffix)) {
+		tagsistant.triple_tag_suffix = g_strdup(tagsistant.namespace_suffix);
 	} else {
-		tagsistant.triple_tag_regex = g_strdup(TAGSISTANT_DEFAULT_TRIPLE_TAG_REGEX);
+		tagsistant.triple_tag_suffix = g_strdup(TAGSISTANT_DEFAULT_NAMESPACE_SUFFIX);
 	}
+	tagsistant.triple_tag_suffix_length = strlen(tagsistant.triple_tag_suffix);
 
 	/* do some tuning on FUSE options */
 //	fuse_opt_add_arg(&args, "-s");
@@ -501,7 +547,7 @@ int main(int argc, char *argv[])
 	 * checking if mount point exists or can be created
 	 */
 	struct stat mst;
-	if ((lstat(tagsistant.mountpoint, &mst) == -1) && (errno == ENOENT)) {
+	if (tagsistant.mountpoint && (lstat(tagsistant.mountpoint, &mst) == -1) && (errno == ENOENT)) {
 		if (mkdir(tagsistant.mountpoint, S_IRWXU|S_IRGRP|S_IXGRP) != 0) {
 			// tagsistant_usage(tagsistant.progname);
 			if (!tagsistant.quiet)
@@ -625,6 +671,11 @@ int main(int argc, char *argv[])
 	g_thread_init(NULL);
 #endif
 
+	/*
+	 * compile the regular expressions
+	 */
+	tagsistant_regex_init();
+
 	/*
 	 * load repository.ini
 	 */
@@ -667,11 +718,20 @@ int main(int argc, char *argv[])
 	 */
 	tagsistant_db_init();
 	tagsistant_create_schema();
+	tagsistant_tag_dictionary_init();
+	tagsistant_negative_cache_init();
+	tagsistant_group_commit_init();
 	tagsistant_path_resolution_init();
 	tagsistant_reasoner_init();
 	tagsistant_utils_init();
 	tagsistant_deduplication_init();
 
+	/*
+	 * time the path parser and exit, if requested
+	 */
+	if (tagsistant.benchmark_parser)
+		exit(tagsistant_parse_benchmark(tagsistant.benchmark_parser));
+
 	/* SQLite requires tagsistant to run in single thread mode */
 	if (tagsistant.sql_database_driver == TAGSISTANT_DBI_SQLITE_BACKEND) {
 		// tagsistant.singlethread = TRUE;
@@ -695,12 +755,20 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 * from now on, no regular expression should be compiled
+	 */
+	tagsistant_regex_steady_state();
+
 	/*
 	 * run FUSE main event loop
 	 */
 	res = tagsistant_fuse_main(&args, &tagsistant_oper);
 	fuse_opt_free_args(&args);
 
+	/* commit the pending group transaction, if any */
+	tagsistant_db_barrier();
+
 	/*
 	 * unloading plugins
 	 */
@@ -71,6 +71,15 @@
 /** cache inode resolution queries? */
 #define TAGSISTANT_ENABLE_AND_SET_CACHE 0
 
+/** remember the tags, aliases and objects found missing? */
+#define TAGSISTANT_ENABLE_NEGATIVE_CACHE 1
+
+/** the maximum number of missing names remembered by the negative cache */
+#define TAGSISTANT_NEGATIVE_CACHE_SIZE 4096
+
+/** resolve store/ queries on in-memory posting lists? */
+#define TAGSISTANT_ENABLE_POSTING_LISTS 1
+
 /** cache reasoner queries? */
 #define TAGSISTANT_ENABLE_REASONER_CACHE 0
 
@@ -89,6 +98,9 @@
 /** the maximum length of the buffer used to store dynamic /stats files */
 #define TAGSISTANT_STATS_BUFFER 2048
 
+/** the maximum length of /stats/sql */
+#define TAGSISTANT_SQL_STATS_BUFFER 65536
+
 /** the maximum length of a query bookmarked as an alias */
 #define TAGSISTANT_ALIAS_MAX_LENGTH 1024
 
@@ -98,21 +110,70 @@
 /** the default regular expression to identify the starting token of a triple tag */
 #define TAGSISTANT_DEFAULT_TRIPLE_TAG_REGEX ":$"
 
+/** the default suffix of the namespace of a triple tag (--namespace-suffix) */
+#define TAGSISTANT_DEFAULT_NAMESPACE_SUFFIX ":"
+
+/** the initial size of the per-thread buffer holding the tokens of a path */
+#define TAGSISTANT_PATH_ARENA_SIZE 1024
+
+/** the initial number of tokens of a path the per-thread buffer can index */
+#define TAGSISTANT_PATH_ARENA_TOKENS 64
+
+/** the times each path of the corpus is parsed by --benchmark-parser */
+#define TAGSISTANT_PARSE_BENCHMARK_ROUNDS 100
+
 /** the default suffix appended to files to get their tags */
 #define TAGSISTANT_DEFAULT_TAGS_SUFFIX ".tags"
 
-/** the number of tuples (rows) allowed in the rds table before the GC kicks in */
+/** the default number of tuples (rows) allowed in the rds table before the GC kicks in (--rds-max-tuples) */
 #define TAGSISTANT_GC_TUPLES 1000000
 
-/** the number of RDS (reusable data sets) allowed in the rds table before the GC kicks in */
+/** the default number of RDS (reusable data sets) allowed in the rds table before the GC kicks in (--rds-max-sets) */
 #define TAGSISTANT_GC_RDS 50000
 
+/** the seconds the RDS garbage collector sleeps between two checks, unless woken up by a new RDS */
+#define TAGSISTANT_RDS_GC_INTERVAL 10
+
+/** the number of RDS whose query is remembered to update them in place */
+#define TAGSISTANT_RDS_PREDICATES 4096
+
+/** the number of query plans shown in /stats/plans */
+#define TAGSISTANT_RDS_PLANS 8
+
+/** the default number of threads evaluating the subqueries of a query (--rds-parallelism) */
+#define TAGSISTANT_RDS_PARALLELISM 1
+
+/** the inodes added to a RDS by each statement, when its subqueries are evaluated in parallel */
+#define TAGSISTANT_RDS_PARALLEL_CHUNK 1000
+
+/** the default number of querytrees kept in the querytree cache (--querytree-cache-entries) */
+#define TAGSISTANT_QUERYTREE_CACHE_ENTRIES 100000
+
+/** the default megabytes of memory used by the querytree cache (--querytree-cache-size) */
+#define TAGSISTANT_QUERYTREE_CACHE_SIZE 64
+
+/** the shards of the querytree cache, each one with its own lock */
+#define TAGSISTANT_QUERYTREE_CACHE_SHARDS 16
+
+/** with --group-commit, the shared transaction is committed after this many operations... */
+#define TAGSISTANT_GROUP_COMMIT_OPERATIONS 512
+
+/** ...or when it has been open for this many microseconds */
+#define TAGSISTANT_GROUP_COMMIT_INTERVAL 500000
+
 #include "config.h"
 
 #ifndef VERSION
 #define VERSION 0
 #endif
 
+/** talk to SQLite through libsqlite3 instead of libdbi (detected by configure) */
+#if defined(HAVE_LIBSQLITE3) && defined(HAVE_SQLITE3_H)
+#define TAGSISTANT_ENABLE_NATIVE_SQLITE 1
+#else
+#define TAGSISTANT_ENABLE_NATIVE_SQLITE 0
+#endif
+
 #ifndef PLUGINS_DIR
 #define PLUGINS_DIR "/usr/local/lib/tagsistant/"
 #endif
@@ -144,6 +205,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -217,10 +279,19 @@ struct tagsistant {
 	gboolean	open_permission;/**< use relaxed permissions (777) on tags and other meta-directories */
 	gboolean	enable_xattr;	/**< enable extended attributes (needed for POSIX ACL) */
 	gboolean	multi_symlink;	/**< allow multiple symlinks with the same name but different targets */
+	gboolean	group_commit;	/**< coalesce write transactions of many operations into one */
+	gint		rds_max_sets;	/**< the RDS kept by the RDS cache */
+	gint		rds_max_tuples;	/**< the tuples kept by the RDS cache */
+	gboolean	rds_temporary_tables; /**< materialize RDS with a temporary table per subquery */
+	gint		rds_parallelism; /**< the threads evaluating the subqueries of a query */
+	gint		querytree_cache_entries; /**< the querytrees kept by the querytree cache */
+	gint		querytree_cache_size; /**< the megabytes used by the querytree cache */
+	gchar		*benchmark_parser; /**< a file of paths to time the parser on, instead of mounting */
 
 	gchar		*tags_suffix;	/**< the suffix to be added to filenames to list their tags */
 	gchar		*namespace_suffix; /**< the suffix that distinguishes namespaces */
-	gchar		*triple_tag_regex; /**< namespace suffix detector regexp */
+	gchar		*triple_tag_suffix; /**< the suffix of the namespace of a triple tag */
+	gsize		triple_tag_suffix_length; /**< the length of triple_tag_suffix */
 
 	gchar		*progname;		/**< tagsistant */
 	gchar		*mountpoint;	/**< no clue? */
@@ -279,9 +350,32 @@ extern void tagsistant_deduplicate(gchar *path);
 /**
  * Check if a path contains the meta-tag ALL/
  */
-#define is_all_path(path) (\
-	g_regex_match_simple("/ALL/", path, G_REGEX_EXTENDED, 0) ||\
-	g_regex_match_simple("/ALL$", path, G_REGEX_EXTENDED, 0))
+#define is_all_path(path) (strstr(path, "/ALL/") || g_str_has_suffix(path, "/ALL"))
+
+/**
+ * Check if a path points to the error file of a query
+ */
+#define is_error_path(path) g_str_has_suffix(path, TAGSISTANT_QUERY_DELIMITER "/error")
+
+/**
+ * The regular expressions compiled once by tagsistant_regex_init()
+ */
+typedef enum {
+	TAGSISTANT_RX_RELATION,			/**< a valid relation name */
+	TAGSISTANT_RX_ALIAS,			/**< an alias inside a path */
+	TAGSISTANT_RX_STATS_FILE,		/**< a file under /stats */
+	TAGSISTANT_RX_OPERATOR_SUFFIX,	/**< a path ending with an operator */
+	TAGSISTANT_RX_OPEN_TAG_GROUP,	/**< a path ending inside a tag group */
+	TAGSISTANT_RX_ARCHIVED_INODE,	/**< the inode prefixed to an archived file */
+	TAGSISTANT_RX_TOTAL
+} tagsistant_regex_id;
+
+extern GRegex *tagsistant_regex_registry[TAGSISTANT_RX_TOTAL];
+
+/**
+ * Match a string against a regular expression of the registry
+ */
+#define tagsistant_regex_match(id, string) g_regex_match(tagsistant_regex_registry[id], string, 0, NULL)
 
 /**
  * Fuse operations logging macros.
@@ -301,7 +395,19 @@ extern void tagsistant_deduplicate(gchar *path);
 
 #endif // TAGSISTANT_VERBOSE_LOGGING
 
+// squeeze duplicated slashes of a path
+extern gchar *tagsistant_compress_slashes(const gchar *path);
+
+// tell triple tag namespaces from plain tags
+extern gboolean tagsistant_is_triple_tag(const gchar *token);
+
+// compile regular expressions, keeping count of it
+extern GRegex *tagsistant_regex_compile(const gchar *pattern, GRegexCompileFlags flags);
+extern void tagsistant_regex_steady_state();
+extern void tagsistant_regex_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+
 // some init functions
+extern void tagsistant_regex_init();
 extern void tagsistant_utils_init();
 extern void tagsistant_init_syslog();
 extern void tagsistant_plugin_loader();
@@ -359,9 +465,39 @@ extern int tagsistant_querytree_find_duplicates(tagsistant_querytree *qtree, gch
 
 extern gchar *tagsistant_get_file_tags(tagsistant_querytree *qtree);
 
-extern GHashTable *tagsistant_rds_new(tagsistant_querytree *qtree, int is_all_path);
-extern void tagsistant_rds_destroy_value_list(gchar *key, GList *list, gpointer data);
+/**
+ * receives the objects listed by tagsistant_rds_list()
+ *
+ * @param data the data passed to tagsistant_rds_list()
+ * @param name the object name
+ * @param inode the object inode
+ * @param homonym true if other objects have the same name
+ * @return non zero to stop the listing
+ */
+typedef int (*tagsistant_rds_filler)(void *data, const gchar *name, tagsistant_inode inode, int homonym);
+
+extern void tagsistant_rds_list(tagsistant_querytree *qtree, int is_all_path, tagsistant_rds_filler filler, void *data);
 extern void tagsistant_delete_rds_involved(tagsistant_querytree *qtree);
-extern gchar *tagsistant_materialize_rds(tagsistant_querytree *qtree);
-extern gchar *tagsistant_get_rds_id(tagsistant_querytree *qtree, int *materialized);
+extern void tagsistant_delete_rds_by_tagname(const gchar *tagname, dbi_conn dbi);
+extern int tagsistant_materialize_rds(tagsistant_querytree *qtree);
+extern int tagsistant_get_rds_id(tagsistant_querytree *qtree);
 extern gchar *tagsistant_get_rds_checksum(tagsistant_querytree *qtree);
+extern void tagsistant_rds_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+extern void tagsistant_rds_plans_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER]);
+extern void tagsistant_rds_cache_init();
+extern void tagsistant_query_add_and_set(GString *statement, qtree_and_node *and_set);
+
+/* posting lists (see posting.c) */
+extern void		tagsistant_posting_init();
+extern void		tagsistant_posting_tag(tagsistant_tag_id tag_id, tagsistant_inode inode);
+extern void		tagsistant_posting_untag(tagsistant_tag_id tag_id, tagsistant_inode inode);
+extern void		tagsistant_posting_drop_tag(tagsistant_tag_id tag_id);
+extern void		tagsistant_posting_drop_object(tagsistant_inode inode);
+extern void		tagsistant_posting_move_object(tagsistant_inode from, tagsistant_inode to);
+extern void		tagsistant_posting_end_transaction(int commit);
+extern void		tagsistant_posting_end_savepoint(int commit);
+extern void		tagsistant_posting_end_group(int commit);
+extern GArray	*tagsistant_posting_evaluate(tagsistant_querytree *qtree);
+extern gboolean	tagsistant_posting_materialize_rds(tagsistant_querytree *qtree, int rds_id);
+extern gboolean	tagsistant_posting_stats(int *lists, int *evaluations);
+extern gint		tagsistant_posting_cardinality(tagsistant_tag_id tag_id);
@@ -182,6 +182,19 @@ test("stat $MP/store/time:/year/gt/2005/@@/*___file8");
 test("ls $MP/store/time:/year/gt/1999/@@/*___file7");
 test("stat $MP/store/time:/year/lt/3000/@/*___file8");
 
+#
+# triple tags: a tag created after a failed lookup must be typed
+# and indexed like any other, or gt/ and inc/ would miss it
+#
+test("stat $MP/store/time:/year/eq/2014", 1);
+test("mkdir $MP/store/time:/year/eq/2014");
+test("cp /tmp/file11 $MP/store/time:/year/eq/2014/@@");
+test("ls $MP/store/time:/year/gt/2012/@@");
+out_test('file11');
+test("ls $MP/store/time:/year/inc/014/@@");
+out_test('file11');
+test("stat $MP/store/time:/year/gt/2012/@@/*___file8", 1);
+
 #
 # relations: the includes/ and is_equivalent/ relations
 #
@@ -135,6 +135,10 @@ int tagsistant_inner_create_and_tag_object(tagsistant_querytree *qtree, int *tag
 			qtree->dbi, NULL, NULL, qtree->object_path);
 
 		inode = tagsistant_last_insert_id(qtree->dbi);
+
+#if TAGSISTANT_ENABLE_NEGATIVE_CACHE
+		tagsistant_negative_cache_invalidate();
+#endif
 	}
 
 	if (!inode) {
@@ -147,7 +151,7 @@ int tagsistant_inner_create_and_tag_object(tagsistant_querytree *qtree, int *tag
 	tagsistant_querytree_set_inode(qtree, inode);
 
 	// 3. tag the object
-	tagsistant_querytree_traverse(qtree, tagsistant_sql_tag_object, inode);
+	tagsistant_querytree_tag_object(qtree, inode);
 
 	if (force_create) {
 		dbg('l', LOG_INFO, "Forced creation of object %s", qtree->full_path);
@@ -164,6 +168,95 @@ extern GAsyncQueue *tagsistant_autotag_queue;
 extern void tagsistant_autotag_thread_kernel(gpointer data);
 #endif
 
+/** the regular expressions compiled once by tagsistant_regex_init() */
+GRegex *tagsistant_regex_registry[TAGSISTANT_RX_TOTAL];
+
+/** the regular expressions compiled by tagsistant_regex_compile() */
+static gint tagsistant_regex_compilations = 0;
+
+/** the compilations done before tagsistant_regex_steady_state(), -1 if not yet called */
+static gint tagsistant_regex_startup_compilations = -1;
+
+/**
+ * Compile a regular expression, keeping count of it. Every regular
+ * expression of Tagsistant should be compiled at startup with this
+ * function, to be sure that none is compiled while serving requests.
+ *
+ * @param pattern the regular expression
+ * @param flags the GRegexCompileFlags
+ * @return the GRegex object, NULL on errors
+ */
+GRegex *tagsistant_regex_compile(const gchar *pattern, GRegexCompileFlags flags)
+{
+	GError *error = NULL;
+	GRegex *rx = g_regex_new(pattern, flags, 0, &error);
+	g_atomic_int_inc(&tagsistant_regex_compilations);
+
+	if (!rx) {
+		dbg('l', LOG_ERR, "Error compiling regex %s: %s", pattern, error ? error->message : "unknown error");
+		if (error) g_error_free(error);
+	}
+
+	return (rx);
+}
+
+/**
+ * Compile the regular expressions of the registry
+ */
+void tagsistant_regex_init()
+{
+	tagsistant_regex_registry[TAGSISTANT_RX_RELATION] = tagsistant_regex_compile(
+		TAGSISTANT_RELATION_PATTERN, G_REGEX_EXTENDED|G_REGEX_OPTIMIZE);
+
+	tagsistant_regex_registry[TAGSISTANT_RX_ALIAS] = tagsistant_regex_compile(
+		TAGSISTANT_ALIAS_IDENTIFIER "([^/]+)", G_REGEX_OPTIMIZE);
+
+	tagsistant_regex_registry[TAGSISTANT_RX_STATS_FILE] = tagsistant_regex_compile(
+		"^/stats/(connections|cached_queries|configuration|objects|plans|rds|regex|relations|schema|sql|tags)$",
+		G_REGEX_OPTIMIZE);
+
+	tagsistant_regex_registry[TAGSISTANT_RX_OPERATOR_SUFFIX] = tagsistant_regex_compile("/(\\"
+		TAGSISTANT_ANDSET_DELIMITER "|"
+		TAGSISTANT_QUERY_DELIMITER "|"
+		TAGSISTANT_QUERY_DELIMITER_NO_REASONING "|"
+		TAGSISTANT_NEGATE_NEXT_TAG ")$", G_REGEX_EXTENDED|G_REGEX_OPTIMIZE);
+
+	tagsistant_regex_registry[TAGSISTANT_RX_OPEN_TAG_GROUP] = tagsistant_regex_compile(
+		"/\\" TAGSISTANT_TAG_GROUP_BEGIN "(/[^{}]+)?$", G_REGEX_EXTENDED|G_REGEX_OPTIMIZE);
+
+	tagsistant_regex_registry[TAGSISTANT_RX_ARCHIVED_INODE] = tagsistant_regex_compile(
+		"([0-9]+)" TAGSISTANT_INODE_DELIMITER, G_REGEX_OPTIMIZE);
+}
+
+/**
+ * Record the regular expressions compiled so far as startup compilations.
+ * Called right before serving FUSE requests.
+ */
+void tagsistant_regex_steady_state()
+{
+	g_atomic_int_set(&tagsistant_regex_startup_compilations, g_atomic_int_get(&tagsistant_regex_compilations));
+}
+
+/**
+ * Report the regular expression compilations in /stats/regex
+ *
+ * @param stats_buffer the buffer to be filled
+ */
+void tagsistant_regex_stats(gchar stats_buffer[TAGSISTANT_STATS_BUFFER])
+{
+	gint compilations = g_atomic_int_get(&tagsistant_regex_compilations);
+	gint startup = g_atomic_int_get(&tagsistant_regex_startup_compilations);
+	if (startup < 0) startup = compilations;
+
+	snprintf(stats_buffer, TAGSISTANT_STATS_BUFFER,
+		"# of regular expressions in the registry: %d\n"
+		"# of regular expressions compiled at startup: %d\n"
+		"# of regular expressions compiled while serving requests: %d\n",
+		TAGSISTANT_RX_TOTAL,
+		startup,
+		compilations - startup);
+}
+
 GMutex tagsistant_tags_list_mutex;
 GRegex *tagsistant_tags_list_rx = NULL;
 GRegex *tagsistant_tags_list_removal_rx = NULL;
@@ -183,7 +276,7 @@ void tagsistant_utils_init()
 
 	dbg('l', LOG_INFO, "tag-suffix detection regex: %s", pattern);
 
-	tagsistant_tags_list_rx = g_regex_new(pattern, G_REGEX_OPTIMIZE|G_REGEX_DOLLAR_ENDONLY, 0, NULL);
+	tagsistant_tags_list_rx = tagsistant_regex_compile(pattern, G_REGEX_OPTIMIZE|G_REGEX_DOLLAR_ENDONLY);
 	g_free(pattern);
 
 	/*
@@ -194,12 +287,51 @@ void tagsistant_utils_init()
 
 	dbg('l', LOG_INFO, "tag-suffix removal regex: %s", pattern);
 
-	tagsistant_tags_list_removal_rx = g_regex_new(pattern, G_REGEX_OPTIMIZE|G_REGEX_DOLLAR_ENDONLY, 0, NULL);
+	tagsistant_tags_list_removal_rx = tagsistant_regex_compile(pattern, G_REGEX_OPTIMIZE|G_REGEX_DOLLAR_ENDONLY);
 
 	g_free(pattern);
 	g_free(escaped);
 }
 
+/**
+ * guess if a token is the namespace of a triple tag, comparing its
+ * tail with the namespace suffix computed at startup
+ *
+ * @param token the token to check
+ * @return true if the token ends with the namespace suffix, false otherwise
+ */
+gboolean tagsistant_is_triple_tag(const gchar *token)
+{
+	if (!token) return (FALSE);
+
+	size_t length = strlen(token);
+	if (length < tagsistant.triple_tag_suffix_length) return (FALSE);
+
+	return (memcmp(token + length - tagsistant.triple_tag_suffix_length,
+		tagsistant.triple_tag_suffix, tagsistant.triple_tag_suffix_length) == 0);
+}
+
+/**
+ * copy a path squeezing every run of slashes into a single slash
+ *
+ * @param path the path to copy
+ * @return the compressed copy, to be freed with g_free()
+ */
+gchar *tagsistant_compress_slashes(const gchar *path)
+{
+	gchar *compressed = g_strdup(path);
+	gchar *dst = compressed;
+	const gchar *src;
+
+	for (src = path; *src; src++) {
+		if ('/' == *src && dst > compressed && '/' == *(dst - 1)) continue;
+		*dst++ = *src;
+	}
+	*dst = '\0';
+
+	return (compressed);
+}
+
 /**
  * guess if a filename refers to a tag-listing special file or not
  *
@@ -373,7 +505,7 @@ void tagsistant_fix_archive()
 		 */
 		if ((0 == res) && (S_ISREG(st.st_mode))) {
 			GMatchInfo *match_info;
-			GRegex *rx = g_regex_new("([0-9]+)" TAGSISTANT_INODE_DELIMITER, 0, 0, NULL);
+			GRegex *rx = tagsistant_regex_registry[TAGSISTANT_RX_ARCHIVED_INODE];
 
 			/*
 			 * look for a trailing inode...
@@ -410,7 +542,6 @@ void tagsistant_fix_archive()
 				g_free(full_tree);
 			}
 			g_match_info_free (match_info);
-			g_regex_unref(rx);
 		}
 
 		g_free(filename);
@@ -423,13 +554,13 @@ int tagsistant_read_file_tags(void *tagsbuffer, dbi_result result)
 {
 	GString *buffer = (GString *) tagsbuffer;
 
-	const gchar *next_tag = dbi_result_get_string_idx(result, 1);
+	const gchar *next_tag = tagsistant_result_get_string_idx(result, 1);
 
-	if (g_regex_match_simple(tagsistant.triple_tag_regex, next_tag, 0, 0)) {
+	if (tagsistant_is_triple_tag(next_tag)) {
 		g_string_append_printf(buffer, "%s%s=%s\n",
 			next_tag,
-			dbi_result_get_string_idx(result, 2),
-			dbi_result_get_string_idx(result, 3));
+			tagsistant_result_get_string_idx(result, 2),
+			tagsistant_result_get_string_idx(result, 3));
 	} else {
 		g_string_append_printf(buffer, "%s\n", next_tag);
 	}